@@ -0,0 +1,469 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <memory.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define FAT_CARVE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "stdint.h"
+#include "fat_process.h"
+#include "fat_platform.h"
+#include "fat_holes.h"
+#include "fat_rescue.h"
+#include "fat_carve.h"
+
+#define CARVE_CHUNK_SIZE  (1 << 20)     /* largest single read. */
+#define CARVE_LINE_LENGTH (512)
+
+/* Same format as a signature file. */
+static const char* s_aszDefaultSignatures[] = {
+    "jpeg ffd8ff           ffd9             0  20",
+    "png  89504e470d0a1a0a 49454e44ae426082 0  20",
+    "gif  47494638??61     003b             0  20",
+    "pdf  255044462d       2525454f46       0  100",
+    "zip  504b0304         504b0506         18 100",
+};
+
+typedef struct FAT_CARVE_CANDIDATE {
+    uint32_t  ulCluster;
+    uint32_t  ulSignature;
+} fat_carve_candidate;
+
+/* parses hex byte pairs, "??" for any byte.  returns the byte count, -1 on error. */
+static int carve_parse_hex(
+    const char* szHex,
+    uint8_t*    pBytes,
+    uint8_t*    pMask)
+{
+    int          nCount = 0;
+    unsigned int ulByte = 0;
+
+    while ((szHex[0] != 0) && (szHex[1] != 0))
+    {
+        if (nCount == FAT_CARVE_PATTERN_LENGTH)
+            return -1;
+
+        if ((szHex[0] == '?') && (szHex[1] == '?'))
+        {
+            pBytes[nCount] = 0;
+            pMask[nCount] = 0x00;
+        }
+        else if (isxdigit((unsigned char)szHex[0]) && isxdigit((unsigned char)szHex[1]) &&
+                 (1 == sscanf(szHex, "%2x", &ulByte)))
+        {
+            pBytes[nCount] = (uint8_t)ulByte;
+            pMask[nCount] = 0xFF;
+        }
+        else
+        {
+            return -1;
+        }
+
+        ++nCount;
+        szHex += 2;
+    }
+
+    return (szHex[0] == 0) ? nCount : -1;
+}
+
+/* returns 1 for a signature, 0 for a blank or comment line, -1 on error. */
+static int carve_parse_signature(
+    char*                szLine,
+    fat_carve_signature* pSignature)
+{
+    char*        aszFields[5];
+    char*        szToken = 0;
+    int          nFields = 0;
+    int          nLength = 0;
+    uint8_t      aFooterMask[FAT_CARVE_PATTERN_LENGTH];
+
+    memset(pSignature, 0x00, sizeof(fat_carve_signature));
+
+    szToken = strchr(szLine, '#');
+    if (szToken != 0)
+        *szToken = 0;
+
+    for (szToken = strtok(szLine, " \t\r\n"); (szToken != 0) && (nFields < 5); szToken = strtok(0, " \t\r\n"))
+        aszFields[nFields++] = szToken;
+
+    if (nFields == 0)
+        return 0;
+
+    if ((nFields < 2) || (strlen(aszFields[0]) >= FAT_CARVE_NAME_LENGTH))
+        return -1;
+
+    strcpy(pSignature->szName, aszFields[0]);
+
+    nLength = carve_parse_hex(aszFields[1], pSignature->aHeader, pSignature->aMask);
+    if (nLength <= 0)
+        return -1;
+
+    pSignature->ulHeaderLength = (uint32_t)nLength;
+
+    if ((nFields > 2) && (0 != strcmp(aszFields[2], "-")))
+    {
+        /* Footers are searched for literally. */
+        nLength = carve_parse_hex(aszFields[2], pSignature->aFooter, aFooterMask);
+        if ((nLength <= 0) || (0 != memchr(aFooterMask, 0x00, nLength)))
+            return -1;
+
+        pSignature->ulFooterLength = (uint32_t)nLength;
+    }
+
+    if (nFields > 3)
+        pSignature->ulFooterExtra = (uint32_t)strtoul(aszFields[3], 0, 10);
+
+    pSignature->ullMaxLength = (uint64_t)((nFields > 4) ? strtoul(aszFields[4], 0, 10) : 16) << 20;
+
+    return 1;
+}
+
+void fat_carve_default_set(
+    fat_carve_set* pSet)
+{
+    char     szLine[CARVE_LINE_LENGTH];
+    uint32_t ulIndex = 0;
+
+    memset(pSet, 0x00, sizeof(fat_carve_set));
+
+    for (ulIndex = 0; ulIndex < sizeof(s_aszDefaultSignatures) / sizeof(s_aszDefaultSignatures[0]); ++ulIndex)
+    {
+        strcpy(szLine, s_aszDefaultSignatures[ulIndex]);
+
+        if (1 == carve_parse_signature(szLine, &pSet->aSignatures[pSet->ulCount]))
+            ++pSet->ulCount;
+    }
+}
+
+int fat_carve_load_set(
+    fat_carve_set* pSet,
+    const char*    szFilename)
+{
+    FILE*    pFile = 0;
+    char     szLine[CARVE_LINE_LENGTH];
+    uint32_t ulLine = 0;
+    int      nStatus = 0;
+
+    memset(pSet, 0x00, sizeof(fat_carve_set));
+
+    pFile = fopen(szFilename, "r");
+    if (pFile == 0)
+    {
+        fprintf(stderr, "fopen() failed on file: '%s'.\n", szFilename);
+        return -1;
+    }
+
+    while (0 != fgets(szLine, sizeof(szLine), pFile))
+    {
+        ++ulLine;
+
+        if (pSet->ulCount == FAT_CARVE_MAX_SIGNATURES)
+        {
+            fprintf(stderr, "more than %u signatures in '%s'.\n", FAT_CARVE_MAX_SIGNATURES, szFilename);
+            nStatus = -1;
+            break;
+        }
+
+        nStatus = carve_parse_signature(szLine, &pSet->aSignatures[pSet->ulCount]);
+
+        if (nStatus < 0)
+        {
+            fprintf(stderr, "bad signature on line %u of '%s'.\n", ulLine, szFilename);
+            break;
+        }
+
+        pSet->ulCount += (uint32_t)nStatus;
+        nStatus = 0;
+    }
+
+    fclose(pFile);
+
+    if ((nStatus == 0) && (pSet->ulCount == 0))
+    {
+        fprintf(stderr, "no signatures in '%s'.\n", szFilename);
+        nStatus = -1;
+    }
+
+    return nStatus;
+}
+
+/* index of the first signature matching the start of pData (at least
+   FAT_CARVE_PATTERN_LENGTH bytes), or -1. */
+static int carve_match(
+    const fat_carve_set* pSet,
+    const uint8_t*       pData)
+{
+    uint32_t ulIndex = 0;
+#ifdef FAT_CARVE_SSE2
+    __m128i  vData = _mm_loadu_si128((const __m128i*)pData);
+    __m128i  vMasked;
+
+    /* One masked 16-byte compare per signature. */
+    for (ulIndex = 0; ulIndex < pSet->ulCount; ++ulIndex)
+    {
+        vMasked = _mm_and_si128(vData, _mm_loadu_si128((const __m128i*)pSet->aSignatures[ulIndex].aMask));
+
+        if (0xFFFF == _mm_movemask_epi8(_mm_cmpeq_epi8(
+                vMasked,
+                _mm_loadu_si128((const __m128i*)pSet->aSignatures[ulIndex].aHeader))))
+            return (int)ulIndex;
+    }
+#else
+    uint32_t ulByte = 0;
+
+    for (ulIndex = 0; ulIndex < pSet->ulCount; ++ulIndex)
+    {
+        for (ulByte = 0; ulByte < pSet->aSignatures[ulIndex].ulHeaderLength; ++ulByte)
+            if ((pData[ulByte] & pSet->aSignatures[ulIndex].aMask[ulByte]) != pSet->aSignatures[ulIndex].aHeader[ulByte])
+                break;
+
+        if (ulByte == pSet->aSignatures[ulIndex].ulHeaderLength)
+            return (int)ulIndex;
+    }
+#endif
+
+    return -1;
+}
+
+static int carve_add_candidate(
+    fat_carve_candidate** ppCandidates,
+    uint32_t*             pulCount,
+    uint32_t*             pulCapacity,
+    uint32_t              ulCluster,
+    uint32_t              ulSignature)
+{
+    fat_carve_candidate* pGrown = 0;
+
+    if (*pulCount == *pulCapacity)
+    {
+        *pulCapacity = (*pulCapacity == 0) ? 256 : (*pulCapacity << 1);
+        pGrown = realloc(*ppCandidates, *pulCapacity * sizeof(fat_carve_candidate));
+
+        if (pGrown == 0)
+        {
+            fprintf(stderr, "allocations failed.\n");
+            return -1;
+        }
+
+        *ppCandidates = pGrown;
+    }
+
+    (*ppCandidates)[*pulCount].ulCluster = ulCluster;
+    (*ppCandidates)[*pulCount].ulSignature = ulSignature;
+    ++*pulCount;
+
+    return 0;
+}
+
+/**
+ * Guesses a candidate's length from the free clusters that follow it,
+ * up to the next candidate, the next allocated cluster or the signature
+ * maximum:  up to the footer when one turns up, else the whole run.
+ */
+static uint64_t carve_guess_length(
+    int                        nImageFile,
+    fat_node*                  pFatList,
+    uint32_t                   ulClusterLimit,
+    uint32_t                   ulRootDirOffset,
+    uint32_t                   ulClusterSize,
+    const fat_hole_map*        pHoles,
+    const fat_carve_signature* pSignature,
+    uint32_t                   ulCluster,
+    uint32_t                   ulNextCandidate,
+    uint8_t*                   pBuffer,
+    int*                       pnFooter)
+{
+    uint32_t ulEnd = ulCluster + 1;
+    uint64_t ullRun = 0;
+    uint64_t ullScanned = 0;
+    uint32_t ulOverlap = (pSignature->ulFooterLength > 0) ? (pSignature->ulFooterLength - 1) : 0;
+    uint32_t ulRead = 0;
+    uint32_t ulIndex = 0;
+    __int64  llOffset = 0;
+
+    *pnFooter = 0;
+
+    while ((ulEnd < ulClusterLimit) && (ulEnd < ulNextCandidate) &&
+           (pFatList[ulEnd].value == 0) &&
+           ((uint64_t)(ulEnd - ulCluster) * ulClusterSize < pSignature->ullMaxLength))
+        ++ulEnd;
+
+    ullRun = (uint64_t)(ulEnd - ulCluster) * ulClusterSize;
+    if (ullRun > pSignature->ullMaxLength)
+        ullRun = pSignature->ullMaxLength;
+
+    if (pSignature->ulFooterLength == 0)
+        return ullRun;
+
+    /* Each chunk re-reads the last footer length - 1 bytes of the one before. */
+    while (ullScanned < ullRun)
+    {
+        llOffset = (__int64)ulRootDirOffset + (__int64)(ulCluster - 2) * ulClusterSize + (__int64)ullScanned;
+        ulRead = (ullRun - ullScanned > CARVE_CHUNK_SIZE) ? CARVE_CHUNK_SIZE : (uint32_t)(ullRun - ullScanned);
+
+        if ((ullScanned > 0) && (ulOverlap > 0))
+        {
+            llOffset -= ulOverlap;
+            ulRead += ulOverlap;
+            ullScanned -= ulOverlap;
+        }
+
+        if ((pHoles != 0) && (0 != fat_hole_map_is_hole(pHoles, llOffset, ulRead)))
+            memset(pBuffer, 0x00, ulRead);
+        else if ((__int64)ulRead != fat_rescue_read(nImageFile, pBuffer, ulRead, llOffset))
+            break;
+
+        for (ulIndex = 0; ulIndex + pSignature->ulFooterLength <= ulRead; ++ulIndex)
+        {
+            if ((pBuffer[ulIndex] == pSignature->aFooter[0]) &&
+                (0 == memcmp(&pBuffer[ulIndex], pSignature->aFooter, pSignature->ulFooterLength)))
+            {
+                *pnFooter = 1;
+                ullScanned += ulIndex + pSignature->ulFooterLength + pSignature->ulFooterExtra;
+
+                return (ullScanned < pSignature->ullMaxLength) ? ullScanned : pSignature->ullMaxLength;
+            }
+        }
+
+        ullScanned += ulRead;
+    }
+
+    return ullRun;
+}
+
+int carve_free_clusters(
+    int                  nImageFile,
+    fat_node*            pFatList,
+    uint32_t             ulFatSize,
+    uint32_t             ulRootDirOffset,
+    uint32_t             ulClusterSize,
+    const fat_hole_map*  pHoles,
+    const fat_carve_set* pSet)
+{
+    int                  nReturnValue = 0;
+    int                  nSignature = 0;
+    int                  nFooter = 0;
+    uint8_t*             pBuffer = 0;
+    fat_carve_candidate* pCandidates = 0;
+    uint32_t             ulCandidates = 0;
+    uint32_t             ulCapacity = 0;
+    uint32_t             ulClusterLimit = ulFatSize >> 2;
+    uint32_t             ulChunkClusters = CARVE_CHUNK_SIZE / ulClusterSize;
+    uint32_t             ulCluster = 2;
+    uint32_t             ulRunStart = 0;
+    uint32_t             ulIndex = 0;
+    uint32_t             ulFree = 0;
+    uint32_t             ulRead = 0;
+    __int64              llImageSize = fat_file_size(nImageFile);
+    __int64              llOffset = 0;
+    __int64              llLength = 0;
+    uint64_t             ullLength = 0;
+
+    if (ulChunkClusters == 0)
+        ulChunkClusters = 1;
+
+    /* Clusters past the end of the image have nothing to carve. */
+    if ((llImageSize > (__int64)ulRootDirOffset) &&
+        ((llImageSize - ulRootDirOffset) / ulClusterSize + 2 < ulClusterLimit))
+        ulClusterLimit = (uint32_t)((llImageSize - ulRootDirOffset) / ulClusterSize + 2);
+
+    pBuffer = malloc((size_t)ulChunkClusters * ulClusterSize + FAT_CARVE_PATTERN_LENGTH);
+    if (pBuffer == 0)
+    {
+        fprintf(stderr, "allocations failed.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    // Match the start of every free cluster, reading free runs a chunk at a time.
+    while (ulCluster < ulClusterLimit)
+    {
+        if (pFatList[ulCluster].value != 0)
+        {
+            ++ulCluster;
+            continue;
+        }
+
+        ulRunStart = ulCluster;
+        while ((ulCluster < ulClusterLimit) &&
+               (pFatList[ulCluster].value == 0) &&
+               (ulCluster - ulRunStart < ulChunkClusters))
+            ++ulCluster;
+
+        ulFree += ulCluster - ulRunStart;
+
+        llOffset = (__int64)ulRootDirOffset + (__int64)(ulRunStart - 2) * ulClusterSize;
+        llLength = (__int64)(ulCluster - ulRunStart) * ulClusterSize;
+
+        /* Zeros match no header. */
+        if ((pHoles != 0) && (0 != fat_hole_map_is_hole(pHoles, llOffset, llLength)))
+            continue;
+
+        if (llLength != fat_rescue_read(nImageFile, pBuffer, (size_t)llLength, llOffset))
+        {
+            fprintf(stderr, "read failed at offset: %lld.\n", llOffset);
+            nReturnValue = -1;
+            goto exit;
+        }
+
+        ulRead += ulCluster - ulRunStart;
+
+        for (ulIndex = 0; ulIndex < ulCluster - ulRunStart; ++ulIndex)
+        {
+            nSignature = carve_match(pSet, pBuffer + (size_t)ulIndex * ulClusterSize);
+
+            if ((nSignature >= 0) &&
+                (0 != carve_add_candidate(&pCandidates, &ulCandidates, &ulCapacity, ulRunStart + ulIndex, (uint32_t)nSignature)))
+            {
+                nReturnValue = -1;
+                goto exit;
+            }
+        }
+    }
+
+    // Candidates are in cluster order; each one's run ends at the next.
+    for (ulIndex = 0; ulIndex < ulCandidates; ++ulIndex)
+    {
+        ullLength = carve_guess_length(
+            nImageFile,
+            pFatList,
+            ulClusterLimit,
+            ulRootDirOffset,
+            ulClusterSize,
+            pHoles,
+            &pSet->aSignatures[pCandidates[ulIndex].ulSignature],
+            pCandidates[ulIndex].ulCluster,
+            (ulIndex + 1 < ulCandidates) ? pCandidates[ulIndex + 1].ulCluster : ulClusterLimit,
+            pBuffer,
+            &nFooter);
+
+        fprintf(stdout, "[%8.8X] %-6s : %10lluB : %s\n",
+            pCandidates[ulIndex].ulCluster,
+            pSet->aSignatures[pCandidates[ulIndex].ulSignature].szName,
+            (unsigned long long)ullLength,
+            (nFooter != 0) ? "to footer" : "free run");
+    }
+
+    fprintf(stderr, "carve: %u free clusters, %u read, %u candidates.\n", ulFree, ulRead, ulCandidates);
+
+exit:
+    // Free the pBuffer buffer.
+    if (0 != pBuffer)
+    {
+        free (pBuffer);
+        pBuffer = 0;
+    }
+
+    // Free the pCandidates buffer.
+    if (0 != pCandidates)
+    {
+        free (pCandidates);
+        pCandidates = 0;
+    }
+
+    return nReturnValue;
+}
@@ -0,0 +1,63 @@
+#ifndef __FAT_CARVE_H_HEADER__
+#define __FAT_CARVE_H_HEADER__
+
+#include "stdint.h"
+#include "fat_process.h"
+#include "fat_platform.h"
+#include "fat_holes.h"
+
+#define FAT_CARVE_MAX_SIGNATURES (32)
+#define FAT_CARVE_PATTERN_LENGTH (16)   /* one SSE2 register. */
+#define FAT_CARVE_NAME_LENGTH    (16)
+
+/**
+ * A file type recognized by the bytes at the start of a cluster.
+ *
+ * Header bytes are compared under aMask, so a zero mask byte is a
+ * wildcard.  A footer, when present, ends the file ulFooterExtra bytes
+ * after its last byte; without one the length is guessed from the run of
+ * free clusters.  Neither guess may exceed ullMaxLength.
+ */
+typedef struct FAT_CARVE_SIGNATURE {
+    char      szName[FAT_CARVE_NAME_LENGTH];
+    uint8_t   aHeader[FAT_CARVE_PATTERN_LENGTH];
+    uint8_t   aMask[FAT_CARVE_PATTERN_LENGTH];
+    uint32_t  ulHeaderLength;
+    uint8_t   aFooter[FAT_CARVE_PATTERN_LENGTH];
+    uint32_t  ulFooterLength;
+    uint32_t  ulFooterExtra;
+    uint64_t  ullMaxLength;
+} fat_carve_signature;
+
+typedef struct FAT_CARVE_SET {
+    fat_carve_signature aSignatures[FAT_CARVE_MAX_SIGNATURES];
+    uint32_t            ulCount;
+} fat_carve_set;
+
+/* JPEG, PNG, GIF, PDF and ZIP. */
+void fat_carve_default_set(
+    fat_carve_set* pSet);
+
+/* reads one signature per line:  name header [footer [extra [max MB]]]
+   header and footer are hex, "??" is a wildcard byte, "-" means no
+   footer and '#' starts a comment.  returns 0 on success. */
+int fat_carve_load_set(
+    fat_carve_set* pSet,
+    const char*    szFilename);
+
+/**
+ * Visits only the clusters marked free in pFatList, in image order, and
+ * reports every one whose leading bytes match a signature, with a guessed
+ * length.  Free runs are read in large chunks; runs inside a hole of
+ * pHoles (0 for none) are zeros and are not read at all.
+ */
+int carve_free_clusters(
+    int                  nImageFile,
+    fat_node*            pFatList,
+    uint32_t             ulFatSize,
+    uint32_t             ulRootDirOffset,
+    uint32_t             ulClusterSize,
+    const fat_hole_map*  pHoles,
+    const fat_carve_set* pSet);
+
+#endif /* __FAT_CARVE_H_HEADER__ */
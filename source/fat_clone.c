@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <errno.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define FAT_CLONE_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "stdint.h"
+#include "fat_process.h"
+#include "fat_platform.h"
+#include "fat_holes.h"
+#include "fat_rescue.h"
+#include "fat_clone.h"
+
+typedef struct FAT_CLONE_JOB {
+    int                 nImageFile;
+    int                 nOutputFile;
+    const fat_hole_map* pHoles;
+    uint32_t            ulBlockSize;    /* zero detection granularity; one cluster. */
+    uint8_t*            pBuffer;
+    uint64_t            ullWritten;
+    uint32_t            ulWrites;
+    uint32_t            ulZeroBlocks;
+} fat_clone_job;
+
+/* non-zero if all ulLength bytes are zero. */
+static int clone_is_zero(
+    const uint8_t* pData,
+    size_t         ulLength)
+{
+    size_t  ulIndex = 0;
+#ifdef FAT_CLONE_SSE2
+    __m128i xmmBits;
+
+    /* 64 bytes per step; data clusters rarely open with 64 zero bytes. */
+    for (ulIndex = 0; ulIndex + 64 <= ulLength; ulIndex += 64)
+    {
+        xmmBits = _mm_or_si128(
+            _mm_or_si128(_mm_loadu_si128((const __m128i*)(pData + ulIndex +  0)),
+                         _mm_loadu_si128((const __m128i*)(pData + ulIndex + 16))),
+            _mm_or_si128(_mm_loadu_si128((const __m128i*)(pData + ulIndex + 32)),
+                         _mm_loadu_si128((const __m128i*)(pData + ulIndex + 48))));
+
+        if (0xFFFF != _mm_movemask_epi8(_mm_cmpeq_epi8(xmmBits, _mm_setzero_si128())))
+            return 0;
+    }
+#endif
+
+    for (; ulIndex < ulLength; ++ulIndex)
+        if (pData[ulIndex] != 0)
+            return 0;
+
+    return 1;
+}
+
+/* allocated in FAT1 and not marked bad. */
+static int clone_is_allocated(
+    uint32_t ulValue,
+    uint32_t ulFatEntries)
+{
+    return (FAT_ENTRY_FREE != fat_entry_kind(ulValue, ulFatEntries)) && (ulValue != FAT_BAD);
+}
+
+/* copies one run, writing only the spans of blocks that are not all zeros. */
+static int clone_run(
+    fat_clone_job* pJob,
+    __int64        llOffset,
+    size_t         ulLength)
+{
+    size_t ulDone = 0;
+    size_t ulBlock = 0;
+    size_t ulSpanStart = 0;
+    int    nInSpan = 0;
+
+    /* A hole of a sparse input stays a hole; nothing to read. */
+    if ((pJob->pHoles != 0) && (0 != fat_hole_map_is_hole(pJob->pHoles, llOffset, ulLength)))
+    {
+        pJob->ulZeroBlocks += (uint32_t)((ulLength + pJob->ulBlockSize - 1) / pJob->ulBlockSize);
+        return 0;
+    }
+
+    if ((__int64)ulLength != fat_rescue_read(pJob->nImageFile, pJob->pBuffer, ulLength, llOffset))
+    {
+        fprintf(stderr, "read failed at offset: %lld.\n", llOffset);
+        return -1;
+    }
+
+    /* Read once, front to back. */
+    fat_file_drop_cache(pJob->nImageFile, llOffset, ulLength);
+
+    for (ulDone = 0; ulDone <= ulLength; ulDone += ulBlock)
+    {
+        ulBlock = (ulLength - ulDone < pJob->ulBlockSize) ? (ulLength - ulDone) : pJob->ulBlockSize;
+
+        if ((ulBlock != 0) && (0 == clone_is_zero(&pJob->pBuffer[ulDone], ulBlock)))
+        {
+            if (nInSpan == 0)
+                ulSpanStart = ulDone;
+
+            nInSpan = 1;
+            continue;
+        }
+
+        if (ulBlock != 0)
+            ++pJob->ulZeroBlocks;
+
+        // Write the span of data blocks that ends here.
+        if (nInSpan != 0)
+        {
+            if ((__int64)(ulDone - ulSpanStart) != fat_file_pwrite(
+                    pJob->nOutputFile,
+                    &pJob->pBuffer[ulSpanStart],
+                    ulDone - ulSpanStart,
+                    llOffset + (__int64)ulSpanStart))
+            {
+                fprintf(stderr, "write failed at offset: %lld.\n", llOffset + (__int64)ulSpanStart);
+                return -1;
+            }
+
+            pJob->ullWritten += ulDone - ulSpanStart;
+            ++pJob->ulWrites;
+            nInSpan = 0;
+        }
+
+        if (ulBlock == 0)
+            break;
+    }
+
+    return 0;
+}
+
+int clone_image(
+    int                 nImageFile,
+    const char*         szOutputFilename,
+    const uint32_t*     pFat,
+    uint32_t            ulFatSize,
+    uint32_t            ulRootDirOffset,
+    uint32_t            ulClusterSize,
+    const fat_hole_map* pHoles)
+{
+    fat_clone_job job;
+    __int64       llImageSize = 0;
+    __int64       llOffset = 0;
+    __int64       llLength = 0;
+    uint32_t      ulFatEntries = (ulFatSize >> 2);
+    uint32_t      ulRunClusters = FAT_CLONE_RUN_SIZE / ulClusterSize;
+    uint32_t      ulCluster = 2;
+    uint32_t      ulRunStart = 0;
+    uint32_t      ulAllocated = 0;
+    int           nReturnValue = 0;
+
+    memset(&job, 0x00, sizeof(job));
+    job.nImageFile = nImageFile;
+    job.nOutputFile = -1;
+    job.pHoles = pHoles;
+    job.ulBlockSize = ulClusterSize;
+
+    if (ulRunClusters == 0)
+        ulRunClusters = 1;
+
+    if (0 != fat_file_is_same(nImageFile, szOutputFilename))
+    {
+        fprintf(stderr, "clone file '%s' is the input image.\n", szOutputFilename);
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    llImageSize = fat_file_size(nImageFile);
+    job.pBuffer = malloc((size_t)ulRunClusters * ulClusterSize);
+
+    if (job.pBuffer == 0)
+    {
+        fprintf(stderr, "allocations failed.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    // Create the output sparse, at the full size of the input; never over an existing file.
+    job.nOutputFile = fat_file_create_new(szOutputFilename);
+
+    if ((job.nOutputFile < 0) && (errno == EEXIST))
+    {
+        fprintf(stderr, "clone file '%s' already exists, not overwriting.\n", szOutputFilename);
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    /* A file system without sparse files still gets a full clone. */
+    if (job.nOutputFile >= 0)
+        fat_file_set_sparse(job.nOutputFile);
+
+    if ((job.nOutputFile < 0) ||
+        (0 != fat_file_truncate(job.nOutputFile, llImageSize)))
+    {
+        fprintf(stderr, "cannot create clone file: '%s'.\n", szOutputFilename);
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    // Copy the MBR, reserved sectors and both FATs.
+    for (llOffset = 0; (nReturnValue == 0) && (llOffset < ulRootDirOffset); llOffset += llLength)
+    {
+        llLength = (__int64)ulRunClusters * ulClusterSize;
+        if (llLength > (__int64)ulRootDirOffset - llOffset)
+            llLength = (__int64)ulRootDirOffset - llOffset;
+
+        nReturnValue = clone_run(&job, llOffset, (size_t)llLength);
+    }
+
+    // Copy each run of allocated clusters, front to back.
+    while ((nReturnValue == 0) && (ulCluster < ulFatEntries))
+    {
+        if (0 == clone_is_allocated(pFat[ulCluster], ulFatEntries))
+        {
+            ++ulCluster;
+            continue;
+        }
+
+        ulRunStart = ulCluster;
+
+        while ((ulCluster < ulFatEntries) &&
+               (ulCluster - ulRunStart < ulRunClusters) &&
+               (0 != clone_is_allocated(pFat[ulCluster], ulFatEntries)))
+        {
+            ++ulCluster;
+        }
+
+        ulAllocated += ulCluster - ulRunStart;
+
+        /* The FAT may describe more clusters than a truncated image holds. */
+        llOffset = (__int64)ulRootDirOffset + (__int64)(ulRunStart - 2) * ulClusterSize;
+        llLength = (__int64)(ulCluster - ulRunStart) * ulClusterSize;
+
+        if (llOffset >= llImageSize)
+            break;
+
+        if (llLength > llImageSize - llOffset)
+            llLength = llImageSize - llOffset;
+
+        nReturnValue = clone_run(&job, llOffset, (size_t)llLength);
+    }
+
+    if (nReturnValue == 0)
+    {
+        fprintf(stdout, "cloned %u allocated clusters of %u to '%s': %llu bytes in %u writes, %u all-zero clusters left as holes.\n",
+            ulAllocated,
+            (ulFatEntries > 2) ? (ulFatEntries - 2) : 0,
+            szOutputFilename,
+            (unsigned long long)job.ullWritten,
+            job.ulWrites,
+            job.ulZeroBlocks);
+    }
+
+exit:
+    if (job.nOutputFile >= 0)
+    {
+        fat_file_close(job.nOutputFile);
+        job.nOutputFile = -1;
+    }
+
+    // Free the job.pBuffer buffer.
+    if (0 != job.pBuffer)
+    {
+        free (job.pBuffer);
+        job.pBuffer = 0;
+    }
+
+    return nReturnValue;
+}
@@ -0,0 +1,30 @@
+#ifndef __FAT_CLONE_H_HEADER__
+#define __FAT_CLONE_H_HEADER__
+
+#include "stdint.h"
+#include "fat_holes.h"
+
+#define FAT_CLONE_RUN_SIZE (1 << 22)    /* largest single read or write. */
+
+/**
+ * Allocated-only copy of a volume, in the manner of partclone.
+ *
+ * Everything ahead of the data region (MBR, reserved sectors and both
+ * FATs) is copied, then every cluster FAT1 does not mark free or bad.
+ * Runs of adjacent clusters are read and written in one call, up to
+ * FAT_CLONE_RUN_SIZE.  Clusters that are all zeros, whether allocated or
+ * in a hole of a sparse input, are never written, so they stay holes in
+ * the output, which is created sparse at the size of the input.  Free
+ * clusters read back as zeros from the clone.  The output must not exist
+ * yet, and in particular must not be the input image.
+ */
+int clone_image(
+    int                 nImageFile,
+    const char*         szOutputFilename,
+    const uint32_t*     pFat,
+    uint32_t            ulFatSize,
+    uint32_t            ulRootDirOffset,
+    uint32_t            ulClusterSize,
+    const fat_hole_map* pHoles);
+
+#endif /* __FAT_CLONE_H_HEADER__ */
@@ -0,0 +1,620 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "stdint.h"
+#include "fat_process.h"
+#include "fat_index.h"
+#include "fat_platform.h"
+#include "fat_volume.h"
+#include "fat_daemon.h"
+
+#define DAEMON_LINE_LENGTH (4096)
+#define DAEMON_IO_SIZE     (1 << 20)
+#define DAEMON_MAX_THREADS (64)
+
+#ifndef _WIN32
+
+typedef struct FAT_DAEMON_ENTRY {
+    struct FAT_DAEMON_ENTRY* next;
+    char*                    szImage;
+    fat_volume*              pVolume;
+    uint64_t                 ullMemory;
+    uint64_t                 ullLastUse;    /* cache tick of the last acquire. */
+    uint32_t                 ulRefs;        /* connections using pVolume. */
+} fat_daemon_entry;
+
+typedef struct FAT_DAEMON {
+    int               nListenSocket;
+    uint64_t          ullMemoryLimit;
+
+    fat_mutex         mutex;
+    fat_daemon_entry* pEntries;     /* guarded by mutex. */
+    uint64_t          ullMemory;    /* guarded by mutex. */
+    uint64_t          ullTick;      /* guarded by mutex. */
+    int               nShutdown;    /* guarded by mutex. */
+} fat_daemon;
+
+typedef struct FAT_DAEMON_CONNECTION {
+    fat_daemon* pDaemon;
+    int         nSocket;
+    char        szBuffer[DAEMON_LINE_LENGTH];
+    size_t      ulBuffered;
+} fat_daemon_connection;
+
+/* drops unused entries, least recently used first, until under the limit. */
+static void daemon_evict(fat_daemon* pDaemon)
+{
+    fat_daemon_entry** ppEntry = 0;
+    fat_daemon_entry** ppOldest = 0;
+    fat_daemon_entry*  pEntry = 0;
+
+    while (pDaemon->ullMemory > pDaemon->ullMemoryLimit)
+    {
+        ppOldest = 0;
+
+        for (ppEntry = &pDaemon->pEntries; *ppEntry != 0; ppEntry = &(*ppEntry)->next)
+            if (((*ppEntry)->ulRefs == 0) &&
+                ((ppOldest == 0) || ((*ppEntry)->ullLastUse < (*ppOldest)->ullLastUse)))
+                ppOldest = ppEntry;
+
+        /* Everything left is in use. */
+        if (ppOldest == 0)
+            break;
+
+        pEntry = *ppOldest;
+        *ppOldest = pEntry->next;
+        pDaemon->ullMemory -= pEntry->ullMemory;
+
+        fat_volume_close(pEntry->pVolume);
+        free (pEntry->szImage);
+        free (pEntry);
+    }
+}
+
+/* returns the cached handle for szImage, opening it if needed. */
+static fat_daemon_entry* daemon_acquire(
+    fat_daemon* pDaemon,
+    const char* szImage)
+{
+    fat_daemon_entry* pEntry = 0;
+    fat_daemon_entry* pLoaded = 0;
+    fat_volume*       pVolume = 0;
+
+    fat_mutex_lock(&pDaemon->mutex);
+
+    for (pEntry = pDaemon->pEntries; pEntry != 0; pEntry = pEntry->next)
+        if (0 == strcmp(pEntry->szImage, szImage))
+            break;
+
+    if (pEntry != 0)
+    {
+        ++pEntry->ulRefs;
+        pEntry->ullLastUse = ++pDaemon->ullTick;
+    }
+
+    fat_mutex_unlock(&pDaemon->mutex);
+
+    if (pEntry != 0)
+        return pEntry;
+
+    /* Load without the lock so hot images keep being served meanwhile. */
+    if ((0 != fat_volume_open(szImage, &pVolume)) ||
+        (0 != fat_volume_build_index(pVolume)))
+    {
+        fat_volume_close(pVolume);
+        return 0;
+    }
+
+    pLoaded = calloc(1, sizeof(fat_daemon_entry));
+    if ((pLoaded == 0) || (0 == (pLoaded->szImage = malloc(strlen(szImage) + 1))))
+    {
+        fprintf(stderr, "allocations failed.\n");
+        fat_volume_close(pVolume);
+        free (pLoaded);
+        return 0;
+    }
+
+    strcpy(pLoaded->szImage, szImage);
+    pLoaded->pVolume = pVolume;
+    pLoaded->ullMemory = fat_volume_memory_usage(pVolume);
+
+    fat_mutex_lock(&pDaemon->mutex);
+
+    /* Another connection may have loaded it first. */
+    for (pEntry = pDaemon->pEntries; pEntry != 0; pEntry = pEntry->next)
+        if (0 == strcmp(pEntry->szImage, szImage))
+            break;
+
+    if (pEntry == 0)
+    {
+        pEntry = pLoaded;
+        pEntry->next = pDaemon->pEntries;
+        pDaemon->pEntries = pEntry;
+        pDaemon->ullMemory += pEntry->ullMemory;
+        pLoaded = 0;
+    }
+
+    ++pEntry->ulRefs;
+    pEntry->ullLastUse = ++pDaemon->ullTick;
+
+    daemon_evict(pDaemon);
+
+    fat_mutex_unlock(&pDaemon->mutex);
+
+    if (pLoaded != 0)
+    {
+        fat_volume_close(pLoaded->pVolume);
+        free (pLoaded->szImage);
+        free (pLoaded);
+    }
+
+    return pEntry;
+}
+
+static void daemon_release(
+    fat_daemon*       pDaemon,
+    fat_daemon_entry* pEntry)
+{
+    fat_mutex_lock(&pDaemon->mutex);
+    --pEntry->ulRefs;
+    daemon_evict(pDaemon);
+    fat_mutex_unlock(&pDaemon->mutex);
+}
+
+static int daemon_send(
+    int         nSocket,
+    const void* pData,
+    size_t      ulLength)
+{
+    const char* pBytes = (const char*)pData;
+    ssize_t     lSent = 0;
+
+    while (ulLength > 0)
+    {
+        lSent = send(nSocket, pBytes, ulLength, 0);
+
+        if ((lSent < 0) && (errno == EINTR))
+            continue;
+
+        if (lSent <= 0)
+            return -1;
+
+        pBytes += lSent;
+        ulLength -= (size_t)lSent;
+    }
+
+    return 0;
+}
+
+static int daemon_printf(
+    int         nSocket,
+    const char* szFormat,
+    ...)
+{
+    char    szLine[DAEMON_LINE_LENGTH + 128];
+    va_list args;
+    int     nLength = 0;
+
+    va_start(args, szFormat);
+    nLength = vsnprintf(szLine, sizeof(szLine), szFormat, args);
+    va_end(args);
+
+    if (nLength < 0)
+        return -1;
+
+    if ((size_t)nLength >= sizeof(szLine))
+        nLength = sizeof(szLine) - 1;
+
+    return daemon_send(nSocket, szLine, (size_t)nLength);
+}
+
+/* reads one '\n' terminated line; returns -1 on close or overlong lines. */
+static int daemon_read_line(
+    fat_daemon_connection* pConnection,
+    char*                  szLine)
+{
+    char*   pEnd = 0;
+    ssize_t lReceived = 0;
+    size_t  ulLength = 0;
+
+    for (;;)
+    {
+        pEnd = memchr(pConnection->szBuffer, '\n', pConnection->ulBuffered);
+
+        if (pEnd != 0)
+        {
+            ulLength = (size_t)(pEnd - pConnection->szBuffer);
+
+            memcpy(szLine, pConnection->szBuffer, ulLength);
+            szLine[ulLength] = 0;
+
+            if ((ulLength > 0) && (szLine[ulLength - 1] == '\r'))
+                szLine[ulLength - 1] = 0;
+
+            pConnection->ulBuffered -= ulLength + 1;
+            memmove(pConnection->szBuffer, pEnd + 1, pConnection->ulBuffered);
+
+            return 0;
+        }
+
+        if (pConnection->ulBuffered == sizeof(pConnection->szBuffer))
+            return -1;
+
+        lReceived = recv(
+            pConnection->nSocket,
+            pConnection->szBuffer + pConnection->ulBuffered,
+            sizeof(pConnection->szBuffer) - pConnection->ulBuffered,
+            0);
+
+        if ((lReceived < 0) && (errno == EINTR))
+            continue;
+
+        if (lReceived <= 0)
+            return -1;
+
+        pConnection->ulBuffered += (size_t)lReceived;
+    }
+}
+
+static int daemon_list_entry(
+    fat_chain*  pChain,
+    const char* szPath,
+    void*       pContext)
+{
+    return daemon_printf(*(int*)pContext, "%u %2.2X %s\n",
+        pChain->filesize,
+        pChain->attributes,
+        szPath);
+}
+
+static int daemon_count_entry(
+    fat_chain*  pChain,
+    const char* szPath,
+    void*       pContext)
+{
+    (void)pChain;
+    (void)szPath;
+    (void)pContext;
+
+    return 0;
+}
+
+static int daemon_extract(
+    int               nSocket,
+    fat_volume*       pVolume,
+    const fat_chain*  pChain)
+{
+    char*   pBuffer = 0;
+    __int64 llOffset = 0;
+    __int64 llRead = 0;
+
+    pBuffer = malloc(DAEMON_IO_SIZE);
+    if (pBuffer == 0)
+        return daemon_printf(nSocket, "err allocations failed\n");
+
+    if (0 != daemon_printf(nSocket, "ok %u\n", pChain->filesize))
+    {
+        free (pBuffer);
+        return -1;
+    }
+
+    /* The size is already promised; a read failure can only drop the connection. */
+    while (llOffset < pChain->filesize)
+    {
+        llRead = fat_volume_read(pVolume, pChain, llOffset, pBuffer, DAEMON_IO_SIZE);
+
+        if ((llRead <= 0) || (0 != daemon_send(nSocket, pBuffer, (size_t)llRead)))
+        {
+            free (pBuffer);
+            return -1;
+        }
+
+        llOffset += llRead;
+    }
+
+    free (pBuffer);
+
+    return 0;
+}
+
+/* returns -1 to close the connection. */
+static int daemon_request(
+    fat_daemon_connection* pConnection,
+    char*                  szLine)
+{
+    int               nSocket = pConnection->nSocket;
+    int               nReturnValue = 0;
+    char*             szCommand = szLine;
+    char*             szImage = 0;
+    char*             szArgument = 0;
+    fat_daemon_entry* pEntry = 0;
+    const fat_chain*  pChain = 0;
+    const char*       szPath = 0;
+    fat_node*         pFatNode = 0;
+    uint32_t          ulClusters = 0;
+    uint32_t          ulCount = 0;
+
+    /* "<command> <image> <argument...>" */
+    szImage = strchr(szCommand, ' ');
+    if (szImage != 0)
+    {
+        *szImage++ = 0;
+        szArgument = strchr(szImage, ' ');
+
+        if (szArgument != 0)
+            *szArgument++ = 0;
+    }
+
+    if (0 == strcmp(szCommand, "quit"))
+        return -1;
+
+    if (0 == strcmp(szCommand, "shutdown"))
+    {
+        fat_mutex_lock(&pConnection->pDaemon->mutex);
+        pConnection->pDaemon->nShutdown = 1;
+        fat_mutex_unlock(&pConnection->pDaemon->mutex);
+
+        /* Wakes every worker blocked in accept(). */
+        shutdown(pConnection->pDaemon->nListenSocket, SHUT_RDWR);
+        daemon_printf(nSocket, "ok\n");
+        return -1;
+    }
+
+    if ((szImage == 0) || (szArgument == 0) || (*szArgument == 0))
+        return daemon_printf(nSocket, "err usage: <list|stat|extract|owner> <image> <argument>\n");
+
+    pEntry = daemon_acquire(pConnection->pDaemon, szImage);
+    if (pEntry == 0)
+        return daemon_printf(nSocket, "err cannot open image '%s'\n", szImage);
+
+    if (0 == strcmp(szCommand, "list"))
+    {
+        ulCount = fat_volume_list_directory(pEntry->pVolume, szArgument, daemon_count_entry, 0);
+
+        nReturnValue = daemon_printf(nSocket, "ok %u\n", ulCount);
+        if (nReturnValue == 0)
+            fat_volume_list_directory(pEntry->pVolume, szArgument, daemon_list_entry, &nSocket);
+    }
+    else if ((0 == strcmp(szCommand, "stat")) || (0 == strcmp(szCommand, "extract")))
+    {
+        pChain = fat_volume_chain_by_path(pEntry->pVolume, szArgument);
+
+        if (pChain == 0)
+        {
+            nReturnValue = daemon_printf(nSocket, "err no entry '%s'\n", szArgument);
+        }
+        else if (0 == strcmp(szCommand, "extract"))
+        {
+            nReturnValue = daemon_extract(nSocket, pEntry->pVolume, pChain);
+        }
+        else
+        {
+            for (pFatNode = pChain->head; pFatNode != 0; pFatNode = (pFatNode == pChain->tail) ? 0 : pFatNode->next)
+                ++ulClusters;
+
+            nReturnValue = daemon_printf(nSocket, "ok %u %2.2X %04d-%02d-%02d %02d:%02d:%02d %8.8X %u %s\n",
+                pChain->filesize,
+                pChain->attributes,
+                pChain->timestamp.date.decode.year + 1980,
+                pChain->timestamp.date.decode.month,
+                pChain->timestamp.date.decode.day,
+                pChain->timestamp.time.decode.hour,
+                pChain->timestamp.time.decode.min,
+                pChain->timestamp.time.decode.sec,
+                pChain->head->cluster,
+                ulClusters,
+                fat_volume_chain_path(pEntry->pVolume, pChain));
+        }
+    }
+    else if (0 == strcmp(szCommand, "owner"))
+    {
+        pChain = fat_volume_chain_by_cluster(pEntry->pVolume, (uint32_t)strtoul(szArgument, 0, 16));
+        szPath = (pChain != 0) ? fat_volume_chain_path(pEntry->pVolume, pChain) : 0;
+
+        if (pChain == 0)
+            nReturnValue = daemon_printf(nSocket, "err cluster %s is free\n", szArgument);
+        else if (szPath == 0)
+            nReturnValue = daemon_printf(nSocket, "err cluster %s has no directory entry\n", szArgument);
+        else
+            nReturnValue = daemon_printf(nSocket, "ok %s\n", szPath);
+    }
+    else
+    {
+        nReturnValue = daemon_printf(nSocket, "err unknown command '%s'\n", szCommand);
+    }
+
+    daemon_release(pConnection->pDaemon, pEntry);
+
+    return nReturnValue;
+}
+
+static int daemon_worker(void* pContext)
+{
+    fat_daemon*            pDaemon = (fat_daemon*)pContext;
+    fat_daemon_connection* pConnection = 0;
+    char*                  szLine = 0;
+    int                    nShutdown = 0;
+
+    pConnection = malloc(sizeof(fat_daemon_connection));
+    szLine = malloc(DAEMON_LINE_LENGTH + 1);
+    if ((pConnection == 0) || (szLine == 0))
+    {
+        fprintf(stderr, "allocations failed.\n");
+        free (pConnection);
+        free (szLine);
+        return -1;
+    }
+
+    pConnection->pDaemon = pDaemon;
+
+    while (nShutdown == 0)
+    {
+        pConnection->nSocket = accept(pDaemon->nListenSocket, 0, 0);
+        pConnection->ulBuffered = 0;
+
+        if (pConnection->nSocket >= 0)
+        {
+            while ((0 == daemon_read_line(pConnection, szLine)) &&
+                   (0 == daemon_request(pConnection, szLine)))
+                ;
+
+            close(pConnection->nSocket);
+        }
+        else if ((errno != EINTR) && (errno != ECONNABORTED))
+        {
+            fat_mutex_lock(&pDaemon->mutex);
+            pDaemon->nShutdown = 1;
+            fat_mutex_unlock(&pDaemon->mutex);
+        }
+
+        fat_mutex_lock(&pDaemon->mutex);
+        nShutdown = pDaemon->nShutdown;
+        fat_mutex_unlock(&pDaemon->mutex);
+    }
+
+    free (pConnection);
+    free (szLine);
+
+    return 0;
+}
+
+int daemon_serve(
+    const char* szSocketPath,
+    uint64_t    ullMemoryLimit,
+    uint32_t    ulThreadCount)
+{
+    int                nReturnValue = 0;
+    fat_daemon         daemon;
+    fat_daemon_entry*  pEntry = 0;
+    struct sockaddr_un address;
+    struct stat        fileStat;
+    fat_thread         aThreads[DAEMON_MAX_THREADS];
+    uint32_t           ulThread = 0;
+    uint32_t           ulStarted = 0;
+    mode_t             ulMask = 0;
+    int                nBound = 0;
+
+    memset(&daemon, 0x00, sizeof(daemon));
+    memset(&address, 0x00, sizeof(address));
+
+    daemon.ullMemoryLimit = ullMemoryLimit;
+    daemon.nListenSocket = -1;
+
+    if (strlen(szSocketPath) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "socket path too long: '%s'.\n", szSocketPath);
+        return -1;
+    }
+
+    /* Replace a stale socket, never anything else. */
+    if (0 == lstat(szSocketPath, &fileStat))
+    {
+        if (!S_ISSOCK(fileStat.st_mode))
+        {
+            fprintf(stderr, "not a socket: '%s'.\n", szSocketPath);
+            return -1;
+        }
+
+        unlink(szSocketPath);
+    }
+
+    /* A client hanging up mid-reply must not kill the daemon. */
+    signal(SIGPIPE, SIG_IGN);
+
+    daemon.nListenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (daemon.nListenSocket < 0)
+    {
+        fprintf(stderr, "socket() failed.\n");
+        return -1;
+    }
+
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, szSocketPath);
+
+    /* Owner only from the moment the socket appears; no worker runs yet,
+       so the process wide umask is ours to change. */
+    ulMask = umask(S_IXUSR | S_IRWXG | S_IRWXO);
+    nBound = bind(daemon.nListenSocket, (struct sockaddr*)&address, sizeof(address));
+    umask(ulMask);
+
+    if ((0 != nBound) ||
+        (0 != listen(daemon.nListenSocket, 64)))
+    {
+        fprintf(stderr, "bind() failed on socket: '%s'.\n", szSocketPath);
+        close(daemon.nListenSocket);
+        return -1;
+    }
+
+    fat_mutex_init(&daemon.mutex);
+
+    if (ulThreadCount == 0)
+        ulThreadCount = fat_cpu_count();
+
+    if (ulThreadCount > DAEMON_MAX_THREADS)
+        ulThreadCount = DAEMON_MAX_THREADS;
+
+    fprintf(stdout, "serving on '%s' (threads: %u, cache: %llu MB).\n",
+        szSocketPath,
+        ulThreadCount,
+        (unsigned long long)(ullMemoryLimit >> 20));
+    fflush(stdout);
+
+    for (ulThread = 0; ulThread < ulThreadCount; ++ulThread)
+    {
+        if (0 != fat_thread_start(&aThreads[ulThread], daemon_worker, &daemon))
+            break;
+
+        ++ulStarted;
+    }
+
+    /* No worker could be started; serve on this thread. */
+    if (ulStarted == 0)
+        daemon_worker(&daemon);
+
+    for (ulThread = 0; ulThread < ulStarted; ++ulThread)
+        fat_thread_join(&aThreads[ulThread]);
+
+    close(daemon.nListenSocket);
+    unlink(szSocketPath);
+
+    // Free the cached volumes.
+    while (daemon.pEntries != 0)
+    {
+        pEntry = daemon.pEntries;
+        daemon.pEntries = pEntry->next;
+
+        fat_volume_close(pEntry->pVolume);
+        free (pEntry->szImage);
+        free (pEntry);
+    }
+
+    fat_mutex_destroy(&daemon.mutex);
+
+    return nReturnValue;
+}
+
+#else
+
+int daemon_serve(
+    const char* szSocketPath,
+    uint64_t    ullMemoryLimit,
+    uint32_t    ulThreadCount)
+{
+    fprintf(stderr, "--serve needs Unix domain sockets; not supported in this build.\n");
+    return -1;
+}
+
+#endif
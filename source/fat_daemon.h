@@ -0,0 +1,27 @@
+#ifndef __FAT_DAEMON_H_HEADER__
+#define __FAT_DAEMON_H_HEADER__
+
+#include "stdint.h"
+
+/**
+ * Serves queries on a local (Unix domain) socket until "shutdown".
+ *
+ * Images are opened on first use and their indexed fat_volume handles
+ * kept, least recently used evicted first once ullMemoryLimit is
+ * exceeded.  ulThreadCount workers accept connections; each connection
+ * sends lines of the form
+ *
+ *     list    <image> <dir path>     -> "ok <n>" + n lines "<size> <attr> <path>"
+ *     stat    <image> <path>         -> "ok <size> <attr> <yyyy-mm-dd hh:mm:ss> <first> <clusters> <path>"
+ *     extract <image> <path>         -> "ok <size>" + size raw bytes
+ *     owner   <image> <cluster>      -> "ok <path>" (cluster in hex)
+ *     quit | shutdown
+ *
+ * and gets "err <reason>" on failure.
+ */
+int daemon_serve(
+    const char* szSocketPath,
+    uint64_t    ullMemoryLimit,
+    uint32_t    ulThreadCount);
+
+#endif /* __FAT_DAEMON_H_HEADER__ */
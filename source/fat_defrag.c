@@ -0,0 +1,717 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#include "stdint.h"
+#include "fat_process.h"
+#include "fat_defs.h"
+#include "fat_index.h"
+#include "fat_platform.h"
+#include "fat_writeback.h"
+#include "fat_defrag.h"
+
+#define DEFRAG_SECTOR_SIZE  (512)
+#define DEFRAG_MAX_ANCHORS  (8)                 /* own runs tried as the fixed point. */
+#define DEFRAG_BATCH_SIZE   (1024 * 1024)
+#define DEFRAG_SEEK_MS      (8)                 /* cost model for the estimate. */
+#define DEFRAG_MB_PER_SEC   (100)
+
+typedef struct DEFRAG_CANDIDATE {
+    uint32_t  ulChain;
+    uint32_t  ulFragments;
+    uint32_t  ulClusters;
+} defrag_candidate;
+
+/* a run of free clusters; ulCount 0 once used up. */
+typedef struct DEFRAG_FREE_RUN {
+    uint32_t  ulFirst;
+    uint32_t  ulCount;
+} defrag_free_run;
+
+/* a run of one file's clusters, ulPosition clusters into the file. */
+typedef struct DEFRAG_ANCHOR {
+    uint32_t  ulPosition;
+    uint32_t  ulCluster;
+    uint32_t  ulCount;
+} defrag_anchor;
+
+static int compare_defrag_candidates(
+    const void* pLeft,
+    const void* pRight)
+{
+    const defrag_candidate* pA = (const defrag_candidate*)pLeft;
+    const defrag_candidate* pB = (const defrag_candidate*)pRight;
+
+    if (pA->ulFragments != pB->ulFragments)
+        return (pA->ulFragments > pB->ulFragments) ? -1 : 1;
+
+    return (pA->ulChain < pB->ulChain) ? -1 : ((pA->ulChain > pB->ulChain) ? 1 : 0);
+}
+
+static int compare_defrag_moves(
+    const void* pLeft,
+    const void* pRight)
+{
+    uint32_t ulLeft = ((const fat_defrag_move*)pLeft)->ulFrom;
+    uint32_t ulRight = ((const fat_defrag_move*)pRight)->ulFrom;
+
+    return (ulLeft < ulRight) ? -1 : ((ulLeft > ulRight) ? 1 : 0);
+}
+
+/* counts the clusters and runs of a chain; 0 clusters if it never reaches its tail. */
+static void defrag_measure_chain(
+    const fat_chain* pChain,
+    uint32_t         ulFatEntries,
+    uint32_t*        pulClusters,
+    uint32_t*        pulFragments)
+{
+    const fat_node* pFatNode = pChain->head;
+    uint32_t        ulSteps = 0;
+    uint32_t        ulPrevious = 0;
+
+    *pulClusters = 0;
+    *pulFragments = 0;
+
+    for (ulSteps = 0; (pFatNode != 0) && (ulSteps < ulFatEntries); ++ulSteps)
+    {
+        if ((ulSteps == 0) || (pFatNode->cluster != ulPrevious + 1))
+            ++*pulFragments;
+
+        ulPrevious = pFatNode->cluster;
+
+        if (pFatNode == pChain->tail)
+        {
+            *pulClusters = ulSteps + 1;
+            return;
+        }
+
+        pFatNode = pFatNode->next;
+    }
+
+    *pulFragments = 0;
+}
+
+static int defrag_add_move(
+    fat_defrag_plan* pPlan,
+    fat_defrag_file* pFile,
+    uint32_t         ulFrom,
+    uint32_t         ulTo)
+{
+    fat_defrag_move* pLast = (pFile->ulMoveCount != 0) ? &pPlan->pMoves[pPlan->ulMoveCount - 1] : 0;
+    fat_defrag_move* pGrown = 0;
+
+    /* Consecutive on both sides extends the previous move. */
+    if ((pLast != 0) && (pLast->ulFrom + pLast->ulCount == ulFrom) && (pLast->ulTo + pLast->ulCount == ulTo))
+    {
+        ++pLast->ulCount;
+        return 0;
+    }
+
+    if (pPlan->ulMoveCount == pPlan->ulMoveCapacity)
+    {
+        pPlan->ulMoveCapacity = (pPlan->ulMoveCapacity == 0) ? 256 : (pPlan->ulMoveCapacity << 1);
+        pGrown = realloc(pPlan->pMoves, pPlan->ulMoveCapacity * sizeof(fat_defrag_move));
+
+        if (pGrown == 0)
+        {
+            fprintf(stderr, "allocations failed.\n");
+            return -1;
+        }
+
+        pPlan->pMoves = pGrown;
+    }
+
+    pPlan->pMoves[pPlan->ulMoveCount].ulFrom = ulFrom;
+    pPlan->pMoves[pPlan->ulMoveCount].ulTo = ulTo;
+    pPlan->pMoves[pPlan->ulMoveCount].ulCount = 1;
+    ++pPlan->ulMoveCount;
+    ++pFile->ulMoveCount;
+
+    return 0;
+}
+
+/* clusters of pClusters that would move to [ulTarget, ulTarget + ulCount),
+   or 0xFFFFFFFF if the place holds anything but free clusters and the
+   file's own clusters already in position. */
+static uint32_t defrag_place_cost(
+    const uint32_t* pClusters,
+    uint32_t        ulCount,
+    uint32_t        ulTarget,
+    const uint8_t*  pFree)
+{
+    uint32_t ulIndex = 0;
+    uint32_t ulMoved = 0;
+
+    for (ulIndex = 0; ulIndex < ulCount; ++ulIndex)
+    {
+        if (pClusters[ulIndex] == ulTarget + ulIndex)
+            continue;
+
+        if (pFree[ulTarget + ulIndex] == 0)
+            return 0xFFFFFFFF;
+
+        ++ulMoved;
+    }
+
+    return ulMoved;
+}
+
+int fat_defrag_plan_build(
+    fat_defrag_plan* pPlan,
+    fat_node*        pFatList,
+    fat_chain*       pFatChainList,
+    uint32_t         ulFatChainCount,
+    uint32_t         ulFatSize,
+    uint32_t         ulClusterCount,
+    uint32_t         ulClusterSize,
+    uint32_t         ulLimit)
+{
+    uint32_t          ulFatEntries = ulFatSize >> 2;
+    uint32_t          ulEnd = ulFatEntries;
+    defrag_candidate* pCandidates = 0;
+    uint32_t          ulCandidateCount = 0;
+    defrag_free_run*  pFreeRuns = 0;
+    uint32_t          ulFreeRunCount = 0;
+    uint8_t*          pFree = 0;
+    uint8_t*          pFatSectors = 0;
+    uint32_t*         pClusters = 0;
+    defrag_anchor     aAnchors[DEFRAG_MAX_ANCHORS];
+    uint32_t          ulAnchorCount = 0;
+    fat_defrag_file*  pFile = 0;
+    fat_chain*        pChain = 0;
+    fat_node*         pFatNode = 0;
+    uint32_t          ulIndex = 0;
+    uint32_t          ulCluster = 0;
+    uint32_t          ulCount = 0;
+    uint32_t          ulFragments = 0;
+    uint32_t          ulRunStart = 0;
+    uint32_t          ulBestTarget = 0;
+    uint32_t          ulBestCost = 0;
+    uint32_t          ulBestRun = 0;
+    uint32_t          ulCost = 0;
+    uint32_t          ulTarget = 0;
+    uint32_t          ulSlot = 0;
+    int               nReturnValue = 0;
+
+    memset(pPlan, 0x00, sizeof(fat_defrag_plan));
+    pPlan->ulClusterSize = ulClusterSize;
+
+    /* Data clusters run from 2 to the cluster count, or the FAT's end. */
+    if ((uint64_t)ulClusterCount + 2 < ulEnd)
+        ulEnd = ulClusterCount + 2;
+
+    pCandidates = malloc((ulFatChainCount + 1) * sizeof(defrag_candidate));
+    pFreeRuns = malloc(((ulEnd >> 1) + 2) * sizeof(defrag_free_run));
+    pFree = calloc(ulFatEntries + 1, 1);
+    pFatSectors = calloc((ulFatSize / DEFRAG_SECTOR_SIZE + 8) >> 3, 1);
+
+    if ((pCandidates == 0) || (pFreeRuns == 0) || (pFree == 0) || (pFatSectors == 0))
+    {
+        fprintf(stderr, "allocations failed.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    // Rank the fragmented files.
+    for (ulIndex = 0; ulIndex < ulFatChainCount; ++ulIndex)
+    {
+        pChain = &pFatChainList[ulIndex];
+
+        /* Directories carry "." and ".." links to themselves; leave them be. */
+        if ((pChain->populated == 0) || (pChain->entryoffset == 0) ||
+            (pChain->filename[0] == FILE_DEL_ENTRY) ||
+            ((pChain->attributes & FILE_ATTRIB_DIR) != 0))
+            continue;
+
+        defrag_measure_chain(pChain, ulFatEntries, &ulCount, &ulFragments);
+
+        if (ulFragments < 2)
+            continue;
+
+        pCandidates[ulCandidateCount].ulChain = ulIndex;
+        pCandidates[ulCandidateCount].ulFragments = ulFragments;
+        pCandidates[ulCandidateCount].ulClusters = ulCount;
+        ++ulCandidateCount;
+    }
+
+    qsort(pCandidates, ulCandidateCount, sizeof(defrag_candidate), compare_defrag_candidates);
+
+    if ((ulLimit != 0) && (ulLimit < ulCandidateCount))
+        ulCandidateCount = ulLimit;
+
+    pPlan->pFiles = calloc(ulCandidateCount + 1, sizeof(fat_defrag_file));
+    if (pPlan->pFiles == 0)
+    {
+        fprintf(stderr, "allocations failed.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    // Free space as a bitmap and as runs.
+    for (ulCluster = 2; ulCluster < ulEnd; ++ulCluster)
+    {
+        pFree[ulCluster] = (pFatList[ulCluster].value == 0) ? 1 : 0;
+
+        if (pFree[ulCluster] == 0)
+            continue;
+
+        if ((ulCluster == 2) || (pFree[ulCluster - 1] == 0))
+        {
+            pFreeRuns[ulFreeRunCount].ulFirst = ulCluster;
+            pFreeRuns[ulFreeRunCount].ulCount = 0;
+            ++ulFreeRunCount;
+        }
+
+        ++pFreeRuns[ulFreeRunCount - 1].ulCount;
+    }
+
+    // Place each file where the fewest of its clusters move.
+    for (ulIndex = 0; ulIndex < ulCandidateCount; ++ulIndex)
+    {
+        pChain = &pFatChainList[pCandidates[ulIndex].ulChain];
+        ulCount = pCandidates[ulIndex].ulClusters;
+
+        free (pClusters);
+        pClusters = malloc(ulCount * sizeof(uint32_t));
+        if (pClusters == 0)
+        {
+            fprintf(stderr, "allocations failed.\n");
+            nReturnValue = -1;
+            goto exit;
+        }
+
+        /* The file's clusters, and its largest runs as anchors. */
+        ulAnchorCount = 0;
+        pFatNode = pChain->head;
+
+        for (ulCluster = 0; ulCluster < ulCount; ++ulCluster, pFatNode = pFatNode->next)
+        {
+            pClusters[ulCluster] = pFatNode->cluster;
+
+            if ((ulCluster == 0) || (pClusters[ulCluster] != pClusters[ulCluster - 1] + 1))
+                ulRunStart = ulCluster;
+
+            if ((ulCluster + 1 < ulCount) && (pFatNode->next->cluster == pFatNode->cluster + 1))
+                continue;
+
+            /* Keep the DEFRAG_MAX_ANCHORS longest runs, replacing the shortest. */
+            ulSlot = ulAnchorCount;
+
+            if (ulAnchorCount == DEFRAG_MAX_ANCHORS)
+            {
+                for (ulSlot = 0, ulTarget = 1; ulTarget < ulAnchorCount; ++ulTarget)
+                    if (aAnchors[ulTarget].ulCount < aAnchors[ulSlot].ulCount)
+                        ulSlot = ulTarget;
+
+                if (aAnchors[ulSlot].ulCount >= ulCluster + 1 - ulRunStart)
+                    continue;
+            }
+            else
+            {
+                ++ulAnchorCount;
+            }
+
+            aAnchors[ulSlot].ulPosition = ulRunStart;
+            aAnchors[ulSlot].ulCluster = pClusters[ulRunStart];
+            aAnchors[ulSlot].ulCount = ulCluster + 1 - ulRunStart;
+        }
+
+        ulBestCost = 0xFFFFFFFF;
+        ulBestRun = 0xFFFFFFFF;
+
+        for (ulSlot = 0; ulSlot < ulAnchorCount; ++ulSlot)
+        {
+            if (aAnchors[ulSlot].ulCluster < aAnchors[ulSlot].ulPosition + 2)
+                continue;
+
+            ulTarget = aAnchors[ulSlot].ulCluster - aAnchors[ulSlot].ulPosition;
+            if ((uint64_t)ulTarget + ulCount > ulEnd)
+                continue;
+
+            ulCost = defrag_place_cost(pClusters, ulCount, ulTarget, pFree);
+            if (ulCost < ulBestCost)
+            {
+                ulBestCost = ulCost;
+                ulBestTarget = ulTarget;
+            }
+        }
+
+        /* Otherwise the smallest free run that holds the whole file. */
+        if (ulBestCost >= ulCount)
+        {
+            for (ulSlot = 0; ulSlot < ulFreeRunCount; ++ulSlot)
+            {
+                if ((pFreeRuns[ulSlot].ulCount >= ulCount) &&
+                    ((ulBestRun == 0xFFFFFFFF) || (pFreeRuns[ulSlot].ulCount < pFreeRuns[ulBestRun].ulCount)))
+                    ulBestRun = ulSlot;
+            }
+
+            if (ulBestRun != 0xFFFFFFFF)
+            {
+                ulBestCost = ulCount;
+                ulBestTarget = pFreeRuns[ulBestRun].ulFirst;
+            }
+        }
+
+        if (ulBestCost == 0xFFFFFFFF)
+        {
+            ++pPlan->ulSkipped;
+            continue;
+        }
+
+        pFile = &pPlan->pFiles[pPlan->ulFileCount++];
+        pFile->pChain = pChain;
+        pFile->ulTarget = ulBestTarget;
+        pFile->ulClusters = ulCount;
+        pFile->ulFragments = pCandidates[ulIndex].ulFragments;
+        pFile->ulMoved = ulBestCost;
+        pFile->ulFirstMove = pPlan->ulMoveCount;
+
+        for (ulCluster = 0; ulCluster < ulCount; ++ulCluster)
+        {
+            /* Every entry of the old and the new place is rewritten. */
+            pFatSectors[(pClusters[ulCluster] >> 7) >> 3] |= (uint8_t)(1 << ((pClusters[ulCluster] >> 7) & 7));
+            pFatSectors[((ulBestTarget + ulCluster) >> 7) >> 3] |= (uint8_t)(1 << (((ulBestTarget + ulCluster) >> 7) & 7));
+
+            if (pClusters[ulCluster] == ulBestTarget + ulCluster)
+                continue;
+
+            pFree[ulBestTarget + ulCluster] = 0;
+
+            if (0 != defrag_add_move(pPlan, pFile, pClusters[ulCluster], ulBestTarget + ulCluster))
+            {
+                nReturnValue = -1;
+                goto exit;
+            }
+        }
+
+        pPlan->ulClustersMoved += ulBestCost;
+
+        /* Trim the free runs the place overlapped, keeping the larger side. */
+        for (ulSlot = 0; ulSlot < ulFreeRunCount; ++ulSlot)
+        {
+            ulRunStart = pFreeRuns[ulSlot].ulFirst;
+
+            if ((pFreeRuns[ulSlot].ulCount == 0) ||
+                (ulRunStart >= ulBestTarget + ulCount) ||
+                (ulRunStart + pFreeRuns[ulSlot].ulCount <= ulBestTarget))
+                continue;
+
+            ulCost = (ulRunStart < ulBestTarget) ? ulBestTarget - ulRunStart : 0;
+            ulTarget = (ulRunStart + pFreeRuns[ulSlot].ulCount > ulBestTarget + ulCount) ?
+                ulRunStart + pFreeRuns[ulSlot].ulCount - (ulBestTarget + ulCount) : 0;
+
+            if (ulCost >= ulTarget)
+            {
+                pFreeRuns[ulSlot].ulCount = ulCost;
+            }
+            else
+            {
+                pFreeRuns[ulSlot].ulFirst = ulBestTarget + ulCount;
+                pFreeRuns[ulSlot].ulCount = ulTarget;
+            }
+        }
+    }
+
+    for (ulIndex = 0; ulIndex < ulFatSize / DEFRAG_SECTOR_SIZE + 1; ++ulIndex)
+        if (0 != (pFatSectors[ulIndex >> 3] & (1 << (ulIndex & 7))))
+            ++pPlan->ulFatSectors;
+
+exit:
+    // Free the pCandidates buffer.
+    if (0 != pCandidates)
+    {
+        free (pCandidates);
+        pCandidates = 0;
+    }
+
+    // Free the pFreeRuns buffer.
+    if (0 != pFreeRuns)
+    {
+        free (pFreeRuns);
+        pFreeRuns = 0;
+    }
+
+    // Free the pFree buffer.
+    if (0 != pFree)
+    {
+        free (pFree);
+        pFree = 0;
+    }
+
+    // Free the pFatSectors buffer.
+    if (0 != pFatSectors)
+    {
+        free (pFatSectors);
+        pFatSectors = 0;
+    }
+
+    // Free the pClusters buffer.
+    if (0 != pClusters)
+    {
+        free (pClusters);
+        pClusters = 0;
+    }
+
+    if (nReturnValue != 0)
+        fat_defrag_plan_free(pPlan);
+
+    return nReturnValue;
+}
+
+void fat_defrag_plan_free(
+    fat_defrag_plan* pPlan)
+{
+    // Free the pPlan->pFiles buffer.
+    if (0 != pPlan->pFiles)
+    {
+        free (pPlan->pFiles);
+        pPlan->pFiles = 0;
+    }
+
+    // Free the pPlan->pMoves buffer.
+    if (0 != pPlan->pMoves)
+    {
+        free (pPlan->pMoves);
+        pPlan->pMoves = 0;
+    }
+
+    pPlan->ulFileCount = 0;
+    pPlan->ulMoveCount = 0;
+    pPlan->ulMoveCapacity = 0;
+}
+
+void report_defrag_plan(
+    const fat_defrag_plan* pPlan,
+    fat_index*             pIndex)
+{
+    const fat_defrag_file* pFile = 0;
+    const char*            szPath = 0;
+    uint32_t               ulIndex = 0;
+    uint64_t               ullBytes = (uint64_t)pPlan->ulClustersMoved * pPlan->ulClusterSize;
+    uint64_t               ullMilliseconds = 0;
+
+    for (ulIndex = 0; ulIndex < pPlan->ulFileCount; ++ulIndex)
+    {
+        pFile = &pPlan->pFiles[ulIndex];
+        szPath = fat_index_path(pIndex, pFile->pChain);
+
+        fprintf(stdout, "%s : %u fragments, %u clusters -> [%8.8X->%8.8X] : %u moved in %u runs\n",
+            (szPath != 0) ? szPath : "?",
+            pFile->ulFragments,
+            pFile->ulClusters,
+            pFile->ulTarget,
+            pFile->ulTarget + pFile->ulClusters - 1,
+            pFile->ulMoved,
+            pFile->ulMoveCount);
+    }
+
+    /* A seek to read and one to write each run, then both FATs in order. */
+    ullMilliseconds =
+        ((uint64_t)pPlan->ulMoveCount * 2 + 2) * DEFRAG_SEEK_MS +
+        ((ullBytes * 2 + (uint64_t)pPlan->ulFatSectors * 2 * DEFRAG_SECTOR_SIZE) * 1000) /
+            ((uint64_t)DEFRAG_MB_PER_SEC << 20);
+
+    fprintf(stdout, "plan: %u files, %u clusters moved in %u runs, %llu KB read and written, "
+        "%u FAT sectors per copy; about %llu ms at %u ms per seek and %u MB/s.\n",
+        pPlan->ulFileCount,
+        pPlan->ulClustersMoved,
+        pPlan->ulMoveCount,
+        (unsigned long long)(ullBytes >> 10),
+        pPlan->ulFatSectors,
+        (unsigned long long)((pPlan->ulFileCount != 0) ? ullMilliseconds : 0),
+        DEFRAG_SEEK_MS,
+        DEFRAG_MB_PER_SEC);
+
+    if (pPlan->ulSkipped != 0)
+        fprintf(stdout, "%u fragmented files have no contiguous room.\n", pPlan->ulSkipped);
+}
+
+int fat_defrag_apply(
+    const fat_defrag_plan* pPlan,
+    const char*            szImageFilename,
+    const char*            szJournal,
+    uint32_t*              pFat1Buffer,
+    uint32_t*              pFat2Buffer,
+    uint32_t               ulFatSize,
+    uint32_t               ulRootDirOffset)
+{
+    int                    nReturnValue = 0;
+    int                    nImageFile = -1;
+    fat_defrag_move*       pMoves = 0;
+    uint8_t*               pBuffer = 0;
+    uint8_t*               pSector = 0;
+    FAT32_DIR_ENTRY*       pDirEntry = 0;
+    const fat_defrag_file* pFile = 0;
+    fat_node*              pFatNode = 0;
+    fat_dirty_map          dirtyMap;
+    FILE*                  pJournal = 0;
+    uint32_t               ulBatchClusters = DEFRAG_BATCH_SIZE / pPlan->ulClusterSize;
+    uint32_t               ulIndex = 0;
+    uint32_t               ulCluster = 0;
+    uint32_t               ulDone = 0;
+    uint32_t               ulRun = 0;
+    uint32_t               ulTailValue = 0;
+    size_t                 ulBytes = 0;
+    __int64                llSector = 0;
+
+    memset(&dirtyMap, 0x00, sizeof(dirtyMap));
+
+    if (pPlan->ulFileCount == 0)
+    {
+        fprintf(stdout, "nothing to move.\n");
+        return 0;
+    }
+
+    if (ulBatchClusters == 0)
+        ulBatchClusters = 1;
+
+    /* fat_writeback_commit() refuses an existing journal; refuse it before copying. */
+    pJournal = fopen(szJournal, "rb");
+    if (pJournal != 0)
+    {
+        fclose(pJournal);
+        fprintf(stderr, "undo journal '%s' already exists, not writing.\n", szJournal);
+        return -1;
+    }
+
+    pMoves = malloc((pPlan->ulMoveCount + 1) * sizeof(fat_defrag_move));
+    pBuffer = malloc((size_t)ulBatchClusters * pPlan->ulClusterSize);
+    if ((pMoves == 0) || (pBuffer == 0))
+    {
+        fprintf(stderr, "allocations failed.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    nImageFile = fat_file_open_write(szImageFilename);
+    if (nImageFile < 0)
+    {
+        fprintf(stderr, "open failed on image '%s'.\n", szImageFilename);
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    // Copy the data first, in source order; the targets were all free.
+    memcpy(pMoves, pPlan->pMoves, pPlan->ulMoveCount * sizeof(fat_defrag_move));
+    qsort(pMoves, pPlan->ulMoveCount, sizeof(fat_defrag_move), compare_defrag_moves);
+
+    for (ulIndex = 0; ulIndex < pPlan->ulMoveCount; ++ulIndex)
+    {
+        for (ulDone = 0; ulDone < pMoves[ulIndex].ulCount; ulDone += ulRun)
+        {
+            ulRun = pMoves[ulIndex].ulCount - ulDone;
+            if (ulRun > ulBatchClusters)
+                ulRun = ulBatchClusters;
+
+            ulBytes = (size_t)ulRun * pPlan->ulClusterSize;
+
+            if (((__int64)ulBytes != fat_file_pread(nImageFile, pBuffer, ulBytes,
+                    (__int64)ulRootDirOffset + (__int64)(pMoves[ulIndex].ulFrom + ulDone - 2) * pPlan->ulClusterSize)) ||
+                ((__int64)ulBytes != fat_file_pwrite(nImageFile, pBuffer, ulBytes,
+                    (__int64)ulRootDirOffset + (__int64)(pMoves[ulIndex].ulTo + ulDone - 2) * pPlan->ulClusterSize)))
+            {
+                fprintf(stderr, "cluster copy failed on image '%s'; the volume is unchanged.\n", szImageFilename);
+                nReturnValue = -1;
+                goto exit;
+            }
+        }
+    }
+
+    if (0 != fat_file_sync(nImageFile))
+    {
+        fprintf(stderr, "sync failed on image '%s'.\n", szImageFilename);
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    // Point both FATs, and moved first clusters, at the copies.
+    nReturnValue = fat_dirty_map_init(&dirtyMap, ulFatSize, DEFRAG_SECTOR_SIZE);
+    if (nReturnValue != 0)
+        goto exit;
+
+    for (ulIndex = 0; ulIndex < pPlan->ulFileCount; ++ulIndex)
+    {
+        pFile = &pPlan->pFiles[ulIndex];
+        ulTailValue = pFat1Buffer[pFile->pChain->tail->cluster];
+
+        for (pFatNode = pFile->pChain->head, ulCluster = 0; ulCluster < pFile->ulClusters; ++ulCluster, pFatNode = pFatNode->next)
+        {
+            pFat1Buffer[pFatNode->cluster] = 0;
+            pFat2Buffer[pFatNode->cluster] = 0;
+            fat_dirty_map_mark(&dirtyMap, 1, pFatNode->cluster);
+            fat_dirty_map_mark(&dirtyMap, 2, pFatNode->cluster);
+        }
+
+        for (ulCluster = pFile->ulTarget; ulCluster < pFile->ulTarget + pFile->ulClusters; ++ulCluster)
+        {
+            pFat1Buffer[ulCluster] = (ulCluster + 1 < pFile->ulTarget + pFile->ulClusters) ? ulCluster + 1 : ulTailValue;
+            pFat2Buffer[ulCluster] = pFat1Buffer[ulCluster];
+            fat_dirty_map_mark(&dirtyMap, 1, ulCluster);
+            fat_dirty_map_mark(&dirtyMap, 2, ulCluster);
+        }
+
+        if (pFile->ulTarget == pFile->pChain->start)
+            continue;
+
+        llSector = (__int64)pFile->pChain->entryoffset & ~(__int64)(DEFRAG_SECTOR_SIZE - 1);
+        pSector = fat_dirty_map_sector(&dirtyMap, nImageFile, llSector);
+        if (pSector == 0)
+        {
+            nReturnValue = -1;
+            goto exit;
+        }
+
+        pDirEntry = (FAT32_DIR_ENTRY*)(pSector + ((__int64)pFile->pChain->entryoffset - llSector));
+        pDirEntry->clusterAddressHigh = (uint16_t)(pFile->ulTarget >> 16);
+        pDirEntry->clusterAddressLow = (uint16_t)(pFile->ulTarget & 0xFFFF);
+    }
+
+    // The write-back opens the image itself.
+    fat_file_close(nImageFile);
+    nImageFile = -1;
+
+    nReturnValue = fat_writeback_commit(
+        "defrag",
+        szImageFilename,
+        szJournal,
+        &dirtyMap,
+        pFat1Buffer,
+        pFat2Buffer,
+        (__int64)ulRootDirOffset - 2 * (__int64)ulFatSize,
+        (__int64)ulRootDirOffset - (__int64)ulFatSize);
+
+    if (nReturnValue == 0)
+    {
+        fprintf(stdout, "defragmented %u files: %u clusters copied.\n",
+            pPlan->ulFileCount,
+            pPlan->ulClustersMoved);
+    }
+
+exit:
+    fat_dirty_map_free(&dirtyMap);
+
+    // Close the image.
+    if (nImageFile >= 0)
+    {
+        fat_file_close(nImageFile);
+        nImageFile = -1;
+    }
+
+    // Free the pMoves buffer.
+    if (0 != pMoves)
+    {
+        free (pMoves);
+        pMoves = 0;
+    }
+
+    // Free the pBuffer buffer.
+    if (0 != pBuffer)
+    {
+        free (pBuffer);
+        pBuffer = 0;
+    }
+
+    return nReturnValue;
+}
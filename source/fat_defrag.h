@@ -0,0 +1,83 @@
+#ifndef __FAT_DEFRAG_H_HEADER__
+#define __FAT_DEFRAG_H_HEADER__
+
+#include "stdint.h"
+#include "fat_process.h"
+#include "fat_index.h"
+#include "fat_writeback.h"
+
+/* clusters ulFrom.. move to ulTo.., ulCount of them. */
+typedef struct FAT_DEFRAG_MOVE {
+    uint32_t  ulFrom;
+    uint32_t  ulTo;
+    uint32_t  ulCount;
+} fat_defrag_move;
+
+typedef struct FAT_DEFRAG_FILE {
+    fat_chain*  pChain;
+    uint32_t    ulTarget;       /* first cluster of the contiguous place. */
+    uint32_t    ulClusters;
+    uint32_t    ulFragments;    /* runs before the move. */
+    uint32_t    ulMoved;        /* clusters that change place. */
+    uint32_t    ulFirstMove;    /* into the plan's moves. */
+    uint32_t    ulMoveCount;
+} fat_defrag_file;
+
+/**
+ * Cluster relocation plan that makes fragmented files contiguous.
+ *
+ * Files are taken most fragmented first.  Each goes where the fewest of
+ * its clusters must move:  either in place around one of its own larger
+ * runs, with the gaps free, or into the smallest free run that holds it.
+ * Only clusters free before the plan are written, so the old copies stay
+ * intact until the FATs point away from them and a rollback of the FAT
+ * and directory sectors restores a consistent volume.  Clusters a move
+ * frees are therefore not reused within the same plan.
+ */
+typedef struct FAT_DEFRAG_PLAN {
+    fat_defrag_file*  pFiles;
+    uint32_t          ulFileCount;
+    fat_defrag_move*  pMoves;
+    uint32_t          ulMoveCount;
+    uint32_t          ulMoveCapacity;
+    uint32_t          ulClustersMoved;
+    uint32_t          ulSkipped;        /* fragmented, but no room. */
+    uint32_t          ulFatSectors;     /* rewritten per FAT copy. */
+    uint32_t          ulClusterSize;
+} fat_defrag_plan;
+
+/* plans the ulLimit most fragmented files (0 for all of them). */
+int fat_defrag_plan_build(
+    fat_defrag_plan* pPlan,
+    fat_node*        pFatList,
+    fat_chain*       pFatChainList,
+    uint32_t         ulFatChainCount,
+    uint32_t         ulFatSize,
+    uint32_t         ulClusterCount,
+    uint32_t         ulClusterSize,
+    uint32_t         ulLimit);
+
+void fat_defrag_plan_free(
+    fat_defrag_plan* pPlan);
+
+/* prints the plan with its estimated I/O cost. */
+void report_defrag_plan(
+    const fat_defrag_plan* pPlan,
+    fat_index*             pIndex);
+
+/**
+ * Carries the plan out:  copies the moved clusters in batches, in source
+ * order, and syncs; then rewrites both FAT copies and the directory
+ * entries of files whose first cluster moved through
+ * fat_writeback_commit(), journaled to szJournal.
+ */
+int fat_defrag_apply(
+    const fat_defrag_plan* pPlan,
+    const char*            szImageFilename,
+    const char*            szJournal,
+    uint32_t*              pFat1Buffer,
+    uint32_t*              pFat2Buffer,
+    uint32_t               ulFatSize,
+    uint32_t               ulRootDirOffset);
+
+#endif /* __FAT_DEFRAG_H_HEADER__ */
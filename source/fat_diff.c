@@ -0,0 +1,408 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#include "stdint.h"
+#include "fat_process.h"
+#include "fat_index.h"
+#include "fat_platform.h"
+#include "fat_volume.h"
+#include "fat_diff.h"
+
+#define DIFF_BLOCK_SIZE (1024 * 1024)
+
+typedef struct DIFF_OPEN_CONTEXT {
+    const char* szImage;
+    fat_volume* pVolume;
+} diff_open_context;
+
+/* chain indices found on one side of the merge only. */
+typedef struct DIFF_LIST {
+    uint32_t* pChains;
+    uint32_t  ulCount;
+} diff_list;
+
+/* sort context for pairing moves; qsort has no context argument. */
+static const fat_chain* g_pMoveChains = 0;
+
+static const char* diff_path(
+    const fat_index* pIndex,
+    uint32_t         ulChainIndex)
+{
+    return pIndex->pPathPool + pIndex->pPathOffsets[ulChainIndex];
+}
+
+/* same first cluster, size and creation stamp. */
+static int diff_compare_identity(
+    const fat_chain* pLeft,
+    const fat_chain* pRight)
+{
+    if (pLeft->start != pRight->start)
+        return (pLeft->start < pRight->start) ? -1 : 1;
+
+    if (pLeft->filesize != pRight->filesize)
+        return (pLeft->filesize < pRight->filesize) ? -1 : 1;
+
+    if (pLeft->timestamp.date.value != pRight->timestamp.date.value)
+        return (pLeft->timestamp.date.value < pRight->timestamp.date.value) ? -1 : 1;
+
+    if (pLeft->timestamp.time.value != pRight->timestamp.time.value)
+        return (pLeft->timestamp.time.value < pRight->timestamp.time.value) ? -1 : 1;
+
+    return 0;
+}
+
+static int diff_compare_moves(
+    const void* pLeft,
+    const void* pRight)
+{
+    return diff_compare_identity(
+        &g_pMoveChains[*(const uint32_t*)pLeft],
+        &g_pMoveChains[*(const uint32_t*)pRight]);
+}
+
+/* non-zero if both chains cover their (equal) size with the same clusters. */
+static int diff_same_extents(
+    const fat_chain* pOldChain,
+    const fat_chain* pNewChain,
+    uint32_t         ulClusterSize)
+{
+    const fat_node* pOldNode = pOldChain->head;
+    const fat_node* pNewNode = pNewChain->head;
+    uint32_t        ulClusters = (uint32_t)(((uint64_t)pOldChain->filesize + ulClusterSize - 1) / ulClusterSize);
+
+    while (ulClusters-- > 0)
+    {
+        if ((pOldNode == 0) || (pNewNode == 0) || (pOldNode->cluster != pNewNode->cluster))
+            return 0;
+
+        pOldNode = pOldNode->next;
+        pNewNode = pNewNode->next;
+    }
+
+    return 1;
+}
+
+/* returns 1 if the contents differ, 0 if not, -1 on a read error. */
+static int diff_contents(
+    const fat_volume* pOld,
+    const fat_chain*  pOldChain,
+    const fat_volume* pNew,
+    const fat_chain*  pNewChain,
+    char*             pOldBuffer,
+    char*             pNewBuffer,
+    fat_diff_summary* pSummary)
+{
+    __int64 llOffset = 0;
+    __int64 llOldRead = 0;
+    __int64 llNewRead = 0;
+
+    while (llOffset < pOldChain->filesize)
+    {
+        llOldRead = fat_volume_read(pOld, pOldChain, llOffset, pOldBuffer, DIFF_BLOCK_SIZE);
+        llNewRead = fat_volume_read(pNew, pNewChain, llOffset, pNewBuffer, DIFF_BLOCK_SIZE);
+
+        if ((llOldRead <= 0) || (llNewRead <= 0))
+            return -1;
+
+        pSummary->ullBytesCompared += (uint64_t)llOldRead;
+
+        if ((llOldRead != llNewRead) || (0 != memcmp(pOldBuffer, pNewBuffer, (size_t)llOldRead)))
+            return 1;
+
+        llOffset += llOldRead;
+    }
+
+    return 0;
+}
+
+int fat_diff_volumes(
+    const fat_volume* pOld,
+    const fat_volume* pNew,
+    fat_diff_summary* pSummary)
+{
+    const fat_index* pOldIndex = fat_volume_index(pOld);
+    const fat_index* pNewIndex = fat_volume_index(pNew);
+    const fat_chain* pOldChain = 0;
+    const fat_chain* pNewChain = 0;
+    diff_list        removed;
+    diff_list        added;
+    uint8_t*         pPaired = 0;
+    char*            pOldBuffer = 0;
+    char*            pNewBuffer = 0;
+    uint32_t         ulOld = 0;
+    uint32_t         ulNew = 0;
+    uint32_t         ulIndex = 0;
+    uint32_t         ulLow = 0;
+    uint32_t         ulHigh = 0;
+    uint32_t         ulMiddle = 0;
+    int              nSameGeometry = 0;
+    int              nCompare = 0;
+    int              nDiffers = 0;
+    int              nReturnValue = 0;
+
+    memset(pSummary, 0x00, sizeof(fat_diff_summary));
+    memset(&removed, 0x00, sizeof(removed));
+    memset(&added, 0x00, sizeof(added));
+
+    if ((pOldIndex == 0) || (pNewIndex == 0))
+        return -1;
+
+    removed.pChains = malloc((pOldIndex->ulSortedCount + 1) * sizeof(uint32_t));
+    added.pChains = malloc((pNewIndex->ulSortedCount + 1) * sizeof(uint32_t));
+    pPaired = calloc(pNewIndex->ulSortedCount + 1, sizeof(uint8_t));
+    pOldBuffer = malloc(DIFF_BLOCK_SIZE);
+    pNewBuffer = malloc(DIFF_BLOCK_SIZE);
+
+    if ((removed.pChains == 0) || (added.pChains == 0) || (pPaired == 0) ||
+        (pOldBuffer == 0) || (pNewBuffer == 0))
+    {
+        fprintf(stderr, "allocations failed.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    /* Cluster numbers only name the same bytes on the same layout. */
+    nSameGeometry =
+        (fat_volume_cluster_size(pOld) == fat_volume_cluster_size(pNew)) &&
+        (fat_volume_data_offset(pOld) == fat_volume_data_offset(pNew));
+
+    // Merge the two path-sorted arrays.
+    while ((ulOld < pOldIndex->ulSortedCount) || (ulNew < pNewIndex->ulSortedCount))
+    {
+        if (ulOld == pOldIndex->ulSortedCount)
+            nCompare = 1;
+        else if (ulNew == pNewIndex->ulSortedCount)
+            nCompare = -1;
+        else
+            nCompare = strcmp(
+                diff_path(pOldIndex, pOldIndex->pSortedPaths[ulOld]),
+                diff_path(pNewIndex, pNewIndex->pSortedPaths[ulNew]));
+
+        if (nCompare < 0)
+        {
+            removed.pChains[removed.ulCount++] = pOldIndex->pSortedPaths[ulOld++];
+            continue;
+        }
+
+        if (nCompare > 0)
+        {
+            added.pChains[added.ulCount++] = pNewIndex->pSortedPaths[ulNew++];
+            continue;
+        }
+
+        pOldChain = &pOldIndex->pChainList[pOldIndex->pSortedPaths[ulOld]];
+        pNewChain = &pNewIndex->pChainList[pNewIndex->pSortedPaths[ulNew]];
+
+        /* A file replaced by a directory, or the reverse, is two changes. */
+        if ((pOldChain->attributes & FILE_ATTRIB_DIR) != (pNewChain->attributes & FILE_ATTRIB_DIR))
+        {
+            removed.pChains[removed.ulCount++] = pOldIndex->pSortedPaths[ulOld++];
+            added.pChains[added.ulCount++] = pNewIndex->pSortedPaths[ulNew++];
+            continue;
+        }
+
+        /* Directory changes show up as changes to their entries. */
+        if ((pOldChain->attributes & FILE_ATTRIB_DIR) != 0)
+        {
+            nDiffers = 0;
+        }
+        else if (pOldChain->filesize != pNewChain->filesize)
+        {
+            fprintf(stdout, "R %s : %uB -> %uB\n",
+                diff_path(pOldIndex, pOldIndex->pSortedPaths[ulOld]),
+                pOldChain->filesize,
+                pNewChain->filesize);
+
+            ++pSummary->ulResized;
+            ++ulOld;
+            ++ulNew;
+            continue;
+        }
+        else if ((nSameGeometry != 0) &&
+                 (pOldChain->modifydate == pNewChain->modifydate) &&
+                 (pOldChain->modifytime == pNewChain->modifytime) &&
+                 (0 != diff_same_extents(pOldChain, pNewChain, fat_volume_cluster_size(pOld))))
+        {
+            nDiffers = 0;
+        }
+        else
+        {
+            nDiffers = diff_contents(pOld, pOldChain, pNew, pNewChain, pOldBuffer, pNewBuffer, pSummary);
+
+            /* A chain too short for its size cannot be shown unchanged. */
+            if (nDiffers < 0)
+            {
+                fprintf(stderr, "read failed on '%s'.\n", diff_path(pOldIndex, pOldIndex->pSortedPaths[ulOld]));
+                nDiffers = 1;
+            }
+        }
+
+        if (nDiffers > 0)
+        {
+            fprintf(stdout, "C %s\n", diff_path(pOldIndex, pOldIndex->pSortedPaths[ulOld]));
+            ++pSummary->ulChanged;
+        }
+        else
+        {
+            ++pSummary->ulUnchanged;
+        }
+
+        ++ulOld;
+        ++ulNew;
+    }
+
+    // Pair removed and added paths holding the same data as moves.
+    g_pMoveChains = pNewIndex->pChainList;
+    qsort(added.pChains, added.ulCount, sizeof(uint32_t), diff_compare_moves);
+
+    for (ulIndex = 0; ulIndex < removed.ulCount; ++ulIndex)
+    {
+        pOldChain = &pOldIndex->pChainList[removed.pChains[ulIndex]];
+
+        /* first added entry not below the removed one. */
+        ulLow = 0;
+        ulHigh = added.ulCount;
+
+        while (ulLow < ulHigh)
+        {
+            ulMiddle = ulLow + ((ulHigh - ulLow) >> 1);
+
+            if (diff_compare_identity(&pNewIndex->pChainList[added.pChains[ulMiddle]], pOldChain) < 0)
+                ulLow = ulMiddle + 1;
+            else
+                ulHigh = ulMiddle;
+        }
+
+        while ((ulLow < added.ulCount) && (pPaired[ulLow] != 0) &&
+               (0 == diff_compare_identity(&pNewIndex->pChainList[added.pChains[ulLow]], pOldChain)))
+            ++ulLow;
+
+        if ((ulLow < added.ulCount) &&
+            (0 == diff_compare_identity(&pNewIndex->pChainList[added.pChains[ulLow]], pOldChain)))
+        {
+            fprintf(stdout, "M %s -> %s\n",
+                diff_path(pOldIndex, removed.pChains[ulIndex]),
+                diff_path(pNewIndex, added.pChains[ulLow]));
+
+            pPaired[ulLow] = 1;
+            ++pSummary->ulMoved;
+        }
+        else
+        {
+            fprintf(stdout, "D %s\n", diff_path(pOldIndex, removed.pChains[ulIndex]));
+            ++pSummary->ulRemoved;
+        }
+    }
+
+    for (ulIndex = 0; ulIndex < added.ulCount; ++ulIndex)
+    {
+        if (pPaired[ulIndex] == 0)
+        {
+            fprintf(stdout, "A %s\n", diff_path(pNewIndex, added.pChains[ulIndex]));
+            ++pSummary->ulAdded;
+        }
+    }
+
+exit:
+    // Free the removed.pChains buffer.
+    if (0 != removed.pChains)
+    {
+        free (removed.pChains);
+        removed.pChains = 0;
+    }
+
+    // Free the added.pChains buffer.
+    if (0 != added.pChains)
+    {
+        free (added.pChains);
+        added.pChains = 0;
+    }
+
+    // Free the pPaired buffer.
+    if (0 != pPaired)
+    {
+        free (pPaired);
+        pPaired = 0;
+    }
+
+    // Free the pOldBuffer buffer.
+    if (0 != pOldBuffer)
+    {
+        free (pOldBuffer);
+        pOldBuffer = 0;
+    }
+
+    // Free the pNewBuffer buffer.
+    if (0 != pNewBuffer)
+    {
+        free (pNewBuffer);
+        pNewBuffer = 0;
+    }
+
+    return nReturnValue;
+}
+
+static int diff_open_volume(
+    void*       pContext)
+{
+    diff_open_context* pOpen = (diff_open_context*)pContext;
+
+    if (0 != fat_volume_open(pOpen->szImage, &pOpen->pVolume))
+        return -1;
+
+    return fat_volume_build_index(pOpen->pVolume);
+}
+
+int diff_images(
+    const char* szOldImage,
+    const char* szNewImage)
+{
+    diff_open_context oldOpen;
+    diff_open_context newOpen;
+    fat_thread        thread;
+    fat_diff_summary  summary;
+    int               nStarted = 0;
+    int               nReturnValue = 0;
+
+    oldOpen.szImage = szOldImage;
+    oldOpen.pVolume = 0;
+    newOpen.szImage = szNewImage;
+    newOpen.pVolume = 0;
+
+    // Load the second image while this thread loads the first.
+    nStarted = (0 == fat_thread_start(&thread, diff_open_volume, &newOpen));
+
+    nReturnValue = diff_open_volume(&oldOpen);
+
+    if (nStarted != 0)
+    {
+        if (0 != fat_thread_join(&thread))
+            nReturnValue = -1;
+    }
+    else if (0 != diff_open_volume(&newOpen))
+    {
+        nReturnValue = -1;
+    }
+
+    if (nReturnValue == 0)
+        nReturnValue = fat_diff_volumes(oldOpen.pVolume, newOpen.pVolume, &summary);
+
+    if (nReturnValue == 0)
+    {
+        fprintf(stderr, "%u added, %u removed, %u moved, %u resized, %u changed, %u unchanged (%llu KB compared).\n",
+            summary.ulAdded,
+            summary.ulRemoved,
+            summary.ulMoved,
+            summary.ulResized,
+            summary.ulChanged,
+            summary.ulUnchanged,
+            (unsigned long long)(summary.ullBytesCompared >> 10));
+    }
+
+    fat_volume_close(oldOpen.pVolume);
+    fat_volume_close(newOpen.pVolume);
+
+    return nReturnValue;
+}
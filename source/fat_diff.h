@@ -0,0 +1,44 @@
+#ifndef __FAT_DIFF_H_HEADER__
+#define __FAT_DIFF_H_HEADER__
+
+#include "stdint.h"
+#include "fat_volume.h"
+
+/* fat_diff_volumes() counts, one per kind of change. */
+typedef struct FAT_DIFF_SUMMARY {
+    uint32_t  ulAdded;
+    uint32_t  ulRemoved;
+    uint32_t  ulMoved;
+    uint32_t  ulResized;
+    uint32_t  ulChanged;
+    uint32_t  ulUnchanged;
+    uint64_t  ullBytesCompared;
+} fat_diff_summary;
+
+/**
+ * Reports what changed from pOld to pNew, both indexed.
+ *
+ * The path-sorted index arrays are merged in one pass.  Paths on both sides
+ * with the same size are compared by extent first:  identical cluster lists
+ * with the same modify stamp are taken as unchanged without reading, and
+ * only the rest are compared byte by byte.  Paths found on one side only
+ * are paired up as moves when their first cluster, size and creation stamp
+ * agree.  Lines are:
+ *
+ *     A /PATH                  added
+ *     D /PATH                  removed
+ *     M /OLD -> /NEW           moved or renamed
+ *     R /PATH : OLDB -> NEWB   resized
+ *     C /PATH                  same size, different contents
+ */
+int fat_diff_volumes(
+    const fat_volume* pOld,
+    const fat_volume* pNew,
+    fat_diff_summary* pSummary);
+
+/* opens both images (concurrently), diffs them and prints a summary. */
+int diff_images(
+    const char* szOldImage,
+    const char* szNewImage);
+
+#endif /* __FAT_DIFF_H_HEADER__ */
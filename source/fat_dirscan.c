@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define FAT_DIRSCAN_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "stdint.h"
+#include "fat_defs.h"
+#include "fat_process.h"
+#include "fat_dirscan.h"
+
+#define DIRSCAN_BLOCK_ENTRIES (16)
+#define DIRSCAN_ATTRIB_OFFSET (11)
+
+static uint8_t dirscan_classify_entry(const FAT32_DIR_ENTRY* pEntry)
+{
+    if (pEntry->dosFilename[0] == 0x00)
+        return FAT_DIRSCAN_FREE;
+
+    if (pEntry->dosFilename[0] == FILE_DEL_ENTRY)
+        return FAT_DIRSCAN_DELETED;
+
+    if ((pEntry->fileAttributes & FILE_ATTRIB_LFN_MASK) == FILE_ATTRIB_LFN)
+        return FAT_DIRSCAN_LFN;
+
+    if (pEntry->dosFilename[0] == FILE_DOT_ENTRY)
+        return FAT_DIRSCAN_DOT;
+
+    if (0 != (pEntry->fileAttributes & FILE_ATTRIB_VOLUME))
+        return FAT_DIRSCAN_VOLUME;
+
+    if (0 != (pEntry->fileAttributes & FILE_ATTRIB_DIR))
+        return FAT_DIRSCAN_DIRECTORY;
+
+    return FAT_DIRSCAN_FILE;
+}
+
+#ifdef FAT_DIRSCAN_SSE2
+static uint32_t dirscan_first_bit(uint32_t ulMask)
+{
+    uint32_t ulBit = 0;
+
+    while (0 == (ulMask & 1))
+    {
+        ulMask >>= 1;
+        ++ulBit;
+    }
+
+    return ulBit;
+}
+
+/* byte nOffset of four consecutive entries, one per 32-bit lane. */
+static __m128i dirscan_gather4(
+    const uint8_t* pEntries,
+    int            nOffset)
+{
+    const __m128i xmmLowByte = _mm_cvtsi32_si128(0xFF);
+    __m128i       xmmLane0;
+    __m128i       xmmLane1;
+    __m128i       xmmLane2;
+    __m128i       xmmLane3;
+
+    /* Loads start at the wanted byte and stay inside each 32-byte entry. */
+    xmmLane0 = _mm_and_si128(_mm_loadu_si128((const __m128i*)(pEntries + 0 * 32 + nOffset)), xmmLowByte);
+    xmmLane1 = _mm_and_si128(_mm_loadu_si128((const __m128i*)(pEntries + 1 * 32 + nOffset)), xmmLowByte);
+    xmmLane2 = _mm_and_si128(_mm_loadu_si128((const __m128i*)(pEntries + 2 * 32 + nOffset)), xmmLowByte);
+    xmmLane3 = _mm_and_si128(_mm_loadu_si128((const __m128i*)(pEntries + 3 * 32 + nOffset)), xmmLowByte);
+
+    return _mm_or_si128(
+        _mm_or_si128(xmmLane0, _mm_slli_si128(xmmLane1, 4)),
+        _mm_or_si128(_mm_slli_si128(xmmLane2, 8), _mm_slli_si128(xmmLane3, 12)));
+}
+
+/* byte nOffset of sixteen consecutive entries, one per byte lane. */
+static __m128i dirscan_gather16(
+    const uint8_t* pEntries,
+    int            nOffset)
+{
+    return _mm_packus_epi16(
+        _mm_packs_epi32(dirscan_gather4(pEntries + 0 * 128, nOffset), dirscan_gather4(pEntries + 1 * 128, nOffset)),
+        _mm_packs_epi32(dirscan_gather4(pEntries + 2 * 128, nOffset), dirscan_gather4(pEntries + 3 * 128, nOffset)));
+}
+
+static __m128i dirscan_select(
+    __m128i xmmMask,
+    __m128i xmmValue,
+    __m128i xmmOther)
+{
+    return _mm_or_si128(_mm_and_si128(xmmMask, xmmValue), _mm_andnot_si128(xmmMask, xmmOther));
+}
+
+/* classifies sixteen entries; returns the mask of end-of-directory entries. */
+static uint32_t dirscan_classify_block(
+    const uint8_t* pEntries,
+    uint8_t*       pClasses)
+{
+    __m128i xmmFirst = dirscan_gather16(pEntries, 0);
+    __m128i xmmAttrib = dirscan_gather16(pEntries, DIRSCAN_ATTRIB_OFFSET);
+    __m128i xmmClass = _mm_set1_epi8(FAT_DIRSCAN_FILE);
+    __m128i xmmFree = _mm_cmpeq_epi8(xmmFirst, _mm_setzero_si128());
+    __m128i xmmMask;
+
+    /* Apply the classes from lowest to highest precedence. */
+    xmmMask = _mm_cmpeq_epi8(_mm_and_si128(xmmAttrib, _mm_set1_epi8(FILE_ATTRIB_DIR)), _mm_set1_epi8(FILE_ATTRIB_DIR));
+    xmmClass = dirscan_select(xmmMask, _mm_set1_epi8(FAT_DIRSCAN_DIRECTORY), xmmClass);
+
+    xmmMask = _mm_cmpeq_epi8(_mm_and_si128(xmmAttrib, _mm_set1_epi8(FILE_ATTRIB_VOLUME)), _mm_set1_epi8(FILE_ATTRIB_VOLUME));
+    xmmClass = dirscan_select(xmmMask, _mm_set1_epi8(FAT_DIRSCAN_VOLUME), xmmClass);
+
+    xmmMask = _mm_cmpeq_epi8(xmmFirst, _mm_set1_epi8(FILE_DOT_ENTRY));
+    xmmClass = dirscan_select(xmmMask, _mm_set1_epi8(FAT_DIRSCAN_DOT), xmmClass);
+
+    xmmMask = _mm_cmpeq_epi8(_mm_and_si128(xmmAttrib, _mm_set1_epi8(FILE_ATTRIB_LFN_MASK)), _mm_set1_epi8(FILE_ATTRIB_LFN));
+    xmmClass = dirscan_select(xmmMask, _mm_set1_epi8(FAT_DIRSCAN_LFN), xmmClass);
+
+    xmmMask = _mm_cmpeq_epi8(xmmFirst, _mm_set1_epi8((char)FILE_DEL_ENTRY));
+    xmmClass = dirscan_select(xmmMask, _mm_set1_epi8(FAT_DIRSCAN_DELETED), xmmClass);
+
+    xmmClass = dirscan_select(xmmFree, _mm_set1_epi8(FAT_DIRSCAN_FREE), xmmClass);
+
+    _mm_storeu_si128((__m128i*)pClasses, xmmClass);
+
+    return (uint32_t)_mm_movemask_epi8(xmmFree);
+}
+#endif
+
+uint32_t fat_dirscan_classify(
+    const FAT32_DIR_ENTRY* pEntries,
+    uint32_t               ulEntryCount,
+    uint8_t*               pClasses,
+    int                    nStopAtEnd)
+{
+    uint32_t ulEndIndex = ulEntryCount;
+    uint32_t ulIndex = 0;
+
+#ifdef FAT_DIRSCAN_SSE2
+    uint32_t ulFreeMask = 0;
+
+    for (; ulIndex + DIRSCAN_BLOCK_ENTRIES <= ulEntryCount; ulIndex += DIRSCAN_BLOCK_ENTRIES)
+    {
+        ulFreeMask = dirscan_classify_block((const uint8_t*)&pEntries[ulIndex], &pClasses[ulIndex]);
+
+        if ((ulFreeMask != 0) && (ulEndIndex == ulEntryCount))
+        {
+            ulEndIndex = ulIndex + dirscan_first_bit(ulFreeMask);
+
+            if (nStopAtEnd != 0)
+                return ulEndIndex;
+        }
+    }
+#endif
+
+    for (; ulIndex < ulEntryCount; ++ulIndex)
+    {
+        pClasses[ulIndex] = dirscan_classify_entry(&pEntries[ulIndex]);
+
+        if ((pClasses[ulIndex] == FAT_DIRSCAN_FREE) && (ulEndIndex == ulEntryCount))
+        {
+            ulEndIndex = ulIndex;
+
+            if (nStopAtEnd != 0)
+                break;
+        }
+    }
+
+    return ulEndIndex;
+}
+
+int fat_dirscan_opens_directory(
+    const FAT32_DIR_ENTRY* pEntries,
+    uint32_t               ulEntryCount)
+{
+    if (ulEntryCount < 2)
+        return 0;
+
+    return (pEntries[0].dosFilename[0] == FILE_DOT_ENTRY) && (pEntries[0].dosFilename[1] == ' ') &&
+           (pEntries[1].dosFilename[0] == FILE_DOT_ENTRY) && (pEntries[1].dosFilename[1] == FILE_DOT_ENTRY) &&
+           (0 != (pEntries[0].fileAttributes & FILE_ATTRIB_DIR)) &&
+           (0 != (pEntries[1].fileAttributes & FILE_ATTRIB_DIR));
+}
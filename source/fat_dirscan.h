@@ -0,0 +1,40 @@
+#ifndef __FAT_DIRSCAN_H_HEADER__
+#define __FAT_DIRSCAN_H_HEADER__
+
+#include "stdint.h"
+#include "fat_defs.h"
+
+/* Entry classes, in decreasing precedence. */
+#define FAT_DIRSCAN_FREE      (0) /* first byte 0x00: free, and no later entry in use. */
+#define FAT_DIRSCAN_DELETED   (1) /* first byte 0xE5. */
+#define FAT_DIRSCAN_LFN       (2) /* long file name fragment (attributes 0x0F). */
+#define FAT_DIRSCAN_DOT       (3) /* "." or ".." entry. */
+#define FAT_DIRSCAN_VOLUME    (4) /* volume label. */
+#define FAT_DIRSCAN_DIRECTORY (5) /* subdirectory. */
+#define FAT_DIRSCAN_FILE      (6) /* regular file. */
+#define FAT_DIRSCAN_CLASSES   (7)
+
+#define FILE_ATTRIB_VOLUME    (0x08)
+#define FILE_ATTRIB_LFN       (0x0F)
+#define FILE_ATTRIB_LFN_MASK  (0x3F)
+
+/**
+ * Classifies ulEntryCount directory entries, sixteen at a time with SSE2
+ * where available, writing one FAT_DIRSCAN_* value per entry to pClasses.
+ *
+ * returns the index of the first end-of-directory (0x00) entry, or
+ * ulEntryCount if the cluster has none.  When nStopAtEnd is set, entries
+ * past that index are left unclassified.
+ */
+uint32_t fat_dirscan_classify(
+    const FAT32_DIR_ENTRY* pEntries,
+    uint32_t               ulEntryCount,
+    uint8_t*               pClasses,
+    int                    nStopAtEnd);
+
+/* returns non-zero if the entries open with the "." and ".." of a subdirectory. */
+int fat_dirscan_opens_directory(
+    const FAT32_DIR_ENTRY* pEntries,
+    uint32_t               ulEntryCount);
+
+#endif /* __FAT_DIRSCAN_H_HEADER__ */
@@ -0,0 +1,506 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <math.h>
+
+#include "stdint.h"
+#include "fat_defs.h"
+#include "fat_process.h"
+#include "fat_platform.h"
+#include "fat_dirscan.h"
+#include "fat_lazy.h"
+#include "fat_estimate.h"
+
+/* per-page values; each estimates a volume total. */
+#define ESTIMATE_USED    (0)  /* allocated clusters. */
+#define ESTIMATE_CHAINS  (1)  /* end-of-chain entries. */
+#define ESTIMATE_BREAKS  (2)  /* links to anything but the next cluster. */
+#define ESTIMATE_DIRS    (3)  /* directories opening at the probed cluster. */
+#define ESTIMATE_FILES   (4)  /* files in those directories. */
+#define ESTIMATE_VALUES  (5)
+#define ESTIMATE_NONE    (ESTIMATE_VALUES)
+
+#define ESTIMATE_Z95     (1.96)
+#define ESTIMATE_SEED    (0x9E3779B97F4A7C15ULL)
+
+typedef struct ESTIMATE_STRATUM {
+    uint32_t ulFirstPage;
+    uint32_t ulPages;       /* pages in the stratum. */
+    uint32_t ulFirstSample;
+    uint32_t ulSamples;     /* pages read from it. */
+} estimate_stratum;
+
+typedef struct ESTIMATE_SAMPLE {
+    uint32_t ulPage;
+    double   adValues[ESTIMATE_VALUES];
+} estimate_sample;
+
+/* xorshift64*; a fixed seed keeps repeated runs comparable. */
+static uint32_t estimate_random(
+    uint64_t* pullState,
+    uint32_t  ulBound)
+{
+    *pullState ^= *pullState >> 12;
+    *pullState ^= *pullState << 25;
+    *pullState ^= *pullState >> 27;
+
+    return (uint32_t)(((*pullState * 0x2545F4914F6CDD1DULL) >> 32) % ulBound);
+}
+
+static int compare_estimate_samples(
+    const void* pLeft,
+    const void* pRight)
+{
+    uint32_t ulLeft = ((const estimate_sample*)pLeft)->ulPage;
+    uint32_t ulRight = ((const estimate_sample*)pRight)->ulPage;
+
+    return (ulLeft < ulRight) ? -1 : ((ulLeft > ulRight) ? 1 : 0);
+}
+
+/* picks ulSamples distinct pages of the stratum (Floyd), in disk order. */
+static void estimate_pick_pages(
+    const estimate_stratum* pStratum,
+    estimate_sample*        pSamples,
+    uint64_t*               pullState)
+{
+    uint32_t ulCount = 0;
+    uint32_t ulCandidate = 0;
+    uint32_t ulLimit = 0;
+    uint32_t ulIndex = 0;
+
+    for (ulLimit = pStratum->ulPages - pStratum->ulSamples; ulLimit < pStratum->ulPages; ++ulLimit)
+    {
+        ulCandidate = estimate_random(pullState, ulLimit + 1);
+
+        for (ulIndex = 0; ulIndex < ulCount; ++ulIndex)
+            if (pSamples[ulIndex].ulPage == pStratum->ulFirstPage + ulCandidate)
+                break;
+
+        if (ulIndex < ulCount)
+            ulCandidate = ulLimit;
+
+        pSamples[ulCount++].ulPage = pStratum->ulFirstPage + ulCandidate;
+    }
+
+    qsort(pSamples, ulCount, sizeof(estimate_sample), compare_estimate_samples);
+}
+
+/* sum over strata of N * mean. */
+static double estimate_total(
+    const estimate_stratum* pStrata,
+    uint32_t                ulStrata,
+    const estimate_sample*  pSamples,
+    uint32_t                ulValue)
+{
+    double   dTotal = 0;
+    double   dSum = 0;
+    uint32_t ulStratum = 0;
+    uint32_t ulIndex = 0;
+
+    for (ulStratum = 0; ulStratum < ulStrata; ++ulStratum)
+    {
+        dSum = 0;
+
+        for (ulIndex = 0; ulIndex < pStrata[ulStratum].ulSamples; ++ulIndex)
+            dSum += pSamples[pStrata[ulStratum].ulFirstSample + ulIndex].adValues[ulValue];
+
+        if (pStrata[ulStratum].ulSamples != 0)
+            dTotal += (double)pStrata[ulStratum].ulPages * dSum / pStrata[ulStratum].ulSamples;
+    }
+
+    return dTotal;
+}
+
+/**
+ * 95% half-width of the stratified estimate of Y(ulValue) - dRatio * Y(ulDenominator).
+ *
+ * With ulDenominator of ESTIMATE_NONE this is the interval of a plain total.
+ * nFinite applies the finite population correction; values that also depend
+ * on the probed clusters are left uncorrected, so a FAT read in
+ * full still reports the spread of the probes.
+ */
+static double estimate_interval(
+    const estimate_stratum* pStrata,
+    uint32_t                ulStrata,
+    const estimate_sample*  pSamples,
+    uint32_t                ulValue,
+    uint32_t                ulDenominator,
+    double                  dRatio,
+    int                     nFinite)
+{
+    const estimate_sample* pSample = 0;
+    double   dVariance = 0;
+    double   dMean = 0;
+    double   dSquares = 0;
+    double   dValue = 0;
+    double   dSampled = 0;
+    double   dFraction = 0;
+    uint32_t ulStratum = 0;
+    uint32_t ulIndex = 0;
+
+    for (ulStratum = 0; ulStratum < ulStrata; ++ulStratum)
+    {
+        if (pStrata[ulStratum].ulSamples < 2)
+            continue;
+
+        dSampled = pStrata[ulStratum].ulSamples;
+        dMean = 0;
+        dSquares = 0;
+
+        for (ulIndex = 0; ulIndex < pStrata[ulStratum].ulSamples; ++ulIndex)
+        {
+            pSample = &pSamples[pStrata[ulStratum].ulFirstSample + ulIndex];
+            dValue = pSample->adValues[ulValue];
+
+            if (ulDenominator != ESTIMATE_NONE)
+                dValue -= dRatio * pSample->adValues[ulDenominator];
+
+            dMean += dValue;
+            dSquares += dValue * dValue;
+        }
+
+        dMean /= dSampled;
+        dFraction = (nFinite != 0) ? dSampled / pStrata[ulStratum].ulPages : 0;
+
+        dVariance += (double)pStrata[ulStratum].ulPages * pStrata[ulStratum].ulPages * (1 - dFraction) *
+            ((dSquares - dSampled * dMean * dMean) / (dSampled - 1)) / dSampled;
+    }
+
+    return (dVariance > 0) ? ESTIMATE_Z95 * sqrt(dVariance) : 0;
+}
+
+/* decodes one FAT page the way process_fat_entries() does. */
+static uint32_t estimate_decode_page(
+    const uint32_t*  pPage,
+    uint32_t         ulFirstCluster,
+    uint32_t         ulEntries,
+    uint32_t         ulFatEntries,
+    estimate_sample* pSample)
+{
+    uint32_t ulIndex = 0;
+    uint32_t ulCluster = 0;
+
+    for (ulIndex = 0; ulIndex < ulEntries; ++ulIndex)
+    {
+        ulCluster = ulFirstCluster + ulIndex;
+
+        if (ulCluster < FAT_ROOT_DIR)
+            continue;
+
+        switch (fat_entry_kind(pPage[ulIndex], ulFatEntries))
+        {
+            case FAT_ENTRY_NEXT:
+                pSample->adValues[ESTIMATE_USED] += 1;
+
+                if (pPage[ulIndex] != ulCluster + 1)
+                    pSample->adValues[ESTIMATE_BREAKS] += 1;
+                break;
+
+            case FAT_ENTRY_END:
+                pSample->adValues[ESTIMATE_USED] += 1;
+                pSample->adValues[ESTIMATE_CHAINS] += 1;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    return (uint32_t)pSample->adValues[ESTIMATE_USED];
+}
+
+/**
+ * counts the files in the directory starting at ulCluster.
+ *
+ * returns 0 if counted, 1 if nRequireDots is set and the cluster does not
+ * open with "." and "..", -1 if a cluster could not be read.
+ */
+static int estimate_count_directory(
+    fat_lazy_volume* pVolume,
+    uint32_t         ulCluster,
+    int              nRequireDots,
+    FAT32_DIR_ENTRY* pDirectoryBuffer,
+    uint8_t*         pClasses,
+    uint32_t*        pulFiles)
+{
+    uint32_t ulDirsPerCluster = pVolume->ulClusterSize / sizeof(FAT32_DIR_ENTRY);
+    uint32_t ulEntriesInUse = 0;
+    uint32_t ulIndex = 0;
+    uint32_t ulSteps = 0;
+
+    *pulFiles = 0;
+
+    while ((ulCluster >= 2) && (ulCluster < FAT_EOC) && (ulSteps++ < pVolume->ulFatEntries))
+    {
+        if ((__int64)pVolume->ulClusterSize != fat_file_pread(
+                pVolume->nImageFile,
+                pDirectoryBuffer,
+                pVolume->ulClusterSize,
+                pVolume->llDataOffset + (__int64)(ulCluster - 2) * pVolume->ulClusterSize))
+            return -1;
+
+        ++pVolume->ulClustersRead;
+
+        ulEntriesInUse = fat_dirscan_classify(pDirectoryBuffer, ulDirsPerCluster, pClasses, 1);
+
+        if ((nRequireDots != 0) && (ulSteps == 1) &&
+            (0 == fat_dirscan_opens_directory(pDirectoryBuffer, ulEntriesInUse)))
+            return 1;
+
+        for (ulIndex = 0; ulIndex < ulEntriesInUse; ++ulIndex)
+            if (pClasses[ulIndex] == FAT_DIRSCAN_FILE)
+                ++*pulFiles;
+
+        /* End of directory; later clusters hold no live entries. */
+        if (ulEntriesInUse < ulDirsPerCluster)
+            break;
+
+        if (0 != fat_lazy_fat_entry(pVolume, ulCluster, &ulCluster))
+            return -1;
+    }
+
+    return 0;
+}
+
+static void report_estimate_line(
+    const char* szLabel,
+    double      dValue,
+    double      dInterval)
+{
+    fprintf(stdout, "  %-14s: %15.0f +/- %.0f\n", szLabel, dValue, dInterval);
+}
+
+int estimate_image(
+    const char* szImageFilename,
+    uint32_t    ulSamples)
+{
+    fat_lazy_volume   volume;
+    estimate_stratum* pStrata = 0;
+    estimate_sample*  pSamples = 0;
+    estimate_sample*  pSample = 0;
+    uint32_t*         pPage = 0;
+    FAT32_DIR_ENTRY*  pDirectoryBuffer = 0;
+    uint8_t*          pClasses = 0;
+    uint64_t          ullState = ESTIMATE_SEED;
+    uint32_t          ulStrata = 1;
+    uint32_t          ulStratum = 0;
+    uint32_t          ulIndex = 0;
+    uint32_t          ulEntry = 0;
+    uint32_t          ulEntries = 0;
+    uint32_t          ulUsed = 0;
+    uint32_t          ulProbe = 0;
+    uint32_t          ulProbes = 1;
+    uint32_t          ulAttempt = 0;
+    uint32_t          ulFiles = 0;
+    uint32_t          ulRootFiles = 0;
+    uint32_t          ulUnreadable = 0;
+    uint32_t          ulSampleCount = 0;
+    size_t            ulLength = 0;
+    double            adTotals[ESTIMATE_VALUES];
+    double            dRatio = 0;
+    int               nStatus = 0;
+    int               nReturnValue = 0;
+
+    if (0 != fat_lazy_open(&volume, szImageFilename))
+        return -1;
+
+    if (ulSamples < 2)
+        ulSamples = FAT_ESTIMATE_DEFAULT_SAMPLES;
+
+    // Read small FATs in full, probing more clusters per page; otherwise a few pages from each of the strata.
+    if (volume.ulPageCount <= ulSamples)
+    {
+        ulProbes = ulSamples / volume.ulPageCount;
+        ulSamples = volume.ulPageCount;
+    }
+    else
+        ulStrata = (ulSamples >= 2 * FAT_ESTIMATE_PER_STRATUM) ? (ulSamples / FAT_ESTIMATE_PER_STRATUM) : 1;
+
+    pStrata = calloc(ulStrata, sizeof(estimate_stratum));
+    pSamples = calloc(ulSamples, sizeof(estimate_sample));
+    pPage = malloc(FAT_LAZY_PAGE_SIZE);
+    pDirectoryBuffer = malloc(volume.ulClusterSize);
+    pClasses = malloc(volume.ulClusterSize / sizeof(FAT32_DIR_ENTRY) + 1);
+
+    if ((pStrata == 0) || (pSamples == 0) || (pPage == 0) || (pDirectoryBuffer == 0) || (pClasses == 0))
+    {
+        fprintf(stderr, "allocations failed.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    for (ulStratum = 0; ulStratum < ulStrata; ++ulStratum)
+    {
+        pStrata[ulStratum].ulFirstPage = (uint32_t)((uint64_t)volume.ulPageCount * ulStratum / ulStrata);
+        pStrata[ulStratum].ulPages =
+            (uint32_t)((uint64_t)volume.ulPageCount * (ulStratum + 1) / ulStrata) - pStrata[ulStratum].ulFirstPage;
+        pStrata[ulStratum].ulFirstSample = ulSampleCount;
+        pStrata[ulStratum].ulSamples = ulSamples / ulStrata;
+
+        if (pStrata[ulStratum].ulSamples > pStrata[ulStratum].ulPages)
+            pStrata[ulStratum].ulSamples = pStrata[ulStratum].ulPages;
+
+        estimate_pick_pages(&pStrata[ulStratum], &pSamples[ulSampleCount], &ullState);
+        ulSampleCount += pStrata[ulStratum].ulSamples;
+    }
+
+    for (ulIndex = 0; ulIndex < ulSampleCount; ++ulIndex)
+    {
+        pSample = &pSamples[ulIndex];
+
+        /* The last page may be short. */
+        ulLength = FAT_LAZY_PAGE_SIZE;
+        if ((uint64_t)pSample->ulPage * FAT_LAZY_PAGE_SIZE + ulLength > volume.ulFatSize)
+            ulLength = volume.ulFatSize - pSample->ulPage * FAT_LAZY_PAGE_SIZE;
+
+        if ((__int64)ulLength != fat_file_pread(
+                volume.nImageFile,
+                pPage,
+                ulLength,
+                volume.llFat1Offset + (__int64)pSample->ulPage * FAT_LAZY_PAGE_SIZE))
+        {
+            fprintf(stderr, "read failed on FAT page: %u.\n", pSample->ulPage);
+            nReturnValue = -1;
+            goto exit;
+        }
+
+        ulEntries = (uint32_t)(ulLength >> 2);
+        ulUsed = estimate_decode_page(
+            pPage,
+            pSample->ulPage * FAT_LAZY_PAGE_ENTRIES,
+            ulEntries,
+            volume.ulFatEntries,
+            pSample);
+
+        if (ulUsed == 0)
+            continue;
+
+        // Probe allocated clusters of the page, with replacement, for the start of a directory.
+        for (ulAttempt = 0; ulAttempt < ulProbes; ++ulAttempt)
+        {
+            ulProbe = estimate_random(&ullState, ulUsed);
+
+            for (ulEntry = 0; ; ++ulEntry)
+            {
+                if ((pSample->ulPage * FAT_LAZY_PAGE_ENTRIES + ulEntry < FAT_ROOT_DIR) ||
+                    (fat_entry_kind(pPage[ulEntry], volume.ulFatEntries) == FAT_ENTRY_FREE) ||
+                    (fat_entry_kind(pPage[ulEntry], volume.ulFatEntries) == FAT_ENTRY_OTHER))
+                    continue;
+
+                if (ulProbe-- == 0)
+                    break;
+            }
+
+            nStatus = estimate_count_directory(
+                &volume,
+                pSample->ulPage * FAT_LAZY_PAGE_ENTRIES + ulEntry,
+                1,
+                pDirectoryBuffer,
+                pClasses,
+                &ulFiles);
+
+            if (nStatus < 0)
+                ++ulUnreadable;
+
+            /* Each hit stands for ulUsed / ulProbes directories of the page. */
+            if (nStatus == 0)
+            {
+                pSample->adValues[ESTIMATE_DIRS] += (double)ulUsed / ulProbes;
+                pSample->adValues[ESTIMATE_FILES] += (double)ulUsed * ulFiles / ulProbes;
+            }
+        }
+    }
+
+    // The root has no dot entries and is never found by a probe; count it directly.
+    if (0 != estimate_count_directory(&volume, volume.ulRootCluster, 0, pDirectoryBuffer, pClasses, &ulRootFiles))
+    {
+        fprintf(stderr, "read failed on the root directory.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    for (ulIndex = 0; ulIndex < ESTIMATE_VALUES; ++ulIndex)
+        adTotals[ulIndex] = estimate_total(pStrata, ulStrata, pSamples, ulIndex);
+
+    fprintf(stdout, "estimate: %u of %u FAT pages read from %u strata, %u clusters probed, %u directory clusters read.\n",
+        ulSampleCount,
+        volume.ulPageCount,
+        ulStrata,
+        ulSampleCount * ulProbes,
+        volume.ulClustersRead);
+
+    report_estimate_line("used clusters", adTotals[ESTIMATE_USED],
+        estimate_interval(pStrata, ulStrata, pSamples, ESTIMATE_USED, ESTIMATE_NONE, 0, 1));
+
+    fprintf(stdout, "  %-14s: %15.1f%% of %u FAT entries\n", "",
+        100.0 * adTotals[ESTIMATE_USED] / (volume.ulFatEntries - FAT_ROOT_DIR),
+        volume.ulFatEntries - FAT_ROOT_DIR);
+
+    report_estimate_line("used bytes", adTotals[ESTIMATE_USED] * volume.ulClusterSize,
+        estimate_interval(pStrata, ulStrata, pSamples, ESTIMATE_USED, ESTIMATE_NONE, 0, 1) * volume.ulClusterSize);
+
+    report_estimate_line("chains", adTotals[ESTIMATE_CHAINS],
+        estimate_interval(pStrata, ulStrata, pSamples, ESTIMATE_CHAINS, ESTIMATE_NONE, 0, 1));
+
+    report_estimate_line("fragments", adTotals[ESTIMATE_CHAINS] + adTotals[ESTIMATE_BREAKS],
+        estimate_interval(pStrata, ulStrata, pSamples, ESTIMATE_BREAKS, ESTIMATE_CHAINS, -1, 1));
+
+    if (adTotals[ESTIMATE_CHAINS] > 0)
+    {
+        dRatio = adTotals[ESTIMATE_BREAKS] / adTotals[ESTIMATE_CHAINS];
+
+        fprintf(stdout, "  %-14s: %15.2f +/- %.2f\n", "per chain", 1 + dRatio,
+            estimate_interval(pStrata, ulStrata, pSamples, ESTIMATE_BREAKS, ESTIMATE_CHAINS, dRatio, 1) /
+            adTotals[ESTIMATE_CHAINS]);
+    }
+
+    report_estimate_line("directories", 1 + adTotals[ESTIMATE_DIRS],
+        estimate_interval(pStrata, ulStrata, pSamples, ESTIMATE_DIRS, ESTIMATE_NONE, 0, 0));
+
+    report_estimate_line("files", ulRootFiles + adTotals[ESTIMATE_FILES],
+        estimate_interval(pStrata, ulStrata, pSamples, ESTIMATE_FILES, ESTIMATE_NONE, 0, 0));
+
+    if (ulUnreadable != 0)
+        fprintf(stderr, "%u probed clusters lie past the end of the image.\n", ulUnreadable);
+
+exit:
+    // Free the pStrata buffer.
+    if (0 != pStrata)
+    {
+        free (pStrata);
+        pStrata = 0;
+    }
+
+    // Free the pSamples buffer.
+    if (0 != pSamples)
+    {
+        free (pSamples);
+        pSamples = 0;
+    }
+
+    // Free the pPage buffer.
+    if (0 != pPage)
+    {
+        free (pPage);
+        pPage = 0;
+    }
+
+    // Free the pDirectoryBuffer buffer.
+    if (0 != pDirectoryBuffer)
+    {
+        free (pDirectoryBuffer);
+        pDirectoryBuffer = 0;
+    }
+
+    // Free the pClasses buffer.
+    if (0 != pClasses)
+    {
+        free (pClasses);
+        pClasses = 0;
+    }
+
+    fat_lazy_close(&volume);
+
+    return nReturnValue;
+}
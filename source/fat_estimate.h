@@ -0,0 +1,24 @@
+#ifndef __FAT_ESTIMATE_H_HEADER__
+#define __FAT_ESTIMATE_H_HEADER__
+
+#include "stdint.h"
+
+#define FAT_ESTIMATE_DEFAULT_SAMPLES (256) /* FAT pages read, and clusters probed. */
+#define FAT_ESTIMATE_PER_STRATUM     (4)
+
+/**
+ * Quick statistical survey of a volume without loading the FATs.
+ *
+ * The FAT is split into equal strata of FAT_LAZY_PAGE_SIZE pages and a
+ * few pages are read at random from each, decoded with fat_entry_kind().
+ * Allocated clusters of each sampled page are read to see whether they
+ * open a directory; those directories are counted through to the end.
+ * Totals are printed with 95% confidence intervals from the stratified
+ * variance.  A FAT with no more pages than ulSamples is read in full and
+ * the spare budget goes to probing more clusters per page.
+ */
+int estimate_image(
+    const char* szImageFilename,
+    uint32_t    ulSamples);
+
+#endif /* __FAT_ESTIMATE_H_HEADER__ */
@@ -0,0 +1,628 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <memory.h>
+
+#include "stdint.h"
+#include "fat_process.h"
+#include "fat_index.h"
+#include "fat_platform.h"
+#include "fat_prefetch.h"
+#include "fat_holes.h"
+#include "fat_rescue.h"
+#include "fat_extract.h"
+
+#define EXTRACT_PATH_LENGTH (4096)
+#define EXTRACT_MAX_THREADS (64)
+
+typedef struct FAT_EXTRACT_LIST {
+    fat_extract_item* pItems;
+    char**            ppszOutputPaths;  /* unique per item; 0 where none could be built. */
+    uint32_t          ulCount;
+    uint32_t          ulCapacity;
+} fat_extract_list;
+
+/* an item's output path, for finding the ones that collide. */
+typedef struct FAT_EXTRACT_PATH {
+    char*    szPath;
+    uint32_t ulItem;
+    int      nFile;
+} fat_extract_path;
+
+typedef struct FAT_EXTRACT_JOB {
+    int                 nImageFile;
+    fat_extract_list*   pList;
+    uint32_t            ulRootDirOffset;
+    uint32_t            ulClusterSize;
+    uint32_t            ulReadahead;
+    const fat_hole_map* pHoles;
+
+    fat_mutex           mutex;
+    uint32_t            ulNextItem;   /* guarded by mutex. */
+    uint32_t            ulFailed;     /* guarded by mutex. */
+    __int64             llBytes;      /* guarded by mutex. */
+} fat_extract_job;
+
+static int extract_collect_item(
+    fat_chain*  pChain,
+    const char* szPath,
+    void*       pContext)
+{
+    fat_extract_list* pList = (fat_extract_list*)pContext;
+    fat_extract_item* pItems = 0;
+
+    if (szPath == 0)
+        return 0;
+
+    if (pList->ulCount == pList->ulCapacity)
+    {
+        pList->ulCapacity = (pList->ulCapacity == 0) ? 256 : (pList->ulCapacity << 1);
+        pItems = realloc(pList->pItems, pList->ulCapacity * sizeof(fat_extract_item));
+
+        if (pItems == 0)
+        {
+            fprintf(stderr, "allocations failed.\n");
+            return 1;
+        }
+
+        pList->pItems = pItems;
+    }
+
+    pList->pItems[pList->ulCount].pChain = pChain;
+    pList->pItems[pList->ulCount].szPath = szPath;
+    ++pList->ulCount;
+
+    return 0;
+}
+
+/* joins szOutputDir and the path of pChain, built from its own names so that
+   a '/' or '\' inside a name cannot start a component; those, "." and ".."
+   names, and bytes no host file system accepts all become '_'. */
+static int extract_output_path(
+    const char* szOutputDir,
+    fat_chain*  pChain,
+    char*       szOutputPath)
+{
+    fat_chain*    apComponents[FAT_INDEX_MAX_DEPTH];
+    char          szName[FAT_INDEX_NAME_LENGTH];
+    size_t        ulLength = strlen(szOutputDir);
+    size_t        ulNameLength = 0;
+    size_t        ulIndex = 0;
+    uint32_t      ulDepth = 0;
+    unsigned char chValue = 0;
+    int           nDotName = 0;
+
+    for (ulDepth = 0; (pChain != 0) && (pChain->populated != 0); ++ulDepth)
+    {
+        /* Corrupt (cyclic) parent links. */
+        if (ulDepth == FAT_INDEX_MAX_DEPTH)
+            return -1;
+
+        apComponents[ulDepth] = pChain;
+        pChain = pChain->parent;
+    }
+
+    if (ulLength >= EXTRACT_PATH_LENGTH)
+        return -1;
+
+    memcpy(szOutputPath, szOutputDir, ulLength);
+
+    while (ulDepth-- > 0)
+    {
+        fat_index_format_name(apComponents[ulDepth]->filename, apComponents[ulDepth]->extension, szName);
+        ulNameLength = strlen(szName);
+
+        if ((ulNameLength == 0) || (ulLength + ulNameLength + 2 > EXTRACT_PATH_LENGTH))
+            return -1;
+
+        nDotName = (0 == strcmp(szName, ".")) || (0 == strcmp(szName, ".."));
+
+        szOutputPath[ulLength++] = '/';
+
+        for (ulIndex = 0; ulIndex < ulNameLength; ++ulIndex)
+        {
+            chValue = (unsigned char)szName[ulIndex];
+
+            if ((nDotName != 0) || (chValue < 0x20) || (chValue >= 0x7F) || (0 != strchr("<>:\"/\\|?*", chValue)))
+                chValue = '_';
+
+            szOutputPath[ulLength++] = (char)chValue;
+        }
+    }
+
+    szOutputPath[ulLength] = 0;
+
+    return 0;
+}
+
+time_t fat_decode_time(
+    uint16_t    usDate,
+    uint16_t    usTime)
+{
+    struct tm timeFields;
+
+    memset(&timeFields, 0x00, sizeof(timeFields));
+
+    timeFields.tm_year  = ((usDate >> 9) & 0x7F) + 80;
+    timeFields.tm_mon   = ((usDate >> 5) & 0x0F) - 1;
+    timeFields.tm_mday  = (usDate & 0x1F);
+    timeFields.tm_hour  = ((usTime >> 11) & 0x1F);
+    timeFields.tm_min   = ((usTime >> 5) & 0x3F);
+    timeFields.tm_sec   = (usTime & 0x1F) << 1;
+    timeFields.tm_isdst = -1;
+
+    /* Unset dates (0) decode to month -1, day 0; clamp to 1980-01-01. */
+    if (timeFields.tm_mon < 0)
+        timeFields.tm_mon = 0;
+
+    if (timeFields.tm_mday == 0)
+        timeFields.tm_mday = 1;
+
+    return mktime(&timeFields);
+}
+
+/* stamps szPath with the entry's last write and last access; an unset
+   stamp falls back to the write stamp, then the creation stamp. */
+static void extract_set_times(
+    const char*      szPath,
+    const fat_chain* pChain)
+{
+    time_t tModify;
+    time_t tAccess;
+
+    if (pChain->modifydate != 0)
+        tModify = fat_decode_time(pChain->modifydate, pChain->modifytime);
+    else
+        tModify = fat_decode_time(pChain->timestamp.date.value, pChain->timestamp.time.value);
+
+    /* The access stamp is a date only. */
+    tAccess = (pChain->accessdate != 0) ? fat_decode_time(pChain->accessdate, 0) : tModify;
+
+    fat_file_set_times(szPath, tAccess, tModify);
+}
+
+/* by path; directories ahead of files, then in tree order. */
+static int extract_compare_paths(
+    const void* pLeft,
+    const void* pRight)
+{
+    const fat_extract_path* pLeftPath = (const fat_extract_path*)pLeft;
+    const fat_extract_path* pRightPath = (const fat_extract_path*)pRight;
+    int nOrder = strcmp(pLeftPath->szPath, pRightPath->szPath);
+
+    if (nOrder != 0)
+        return nOrder;
+
+    if (pLeftPath->nFile != pRightPath->nFile)
+        return pLeftPath->nFile - pRightPath->nFile;
+
+    return (pLeftPath->ulItem < pRightPath->ulItem) ? -1 : (pLeftPath->ulItem > pRightPath->ulItem);
+}
+
+static int extract_compare_path_key(
+    const void* pKey,
+    const void* pPath)
+{
+    return strcmp((const char*)pKey, ((const fat_extract_path*)pPath)->szPath);
+}
+
+/* fills pList->ppszOutputPaths.  Sanitizing can give different entries the
+   same output path (A\B.TXT and A_B.TXT); the first keeps it, directories
+   merge, and every later file gets a "~N" suffix no other item uses. */
+static int extract_assign_paths(
+    fat_extract_list* pList,
+    const char*       szOutputDir)
+{
+    fat_extract_path* pPaths = 0;
+    uint32_t          ulPaths = 0;
+    uint32_t          ulItem = 0;
+    uint32_t          ulIndex = 0;
+    uint32_t          ulRunStart = 0;
+    uint32_t          ulSuffix = 1;
+    size_t            ulLength = 0;
+    char*             szRenamed = 0;
+    char              szOutputPath[EXTRACT_PATH_LENGTH];
+    int               nReturnValue = 0;
+
+    pList->ppszOutputPaths = calloc(pList->ulCount, sizeof(char*));
+    pPaths = malloc(pList->ulCount * sizeof(fat_extract_path));
+
+    if ((pList->ppszOutputPaths == 0) || (pPaths == 0))
+    {
+        fprintf(stderr, "allocations failed.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    for (ulItem = 0; ulItem < pList->ulCount; ++ulItem)
+    {
+        if (0 != extract_output_path(szOutputDir, pList->pItems[ulItem].pChain, szOutputPath))
+        {
+            fprintf(stderr, "cannot build output path for: '%s'.\n", pList->pItems[ulItem].szPath);
+            continue;
+        }
+
+        ulLength = strlen(szOutputPath);
+        pList->ppszOutputPaths[ulItem] = malloc(ulLength + 1);
+
+        if (pList->ppszOutputPaths[ulItem] == 0)
+        {
+            fprintf(stderr, "allocations failed.\n");
+            nReturnValue = -1;
+            goto exit;
+        }
+
+        memcpy(pList->ppszOutputPaths[ulItem], szOutputPath, ulLength + 1);
+
+        pPaths[ulPaths].szPath = pList->ppszOutputPaths[ulItem];
+        pPaths[ulPaths].ulItem = ulItem;
+        pPaths[ulPaths].nFile = (0 == (pList->pItems[ulItem].pChain->attributes & FILE_ATTRIB_DIR));
+        ++ulPaths;
+    }
+
+    qsort(pPaths, ulPaths, sizeof(fat_extract_path), extract_compare_paths);
+
+    for (ulIndex = 1; ulIndex < ulPaths; ++ulIndex)
+    {
+        if (0 != strcmp(pPaths[ulIndex].szPath, pPaths[ulRunStart].szPath))
+        {
+            ulRunStart = ulIndex;
+            ulSuffix = 1;
+            continue;
+        }
+
+        if (pPaths[ulIndex].nFile == 0)
+            continue;
+
+        ulLength = strlen(pPaths[ulIndex].szPath);
+        szRenamed = malloc(ulLength + 12);
+
+        if (szRenamed == 0)
+        {
+            fprintf(stderr, "allocations failed.\n");
+            nReturnValue = -1;
+            goto exit;
+        }
+
+        /* The originals stay in pPaths until the end, so a suffix is
+           checked against every name the sanitizer produced. */
+        do
+        {
+            _snprintf(szRenamed, ulLength + 12, "%s~%u", pPaths[ulIndex].szPath, ++ulSuffix);
+        } while (0 != bsearch(szRenamed, pPaths, ulPaths, sizeof(fat_extract_path), extract_compare_path_key));
+
+        fprintf(stderr, "output path '%s' taken, extracting '%s' to '%s'.\n",
+            pPaths[ulIndex].szPath, pList->pItems[pPaths[ulIndex].ulItem].szPath, szRenamed);
+
+        pList->ppszOutputPaths[pPaths[ulIndex].ulItem] = szRenamed;
+        szRenamed = 0;
+    }
+
+exit:
+    // Free the paths that were renamed.
+    for (ulIndex = 0; ulIndex < ulPaths; ++ulIndex)
+    {
+        if (pList->ppszOutputPaths[pPaths[ulIndex].ulItem] != pPaths[ulIndex].szPath)
+            free (pPaths[ulIndex].szPath);
+    }
+
+    // Free the pPaths buffer.
+    if (0 != pPaths)
+    {
+        free (pPaths);
+        pPaths = 0;
+    }
+
+    return nReturnValue;
+}
+
+int extract_chain_to_file(
+    int                 nImageFile,
+    fat_chain*          pChain,
+    const char*         szOutputPath,
+    uint32_t            ulRootDirOffset,
+    uint32_t            ulClusterSize,
+    fat_prefetch*       pPrefetch,
+    const fat_hole_map* pHoles)
+{
+    int       nReturnValue = 0;
+    int       nOutputFile = -1;
+    fat_node* pFatNode = pChain->head;
+    uint32_t  ulExtentStart = 0;
+    uint32_t  ulExtentClusters = 0;
+    __int64   llRemaining = pChain->filesize;
+    __int64   llOutputOffset = 0;
+    __int64   llExtentBytes = 0;
+    __int64   llExtentOffset = 0;
+
+    nOutputFile = fat_file_create(szOutputPath);
+    if (nOutputFile < 0)
+    {
+        fprintf(stderr, "create failed on file: '%s'.\n", szOutputPath);
+        return -1;
+    }
+
+    if (pPrefetch != 0)
+        fat_prefetch_start(pPrefetch, pChain->head, pChain->filesize);
+
+    /* Copy contiguous cluster runs; the entry size bounds the walk. */
+    while ((pFatNode != 0) && (llRemaining > 0))
+    {
+        ulExtentStart = pFatNode->cluster;
+        ulExtentClusters = 1;
+
+        while ((pFatNode->next != 0) &&
+               (pFatNode->next->cluster == pFatNode->cluster + 1) &&
+               ((__int64)ulExtentClusters * ulClusterSize < llRemaining))
+        {
+            pFatNode = pFatNode->next;
+            ++ulExtentClusters;
+        }
+
+        llExtentBytes = (__int64)ulExtentClusters * ulClusterSize;
+        if (llExtentBytes > llRemaining)
+            llExtentBytes = llRemaining;
+
+        llExtentOffset = (__int64)ulRootDirOffset + (__int64)(ulExtentStart - 2) * ulClusterSize;
+
+        /* Extents in a hole of a sparse image are left as holes in the
+           output; the final truncate covers one at the end. */
+        if ((pHoles == 0) || (0 == fat_hole_map_is_hole(pHoles, llExtentOffset, llExtentBytes)))
+        {
+            if (llExtentBytes != fat_rescue_copy_range(
+                    nImageFile,
+                    llExtentOffset,
+                    nOutputFile,
+                    llOutputOffset,
+                    llExtentBytes))
+            {
+                fprintf(stderr, "copy failed on file: '%s'.\n", szOutputPath);
+                nReturnValue = -1;
+                break;
+            }
+        }
+
+        llOutputOffset += llExtentBytes;
+        llRemaining -= llExtentBytes;
+        pFatNode = pFatNode->next;
+
+        if (pPrefetch != 0)
+            fat_prefetch_consumed(pPrefetch, llOutputOffset, llExtentOffset, llExtentBytes);
+    }
+
+    if ((nReturnValue == 0) && (llRemaining > 0))
+    {
+        fprintf(stderr, "chain shorter than entry size on file: '%s'.\n", szOutputPath);
+    }
+
+    /* Entry size wins, even when the chain came up short. */
+    if (0 != fat_file_truncate(nOutputFile, pChain->filesize))
+    {
+        nReturnValue = -1;
+    }
+
+    /* A resumed rescue skips files marked done, so they must be on disk first. */
+    if ((nReturnValue == 0) && (0 != fat_rescue_enabled()) && (0 != fat_file_sync(nOutputFile)))
+    {
+        fprintf(stderr, "sync failed on file: '%s'.\n", szOutputPath);
+        nReturnValue = -1;
+    }
+
+    fat_file_close(nOutputFile);
+
+    extract_set_times(szOutputPath, pChain);
+
+    return nReturnValue;
+}
+
+static int extract_worker(void* pContext)
+{
+    fat_extract_job*  pJob = (fat_extract_job*)pContext;
+    fat_extract_item* pItem = 0;
+    uint32_t          ulItem = 0;
+    int               nStatus = 0;
+    const char*       szOutputPath = 0;
+    fat_prefetch      prefetch;
+
+    /* Copied contents are read once, so drop them behind the reader. */
+    fat_prefetch_init(
+        &prefetch,
+        pJob->nImageFile,
+        pJob->ulReadahead,
+        1,
+        pJob->ulRootDirOffset,
+        pJob->ulClusterSize);
+
+    for (;;)
+    {
+        fat_mutex_lock(&pJob->mutex);
+        ulItem = pJob->ulNextItem++;
+        fat_mutex_unlock(&pJob->mutex);
+
+        if (ulItem >= pJob->pList->ulCount)
+            break;
+
+        pItem = &pJob->pList->pItems[ulItem];
+
+        if (0 != (pItem->pChain->attributes & FILE_ATTRIB_DIR))
+            continue;
+
+        szOutputPath = pJob->pList->ppszOutputPaths[ulItem];
+
+        /* Items without a path were reported by the pre-pass and fail here. */
+        nStatus = (szOutputPath != 0) ? 0 : -1;
+
+        /* A resumed rescue leaves files finished by the last run alone. */
+        if ((nStatus == 0) && (0 == fat_rescue_is_done(szOutputPath)))
+        {
+            nStatus = extract_chain_to_file(
+                pJob->nImageFile,
+                pItem->pChain,
+                szOutputPath,
+                pJob->ulRootDirOffset,
+                pJob->ulClusterSize,
+                &prefetch,
+                pJob->pHoles);
+
+            if (nStatus == 0)
+                fat_rescue_mark_done(szOutputPath);
+        }
+
+        fat_mutex_lock(&pJob->mutex);
+        if (nStatus != 0)
+            ++pJob->ulFailed;
+        else
+            pJob->llBytes += pItem->pChain->filesize;
+        fat_mutex_unlock(&pJob->mutex);
+    }
+
+    return 0;
+}
+
+int extract_matching_contents(
+    int                 nImageFile,
+    fat_index*          pIndex,
+    const char*         szPattern,
+    const char*         szOutputDir,
+    uint32_t            ulRootDirOffset,
+    uint32_t            ulClusterSize,
+    uint32_t            ulThreadCount,
+    uint32_t            ulReadahead,
+    const fat_hole_map* pHoles)
+{
+    int              nReturnValue = 0;
+    uint32_t         ulItem = 0;
+    uint32_t         ulThread = 0;
+    uint32_t         ulStarted = 0;
+    uint32_t         ulFiles = 0;
+    fat_chain*       pChain = 0;
+    char*            szOutputPath = 0;
+    fat_extract_list list;
+    fat_extract_job  job;
+    fat_thread       aThreads[EXTRACT_MAX_THREADS];
+
+    memset(&list, 0x00, sizeof(list));
+    memset(&job, 0x00, sizeof(job));
+
+    fat_index_glob(
+        pIndex,
+        (szPattern != 0) ? szPattern : "/**",
+        extract_collect_item,
+        &list);
+
+    if (list.ulCount == 0)
+    {
+        fprintf(stderr, "no entries to extract.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    if ((0 != fat_make_parent_directories(szOutputDir)) ||
+        (0 != fat_make_directory(szOutputDir)))
+    {
+        fprintf(stderr, "mkdir failed on directory: '%s'.\n", szOutputDir);
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    if (0 != extract_assign_paths(&list, szOutputDir))
+    {
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    /* Build the tree serially so that workers only ever create files. */
+    for (ulItem = 0; ulItem < list.ulCount; ++ulItem)
+    {
+        pChain = list.pItems[ulItem].pChain;
+        szOutputPath = list.ppszOutputPaths[ulItem];
+
+        if (0 == (pChain->attributes & FILE_ATTRIB_DIR))
+            ++ulFiles;
+
+        if (szOutputPath == 0)
+            continue;
+
+        fat_make_parent_directories(szOutputPath);
+
+        if (0 != (pChain->attributes & FILE_ATTRIB_DIR))
+            fat_make_directory(szOutputPath);
+    }
+
+    job.nImageFile = nImageFile;
+    job.pList = &list;
+    job.ulRootDirOffset = ulRootDirOffset;
+    job.ulClusterSize = ulClusterSize;
+    job.ulReadahead = ulReadahead;
+    job.pHoles = pHoles;
+    fat_mutex_init(&job.mutex);
+
+    if (ulThreadCount == 0)
+        ulThreadCount = fat_cpu_count();
+
+    if (ulThreadCount > EXTRACT_MAX_THREADS)
+        ulThreadCount = EXTRACT_MAX_THREADS;
+
+    if (ulThreadCount > ulFiles)
+        ulThreadCount = (ulFiles > 0) ? ulFiles : 1;
+
+    for (ulThread = 0; ulThread < ulThreadCount; ++ulThread)
+    {
+        if (0 != fat_thread_start(&aThreads[ulThread], extract_worker, &job))
+            break;
+
+        ++ulStarted;
+    }
+
+    /* No worker could be started; extract on this thread. */
+    if (ulStarted == 0)
+        extract_worker(&job);
+
+    for (ulThread = 0; ulThread < ulStarted; ++ulThread)
+        fat_thread_join(&aThreads[ulThread]);
+
+    fat_mutex_destroy(&job.mutex);
+
+    /* Stamp directories last; creating their files updated the times. */
+    for (ulItem = list.ulCount; ulItem-- > 0; )
+    {
+        pChain = list.pItems[ulItem].pChain;
+
+        if ((0 != (pChain->attributes & FILE_ATTRIB_DIR)) &&
+            (0 != list.ppszOutputPaths[ulItem]))
+        {
+            extract_set_times(list.ppszOutputPaths[ulItem], pChain);
+        }
+    }
+
+    fprintf(stdout, "extracted %u of %u files (%lld bytes) to '%s' (threads: %u).\n",
+        ulFiles - job.ulFailed,
+        ulFiles,
+        job.llBytes,
+        szOutputDir,
+        (ulStarted > 0) ? ulStarted : 1);
+
+    if (job.ulFailed != 0)
+        nReturnValue = -1;
+
+exit:
+    // Free the list.ppszOutputPaths buffer.
+    if (0 != list.ppszOutputPaths)
+    {
+        for (ulItem = 0; ulItem < list.ulCount; ++ulItem)
+            free (list.ppszOutputPaths[ulItem]);
+
+        free (list.ppszOutputPaths);
+        list.ppszOutputPaths = 0;
+    }
+
+    // Free the list.pItems buffer.
+    if (0 != list.pItems)
+    {
+        free (list.pItems);
+        list.pItems = 0;
+    }
+
+    return nReturnValue;
+}
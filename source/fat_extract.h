@@ -0,0 +1,57 @@
+#ifndef __FAT_EXTRACT_H_HEADER__
+#define __FAT_EXTRACT_H_HEADER__
+
+#include "stdint.h"
+#include "fat_process.h"
+#include "fat_index.h"
+#include "fat_platform.h"
+#include "fat_prefetch.h"
+#include "fat_holes.h"
+
+/**
+ * One extraction work item: an indexed chain and its volume path.
+ */
+typedef struct FAT_EXTRACT_ITEM {
+    fat_chain*  pChain;
+    const char* szPath;
+} fat_extract_item;
+
+/**
+ * Recreates the matching part of the directory tree below szOutputDir.
+ *
+ * Directories are created up front, then a pool of ulThreadCount workers
+ * copies each file extent by extent straight from the image descriptor,
+ * truncates it to the directory entry size and stamps its times.  Each
+ * worker keeps the next ulReadahead extents of its file hinted and drops
+ * copied extents from the page cache (0 disables both).  Extents inside
+ * a hole of pHoles (0 for none) are not read and stay sparse.
+ * Names the host cannot hold are sanitized, and a file whose sanitized
+ * path is already taken gets a "~N" suffix instead of sharing it.
+ * szPattern follows fat_index_glob(); 0 extracts everything.
+ */
+int extract_matching_contents(
+    int                 nImageFile,
+    fat_index*          pIndex,
+    const char*         szPattern,
+    const char*         szOutputDir,
+    uint32_t            ulRootDirOffset,
+    uint32_t            ulClusterSize,
+    uint32_t            ulThreadCount,
+    uint32_t            ulReadahead,
+    const fat_hole_map* pHoles);
+
+int extract_chain_to_file(
+    int                 nImageFile,
+    fat_chain*          pChain,
+    const char*         szOutputPath,
+    uint32_t            ulRootDirOffset,
+    uint32_t            ulClusterSize,
+    fat_prefetch*       pPrefetch,
+    const fat_hole_map* pHoles);
+
+/* local time of a FAT date/time pair. */
+time_t fat_decode_time(
+    uint16_t    usDate,
+    uint16_t    usTime);
+
+#endif /* __FAT_EXTRACT_H_HEADER__ */
@@ -0,0 +1,712 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#include "stdint.h"
+#include "fat_process.h"
+#include "fat_index.h"
+#include "fat_platform.h"
+#include "fat_extract.h"
+#include "fat_prefetch.h"
+#include "fat_holes.h"
+#include "fat_rescue.h"
+#include "fat_hash.h"
+
+#define HASH_RUN_SIZE    (1 << 20)  /* largest single read per file. */
+#define HASH_MAX_THREADS (64)
+
+#define HASH_OK          (0)
+#define HASH_SHORT_CHAIN (1)
+#define HASH_READ_FAILED (2)
+#define HASH_NOT_HASHED  (3)   /* no worker got to the file. */
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROTL64(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
+
+static const uint32_t s_aSha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define XXH_PRIME64_1 (0x9E3779B185EBCA87ULL)
+#define XXH_PRIME64_2 (0xC2B2AE3D27D4EB4FULL)
+#define XXH_PRIME64_3 (0x165667B19E3779F9ULL)
+#define XXH_PRIME64_4 (0x85EBCA77C2B2AE63ULL)
+#define XXH_PRIME64_5 (0x27D4EB2F165667C5ULL)
+
+typedef struct FAT_HASH_RESULT {
+    uint8_t   sha256[FAT_SHA256_SIZE];
+    uint64_t  ullXxh64;
+    int       nStatus;
+} fat_hash_result;
+
+typedef struct FAT_HASH_JOB {
+    int                 nImageFile;
+    fat_extract_item*   pItems;
+    fat_hash_result*    pResults;
+    uint32_t            ulCount;
+    uint32_t            ulCapacity;
+    uint32_t            ulAlgorithms;
+    uint32_t            ulRootDirOffset;
+    uint32_t            ulClusterSize;
+    uint32_t            ulReadahead;
+    const fat_hole_map* pHoles;
+
+    fat_mutex           mutex;
+    uint32_t            ulNextItem;   /* guarded by mutex. */
+} fat_hash_job;
+
+/* Walks a chain as contiguous runs of at most HASH_RUN_SIZE bytes. */
+typedef struct FAT_HASH_CURSOR {
+    fat_node* pNode;
+    __int64   llRemaining;
+} fat_hash_cursor;
+
+static void sha256_compress(
+    fat_sha256*    pContext,
+    const uint8_t* pBlock)
+{
+    uint32_t aW[64];
+    uint32_t a, b, c, d, e, f, g, h;
+    uint32_t ulT1 = 0;
+    uint32_t ulT2 = 0;
+    int      nIndex = 0;
+
+    for (nIndex = 0; nIndex < 16; ++nIndex)
+    {
+        aW[nIndex] = ((uint32_t)pBlock[nIndex * 4 + 0] << 24) |
+                     ((uint32_t)pBlock[nIndex * 4 + 1] << 16) |
+                     ((uint32_t)pBlock[nIndex * 4 + 2] << 8) |
+                     ((uint32_t)pBlock[nIndex * 4 + 3] << 0);
+    }
+
+    for (nIndex = 16; nIndex < 64; ++nIndex)
+    {
+        aW[nIndex] = aW[nIndex - 16] + aW[nIndex - 7] +
+            (ROTR32(aW[nIndex - 15], 7) ^ ROTR32(aW[nIndex - 15], 18) ^ (aW[nIndex - 15] >> 3)) +
+            (ROTR32(aW[nIndex - 2], 17) ^ ROTR32(aW[nIndex - 2], 19) ^ (aW[nIndex - 2] >> 10));
+    }
+
+    a = pContext->state[0];
+    b = pContext->state[1];
+    c = pContext->state[2];
+    d = pContext->state[3];
+    e = pContext->state[4];
+    f = pContext->state[5];
+    g = pContext->state[6];
+    h = pContext->state[7];
+
+    for (nIndex = 0; nIndex < 64; ++nIndex)
+    {
+        ulT1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) + ((e & f) ^ (~e & g)) +
+               s_aSha256K[nIndex] + aW[nIndex];
+        ulT2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + ulT1;
+        d = c;
+        c = b;
+        b = a;
+        a = ulT1 + ulT2;
+    }
+
+    pContext->state[0] += a;
+    pContext->state[1] += b;
+    pContext->state[2] += c;
+    pContext->state[3] += d;
+    pContext->state[4] += e;
+    pContext->state[5] += f;
+    pContext->state[6] += g;
+    pContext->state[7] += h;
+}
+
+void fat_sha256_init(fat_sha256* pContext)
+{
+    memset(pContext, 0x00, sizeof(fat_sha256));
+
+    pContext->state[0] = 0x6a09e667;
+    pContext->state[1] = 0xbb67ae85;
+    pContext->state[2] = 0x3c6ef372;
+    pContext->state[3] = 0xa54ff53a;
+    pContext->state[4] = 0x510e527f;
+    pContext->state[5] = 0x9b05688c;
+    pContext->state[6] = 0x1f83d9ab;
+    pContext->state[7] = 0x5be0cd19;
+}
+
+void fat_sha256_update(fat_sha256* pContext, const void* pData, size_t ulLength)
+{
+    const uint8_t* pBytes = (const uint8_t*)pData;
+    size_t         ulChunk = 0;
+
+    pContext->ullLength += ulLength;
+
+    /* Top up a partial block first. */
+    if (pContext->ulBlockUsed != 0)
+    {
+        ulChunk = 64 - pContext->ulBlockUsed;
+        if (ulChunk > ulLength)
+            ulChunk = ulLength;
+
+        memcpy(pContext->block + pContext->ulBlockUsed, pBytes, ulChunk);
+        pContext->ulBlockUsed += (uint32_t)ulChunk;
+        pBytes += ulChunk;
+        ulLength -= ulChunk;
+
+        if (pContext->ulBlockUsed < 64)
+            return;
+
+        sha256_compress(pContext, pContext->block);
+        pContext->ulBlockUsed = 0;
+    }
+
+    /* Whole blocks straight from the caller's buffer. */
+    while (ulLength >= 64)
+    {
+        sha256_compress(pContext, pBytes);
+        pBytes += 64;
+        ulLength -= 64;
+    }
+
+    memcpy(pContext->block, pBytes, ulLength);
+    pContext->ulBlockUsed = (uint32_t)ulLength;
+}
+
+void fat_sha256_final(fat_sha256* pContext, uint8_t* pDigest)
+{
+    uint64_t ullBits = pContext->ullLength << 3;
+    int      nIndex = 0;
+
+    pContext->block[pContext->ulBlockUsed++] = 0x80;
+
+    if (pContext->ulBlockUsed > 56)
+    {
+        memset(pContext->block + pContext->ulBlockUsed, 0x00, 64 - pContext->ulBlockUsed);
+        sha256_compress(pContext, pContext->block);
+        pContext->ulBlockUsed = 0;
+    }
+
+    memset(pContext->block + pContext->ulBlockUsed, 0x00, 56 - pContext->ulBlockUsed);
+
+    for (nIndex = 0; nIndex < 8; ++nIndex)
+        pContext->block[56 + nIndex] = (uint8_t)(ullBits >> (56 - nIndex * 8));
+
+    sha256_compress(pContext, pContext->block);
+
+    for (nIndex = 0; nIndex < 32; ++nIndex)
+        pDigest[nIndex] = (uint8_t)(pContext->state[nIndex >> 2] >> (24 - (nIndex & 3) * 8));
+}
+
+static uint64_t xxh64_read64(const uint8_t* pBytes)
+{
+    uint64_t ullValue = 0;
+    int      nIndex = 0;
+
+    for (nIndex = 7; nIndex >= 0; --nIndex)
+        ullValue = (ullValue << 8) | pBytes[nIndex];
+
+    return ullValue;
+}
+
+static uint64_t xxh64_round(uint64_t ullAccumulator, uint64_t ullInput)
+{
+    ullAccumulator += ullInput * XXH_PRIME64_2;
+    ullAccumulator  = ROTL64(ullAccumulator, 31);
+    return ullAccumulator * XXH_PRIME64_1;
+}
+
+static uint64_t xxh64_merge_round(uint64_t ullAccumulator, uint64_t ullLane)
+{
+    ullAccumulator ^= xxh64_round(0, ullLane);
+    return ullAccumulator * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+
+static void xxh64_consume_stripe(fat_xxh64* pContext, const uint8_t* pStripe)
+{
+    pContext->lane[0] = xxh64_round(pContext->lane[0], xxh64_read64(pStripe + 0));
+    pContext->lane[1] = xxh64_round(pContext->lane[1], xxh64_read64(pStripe + 8));
+    pContext->lane[2] = xxh64_round(pContext->lane[2], xxh64_read64(pStripe + 16));
+    pContext->lane[3] = xxh64_round(pContext->lane[3], xxh64_read64(pStripe + 24));
+}
+
+void fat_xxh64_init(fat_xxh64* pContext)
+{
+    memset(pContext, 0x00, sizeof(fat_xxh64));
+
+    pContext->lane[0] = XXH_PRIME64_1 + XXH_PRIME64_2;
+    pContext->lane[1] = XXH_PRIME64_2;
+    pContext->lane[2] = 0;
+    pContext->lane[3] = 0 - XXH_PRIME64_1;
+}
+
+void fat_xxh64_update(fat_xxh64* pContext, const void* pData, size_t ulLength)
+{
+    const uint8_t* pBytes = (const uint8_t*)pData;
+    size_t         ulChunk = 0;
+
+    pContext->ullLength += ulLength;
+
+    if (pContext->ulStripeUsed != 0)
+    {
+        ulChunk = 32 - pContext->ulStripeUsed;
+        if (ulChunk > ulLength)
+            ulChunk = ulLength;
+
+        memcpy(pContext->stripe + pContext->ulStripeUsed, pBytes, ulChunk);
+        pContext->ulStripeUsed += (uint32_t)ulChunk;
+        pBytes += ulChunk;
+        ulLength -= ulChunk;
+
+        if (pContext->ulStripeUsed < 32)
+            return;
+
+        xxh64_consume_stripe(pContext, pContext->stripe);
+        pContext->ulStripeUsed = 0;
+    }
+
+    while (ulLength >= 32)
+    {
+        xxh64_consume_stripe(pContext, pBytes);
+        pBytes += 32;
+        ulLength -= 32;
+    }
+
+    memcpy(pContext->stripe, pBytes, ulLength);
+    pContext->ulStripeUsed = (uint32_t)ulLength;
+}
+
+uint64_t fat_xxh64_final(fat_xxh64* pContext)
+{
+    const uint8_t* pBytes = pContext->stripe;
+    uint32_t       ulLeft = pContext->ulStripeUsed;
+    uint64_t       ullHash = 0;
+    uint32_t       ulWord = 0;
+
+    if (pContext->ullLength >= 32)
+    {
+        ullHash = ROTL64(pContext->lane[0], 1) + ROTL64(pContext->lane[1], 7) +
+                  ROTL64(pContext->lane[2], 12) + ROTL64(pContext->lane[3], 18);
+        ullHash = xxh64_merge_round(ullHash, pContext->lane[0]);
+        ullHash = xxh64_merge_round(ullHash, pContext->lane[1]);
+        ullHash = xxh64_merge_round(ullHash, pContext->lane[2]);
+        ullHash = xxh64_merge_round(ullHash, pContext->lane[3]);
+    }
+    else
+    {
+        ullHash = XXH_PRIME64_5;
+    }
+
+    ullHash += pContext->ullLength;
+
+    for (; ulLeft >= 8; ulLeft -= 8, pBytes += 8)
+    {
+        ullHash ^= xxh64_round(0, xxh64_read64(pBytes));
+        ullHash  = ROTL64(ullHash, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+
+    if (ulLeft >= 4)
+    {
+        ulWord = (uint32_t)pBytes[0] | ((uint32_t)pBytes[1] << 8) |
+                 ((uint32_t)pBytes[2] << 16) | ((uint32_t)pBytes[3] << 24);
+        ullHash ^= (uint64_t)ulWord * XXH_PRIME64_1;
+        ullHash  = ROTL64(ullHash, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        ulLeft -= 4;
+        pBytes += 4;
+    }
+
+    for (; ulLeft > 0; --ulLeft, ++pBytes)
+    {
+        ullHash ^= (*pBytes) * XXH_PRIME64_5;
+        ullHash  = ROTL64(ullHash, 11) * XXH_PRIME64_1;
+    }
+
+    ullHash ^= ullHash >> 33;
+    ullHash *= XXH_PRIME64_2;
+    ullHash ^= ullHash >> 29;
+    ullHash *= XXH_PRIME64_3;
+    ullHash ^= ullHash >> 32;
+
+    return ullHash;
+}
+
+int fat_hash_algorithms(
+    const char* szNames)
+{
+    int         nAlgorithms = 0;
+    const char* pStart = szNames;
+    size_t      ulLength = 0;
+
+    while (*pStart != 0)
+    {
+        ulLength = strcspn(pStart, ",");
+
+        if ((ulLength == 6) && (0 == strncmp(pStart, "sha256", 6)))
+            nAlgorithms |= FAT_HASH_SHA256;
+        else if ((ulLength == 5) && (0 == strncmp(pStart, "xxh64", 5)))
+            nAlgorithms |= FAT_HASH_XXH64;
+        else
+            return -1;
+
+        pStart += ulLength;
+        if (*pStart == ',')
+            ++pStart;
+    }
+
+    return (nAlgorithms != 0) ? nAlgorithms : -1;
+}
+
+static int hash_collect_item(
+    fat_chain*  pChain,
+    const char* szPath,
+    void*       pContext)
+{
+    fat_hash_job*     pJob = (fat_hash_job*)pContext;
+    fat_extract_item* pItems = 0;
+
+    if ((szPath == 0) || (0 != (pChain->attributes & FILE_ATTRIB_DIR)))
+        return 0;
+
+    if (pJob->ulCount == pJob->ulCapacity)
+    {
+        pJob->ulCapacity = (pJob->ulCapacity == 0) ? 256 : (pJob->ulCapacity << 1);
+        pItems = realloc(pJob->pItems, pJob->ulCapacity * sizeof(fat_extract_item));
+
+        if (pItems == 0)
+        {
+            fprintf(stderr, "allocations failed.\n");
+            return 1;
+        }
+
+        pJob->pItems = pItems;
+    }
+
+    pJob->pItems[pJob->ulCount].pChain = pChain;
+    pJob->pItems[pJob->ulCount].szPath = szPath;
+    ++pJob->ulCount;
+
+    return 0;
+}
+
+/* returns 0 at the end of the chain or entry size. */
+static int hash_next_run(
+    fat_hash_cursor* pCursor,
+    uint32_t         ulRootDirOffset,
+    uint32_t         ulClusterSize,
+    __int64*         pllOffset,
+    size_t*          pulLength)
+{
+    uint32_t ulStart = 0;
+    uint32_t ulClusters = 1;
+    uint32_t ulMaxClusters = HASH_RUN_SIZE / ulClusterSize;
+    __int64  llLength = 0;
+
+    if ((pCursor->pNode == 0) || (pCursor->llRemaining <= 0))
+        return 0;
+
+    if (ulMaxClusters == 0)
+        ulMaxClusters = 1;
+
+    ulStart = pCursor->pNode->cluster;
+
+    while ((ulClusters < ulMaxClusters) &&
+           (pCursor->pNode->next != 0) &&
+           (pCursor->pNode->next->cluster == pCursor->pNode->cluster + 1) &&
+           ((__int64)ulClusters * ulClusterSize < pCursor->llRemaining))
+    {
+        pCursor->pNode = pCursor->pNode->next;
+        ++ulClusters;
+    }
+
+    llLength = (__int64)ulClusters * ulClusterSize;
+    if (llLength > pCursor->llRemaining)
+        llLength = pCursor->llRemaining;
+
+    pCursor->pNode = pCursor->pNode->next;
+    pCursor->llRemaining -= llLength;
+
+    *pllOffset = (__int64)ulRootDirOffset + (__int64)(ulStart - 2) * ulClusterSize;
+    *pulLength = (size_t)llLength;
+
+    return 1;
+}
+
+static int hash_chain_contents(
+    fat_hash_job*    pJob,
+    fat_chain*       pChain,
+    uint8_t*         pBuffer,
+    fat_prefetch*    pPrefetch,
+    fat_hash_result* pResult)
+{
+    fat_hash_cursor cursor;
+    fat_sha256      sha256;
+    fat_xxh64       xxh64;
+    __int64         llOffset = 0;
+    __int64         llDone = 0;
+    size_t          ulLength = 0;
+
+    cursor.pNode = pChain->head;
+    cursor.llRemaining = pChain->filesize;
+
+    fat_sha256_init(&sha256);
+    fat_xxh64_init(&xxh64);
+
+    /* Keep the next extents of the chain in flight while this one is hashed. */
+    fat_prefetch_start(pPrefetch, pChain->head, pChain->filesize);
+
+    while (0 != hash_next_run(&cursor, pJob->ulRootDirOffset, pJob->ulClusterSize, &llOffset, &ulLength))
+    {
+        /* Runs in a hole of a sparse image are zeros; skip the read. */
+        if ((pJob->pHoles != 0) && (0 != fat_hole_map_is_hole(pJob->pHoles, llOffset, ulLength)))
+            memset(pBuffer, 0x00, ulLength);
+        else if ((__int64)ulLength != fat_rescue_read(pJob->nImageFile, pBuffer, ulLength, llOffset))
+            return HASH_READ_FAILED;
+
+        if (0 != (pJob->ulAlgorithms & FAT_HASH_SHA256))
+            fat_sha256_update(&sha256, pBuffer, ulLength);
+
+        if (0 != (pJob->ulAlgorithms & FAT_HASH_XXH64))
+            fat_xxh64_update(&xxh64, pBuffer, ulLength);
+
+        llDone += ulLength;
+        fat_prefetch_consumed(pPrefetch, llDone, llOffset, ulLength);
+    }
+
+    if (cursor.llRemaining > 0)
+        return HASH_SHORT_CHAIN;
+
+    fat_sha256_final(&sha256, pResult->sha256);
+    pResult->ullXxh64 = fat_xxh64_final(&xxh64);
+
+    return HASH_OK;
+}
+
+static int hash_worker(void* pContext)
+{
+    fat_hash_job* pJob = (fat_hash_job*)pContext;
+    uint8_t*      pBuffer = 0;
+    uint32_t      ulItem = 0;
+    fat_prefetch  prefetch;
+
+    pBuffer = malloc((pJob->ulClusterSize > HASH_RUN_SIZE) ? pJob->ulClusterSize : HASH_RUN_SIZE);
+    if (pBuffer == 0)
+    {
+        fprintf(stderr, "allocations failed.\n");
+        return -1;
+    }
+
+    /* Hashed contents are read once, so drop them behind the reader. */
+    fat_prefetch_init(
+        &prefetch,
+        pJob->nImageFile,
+        pJob->ulReadahead,
+        1,
+        pJob->ulRootDirOffset,
+        pJob->ulClusterSize);
+
+    for (;;)
+    {
+        fat_mutex_lock(&pJob->mutex);
+        ulItem = pJob->ulNextItem++;
+        fat_mutex_unlock(&pJob->mutex);
+
+        if (ulItem >= pJob->ulCount)
+            break;
+
+        pJob->pResults[ulItem].nStatus = hash_chain_contents(
+            pJob,
+            pJob->pItems[ulItem].pChain,
+            pBuffer,
+            &prefetch,
+            &pJob->pResults[ulItem]);
+    }
+
+    // Free the pBuffer buffer.
+    free (pBuffer);
+
+    return 0;
+}
+
+int hash_matching_contents(
+    int                 nImageFile,
+    fat_index*          pIndex,
+    const char*         szPattern,
+    const char*         szManifest,
+    uint32_t            ulAlgorithms,
+    uint32_t            ulRootDirOffset,
+    uint32_t            ulClusterSize,
+    uint32_t            ulThreadCount,
+    uint32_t            ulReadahead,
+    const fat_hole_map* pHoles)
+{
+    int              nReturnValue = 0;
+    uint32_t         ulItem = 0;
+    uint32_t         ulThread = 0;
+    uint32_t         ulStarted = 0;
+    uint32_t         ulFailed = 0;
+    uint32_t         ulByte = 0;
+    __int64          llBytes = 0;
+    FILE*            pManifest = 0;
+    fat_hash_result* pResult = 0;
+    fat_hash_job     job;
+    fat_thread       aThreads[HASH_MAX_THREADS];
+
+    memset(&job, 0x00, sizeof(job));
+
+    fat_index_glob(
+        pIndex,
+        (szPattern != 0) ? szPattern : "/**",
+        hash_collect_item,
+        &job);
+
+    if (job.ulCount == 0)
+    {
+        fprintf(stderr, "no files to hash.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    job.pResults = calloc(job.ulCount, sizeof(fat_hash_result));
+    if (job.pResults == 0)
+    {
+        fprintf(stderr, "allocations failed.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    /* A file only counts as hashed once a worker has hashed it. */
+    for (ulItem = 0; ulItem < job.ulCount; ++ulItem)
+        job.pResults[ulItem].nStatus = HASH_NOT_HASHED;
+
+    pManifest = fopen(szManifest, "w");
+    if (pManifest == 0)
+    {
+        fprintf(stderr, "fopen() failed on file: '%s'.\n", szManifest);
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    job.nImageFile = nImageFile;
+    job.ulAlgorithms = ulAlgorithms;
+    job.ulRootDirOffset = ulRootDirOffset;
+    job.ulClusterSize = ulClusterSize;
+    job.ulReadahead = ulReadahead;
+    job.pHoles = pHoles;
+    fat_mutex_init(&job.mutex);
+
+    if (ulThreadCount == 0)
+        ulThreadCount = fat_cpu_count();
+
+    if (ulThreadCount > HASH_MAX_THREADS)
+        ulThreadCount = HASH_MAX_THREADS;
+
+    if (ulThreadCount > job.ulCount)
+        ulThreadCount = job.ulCount;
+
+    for (ulThread = 0; ulThread < ulThreadCount; ++ulThread)
+    {
+        if (0 != fat_thread_start(&aThreads[ulThread], hash_worker, &job))
+            break;
+
+        ++ulStarted;
+    }
+
+    /* No worker could be started; hash on this thread. */
+    if (ulStarted == 0)
+        hash_worker(&job);
+
+    for (ulThread = 0; ulThread < ulStarted; ++ulThread)
+        fat_thread_join(&aThreads[ulThread]);
+
+    fat_mutex_destroy(&job.mutex);
+
+    /* One line per file: the selected digests, the entry size and the path. */
+    fprintf(pManifest, "#%s%s size path\n",
+        (0 != (ulAlgorithms & FAT_HASH_SHA256)) ? " sha256" : "",
+        (0 != (ulAlgorithms & FAT_HASH_XXH64)) ? " xxh64" : "");
+
+    for (ulItem = 0; ulItem < job.ulCount; ++ulItem)
+    {
+        pResult = &job.pResults[ulItem];
+
+        if (pResult->nStatus != HASH_OK)
+        {
+            fprintf(stderr, "%s on file: '%s'.\n",
+                (pResult->nStatus == HASH_SHORT_CHAIN) ? "chain shorter than entry size" :
+                (pResult->nStatus == HASH_READ_FAILED) ? "read failed" : "not hashed",
+                job.pItems[ulItem].szPath);
+
+            ++ulFailed;
+        }
+        else
+        {
+            llBytes += job.pItems[ulItem].pChain->filesize;
+        }
+
+        if (0 != (ulAlgorithms & FAT_HASH_SHA256))
+        {
+            if (pResult->nStatus != HASH_OK)
+                fprintf(pManifest, "%-64s  ", "-");
+            else
+                for (ulByte = 0; ulByte < FAT_SHA256_SIZE; ++ulByte)
+                    fprintf(pManifest, (ulByte + 1 < FAT_SHA256_SIZE) ? "%02x" : "%02x  ", pResult->sha256[ulByte]);
+        }
+
+        if (0 != (ulAlgorithms & FAT_HASH_XXH64))
+        {
+            if (pResult->nStatus != HASH_OK)
+                fprintf(pManifest, "%-16s  ", "-");
+            else
+                fprintf(pManifest, "%016llx  ", (unsigned long long)pResult->ullXxh64);
+        }
+
+        fprintf(pManifest, "%u  %s\n",
+            job.pItems[ulItem].pChain->filesize,
+            job.pItems[ulItem].szPath);
+    }
+
+    fprintf(stdout, "hashed %u of %u files (%lld bytes) to '%s' (threads: %u).\n",
+        job.ulCount - ulFailed,
+        job.ulCount,
+        llBytes,
+        szManifest,
+        (ulStarted > 0) ? ulStarted : 1);
+
+    if (ulFailed != 0)
+        nReturnValue = -1;
+
+exit:
+    // Close the manifest.
+    if (pManifest != 0)
+    {
+        if (0 != fclose(pManifest))
+        {
+            fprintf(stderr, "fclose() failed on file: '%s'.\n", szManifest);
+            nReturnValue = -1;
+        }
+    }
+
+    // Free the job.pResults buffer.
+    if (0 != job.pResults)
+    {
+        free (job.pResults);
+        job.pResults = 0;
+    }
+
+    // Free the job.pItems buffer.
+    if (0 != job.pItems)
+    {
+        free (job.pItems);
+        job.pItems = 0;
+    }
+
+    return nReturnValue;
+}
@@ -0,0 +1,67 @@
+#ifndef __FAT_HASH_H_HEADER__
+#define __FAT_HASH_H_HEADER__
+
+#include "stdint.h"
+#include "fat_process.h"
+#include "fat_index.h"
+#include "fat_platform.h"
+#include "fat_holes.h"
+
+/* Manifest hash algorithms (bit mask). */
+#define FAT_HASH_SHA256 (0x01)
+#define FAT_HASH_XXH64  (0x02)
+
+#define FAT_SHA256_SIZE (32)
+#define FAT_XXH64_SIZE  (8)
+
+typedef struct FAT_SHA256 {
+    uint32_t  state[8];
+    uint64_t  ullLength;        /* bytes hashed so far. */
+    uint8_t   block[64];
+    uint32_t  ulBlockUsed;
+} fat_sha256;
+
+typedef struct FAT_XXH64 {
+    uint64_t  lane[4];
+    uint64_t  ullLength;        /* bytes hashed so far. */
+    uint8_t   stripe[32];
+    uint32_t  ulStripeUsed;
+} fat_xxh64;
+
+void fat_sha256_init(fat_sha256* pContext);
+void fat_sha256_update(fat_sha256* pContext, const void* pData, size_t ulLength);
+void fat_sha256_final(fat_sha256* pContext, uint8_t* pDigest);
+
+/* XXH64 with seed 0. */
+void fat_xxh64_init(fat_xxh64* pContext);
+void fat_xxh64_update(fat_xxh64* pContext, const void* pData, size_t ulLength);
+uint64_t fat_xxh64_final(fat_xxh64* pContext);
+
+/* parses "sha256", "xxh64" or a comma separated list; returns -1 if unknown. */
+int fat_hash_algorithms(
+    const char* szNames);
+
+/**
+ * Hashes the contents of every file matching szPattern (0 for all) and
+ * writes one manifest line per file to szManifest.
+ *
+ * A pool of ulThreadCount workers streams each chain extent by extent
+ * from the image descriptor, truncated to the directory entry size; the
+ * next ulReadahead extents of every file are hinted to the kernel while
+ * the current one is hashed, and hashed runs are dropped from the page
+ * cache.  Runs inside a hole of pHoles (0 for none) are hashed as zeros
+ * without being read.  Lines are written in path order once all workers are done.
+ */
+int hash_matching_contents(
+    int                 nImageFile,
+    fat_index*          pIndex,
+    const char*         szPattern,
+    const char*         szManifest,
+    uint32_t            ulAlgorithms,
+    uint32_t            ulRootDirOffset,
+    uint32_t            ulClusterSize,
+    uint32_t            ulThreadCount,
+    uint32_t            ulReadahead,
+    const fat_hole_map* pHoles);
+
+#endif /* __FAT_HASH_H_HEADER__ */
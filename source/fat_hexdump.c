@@ -0,0 +1,436 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define FAT_HEXDUMP_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "stdint.h"
+#include "fat_platform.h"
+#include "fat_hexdump.h"
+
+#define HEXDUMP_CHUNK_BYTES   (4096) /* bytes encoded per kernel call. */
+#define HEXDUMP_CLASSIC_LINE  (80)   /* 16 digit offset line, worst case. */
+#define HEXDUMP_PLAIN_BYTES   (30)   /* bytes per plain line, as "xxd -p" writes. */
+
+static const char s_szUpperDigits[] = "0123456789ABCDEF";
+static const char s_szLowerDigits[] = "0123456789abcdef";
+
+void fat_hexdump_encode(
+    const uint8_t* pInput,
+    size_t         ulLength,
+    char*          pOutput,
+    int            nUpperCase)
+{
+    const char* szDigits = (nUpperCase != 0) ? s_szUpperDigits : s_szLowerDigits;
+
+#ifdef FAT_HEXDUMP_SSE2
+    const __m128i xmmNibble = _mm_set1_epi8(0x0F);
+    const __m128i xmmNine   = _mm_set1_epi8(9);
+    const __m128i xmmZero   = _mm_set1_epi8('0');
+    const __m128i xmmAlpha  = _mm_set1_epi8((char)(((nUpperCase != 0) ? 'A' : 'a') - '0' - 10));
+    __m128i       xmmValue;
+    __m128i       xmmHigh;
+    __m128i       xmmLow;
+
+    /* digit = nibble + '0', plus the gap to 'A'/'a' where nibble > 9. */
+    while (ulLength >= 16)
+    {
+        xmmValue = _mm_loadu_si128((const __m128i*)pInput);
+        xmmHigh  = _mm_and_si128(_mm_srli_epi16(xmmValue, 4), xmmNibble);
+        xmmLow   = _mm_and_si128(xmmValue, xmmNibble);
+
+        xmmHigh = _mm_add_epi8(_mm_add_epi8(xmmHigh, xmmZero),
+            _mm_and_si128(_mm_cmpgt_epi8(xmmHigh, xmmNine), xmmAlpha));
+        xmmLow  = _mm_add_epi8(_mm_add_epi8(xmmLow, xmmZero),
+            _mm_and_si128(_mm_cmpgt_epi8(xmmLow, xmmNine), xmmAlpha));
+
+        _mm_storeu_si128((__m128i*)pOutput, _mm_unpacklo_epi8(xmmHigh, xmmLow));
+        _mm_storeu_si128((__m128i*)(pOutput + 16), _mm_unpackhi_epi8(xmmHigh, xmmLow));
+
+        pInput += 16;
+        pOutput += 32;
+        ulLength -= 16;
+    }
+#endif
+
+    while (ulLength-- > 0)
+    {
+        *pOutput++ = szDigits[*pInput >> 4];
+        *pOutput++ = szDigits[*pInput & 0x0F];
+        ++pInput;
+    }
+}
+
+/* replaces non printable bytes with '.'. */
+static void hexdump_printable(
+    const uint8_t* pInput,
+    size_t         ulLength,
+    char*          pOutput)
+{
+#ifdef FAT_HEXDUMP_SSE2
+    const __m128i xmmSpace = _mm_set1_epi8(0x1F);
+    const __m128i xmmDelete = _mm_set1_epi8(0x7F);
+    const __m128i xmmDot = _mm_set1_epi8('.');
+    __m128i       xmmValue;
+    __m128i       xmmMask;
+
+    /* signed compares also reject 0x80-0xFF. */
+    while (ulLength >= 16)
+    {
+        xmmValue = _mm_loadu_si128((const __m128i*)pInput);
+        xmmMask  = _mm_and_si128(_mm_cmpgt_epi8(xmmValue, xmmSpace), _mm_cmplt_epi8(xmmValue, xmmDelete));
+
+        _mm_storeu_si128((__m128i*)pOutput,
+            _mm_or_si128(_mm_and_si128(xmmMask, xmmValue), _mm_andnot_si128(xmmMask, xmmDot)));
+
+        pInput += 16;
+        pOutput += 16;
+        ulLength -= 16;
+    }
+#endif
+
+    while (ulLength-- > 0)
+    {
+        *pOutput++ = ((*pInput >= 0x20) && (*pInput < 0x7F)) ? (char)*pInput : '.';
+        ++pInput;
+    }
+}
+
+static void hexdump_flush(fat_hexdump* pDump)
+{
+    if (pDump->ulUsed > 0)
+    {
+        fwrite(pDump->pBuffer, 1, pDump->ulUsed, pDump->pOutput);
+        pDump->ulUsed = 0;
+    }
+}
+
+static char* hexdump_reserve(
+    fat_hexdump* pDump,
+    size_t       ulLength)
+{
+    if (pDump->ulUsed + ulLength > FAT_HEXDUMP_BUFFER_SIZE)
+        hexdump_flush(pDump);
+
+    return pDump->pBuffer + pDump->ulUsed;
+}
+
+/* "XXXXXXXX " per word, most significant byte first. */
+static void hexdump_words(
+    fat_hexdump*   pDump,
+    const uint8_t* pInput,
+    size_t         ulWords)
+{
+    uint8_t  aSwapped[HEXDUMP_CHUNK_BYTES];
+    char     aDigits[HEXDUMP_CHUNK_BYTES * 2];
+    size_t   ulChunkWords = 0;
+    size_t   ulWord = 0;
+    char*    pOutput = 0;
+
+    while (ulWords > 0)
+    {
+        ulChunkWords = (ulWords > HEXDUMP_CHUNK_BYTES / 4) ? HEXDUMP_CHUNK_BYTES / 4 : ulWords;
+
+        for (ulWord = 0; ulWord < ulChunkWords; ++ulWord)
+        {
+            aSwapped[ulWord * 4 + 0] = pInput[ulWord * 4 + 3];
+            aSwapped[ulWord * 4 + 1] = pInput[ulWord * 4 + 2];
+            aSwapped[ulWord * 4 + 2] = pInput[ulWord * 4 + 1];
+            aSwapped[ulWord * 4 + 3] = pInput[ulWord * 4 + 0];
+        }
+
+        fat_hexdump_encode(aSwapped, ulChunkWords * 4, aDigits, 1);
+
+        pOutput = hexdump_reserve(pDump, ulChunkWords * 9);
+
+        for (ulWord = 0; ulWord < ulChunkWords; ++ulWord)
+        {
+            memcpy(pOutput, &aDigits[ulWord * 8], 8);
+            pOutput[8] = ' ';
+            pOutput += 9;
+        }
+
+        pDump->ulUsed += ulChunkWords * 9;
+        pInput += ulChunkWords * 4;
+        ulWords -= ulChunkWords;
+    }
+}
+
+static size_t hexdump_offset(
+    __int64 llOffset,
+    char*   pOutput)
+{
+    size_t ulDigits = 8;
+    size_t ulIndex = 0;
+
+    while ((ulDigits < 16) && ((llOffset >> (ulDigits * 4)) != 0))
+        ++ulDigits;
+
+    for (ulIndex = 0; ulIndex < ulDigits; ++ulIndex)
+        pOutput[ulIndex] = s_szLowerDigits[(llOffset >> ((ulDigits - ulIndex - 1) * 4)) & 0x0F];
+
+    return ulDigits;
+}
+
+/* one "hexdump -C" line of up to 16 bytes; pDigits holds their hex. */
+static void hexdump_classic_line(
+    fat_hexdump*   pDump,
+    const uint8_t* pInput,
+    const char*    pDigits,
+    size_t         ulBytes)
+{
+    char*  pOutput = 0;
+    size_t ulLength = 0;
+    size_t ulIndex = 0;
+
+    if ((pDump->nSqueeze != 0) && (ulBytes == FAT_HEXDUMP_LINE_BYTES) &&
+        (pDump->nHasPrevious != 0) &&
+        (0 == memcmp(pDump->aPrevious, pInput, FAT_HEXDUMP_LINE_BYTES)))
+    {
+        if (pDump->nSqueezing == 0)
+        {
+            pOutput = hexdump_reserve(pDump, 2);
+            pOutput[0] = '*';
+            pOutput[1] = '\n';
+            pDump->ulUsed += 2;
+            pDump->nSqueezing = 1;
+        }
+
+        pDump->llOffset += ulBytes;
+        return;
+    }
+
+    pDump->nSqueezing = 0;
+    pDump->nHasPrevious = (ulBytes == FAT_HEXDUMP_LINE_BYTES) ? 1 : 0;
+    memcpy(pDump->aPrevious, pInput, ulBytes);
+
+    pOutput = hexdump_reserve(pDump, HEXDUMP_CLASSIC_LINE);
+    ulLength = hexdump_offset(pDump->llOffset, pOutput);
+
+    pOutput[ulLength++] = ' ';
+    pOutput[ulLength++] = ' ';
+
+    for (ulIndex = 0; ulIndex < FAT_HEXDUMP_LINE_BYTES; ++ulIndex)
+    {
+        if (ulIndex < ulBytes)
+        {
+            pOutput[ulLength++] = pDigits[ulIndex * 2];
+            pOutput[ulLength++] = pDigits[ulIndex * 2 + 1];
+        }
+        else
+        {
+            pOutput[ulLength++] = ' ';
+            pOutput[ulLength++] = ' ';
+        }
+
+        pOutput[ulLength++] = ' ';
+
+        if (ulIndex == 7)
+            pOutput[ulLength++] = ' ';
+    }
+
+    pOutput[ulLength++] = ' ';
+    pOutput[ulLength++] = '|';
+    hexdump_printable(pInput, ulBytes, &pOutput[ulLength]);
+    ulLength += ulBytes;
+    pOutput[ulLength++] = '|';
+    pOutput[ulLength++] = '\n';
+
+    pDump->ulUsed += ulLength;
+    pDump->llOffset += ulBytes;
+}
+
+static void hexdump_classic(
+    fat_hexdump*   pDump,
+    const uint8_t* pInput,
+    size_t         ulLines)
+{
+    char   aDigits[HEXDUMP_CHUNK_BYTES * 2];
+    size_t ulChunkLines = 0;
+    size_t ulLine = 0;
+
+    while (ulLines > 0)
+    {
+        ulChunkLines = (ulLines > HEXDUMP_CHUNK_BYTES / FAT_HEXDUMP_LINE_BYTES) ?
+            HEXDUMP_CHUNK_BYTES / FAT_HEXDUMP_LINE_BYTES : ulLines;
+
+        fat_hexdump_encode(pInput, ulChunkLines * FAT_HEXDUMP_LINE_BYTES, aDigits, 0);
+
+        for (ulLine = 0; ulLine < ulChunkLines; ++ulLine)
+        {
+            hexdump_classic_line(
+                pDump,
+                &pInput[ulLine * FAT_HEXDUMP_LINE_BYTES],
+                &aDigits[ulLine * FAT_HEXDUMP_LINE_BYTES * 2],
+                FAT_HEXDUMP_LINE_BYTES);
+        }
+
+        pInput += ulChunkLines * FAT_HEXDUMP_LINE_BYTES;
+        ulLines -= ulChunkLines;
+    }
+}
+
+static void hexdump_plain(
+    fat_hexdump*   pDump,
+    const uint8_t* pInput,
+    size_t         ulLength)
+{
+    size_t ulColumn = 0;
+    size_t ulBytes = 0;
+    char*  pOutput = 0;
+
+    while (ulLength > 0)
+    {
+        ulColumn = (size_t)(pDump->llOffset % HEXDUMP_PLAIN_BYTES);
+        ulBytes = HEXDUMP_PLAIN_BYTES - ulColumn;
+
+        if (ulBytes > ulLength)
+            ulBytes = ulLength;
+
+        pOutput = hexdump_reserve(pDump, ulBytes * 2 + 1);
+        fat_hexdump_encode(pInput, ulBytes, pOutput, 0);
+        pDump->ulUsed += ulBytes * 2;
+
+        if (ulColumn + ulBytes == HEXDUMP_PLAIN_BYTES)
+            pDump->pBuffer[pDump->ulUsed++] = '\n';
+
+        pDump->llOffset += ulBytes;
+        pInput += ulBytes;
+        ulLength -= ulBytes;
+    }
+}
+
+int fat_hexdump_layout(const char* szLayout)
+{
+    if (0 == strcmp(szLayout, "words"))
+        return FAT_HEXDUMP_WORDS;
+
+    if (0 == strcmp(szLayout, "classic"))
+        return FAT_HEXDUMP_CLASSIC;
+
+    if (0 == strcmp(szLayout, "plain"))
+        return FAT_HEXDUMP_PLAIN;
+
+    return -1;
+}
+
+int fat_hexdump_open(
+    fat_hexdump* pDump,
+    FILE*        pOutput,
+    uint32_t     ulLayout,
+    __int64      llBaseOffset)
+{
+    memset(pDump, 0x00, sizeof(fat_hexdump));
+
+    pDump->pOutput = pOutput;
+    pDump->ulLayout = ulLayout;
+    pDump->nSqueeze = (ulLayout == FAT_HEXDUMP_CLASSIC) ? 1 : 0;
+    pDump->llOffset = llBaseOffset;
+    pDump->pBuffer = malloc(FAT_HEXDUMP_BUFFER_SIZE);
+
+    if (pDump->pBuffer == 0)
+    {
+        fprintf(stderr, "allocations failed.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+void fat_hexdump_write(
+    fat_hexdump* pDump,
+    const void*  pData,
+    size_t       ulLength)
+{
+    const uint8_t* pInput = (const uint8_t*)pData;
+    size_t         ulUnit = 0;
+    size_t         ulTake = 0;
+
+    if (pDump->ulLayout == FAT_HEXDUMP_PLAIN)
+    {
+        hexdump_plain(pDump, pInput, ulLength);
+        return;
+    }
+
+    ulUnit = (pDump->ulLayout == FAT_HEXDUMP_WORDS) ? 4 : FAT_HEXDUMP_LINE_BYTES;
+
+    /* Complete a unit left over from the previous call. */
+    if (pDump->ulPending > 0)
+    {
+        ulTake = ulUnit - pDump->ulPending;
+        if (ulTake > ulLength)
+            ulTake = ulLength;
+
+        memcpy(&pDump->aPending[pDump->ulPending], pInput, ulTake);
+        pDump->ulPending += (uint32_t)ulTake;
+        pInput += ulTake;
+        ulLength -= ulTake;
+
+        if (pDump->ulPending < ulUnit)
+            return;
+
+        if (pDump->ulLayout == FAT_HEXDUMP_WORDS)
+            hexdump_words(pDump, pDump->aPending, 1);
+        else
+            hexdump_classic(pDump, pDump->aPending, 1);
+
+        pDump->ulPending = 0;
+    }
+
+    if (pDump->ulLayout == FAT_HEXDUMP_WORDS)
+        hexdump_words(pDump, pInput, ulLength / ulUnit);
+    else
+        hexdump_classic(pDump, pInput, ulLength / ulUnit);
+
+    pDump->ulPending = (uint32_t)(ulLength % ulUnit);
+    memcpy(pDump->aPending, pInput + (ulLength - pDump->ulPending), pDump->ulPending);
+}
+
+void fat_hexdump_close(fat_hexdump* pDump)
+{
+    char   aDigits[FAT_HEXDUMP_LINE_BYTES * 2];
+    char*  pOutput = 0;
+    size_t ulLength = 0;
+
+    if (pDump->pBuffer == 0)
+        return;
+
+    if ((pDump->ulLayout == FAT_HEXDUMP_WORDS) && (pDump->ulPending > 0))
+    {
+        /* Trailing partial word: its bytes in image order. */
+        pOutput = hexdump_reserve(pDump, FAT_HEXDUMP_LINE_BYTES);
+        fat_hexdump_encode(pDump->aPending, pDump->ulPending, pOutput, 1);
+        pOutput[pDump->ulPending * 2] = ' ';
+        pDump->ulUsed += pDump->ulPending * 2 + 1;
+    }
+    else if (pDump->ulLayout == FAT_HEXDUMP_CLASSIC)
+    {
+        if (pDump->ulPending > 0)
+        {
+            fat_hexdump_encode(pDump->aPending, pDump->ulPending, aDigits, 0);
+            hexdump_classic_line(pDump, pDump->aPending, aDigits, pDump->ulPending);
+        }
+
+        /* Closing offset, as hexdump prints it. */
+        pOutput = hexdump_reserve(pDump, 20);
+        ulLength = hexdump_offset(pDump->llOffset, pOutput);
+        pOutput[ulLength++] = '\n';
+        pDump->ulUsed += ulLength;
+    }
+    else if ((pDump->ulLayout == FAT_HEXDUMP_PLAIN) && ((pDump->llOffset % HEXDUMP_PLAIN_BYTES) != 0))
+    {
+        pOutput = hexdump_reserve(pDump, 1);
+        pOutput[0] = '\n';
+        pDump->ulUsed += 1;
+    }
+
+    hexdump_flush(pDump);
+    fflush(pDump->pOutput);
+
+    free (pDump->pBuffer);
+    pDump->pBuffer = 0;
+}
@@ -0,0 +1,65 @@
+#ifndef __FAT_HEXDUMP_H_HEADER__
+#define __FAT_HEXDUMP_H_HEADER__
+
+#include <stdio.h>
+
+#include "stdint.h"
+#include "fat_platform.h"
+
+#define FAT_HEXDUMP_WORDS   (0) /* "%8.8X " per little endian 32-bit word, the dump_buffer() layout. */
+#define FAT_HEXDUMP_CLASSIC (1) /* offset, 16 hex bytes and ASCII per line ("hexdump -C"). */
+#define FAT_HEXDUMP_PLAIN   (2) /* 30 hex bytes per line, no decoration ("xxd -p"). */
+
+#define FAT_HEXDUMP_BUFFER_SIZE (1 << 20)
+#define FAT_HEXDUMP_LINE_BYTES  (16)
+
+/**
+ * Streaming hex formatter.
+ *
+ * Input is converted a block at a time (SSE2 nibble-to-ASCII where the
+ * compiler targets it) into one large output buffer that is written with
+ * fwrite() when full, so no per-word stdio calls are made.
+ */
+typedef struct FAT_HEXDUMP {
+    FILE*    pOutput;
+    uint32_t ulLayout;
+    int      nSqueeze;      /* classic: collapse repeated lines to "*". */
+    int      nSqueezing;
+    __int64  llOffset;      /* offset of the next byte formatted. */
+
+    char*    pBuffer;
+    size_t   ulUsed;
+
+    uint8_t  aPending[FAT_HEXDUMP_LINE_BYTES];
+    uint32_t ulPending;
+    uint8_t  aPrevious[FAT_HEXDUMP_LINE_BYTES];
+    int      nHasPrevious;
+} fat_hexdump;
+
+int fat_hexdump_open(
+    fat_hexdump* pDump,
+    FILE*        pOutput,
+    uint32_t     ulLayout,
+    __int64      llBaseOffset);
+
+void fat_hexdump_write(
+    fat_hexdump* pDump,
+    const void*  pData,
+    size_t       ulLength);
+
+/* formats any partial line, flushes and releases the buffer. */
+void fat_hexdump_close(
+    fat_hexdump* pDump);
+
+/* writes two hex digits per input byte to pOutput (no terminator). */
+void fat_hexdump_encode(
+    const uint8_t* pInput,
+    size_t         ulLength,
+    char*          pOutput,
+    int            nUpperCase);
+
+/* parses "words", "classic" or "plain"; returns -1 if unknown. */
+int fat_hexdump_layout(
+    const char* szLayout);
+
+#endif /* __FAT_HEXDUMP_H_HEADER__ */
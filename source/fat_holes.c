@@ -0,0 +1,146 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#include "stdint.h"
+#include "fat_platform.h"
+#include "fat_holes.h"
+
+static int fat_hole_map_add(
+    fat_hole_map* pMap,
+    __int64       llStart,
+    __int64       llEnd)
+{
+    fat_data_extent* pGrown = 0;
+
+    if (pMap->ulCount == pMap->ulCapacity)
+    {
+        pMap->ulCapacity = (pMap->ulCapacity == 0) ? 64 : (pMap->ulCapacity << 1);
+        pGrown = realloc(pMap->pExtents, pMap->ulCapacity * sizeof(fat_data_extent));
+
+        if (pGrown == 0)
+        {
+            fprintf(stderr, "allocations failed.\n");
+            return -1;
+        }
+
+        pMap->pExtents = pGrown;
+    }
+
+    pMap->pExtents[pMap->ulCount].llStart = llStart;
+    pMap->pExtents[pMap->ulCount].llEnd = llEnd;
+    ++pMap->ulCount;
+
+    pMap->llHoleBytes -= (llEnd - llStart);
+
+    return 0;
+}
+
+int fat_hole_map_load(
+    fat_hole_map* pMap,
+    int           nFile)
+{
+    __int64 llOffset = 0;
+    __int64 llData = 0;
+    __int64 llHole = 0;
+
+    memset(pMap, 0x00, sizeof(fat_hole_map));
+
+    pMap->llSize = fat_file_size(nFile);
+    if (pMap->llSize < 0)
+        return -1;
+
+    pMap->llHoleBytes = pMap->llSize;
+
+    while (llOffset < pMap->llSize)
+    {
+        llData = fat_file_seek_data(nFile, llOffset, &llHole);
+
+        if (llData == -2)
+            break;
+
+        /* No hole reporting here; all of the image is data. */
+        if (llData == -1)
+        {
+            pMap->ulCount = 0;
+            pMap->llHoleBytes = pMap->llSize;
+            return fat_hole_map_add(pMap, 0, pMap->llSize);
+        }
+
+        if (llHole > pMap->llSize)
+            llHole = pMap->llSize;
+
+        if (0 != fat_hole_map_add(pMap, llData, llHole))
+            return -1;
+
+        llOffset = llHole;
+    }
+
+    return 0;
+}
+
+void fat_hole_map_free(
+    fat_hole_map* pMap)
+{
+    // Free the pMap->pExtents buffer.
+    if (0 != pMap->pExtents)
+    {
+        free (pMap->pExtents);
+        pMap->pExtents = 0;
+    }
+
+    pMap->ulCount = 0;
+    pMap->ulCapacity = 0;
+}
+
+/* index of the first extent ending after llOffset (ulCount if none). */
+static uint32_t fat_hole_map_find(
+    const fat_hole_map* pMap,
+    __int64             llOffset)
+{
+    uint32_t ulLow = 0;
+    uint32_t ulHigh = pMap->ulCount;
+    uint32_t ulMiddle = 0;
+
+    while (ulLow < ulHigh)
+    {
+        ulMiddle = ulLow + ((ulHigh - ulLow) >> 1);
+
+        if (pMap->pExtents[ulMiddle].llEnd <= llOffset)
+            ulLow = ulMiddle + 1;
+        else
+            ulHigh = ulMiddle;
+    }
+
+    return ulLow;
+}
+
+int fat_hole_map_is_hole(
+    const fat_hole_map* pMap,
+    __int64             llOffset,
+    __int64             llLength)
+{
+    uint32_t ulExtent = 0;
+
+    /* Past the end reads come up short rather than zero. */
+    if ((llLength <= 0) || (llOffset + llLength > pMap->llSize))
+        return 0;
+
+    ulExtent = fat_hole_map_find(pMap, llOffset);
+
+    return (ulExtent == pMap->ulCount) ||
+           (pMap->pExtents[ulExtent].llStart >= llOffset + llLength);
+}
+
+__int64 fat_hole_map_next_data(
+    const fat_hole_map* pMap,
+    __int64             llOffset)
+{
+    uint32_t ulExtent = fat_hole_map_find(pMap, llOffset);
+
+    if (ulExtent == pMap->ulCount)
+        return pMap->llSize;
+
+    return (pMap->pExtents[ulExtent].llStart > llOffset) ? pMap->pExtents[ulExtent].llStart : llOffset;
+}
@@ -0,0 +1,48 @@
+#ifndef __FAT_HOLES_H_HEADER__
+#define __FAT_HOLES_H_HEADER__
+
+#include "stdint.h"
+#include "fat_platform.h"
+
+typedef struct FAT_DATA_EXTENT {
+    __int64   llStart;
+    __int64   llEnd;
+} fat_data_extent;
+
+/**
+ * Data/hole layout of a sparse image, queried once with SEEK_DATA and
+ * SEEK_HOLE.
+ *
+ * Ranges that fall entirely in a hole read back as zeros, so whole-volume
+ * passes can skip them without issuing reads.  Where the file system
+ * cannot report holes the map holds one extent covering the whole image
+ * and nothing is ever skipped.  The map is read-only once loaded.
+ */
+typedef struct FAT_HOLE_MAP {
+    fat_data_extent* pExtents;      /* sorted, disjoint. */
+    uint32_t         ulCount;
+    uint32_t         ulCapacity;
+    __int64          llSize;
+    __int64          llHoleBytes;
+} fat_hole_map;
+
+/* see fat_file_seek_data() for sharing nFile while this runs. */
+int fat_hole_map_load(
+    fat_hole_map* pMap,
+    int           nFile);
+
+void fat_hole_map_free(
+    fat_hole_map* pMap);
+
+/* returns non-zero if [llOffset, llOffset + llLength) holds no data. */
+int fat_hole_map_is_hole(
+    const fat_hole_map* pMap,
+    __int64             llOffset,
+    __int64             llLength);
+
+/* first data byte at or after llOffset, llSize if only holes follow. */
+__int64 fat_hole_map_next_data(
+    const fat_hole_map* pMap,
+    __int64             llOffset);
+
+#endif /* __FAT_HOLES_H_HEADER__ */
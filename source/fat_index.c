@@ -0,0 +1,631 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <memory.h>
+
+#include "stdint.h"
+#include "fat_process.h"
+#include "fat_index.h"
+
+#define FNV1A_OFFSET (0x811C9DC5)
+#define FNV1A_PRIME  (0x01000193)
+
+typedef struct FAT_INDEX_SORT_ENTRY {
+    const char* szPath;
+    uint32_t    ulChainIndex;
+} fat_index_sort_entry;
+
+static uint32_t fat_index_hash(const char* szKey)
+{
+    uint32_t ulHash = FNV1A_OFFSET;
+
+    while (*szKey != 0)
+    {
+        ulHash ^= (unsigned char)*szKey++;
+        ulHash *= FNV1A_PRIME;
+    }
+
+    return ulHash;
+}
+
+static int fat_index_compare_paths(const void* pLeft, const void* pRight)
+{
+    return strcmp(((const fat_index_sort_entry*)pLeft)->szPath,
+                  ((const fat_index_sort_entry*)pRight)->szPath);
+}
+
+/* copies szSource upper cased; paths get a leading '/' and lose any trailing '/'. */
+static void fat_index_normalize(
+    const char* szSource,
+    char*       szTarget,
+    size_t      ulTargetSize,
+    int         nPath)
+{
+    size_t ulLength = 0;
+
+    if ((nPath != 0) && (*szSource != '/') && (ulTargetSize > 1))
+        szTarget[ulLength++] = '/';
+
+    while ((*szSource != 0) && (ulLength + 1 < ulTargetSize))
+        szTarget[ulLength++] = (char)toupper((unsigned char)*szSource++);
+
+    while ((nPath != 0) && (ulLength > 1) && (szTarget[ulLength - 1] == '/'))
+        --ulLength;
+
+    szTarget[ulLength] = 0;
+}
+
+/* first position in the sorted path array whose path is >= szKey. */
+static uint32_t fat_index_lower_bound(
+    const fat_index* pIndex,
+    const char*      szKey)
+{
+    uint32_t ulLow = 0;
+    uint32_t ulHigh = pIndex->ulSortedCount;
+    uint32_t ulMid = 0;
+    const char* szPath = 0;
+
+    while (ulLow < ulHigh)
+    {
+        ulMid = ulLow + ((ulHigh - ulLow) >> 1);
+        szPath = pIndex->pPathPool + pIndex->pPathOffsets[pIndex->pSortedPaths[ulMid]];
+
+        if (strcmp(szPath, szKey) < 0)
+            ulLow = ulMid + 1;
+        else
+            ulHigh = ulMid;
+    }
+
+    return ulLow;
+}
+
+void fat_index_format_name(
+    const unsigned char* pFilename,
+    const unsigned char* pExtension,
+    char*                szName)
+{
+    int nIndex = 0;
+    int nLength = 0;
+    int nNameLength = 8;
+    int nExtLength = 3;
+
+    while ((nNameLength > 0) && (pFilename[nNameLength - 1] == ' '))
+        --nNameLength;
+
+    while ((nExtLength > 0) && (pExtension[nExtLength - 1] == ' '))
+        --nExtLength;
+
+    for (nIndex = 0; nIndex < nNameLength; ++nIndex)
+        szName[nLength++] = (char)toupper(pFilename[nIndex]);
+
+    /* Per FAT32 spec: 0x05 in the first byte stands for a real 0xE5. */
+    if ((nLength > 0) && ((unsigned char)szName[0] == 0x05))
+        szName[0] = (char)FILE_DEL_ENTRY;
+
+    if (nExtLength > 0)
+    {
+        szName[nLength++] = '.';
+
+        for (nIndex = 0; nIndex < nExtLength; ++nIndex)
+            szName[nLength++] = (char)toupper(pExtension[nIndex]);
+    }
+
+    szName[nLength] = 0;
+}
+
+int fat_index_build(
+    fat_index*  pIndex,
+    fat_chain*  pFatChainList,
+    uint32_t    ulFatChainCount)
+{
+    int         nReturnValue = 0;
+    uint32_t    ulBucketCount = 16;
+    uint32_t    ulChainIndex = 0;
+    uint32_t    ulParentIndex = 0;
+    uint32_t    ulDepth = 0;
+    uint32_t    ulBucket = 0;
+    size_t      ulPoolSize = 0;
+    size_t      ulPathLength = 0;
+    size_t      ulNameLength = 0;
+    char*       szName = 0;
+    char*       szPath = 0;
+    fat_chain*  pChain = 0;
+    uint32_t*   pPathLengths = 0;
+    fat_index_sort_entry* pSortEntries = 0;
+    uint32_t    aulComponents[FAT_INDEX_MAX_DEPTH];
+
+    memset(pIndex, 0x00, sizeof(fat_index));
+    pIndex->pChainList = pFatChainList;
+    pIndex->ulChainCount = ulFatChainCount;
+
+    while (ulBucketCount < (ulFatChainCount << 1))
+        ulBucketCount <<= 1;
+
+    pIndex->ulBucketMask = ulBucketCount - 1;
+    pIndex->pNameBuckets = malloc(ulBucketCount * sizeof(uint32_t));
+    pIndex->pPathBuckets = malloc(ulBucketCount * sizeof(uint32_t));
+    pIndex->pNameNext = malloc((ulFatChainCount + 1) * sizeof(uint32_t));
+    pIndex->pPathNext = malloc((ulFatChainCount + 1) * sizeof(uint32_t));
+    pIndex->pPathOffsets = malloc((ulFatChainCount + 1) * sizeof(uint32_t));
+    pIndex->pSortedPaths = malloc((ulFatChainCount + 1) * sizeof(uint32_t));
+    pIndex->pNamePool = malloc((ulFatChainCount + 1) * FAT_INDEX_NAME_LENGTH);
+    pPathLengths = malloc((ulFatChainCount + 1) * sizeof(uint32_t));
+
+    if ( (0 == pIndex->pNameBuckets) || (0 == pIndex->pPathBuckets) ||
+         (0 == pIndex->pNameNext)    || (0 == pIndex->pPathNext) ||
+         (0 == pIndex->pPathOffsets) || (0 == pIndex->pSortedPaths) ||
+         (0 == pIndex->pNamePool)    || (0 == pPathLengths) )
+    {
+        fprintf(stderr, "allocations failed.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    memset(pIndex->pNameBuckets, 0xFF, ulBucketCount * sizeof(uint32_t));
+    memset(pIndex->pPathBuckets, 0xFF, ulBucketCount * sizeof(uint32_t));
+
+    /* Normalize the short names of every populated chain. */
+    for (ulChainIndex = 0; ulChainIndex < ulFatChainCount; ++ulChainIndex)
+    {
+        pChain = &pFatChainList[ulChainIndex];
+        szName = &pIndex->pNamePool[ulChainIndex * FAT_INDEX_NAME_LENGTH];
+
+        if (pChain->populated != 0)
+            fat_index_format_name(pChain->filename, pChain->extension, szName);
+        else
+            szName[0] = 0;
+    }
+
+    /* Size each path by walking up the parent chains. */
+    for (ulChainIndex = 0; ulChainIndex < ulFatChainCount; ++ulChainIndex)
+    {
+        pChain = &pFatChainList[ulChainIndex];
+        ulPathLength = 0;
+
+        for (ulDepth = 0; (pChain != 0) && (pChain->populated != 0); ++ulDepth)
+        {
+            ulParentIndex = (uint32_t)(pChain - pFatChainList);
+            ulNameLength = strlen(&pIndex->pNamePool[ulParentIndex * FAT_INDEX_NAME_LENGTH]);
+
+            /* Unnamed component or corrupt (cyclic) parent links. */
+            if ((ulNameLength == 0) || (ulDepth == FAT_INDEX_MAX_DEPTH))
+            {
+                ulPathLength = 0;
+                break;
+            }
+
+            ulPathLength += ulNameLength + 1;
+            pChain = pChain->parent;
+        }
+
+        pPathLengths[ulChainIndex] = (uint32_t)ulPathLength;
+
+        if (ulPathLength != 0)
+            ulPoolSize += ulPathLength + 1;
+    }
+
+    pIndex->pPathPool = malloc(ulPoolSize + 1);
+    pSortEntries = malloc((ulFatChainCount + 1) * sizeof(fat_index_sort_entry));
+
+    if ((0 == pIndex->pPathPool) || (0 == pSortEntries))
+    {
+        fprintf(stderr, "allocations failed.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    /* Write the paths, root first, and hash names and paths. */
+    ulPoolSize = 0;
+
+    for (ulChainIndex = 0; ulChainIndex < ulFatChainCount; ++ulChainIndex)
+    {
+        if (pPathLengths[ulChainIndex] == 0)
+        {
+            pIndex->pPathOffsets[ulChainIndex] = FAT_INDEX_NONE;
+            continue;
+        }
+
+        pChain = &pFatChainList[ulChainIndex];
+        szPath = &pIndex->pPathPool[ulPoolSize];
+
+        for (ulDepth = 0; (pChain != 0) && (pChain->populated != 0); ++ulDepth)
+        {
+            aulComponents[ulDepth] = (uint32_t)(pChain - pFatChainList);
+            pChain = pChain->parent;
+        }
+
+        ulPathLength = 0;
+
+        while (ulDepth-- > 0)
+        {
+            szName = &pIndex->pNamePool[aulComponents[ulDepth] * FAT_INDEX_NAME_LENGTH];
+            ulNameLength = strlen(szName);
+
+            szPath[ulPathLength++] = '/';
+            memcpy(&szPath[ulPathLength], szName, ulNameLength);
+            ulPathLength += ulNameLength;
+        }
+
+        szPath[ulPathLength] = 0;
+        pIndex->pPathOffsets[ulChainIndex] = (uint32_t)ulPoolSize;
+        ulPoolSize += ulPathLength + 1;
+
+        pSortEntries[pIndex->ulSortedCount].szPath = szPath;
+        pSortEntries[pIndex->ulSortedCount].ulChainIndex = ulChainIndex;
+        ++pIndex->ulSortedCount;
+    }
+
+    /* Insert in reverse so that bucket walks return chains in FAT order. */
+    for (ulChainIndex = ulFatChainCount; ulChainIndex-- > 0; )
+    {
+        szName = &pIndex->pNamePool[ulChainIndex * FAT_INDEX_NAME_LENGTH];
+
+        if (szName[0] != 0)
+        {
+            ulBucket = fat_index_hash(szName) & pIndex->ulBucketMask;
+            pIndex->pNameNext[ulChainIndex] = pIndex->pNameBuckets[ulBucket];
+            pIndex->pNameBuckets[ulBucket] = ulChainIndex;
+        }
+
+        if (pIndex->pPathOffsets[ulChainIndex] != FAT_INDEX_NONE)
+        {
+            szPath = pIndex->pPathPool + pIndex->pPathOffsets[ulChainIndex];
+            ulBucket = fat_index_hash(szPath) & pIndex->ulBucketMask;
+            pIndex->pPathNext[ulChainIndex] = pIndex->pPathBuckets[ulBucket];
+            pIndex->pPathBuckets[ulBucket] = ulChainIndex;
+        }
+    }
+
+    qsort(pSortEntries, pIndex->ulSortedCount, sizeof(fat_index_sort_entry),
+        fat_index_compare_paths);
+
+    for (ulChainIndex = 0; ulChainIndex < pIndex->ulSortedCount; ++ulChainIndex)
+        pIndex->pSortedPaths[ulChainIndex] = pSortEntries[ulChainIndex].ulChainIndex;
+
+exit:
+    // Free the pPathLengths buffer.
+    if (0 != pPathLengths)
+    {
+        free (pPathLengths);
+        pPathLengths = 0;
+    }
+
+    // Free the pSortEntries buffer.
+    if (0 != pSortEntries)
+    {
+        free (pSortEntries);
+        pSortEntries = 0;
+    }
+
+    if (nReturnValue != 0)
+        fat_index_free(pIndex);
+
+    return nReturnValue;
+}
+
+void fat_index_free(fat_index* pIndex)
+{
+    free (pIndex->pNameBuckets);
+    free (pIndex->pPathBuckets);
+    free (pIndex->pNameNext);
+    free (pIndex->pPathNext);
+    free (pIndex->pNamePool);
+    free (pIndex->pPathPool);
+    free (pIndex->pPathOffsets);
+    free (pIndex->pSortedPaths);
+
+    memset(pIndex, 0x00, sizeof(fat_index));
+}
+
+const char* fat_index_path(
+    const fat_index* pIndex,
+    const fat_chain* pChain)
+{
+    uint32_t ulChainIndex = (uint32_t)(pChain - pIndex->pChainList);
+
+    if ((ulChainIndex >= pIndex->ulChainCount) ||
+        (pIndex->pPathOffsets[ulChainIndex] == FAT_INDEX_NONE))
+    {
+        return 0;
+    }
+
+    return pIndex->pPathPool + pIndex->pPathOffsets[ulChainIndex];
+}
+
+fat_chain* fat_index_find_path(
+    const fat_index* pIndex,
+    const char*      szPath)
+{
+    char     szKey[FAT_INDEX_MAX_DEPTH * FAT_INDEX_NAME_LENGTH];
+    uint32_t ulChainIndex = 0;
+
+    if (pIndex->ulChainCount == 0)
+        return 0;
+
+    fat_index_normalize(szPath, szKey, sizeof(szKey), 1);
+
+    ulChainIndex = pIndex->pPathBuckets[fat_index_hash(szKey) & pIndex->ulBucketMask];
+
+    while (ulChainIndex != FAT_INDEX_NONE)
+    {
+        if (0 == strcmp(pIndex->pPathPool + pIndex->pPathOffsets[ulChainIndex], szKey))
+            return &pIndex->pChainList[ulChainIndex];
+
+        ulChainIndex = pIndex->pPathNext[ulChainIndex];
+    }
+
+    return 0;
+}
+
+uint32_t fat_index_find_name(
+    const fat_index* pIndex,
+    const char*      szName,
+    fat_index_visit  pfnVisit,
+    void*            pContext)
+{
+    char     szKey[FAT_INDEX_NAME_LENGTH];
+    uint32_t ulChainIndex = 0;
+    uint32_t ulVisited = 0;
+
+    if (pIndex->ulChainCount == 0)
+        return 0;
+
+    fat_index_normalize(szName, szKey, sizeof(szKey), 0);
+
+    ulChainIndex = pIndex->pNameBuckets[fat_index_hash(szKey) & pIndex->ulBucketMask];
+
+    while (ulChainIndex != FAT_INDEX_NONE)
+    {
+        if (0 == strcmp(&pIndex->pNamePool[ulChainIndex * FAT_INDEX_NAME_LENGTH], szKey))
+        {
+            ++ulVisited;
+
+            if (0 != pfnVisit(&pIndex->pChainList[ulChainIndex],
+                    fat_index_path(pIndex, &pIndex->pChainList[ulChainIndex]), pContext))
+            {
+                break;
+            }
+        }
+
+        ulChainIndex = pIndex->pNameNext[ulChainIndex];
+    }
+
+    return ulVisited;
+}
+
+uint32_t fat_index_find_prefix(
+    const fat_index* pIndex,
+    const char*      szPrefix,
+    fat_index_visit  pfnVisit,
+    void*            pContext)
+{
+    char        szBuffer[FAT_INDEX_MAX_DEPTH * FAT_INDEX_NAME_LENGTH];
+    char*       szKey = &szBuffer[1];
+    size_t      ulKeyLength = 0;
+    uint32_t    ulPosition = 0;
+    uint32_t    ulChainIndex = 0;
+    uint32_t    ulVisited = 0;
+    const char* szPath = 0;
+
+    /* Normalized as a name so a trailing '/' survives ("/DIR/" must not match "/DIRX"). */
+    fat_index_normalize(szPrefix, szKey, sizeof(szBuffer) - 1, 0);
+
+    if (szKey[0] != '/')
+    {
+        szBuffer[0] = '/';
+        szKey = &szBuffer[0];
+    }
+
+    ulKeyLength = strlen(szKey);
+
+    for (ulPosition = fat_index_lower_bound(pIndex, szKey);
+         ulPosition < pIndex->ulSortedCount; ++ulPosition)
+    {
+        ulChainIndex = pIndex->pSortedPaths[ulPosition];
+        szPath = pIndex->pPathPool + pIndex->pPathOffsets[ulChainIndex];
+
+        if (0 != strncmp(szPath, szKey, ulKeyLength))
+            break;
+
+        ++ulVisited;
+
+        if (0 != pfnVisit(&pIndex->pChainList[ulChainIndex], szPath, pContext))
+            break;
+    }
+
+    return ulVisited;
+}
+
+uint32_t fat_index_glob(
+    const fat_index* pIndex,
+    const char*      szPattern,
+    fat_index_visit  pfnVisit,
+    void*            pContext)
+{
+    char        szKey[FAT_INDEX_MAX_DEPTH * FAT_INDEX_NAME_LENGTH];
+    size_t      ulPrefixLength = 0;
+    uint32_t    ulPosition = 0;
+    uint32_t    ulChainIndex = 0;
+    uint32_t    ulVisited = 0;
+    const char* szPath = 0;
+    char        chSaved = 0;
+
+    /* Name-only pattern. */
+    if (0 == strchr(szPattern, '/'))
+    {
+        if (0 == strpbrk(szPattern, "*?["))
+            return fat_index_find_name(pIndex, szPattern, pfnVisit, pContext);
+
+        fat_index_normalize(szPattern, szKey, sizeof(szKey), 0);
+
+        for (ulChainIndex = 0; ulChainIndex < pIndex->ulChainCount; ++ulChainIndex)
+        {
+            if ((pIndex->pNamePool[ulChainIndex * FAT_INDEX_NAME_LENGTH] != 0) &&
+                (0 != fat_index_glob_match(szKey, &pIndex->pNamePool[ulChainIndex * FAT_INDEX_NAME_LENGTH])))
+            {
+                ++ulVisited;
+
+                if (0 != pfnVisit(&pIndex->pChainList[ulChainIndex],
+                        fat_index_path(pIndex, &pIndex->pChainList[ulChainIndex]), pContext))
+                {
+                    break;
+                }
+            }
+        }
+
+        return ulVisited;
+    }
+
+    fat_index_normalize(szPattern, szKey, sizeof(szKey), 1);
+
+    /* Path pattern: only the range sharing the literal prefix is tested. */
+    ulPrefixLength = strcspn(szKey, "*?[");
+    chSaved = szKey[ulPrefixLength];
+    szKey[ulPrefixLength] = 0;
+    ulPosition = fat_index_lower_bound(pIndex, szKey);
+    szKey[ulPrefixLength] = chSaved;
+
+    for (; ulPosition < pIndex->ulSortedCount; ++ulPosition)
+    {
+        ulChainIndex = pIndex->pSortedPaths[ulPosition];
+        szPath = pIndex->pPathPool + pIndex->pPathOffsets[ulChainIndex];
+
+        if (0 != strncmp(szPath, szKey, ulPrefixLength))
+            break;
+
+        if (0 != fat_index_glob_match(szKey, szPath))
+        {
+            ++ulVisited;
+
+            if (0 != pfnVisit(&pIndex->pChainList[ulChainIndex], szPath, pContext))
+                break;
+        }
+    }
+
+    return ulVisited;
+}
+
+/* matches one '?', '[set]' or literal of *pszPattern against chText and
+   steps past it; '?' and sets never match the '/' between components. */
+static int fat_index_glob_match_char(
+    const char** pszPattern,
+    char         chText)
+{
+    const char* szPattern = *pszPattern;
+    int         nNegate = 0;
+    int         nMatched = 0;
+
+    switch (*szPattern)
+    {
+    case '?':
+        if ((chText == 0) || (chText == '/'))
+            return 0;
+
+        ++szPattern;
+        break;
+
+    case '[':
+        if ((chText == 0) || (chText == '/'))
+            return 0;
+
+        nNegate = ((szPattern[1] == '!') || (szPattern[1] == '^')) ? 1 : 0;
+        szPattern += 1 + nNegate;
+
+        while ((*szPattern != 0) && (*szPattern != ']'))
+        {
+            if ((szPattern[1] == '-') && (szPattern[2] != 0) && (szPattern[2] != ']'))
+            {
+                if ((chText >= szPattern[0]) && (chText <= szPattern[2]))
+                    nMatched = 1;
+
+                szPattern += 3;
+            }
+            else
+            {
+                if (chText == *szPattern)
+                    nMatched = 1;
+
+                ++szPattern;
+            }
+        }
+
+        if (*szPattern == ']')
+            ++szPattern;
+
+        if (nMatched == nNegate)
+            return 0;
+
+        break;
+
+    default:
+        if ((*szPattern == 0) || (*szPattern != chText))
+            return 0;
+
+        ++szPattern;
+        break;
+    }
+
+    *pszPattern = szPattern;
+
+    return 1;
+}
+
+/* Iterative, so a pattern with many stars cannot backtrack exponentially:
+   on a mismatch only the last '*' takes one more character, or, once it
+   would have to cross a '/', the last '**' does and everything after it
+   is matched again.  Each costs at most one pass over szText. */
+int fat_index_glob_match(
+    const char* szPattern,
+    const char* szText)
+{
+    const char* szStarPattern = 0;
+    const char* szStarText = 0;
+    const char* szDeepPattern = 0;
+    const char* szDeepText = 0;
+
+    for (;;)
+    {
+        if (*szPattern == '*')
+        {
+            if (szPattern[1] == '*')
+            {
+                szPattern += 2;
+                szDeepPattern = szPattern;
+                szDeepText = szText;
+                szStarPattern = 0;
+            }
+            else
+            {
+                szPattern += 1;
+                szStarPattern = szPattern;
+                szStarText = szText;
+            }
+
+            continue;
+        }
+
+        if ((*szPattern == 0) && (*szText == 0))
+            return 1;
+
+        if (0 != fat_index_glob_match_char(&szPattern, *szText))
+        {
+            ++szText;
+        }
+        else if ((szStarPattern != 0) && (*szStarText != 0) && (*szStarText != '/'))
+        {
+            szPattern = szStarPattern;
+            szText = ++szStarText;
+        }
+        else if ((szDeepPattern != 0) && (*szDeepText != 0))
+        {
+            szPattern = szDeepPattern;
+            szText = ++szDeepText;
+            szStarPattern = 0;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef __FAT_INDEX_H_HEADER__
+#define __FAT_INDEX_H_HEADER__
+
+#include "stdint.h"
+#include "fat_process.h"
+
+#define FAT_INDEX_NAME_LENGTH (13)  /* "NAMEXXXX.EXT" + terminator. */
+#define FAT_INDEX_MAX_DEPTH   (128) /* Deepest directory nesting indexed. */
+#define FAT_INDEX_NONE        (0xFFFFFFFF)
+
+/**
+ * Lookup index over the populated chains of a volume.
+ *
+ * Names are normalized to upper case "NAME.EXT" and paths to
+ * "/DIR/.../NAME.EXT".  Both are hashed (FNV-1a, chained buckets), and the
+ * paths are additionally kept in a sorted array for prefix and glob queries.
+ */
+typedef struct FAT_INDEX {
+    fat_chain * pChainList;
+    uint32_t    ulChainCount;
+
+    uint32_t    ulBucketMask;   /* bucket count - 1 (power of two). */
+    uint32_t *  pNameBuckets;   /* first chain index per name bucket. */
+    uint32_t *  pNameNext;      /* next chain index in the same name bucket. */
+    uint32_t *  pPathBuckets;   /* first chain index per path bucket. */
+    uint32_t *  pPathNext;      /* next chain index in the same path bucket. */
+
+    char *      pNamePool;      /* ulChainCount * FAT_INDEX_NAME_LENGTH. */
+    char *      pPathPool;      /* concatenated, terminated paths. */
+    uint32_t *  pPathOffsets;   /* per chain offset into pPathPool (FAT_INDEX_NONE if unnamed). */
+
+    uint32_t *  pSortedPaths;   /* chain indices sorted by path. */
+    uint32_t    ulSortedCount;
+} fat_index;
+
+/* return non-zero to stop the query. */
+typedef int (*fat_index_visit)(
+    fat_chain*  pChain,
+    const char* szPath,
+    void*       pContext);
+
+int fat_index_build(
+    fat_index*  pIndex,
+    fat_chain*  pFatChainList,
+    uint32_t    ulFatChainCount);
+
+void fat_index_free(
+    fat_index*  pIndex);
+
+/* normalizes an 8.3 directory name to "NAME.EXT" (szName must hold FAT_INDEX_NAME_LENGTH). */
+void fat_index_format_name(
+    const unsigned char* pFilename,
+    const unsigned char* pExtension,
+    char*                szName);
+
+const char* fat_index_path(
+    const fat_index* pIndex,
+    const fat_chain* pChain);
+
+fat_chain* fat_index_find_path(
+    const fat_index* pIndex,
+    const char*      szPath);
+
+/* returns the number of chains visited. */
+uint32_t fat_index_find_name(
+    const fat_index* pIndex,
+    const char*      szName,
+    fat_index_visit  pfnVisit,
+    void*            pContext);
+
+/* returns the number of chains visited. */
+uint32_t fat_index_find_prefix(
+    const fat_index* pIndex,
+    const char*      szPrefix,
+    fat_index_visit  pfnVisit,
+    void*            pContext);
+
+/* '*' and '?' stay within one path component, '**' spans components.
+   Patterns without a '/' are matched against the name only.
+   returns the number of chains visited. */
+uint32_t fat_index_glob(
+    const fat_index* pIndex,
+    const char*      szPattern,
+    fat_index_visit  pfnVisit,
+    void*            pContext);
+
+int fat_index_glob_match(
+    const char* szPattern,
+    const char* szText);
+
+#endif /* __FAT_INDEX_H_HEADER__ */
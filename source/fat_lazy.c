@@ -0,0 +1,444 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <memory.h>
+
+#include "stdint.h"
+#include "mbr_defs.h"
+#include "fat_defs.h"
+#include "fat_process.h"
+#include "fat_index.h"
+#include "fat_platform.h"
+#include "fat_dirscan.h"
+#include "fat_lazy.h"
+
+#define LAZY_SECTOR_SHIFT (9)
+#define LAZY_ENTRY_MASK   (0x0FFFFFFF)
+
+int fat_lazy_open(
+    fat_lazy_volume* pVolume,
+    const char*      szImageFilename)
+{
+    MASTER_BOOT_RECORD mbr;
+    FAT32_BOOT_SECTOR  bootSector;
+    __int64            llPartitionOffset = 0;
+
+    memset(pVolume, 0x00, sizeof(fat_lazy_volume));
+
+    pVolume->nImageFile = fat_file_open_read(szImageFilename);
+    if (pVolume->nImageFile < 0)
+    {
+        fprintf(stderr, "open failed on file: '%s'.\n", szImageFilename);
+        return -1;
+    }
+
+    // Read the Master Boot Record and the FAT Boot Sector; nothing else.
+    if (sizeof(mbr) != fat_file_pread(pVolume->nImageFile, &mbr, sizeof(mbr), 0))
+    {
+        fprintf(stderr, "read failed on the master boot record.\n");
+        fat_lazy_close(pVolume);
+        return -1;
+    }
+
+    llPartitionOffset = (__int64)mbr.partEntry1.startSectorOffset << LAZY_SECTOR_SHIFT;
+
+    if (sizeof(bootSector) != fat_file_pread(pVolume->nImageFile, &bootSector, sizeof(bootSector), llPartitionOffset))
+    {
+        fprintf(stderr, "read failed on the boot sector.\n");
+        fat_lazy_close(pVolume);
+        return -1;
+    }
+
+    pVolume->ulClusterSize = bootSector.bytesPerSector * bootSector.sectorsPerCluster;
+    pVolume->ulFatSize = bootSector.sectorsPerFat32 << LAZY_SECTOR_SHIFT;
+    pVolume->ulFatEntries = pVolume->ulFatSize >> 2;
+    pVolume->ulRootCluster = (bootSector.rootDirStartCluster >= 2) ? bootSector.rootDirStartCluster : FAT_ROOT_DIR;
+    pVolume->llFat1Offset = llPartitionOffset + ((__int64)bootSector.sectorsBeforeFat << LAZY_SECTOR_SHIFT);
+    pVolume->llDataOffset = pVolume->llFat1Offset + 2 * (__int64)pVolume->ulFatSize;
+
+    if ((pVolume->ulClusterSize == 0) || (pVolume->ulFatEntries <= 2))
+    {
+        fprintf(stderr, "invalid boot sector.\n");
+        fat_lazy_close(pVolume);
+        return -1;
+    }
+
+    // Only the page table is allocated up front.
+    pVolume->ulPageCount = (pVolume->ulFatSize + FAT_LAZY_PAGE_SIZE - 1) / FAT_LAZY_PAGE_SIZE;
+    pVolume->ppFatPages = calloc(pVolume->ulPageCount, sizeof(uint32_t*));
+    if (pVolume->ppFatPages == 0)
+    {
+        fprintf(stderr, "allocations failed.\n");
+        fat_lazy_close(pVolume);
+        return -1;
+    }
+
+    return 0;
+}
+
+void fat_lazy_close(
+    fat_lazy_volume* pVolume)
+{
+    uint32_t ulPage = 0;
+
+    // Free the pVolume->ppFatPages pages.
+    if (0 != pVolume->ppFatPages)
+    {
+        for (ulPage = 0; ulPage < pVolume->ulPageCount; ++ulPage)
+            if (0 != pVolume->ppFatPages[ulPage])
+                free (pVolume->ppFatPages[ulPage]);
+
+        free (pVolume->ppFatPages);
+        pVolume->ppFatPages = 0;
+    }
+
+    if (pVolume->nImageFile >= 0)
+        fat_file_close(pVolume->nImageFile);
+
+    pVolume->nImageFile = -1;
+}
+
+int fat_lazy_fat_entry(
+    fat_lazy_volume* pVolume,
+    uint32_t         ulCluster,
+    uint32_t*        pulValue)
+{
+    uint32_t  ulPage = ulCluster / FAT_LAZY_PAGE_ENTRIES;
+    uint32_t* pPage = 0;
+    size_t    ulLength = FAT_LAZY_PAGE_SIZE;
+
+    if (ulCluster >= pVolume->ulFatEntries)
+    {
+        fprintf(stderr, "invalid cluster: %8.8X.\n", ulCluster);
+        return -1;
+    }
+
+    pPage = pVolume->ppFatPages[ulPage];
+
+    // Load the page on first touch.
+    if (pPage == 0)
+    {
+        pPage = malloc(FAT_LAZY_PAGE_SIZE);
+        if (pPage == 0)
+        {
+            fprintf(stderr, "allocations failed.\n");
+            return -1;
+        }
+
+        /* The last page may be short. */
+        if ((__int64)ulPage * FAT_LAZY_PAGE_SIZE + ulLength > pVolume->ulFatSize)
+            ulLength = pVolume->ulFatSize - ulPage * FAT_LAZY_PAGE_SIZE;
+
+        if ((__int64)ulLength != fat_file_pread(
+                pVolume->nImageFile,
+                pPage,
+                ulLength,
+                pVolume->llFat1Offset + (__int64)ulPage * FAT_LAZY_PAGE_SIZE))
+        {
+            fprintf(stderr, "read failed on FAT page: %u.\n", ulPage);
+            free (pPage);
+            return -1;
+        }
+
+        pVolume->ppFatPages[ulPage] = pPage;
+        ++pVolume->ulPagesLoaded;
+    }
+
+    *pulValue = pPage[ulCluster % FAT_LAZY_PAGE_ENTRIES] & LAZY_ENTRY_MASK;
+
+    return 0;
+}
+
+/* case-insensitive match of one path component against an 8.3 entry. */
+static int lazy_name_matches(
+    FAT32_DIR_ENTRY* pEntry,
+    const char*      pComponent,
+    size_t           ulLength)
+{
+    char   szName[FAT_INDEX_NAME_LENGTH];
+    size_t ulIndex = 0;
+
+    fat_index_format_name(pEntry->dosFilename, pEntry->dosExtension, szName);
+
+    for (ulIndex = 0; ulIndex < ulLength; ++ulIndex)
+        if ((szName[ulIndex] == 0) || (szName[ulIndex] != (char)toupper((unsigned char)pComponent[ulIndex])))
+            return 0;
+
+    return (szName[ulLength] == 0);
+}
+
+/* searches the live entries of one directory; returns 0 if found, 1 if not, -1 on error. */
+static int lazy_find_in_directory(
+    fat_lazy_volume* pVolume,
+    uint32_t         ulDirCluster,
+    const char*      pComponent,
+    size_t           ulLength,
+    FAT32_DIR_ENTRY* pDirectoryBuffer,
+    uint8_t*         pClasses,
+    FAT32_DIR_ENTRY* pEntry)
+{
+    uint32_t ulDirsPerCluster = pVolume->ulClusterSize / sizeof(FAT32_DIR_ENTRY);
+    uint32_t ulEntriesInUse = 0;
+    uint32_t ulIndex = 0;
+    uint32_t ulSteps = 0;
+
+    while ((ulDirCluster >= 2) && (ulDirCluster < FAT_EOC) && (ulSteps++ < pVolume->ulFatEntries))
+    {
+        if ((__int64)pVolume->ulClusterSize != fat_file_pread(
+                pVolume->nImageFile,
+                pDirectoryBuffer,
+                pVolume->ulClusterSize,
+                pVolume->llDataOffset + (__int64)(ulDirCluster - 2) * pVolume->ulClusterSize))
+        {
+            fprintf(stderr, "read failed on cluster: %8.8X.\n", ulDirCluster);
+            return -1;
+        }
+
+        ++pVolume->ulClustersRead;
+
+        ulEntriesInUse = fat_dirscan_classify(pDirectoryBuffer, ulDirsPerCluster, pClasses, 1);
+
+        for (ulIndex = 0; ulIndex < ulEntriesInUse; ++ulIndex)
+        {
+            if ((pClasses[ulIndex] != FAT_DIRSCAN_FILE) && (pClasses[ulIndex] != FAT_DIRSCAN_DIRECTORY))
+                continue;
+
+            if (0 != lazy_name_matches(&pDirectoryBuffer[ulIndex], pComponent, ulLength))
+            {
+                memcpy(pEntry, &pDirectoryBuffer[ulIndex], sizeof(FAT32_DIR_ENTRY));
+                return 0;
+            }
+        }
+
+        /* End of directory; later clusters hold no live entries. */
+        if (ulEntriesInUse < ulDirsPerCluster)
+            return 1;
+
+        if (0 != fat_lazy_fat_entry(pVolume, ulDirCluster, &ulDirCluster))
+            return -1;
+    }
+
+    return 1;
+}
+
+int fat_lazy_lookup(
+    fat_lazy_volume* pVolume,
+    const char*      szPath,
+    FAT32_DIR_ENTRY* pEntry)
+{
+    int              nReturnValue = 1;
+    FAT32_DIR_ENTRY* pDirectoryBuffer = 0;
+    uint8_t*         pClasses = 0;
+    uint32_t         ulDirCluster = pVolume->ulRootCluster;
+    const char*      pComponent = szPath;
+    size_t           ulLength = 0;
+
+    pDirectoryBuffer = malloc(pVolume->ulClusterSize);
+    pClasses = malloc(pVolume->ulClusterSize / sizeof(FAT32_DIR_ENTRY) + 1);
+    if ((pDirectoryBuffer == 0) || (pClasses == 0))
+    {
+        fprintf(stderr, "allocations failed.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    for (;;)
+    {
+        while (*pComponent == '/')
+            ++pComponent;
+
+        ulLength = strcspn(pComponent, "/");
+        if (ulLength == 0)
+            break;
+
+        /* Every component but the last must name a directory. */
+        if (ulDirCluster < 2)
+        {
+            nReturnValue = 1;
+            break;
+        }
+
+        nReturnValue = lazy_find_in_directory(
+            pVolume,
+            ulDirCluster,
+            pComponent,
+            ulLength,
+            pDirectoryBuffer,
+            pClasses,
+            pEntry);
+
+        if (nReturnValue != 0)
+            break;
+
+        ulDirCluster = 0;
+        if (0 != (pEntry->fileAttributes & FILE_ATTRIB_DIR))
+            ulDirCluster = ((uint32_t)pEntry->clusterAddressHigh << 16) | pEntry->clusterAddressLow;
+
+        pComponent += ulLength;
+    }
+
+exit:
+    // Free the pDirectoryBuffer buffer.
+    if (0 != pDirectoryBuffer)
+    {
+        free (pDirectoryBuffer);
+        pDirectoryBuffer = 0;
+    }
+
+    // Free the pClasses buffer.
+    if (0 != pClasses)
+    {
+        free (pClasses);
+        pClasses = 0;
+    }
+
+    return nReturnValue;
+}
+
+int fat_lazy_load_chain(
+    fat_lazy_volume* pVolume,
+    uint32_t         ulCluster,
+    fat_chain*       pChain,
+    fat_node**       ppNodes)
+{
+    fat_node* pNodes = 0;
+    fat_node* pGrown = 0;
+    uint32_t  ulCount = 0;
+    uint32_t  ulCapacity = 0;
+    uint32_t  ulValue = 0;
+
+    *ppNodes = 0;
+
+    while ((ulCluster >= 2) && (ulCluster < FAT_EOC))
+    {
+        /* A cycle can never be longer than the table. */
+        if (ulCount >= pVolume->ulFatEntries)
+        {
+            fprintf(stderr, "cyclic chain at cluster: %8.8X.\n", ulCluster);
+            free (pNodes);
+            return -1;
+        }
+
+        if (0 != fat_lazy_fat_entry(pVolume, ulCluster, &ulValue))
+        {
+            free (pNodes);
+            return -1;
+        }
+
+        if (ulCount == ulCapacity)
+        {
+            ulCapacity = (ulCapacity == 0) ? 64 : (ulCapacity << 1);
+            pGrown = realloc(pNodes, ulCapacity * sizeof(fat_node));
+
+            if (pGrown == 0)
+            {
+                fprintf(stderr, "allocations failed.\n");
+                free (pNodes);
+                return -1;
+            }
+
+            pNodes = pGrown;
+        }
+
+        pNodes[ulCount].cluster = ulCluster;
+        pNodes[ulCount].value = ulValue;
+        ++ulCount;
+
+        ulCluster = ulValue;
+    }
+
+    /* Link only once the array has stopped moving. */
+    for (ulValue = 0; ulValue < ulCount; ++ulValue)
+    {
+        pNodes[ulValue].prev = (ulValue > 0) ? &pNodes[ulValue - 1] : 0;
+        pNodes[ulValue].next = (ulValue + 1 < ulCount) ? &pNodes[ulValue + 1] : 0;
+    }
+
+    pChain->head = (ulCount > 0) ? &pNodes[0] : 0;
+    pChain->start = (ulCount > 0) ? pNodes[0].cluster : 0;
+    pChain->tail = (ulCount > 0) ? &pNodes[ulCount - 1] : 0;
+    *ppNodes = pNodes;
+
+    return 0;
+}
+
+int lazy_report_path(
+    const char*      szImageFilename,
+    const char*      szPath)
+{
+    int             nReturnValue = 0;
+    fat_lazy_volume volume;
+    FAT32_DIR_ENTRY entry;
+    fat_chain       chain;
+    fat_node*       pNodes = 0;
+
+    memset(&chain, 0x00, sizeof(chain));
+
+    if (0 != strpbrk(szPath, "*?["))
+    {
+        fprintf(stderr, "--lazy needs a literal path, not '%s'.\n", szPath);
+        return -1;
+    }
+
+    if (0 != fat_lazy_open(&volume, szImageFilename))
+        return -1;
+
+    nReturnValue = fat_lazy_lookup(&volume, szPath, &entry);
+
+    if (nReturnValue == 1)
+    {
+        fprintf(stderr, "no entries match '%s'.\n", szPath);
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    if (nReturnValue != 0)
+        goto exit;
+
+    nReturnValue = fat_lazy_load_chain(
+        &volume,
+        ((uint32_t)entry.clusterAddressHigh << 16) | entry.clusterAddressLow,
+        &chain,
+        &pNodes);
+
+    if (nReturnValue != 0)
+        goto exit;
+
+    memcpy(chain.filename, entry.dosFilename, sizeof(chain.filename));
+    memcpy(chain.extension, entry.dosExtension, sizeof(chain.extension));
+    chain.attributes = entry.fileAttributes;
+    chain.filesize = entry.fileSizeBytes;
+    chain.timestamp.time_ms = entry.creationTimeMs;
+    chain.timestamp.time.value = entry.creationTimeHMS;
+    chain.timestamp.date.value = entry.creationDate;
+    chain.modifytime = entry.modificationTime;
+    chain.modifydate = entry.modificationDate;
+    chain.accessdate = entry.accessDate;
+    chain.populated = 1;
+
+    fprintf(stdout, "%s\n", szPath);
+
+    if (chain.head != 0)
+        report_fat_chain(&chain);
+    else
+        fprintf(stdout, "%8.8s %3.3s : %10dB : %2.2X : no clusters allocated.\n",
+            chain.filename, chain.extension, chain.filesize, chain.attributes);
+
+    fprintf(stdout, "lazy lookup: %u of %u FAT pages loaded, %u directory clusters read.\n",
+        volume.ulPagesLoaded,
+        volume.ulPageCount,
+        volume.ulClustersRead);
+
+exit:
+    // Free the pNodes buffer.
+    if (0 != pNodes)
+    {
+        free (pNodes);
+        pNodes = 0;
+    }
+
+    fat_lazy_close(&volume);
+
+    return nReturnValue;
+}
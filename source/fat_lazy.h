@@ -0,0 +1,64 @@
+#ifndef __FAT_LAZY_H_HEADER__
+#define __FAT_LAZY_H_HEADER__
+
+#include "stdint.h"
+#include "fat_defs.h"
+#include "fat_process.h"
+#include "fat_platform.h"
+
+#define FAT_LAZY_PAGE_SIZE    (4096)                    /* bytes of FAT loaded per touch. */
+#define FAT_LAZY_PAGE_ENTRIES (FAT_LAZY_PAGE_SIZE >> 2)
+
+/**
+ * Volume opened without reading the FATs.
+ *
+ * Only the boot sector is parsed at open; FAT1 is paged in on first touch
+ * and directories are read only along the path being resolved.
+ */
+typedef struct FAT_LAZY_VOLUME {
+    int        nImageFile;
+    uint32_t   ulClusterSize;
+    uint32_t   ulFatSize;
+    uint32_t   ulFatEntries;
+    uint32_t   ulRootCluster;
+    __int64    llFat1Offset;
+    __int64    llDataOffset;    /* offset of cluster 2. */
+
+    uint32_t** ppFatPages;      /* 0 until the page is first touched. */
+    uint32_t   ulPageCount;
+    uint32_t   ulPagesLoaded;
+    uint32_t   ulClustersRead;  /* directory clusters read so far. */
+} fat_lazy_volume;
+
+int fat_lazy_open(
+    fat_lazy_volume* pVolume,
+    const char*      szImageFilename);
+
+void fat_lazy_close(
+    fat_lazy_volume* pVolume);
+
+/* FAT1 value of ulCluster, loading its page if needed. */
+int fat_lazy_fat_entry(
+    fat_lazy_volume* pVolume,
+    uint32_t         ulCluster,
+    uint32_t*        pulValue);
+
+/* returns 0 if found, 1 if not, -1 on error. */
+int fat_lazy_lookup(
+    fat_lazy_volume* pVolume,
+    const char*      szPath,
+    FAT32_DIR_ENTRY* pEntry);
+
+/* builds the chain starting at ulCluster; *ppNodes must be freed by the caller. */
+int fat_lazy_load_chain(
+    fat_lazy_volume* pVolume,
+    uint32_t         ulCluster,
+    fat_chain*       pChain,
+    fat_node**       ppNodes);
+
+/* resolves and reports a single /path, touching only what the path needs. */
+int lazy_report_path(
+    const char*      szImageFilename,
+    const char*      szPath);
+
+#endif /* __FAT_LAZY_H_HEADER__ */
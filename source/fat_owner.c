@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <ctype.h>
+
+#include "stdint.h"
+#include "fat_process.h"
+#include "fat_index.h"
+#include "fat_platform.h"
+#include "fat_spill.h"
+#include "fat_owner.h"
+
+#define OWNER_SECTOR_SIZE  (512)
+#define OWNER_QUERY_LENGTH (64)
+
+static int compare_owner_extents(
+    const void* pLeft,
+    const void* pRight)
+{
+    uint32_t ulLeft = ((const fat_owner_extent*)pLeft)->ulFirst;
+    uint32_t ulRight = ((const fat_owner_extent*)pRight)->ulFirst;
+
+    return (ulLeft < ulRight) ? -1 : ((ulLeft > ulRight) ? 1 : 0);
+}
+
+/* runs of consecutive clusters in every chain; bounded against FAT loops. */
+static uint32_t count_owner_extents(
+    fat_chain* pFatChainList,
+    uint32_t   ulFatChainCount,
+    uint32_t   ulClusterCount)
+{
+    uint32_t  ulChainIndex = 0;
+    uint32_t  ulSteps = 0;
+    uint32_t  ulExtents = 0;
+    uint32_t  ulPrevious = 0;
+    fat_node* pFatNode = 0;
+
+    for (ulChainIndex = 0; ulChainIndex < ulFatChainCount; ++ulChainIndex)
+    {
+        pFatNode = pFatChainList[ulChainIndex].head;
+
+        for (ulSteps = 0; (pFatNode != 0) && (ulSteps < ulClusterCount); ++ulSteps)
+        {
+            if ((ulSteps == 0) || (pFatNode->cluster != ulPrevious + 1))
+                ++ulExtents;
+
+            ulPrevious = pFatNode->cluster;
+
+            if (pFatNode == pFatChainList[ulChainIndex].tail)
+                break;
+
+            pFatNode = pFatNode->next;
+        }
+    }
+
+    return ulExtents;
+}
+
+int fat_owner_map_build(
+    fat_owner_map* pMap,
+    fat_chain*     pFatChainList,
+    uint32_t       ulFatChainCount,
+    uint32_t       ulFatSize,
+    uint64_t       ullBudget)
+{
+    uint32_t          ulClusterCount = ulFatSize >> 2;
+    uint32_t          ulChainIndex = 0;
+    uint32_t          ulSteps = 0;
+    uint32_t          ulExtents = 0;
+    fat_node*         pFatNode = 0;
+    fat_owner_extent* pExtent = 0;
+
+    memset(pMap, 0x00, sizeof(fat_owner_map));
+    pMap->ulClusterCount = ulClusterCount;
+
+    /* Fall back to runs only when the dense arrays would not fit. */
+    if ((ullBudget != 0) && ((uint64_t)ulClusterCount * 2 * sizeof(uint32_t) > ullBudget))
+    {
+        ulExtents = count_owner_extents(pFatChainList, ulFatChainCount, ulClusterCount);
+
+        pMap->pExtents = fat_spill_alloc((ulExtents + 1) * sizeof(fat_owner_extent));
+        if (pMap->pExtents == 0)
+        {
+            fprintf(stderr, "allocations failed.\n");
+            return -1;
+        }
+    }
+    else
+    {
+        pMap->pChains = fat_spill_alloc(ulClusterCount * sizeof(uint32_t));
+        pMap->pPositions = fat_spill_alloc(ulClusterCount * sizeof(uint32_t));
+        if ((pMap->pChains == 0) || (pMap->pPositions == 0))
+        {
+            fprintf(stderr, "allocations failed.\n");
+            fat_owner_map_free(pMap);
+            return -1;
+        }
+    }
+
+    for (ulChainIndex = 0; ulChainIndex < ulFatChainCount; ++ulChainIndex)
+    {
+        pFatNode = pFatChainList[ulChainIndex].head;
+
+        for (ulSteps = 0; (pFatNode != 0) && (ulSteps < ulClusterCount); ++ulSteps)
+        {
+            if (pMap->pExtents == 0)
+            {
+                pMap->pChains[pFatNode->cluster] = ulChainIndex + 1;
+                pMap->pPositions[pFatNode->cluster] = ulSteps;
+            }
+            else if ((ulSteps == 0) || (pFatNode->cluster != pExtent->ulFirst + pExtent->ulCount))
+            {
+                pExtent = &pMap->pExtents[pMap->ulExtentCount++];
+                pExtent->ulFirst = pFatNode->cluster;
+                pExtent->ulCount = 1;
+                pExtent->ulChain = ulChainIndex;
+                pExtent->ulPosition = ulSteps;
+            }
+            else
+            {
+                ++pExtent->ulCount;
+            }
+
+            if (pFatNode == pFatChainList[ulChainIndex].tail)
+                break;
+
+            pFatNode = pFatNode->next;
+        }
+    }
+
+    if (pMap->pExtents != 0)
+        qsort(pMap->pExtents, pMap->ulExtentCount, sizeof(fat_owner_extent), compare_owner_extents);
+
+    return 0;
+}
+
+void fat_owner_map_free(
+    fat_owner_map* pMap)
+{
+    // Free the pMap->pChains buffer.
+    if (0 != pMap->pChains)
+    {
+        fat_spill_free (pMap->pChains);
+        pMap->pChains = 0;
+    }
+
+    // Free the pMap->pPositions buffer.
+    if (0 != pMap->pPositions)
+    {
+        fat_spill_free (pMap->pPositions);
+        pMap->pPositions = 0;
+    }
+
+    // Free the pMap->pExtents buffer.
+    if (0 != pMap->pExtents)
+    {
+        fat_spill_free (pMap->pExtents);
+        pMap->pExtents = 0;
+    }
+
+    pMap->ulExtentCount = 0;
+    pMap->ulClusterCount = 0;
+}
+
+uint64_t fat_owner_map_bytes(
+    const fat_owner_map* pMap)
+{
+    if (pMap->pExtents != 0)
+        return (uint64_t)pMap->ulExtentCount * sizeof(fat_owner_extent);
+
+    if (pMap->pChains != 0)
+        return (uint64_t)pMap->ulClusterCount * 2 * sizeof(uint32_t);
+
+    return 0;
+}
+
+uint32_t fat_owner_lookup(
+    const fat_owner_map* pMap,
+    uint32_t             ulCluster,
+    uint32_t*            pulPosition)
+{
+    uint32_t ulLow = 0;
+    uint32_t ulHigh = pMap->ulExtentCount;
+    uint32_t ulMiddle = 0;
+
+    if (ulCluster >= pMap->ulClusterCount)
+        return FAT_OWNER_NONE;
+
+    if (pMap->pChains != 0)
+    {
+        if (pMap->pChains[ulCluster] == 0)
+            return FAT_OWNER_NONE;
+
+        if (pulPosition != 0)
+            *pulPosition = pMap->pPositions[ulCluster];
+
+        return pMap->pChains[ulCluster] - 1;
+    }
+
+    /* last run starting at or before ulCluster. */
+    while (ulLow < ulHigh)
+    {
+        ulMiddle = ulLow + ((ulHigh - ulLow) >> 1);
+
+        if (pMap->pExtents[ulMiddle].ulFirst <= ulCluster)
+            ulLow = ulMiddle + 1;
+        else
+            ulHigh = ulMiddle;
+    }
+
+    if ((ulLow == 0) ||
+        (ulCluster - pMap->pExtents[ulLow - 1].ulFirst >= pMap->pExtents[ulLow - 1].ulCount))
+        return FAT_OWNER_NONE;
+
+    if (pulPosition != 0)
+        *pulPosition = pMap->pExtents[ulLow - 1].ulPosition + (ulCluster - pMap->pExtents[ulLow - 1].ulFirst);
+
+    return pMap->pExtents[ulLow - 1].ulChain;
+}
+
+static int report_owner(
+    const fat_owner_map* pMap,
+    fat_index*           pIndex,
+    uint32_t             ulRootDirOffset,
+    uint32_t             ulClusterSize,
+    const char*          szQuery,
+    size_t               ulLength)
+{
+    char        szOffset[OWNER_QUERY_LENGTH];
+    char*       szEnd = 0;
+    uint64_t    ullOffset = 0;
+    uint64_t    ullInFile = 0;
+    uint32_t    ulCluster = 0;
+    uint32_t    ulChain = 0;
+    uint32_t    ulPosition = 0;
+    fat_chain*  pChain = 0;
+    const char* szPath = 0;
+
+    while ((ulLength > 0) && isspace((unsigned char)*szQuery))
+        ++szQuery, --ulLength;
+
+    while ((ulLength > 0) && isspace((unsigned char)szQuery[ulLength - 1]))
+        --ulLength;
+
+    if (ulLength == 0)
+        return 0;
+
+    if (ulLength >= sizeof(szOffset))
+    {
+        fprintf(stderr, "bad offset '%.*s'.\n", (int)ulLength, szQuery);
+        return -1;
+    }
+
+    memcpy(szOffset, szQuery, ulLength);
+    szOffset[ulLength] = 0;
+
+    ullOffset = _strtoui64(szOffset, &szEnd, 0);
+
+    if ((*szEnd == 's') || (*szEnd == 'S'))
+    {
+        ullOffset *= OWNER_SECTOR_SIZE;
+        ++szEnd;
+    }
+
+    if ((szEnd == szOffset) || (*szEnd != 0))
+    {
+        fprintf(stderr, "bad offset '%s'.\n", szOffset);
+        return -1;
+    }
+
+    if (ullOffset < ulRootDirOffset)
+    {
+        fprintf(stdout, "[%12.12llX] reserved sectors or FAT\n", (unsigned long long)ullOffset);
+        return 0;
+    }
+
+    if ((ullOffset - ulRootDirOffset) / ulClusterSize >= pMap->ulClusterCount - FAT_ROOT_DIR)
+    {
+        fprintf(stdout, "[%12.12llX] past the last cluster\n", (unsigned long long)ullOffset);
+        return 0;
+    }
+
+    ulCluster = (uint32_t)((ullOffset - ulRootDirOffset) / ulClusterSize) + FAT_ROOT_DIR;
+    ulChain = fat_owner_lookup(pMap, ulCluster, &ulPosition);
+
+    if (ulChain == FAT_OWNER_NONE)
+    {
+        fprintf(stdout, "[%12.12llX] free (cluster %8.8X)\n", (unsigned long long)ullOffset, ulCluster);
+        return 0;
+    }
+
+    pChain = &pIndex->pChainList[ulChain];
+    szPath = fat_index_path(pIndex, pChain);
+    ullInFile = (uint64_t)ulPosition * ulClusterSize + (ullOffset - ulRootDirOffset) % ulClusterSize;
+
+    fprintf(stdout, "[%12.12llX] %s : +%llu (cluster %8.8X)%s\n",
+        (unsigned long long)ullOffset,
+        (szPath != 0) ? szPath : "(no directory entry)",
+        (unsigned long long)ullInFile,
+        ulCluster,
+        (((pChain->attributes & FILE_ATTRIB_DIR) == 0) && (szPath != 0) &&
+         (ullInFile >= pChain->filesize)) ? " slack" : "");
+
+    return 0;
+}
+
+int report_owners(
+    const fat_owner_map* pMap,
+    fat_index*           pIndex,
+    uint32_t             ulRootDirOffset,
+    uint32_t             ulClusterSize,
+    const char*          szOffsets,
+    const char*          szBatchFile)
+{
+    FILE*       pBatch = 0;
+    char        szLine[256];
+    const char* szComma = 0;
+    int         nReturnValue = 0;
+
+    while ((szOffsets != 0) && (*szOffsets != 0))
+    {
+        szComma = strchr(szOffsets, ',');
+        if (szComma == 0)
+            szComma = szOffsets + strlen(szOffsets);
+
+        if (0 != report_owner(pMap, pIndex, ulRootDirOffset, ulClusterSize, szOffsets, szComma - szOffsets))
+            nReturnValue = -1;
+
+        szOffsets = (*szComma != 0) ? szComma + 1 : szComma;
+    }
+
+    if (szBatchFile == 0)
+        return nReturnValue;
+
+    pBatch = fopen(szBatchFile, "r");
+    if (pBatch == 0)
+    {
+        fprintf(stderr, "fopen() failed on file: '%s'.\n", szBatchFile);
+        return -1;
+    }
+
+    while (0 != fgets(szLine, sizeof(szLine), pBatch))
+    {
+        if (0 != strchr(szLine, '#'))
+            *strchr(szLine, '#') = 0;
+
+        if (0 != report_owner(pMap, pIndex, ulRootDirOffset, ulClusterSize, szLine, strlen(szLine)))
+            nReturnValue = -1;
+    }
+
+    fclose(pBatch);
+
+    return nReturnValue;
+}
@@ -0,0 +1,69 @@
+#ifndef __FAT_OWNER_H_HEADER__
+#define __FAT_OWNER_H_HEADER__
+
+#include "stdint.h"
+#include "fat_process.h"
+#include "fat_index.h"
+
+#define FAT_OWNER_NONE (0xFFFFFFFF)
+
+/* a run of consecutive clusters of one chain. */
+typedef struct FAT_OWNER_EXTENT {
+    uint32_t  ulFirst;      /* first cluster of the run. */
+    uint32_t  ulCount;
+    uint32_t  ulChain;      /* index into the chain list. */
+    uint32_t  ulPosition;   /* cluster index of ulFirst within its chain. */
+} fat_owner_extent;
+
+/**
+ * Cluster to (chain, cluster-in-chain) map, the reverse of the chains.
+ *
+ * The dense form keeps both per cluster, eight bytes each, for O(1)
+ * lookups.  When that does not fit the memory budget the map keeps only
+ * the runs of consecutive clusters, sorted by first cluster, and binary
+ * searches them.  Cross-linked clusters resolve to the chain walked last.
+ */
+typedef struct FAT_OWNER_MAP {
+    uint32_t*          pChains;         /* dense: chain index + 1 per cluster, 0 if free. */
+    uint32_t*          pPositions;      /* dense: cluster index within the chain. */
+    fat_owner_extent*  pExtents;        /* sparse: runs sorted by ulFirst. */
+    uint32_t           ulExtentCount;
+    uint32_t           ulClusterCount;
+} fat_owner_map;
+
+/* walks every chain once; ullBudget (0 for none) selects the form. */
+int fat_owner_map_build(
+    fat_owner_map* pMap,
+    fat_chain*     pFatChainList,
+    uint32_t       ulFatChainCount,
+    uint32_t       ulFatSize,
+    uint64_t       ullBudget);
+
+void fat_owner_map_free(
+    fat_owner_map* pMap);
+
+uint64_t fat_owner_map_bytes(
+    const fat_owner_map* pMap);
+
+/* returns the chain index owning ulCluster, or FAT_OWNER_NONE.  the
+   cluster's index within the chain goes to *pulPosition (may be 0). */
+uint32_t fat_owner_lookup(
+    const fat_owner_map* pMap,
+    uint32_t             ulCluster,
+    uint32_t*            pulPosition);
+
+/**
+ * Resolves each image offset in szOffsets (comma separated) and in the
+ * file szBatchFile (one per line, '#' comments), either of which may be 0.
+ * Offsets are bytes, decimal or 0x hex; a trailing 's' makes one a
+ * 512-byte sector number instead.
+ */
+int report_owners(
+    const fat_owner_map* pMap,
+    fat_index*           pIndex,
+    uint32_t             ulRootDirOffset,
+    uint32_t             ulClusterSize,
+    const char*          szOffsets,
+    const char*          szBatchFile);
+
+#endif /* __FAT_OWNER_H_HEADER__ */
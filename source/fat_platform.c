@@ -0,0 +1,744 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <direct.h>
+#include <sys/utime.h>
+#else
+#include <unistd.h>
+#include <utime.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/sendfile.h>
+#endif
+#endif
+
+#include "stdint.h"
+#include "fat_platform.h"
+
+/* glibc only names these with _GNU_SOURCE; the values are fixed ABI. */
+#if defined(__linux__) && !defined(SEEK_DATA)
+#define SEEK_DATA 3
+#define SEEK_HOLE 4
+#endif
+
+#define FAT_COPY_BUFFER_SIZE (1 << 20)
+#define FAT_PATH_LENGTH      (4096)
+#define FAT_HUGE_PAGE_SIZE   ((uint64_t)2 << 20)
+
+#ifdef _WIN32
+static DWORD WINAPI fat_thread_entry(LPVOID pArgument)
+{
+    fat_thread* pThread = (fat_thread*)pArgument;
+
+    pThread->nResult = pThread->pfnProc(pThread->pContext);
+
+    return 0;
+}
+#else
+static void* fat_thread_entry(void* pArgument)
+{
+    fat_thread* pThread = (fat_thread*)pArgument;
+
+    pThread->nResult = pThread->pfnProc(pThread->pContext);
+
+    return 0;
+}
+#endif
+
+int fat_thread_start(
+    fat_thread*     pThread,
+    fat_thread_proc pfnProc,
+    void*           pContext)
+{
+    pThread->pfnProc = pfnProc;
+    pThread->pContext = pContext;
+    pThread->nResult = 0;
+
+#ifdef _WIN32
+    pThread->hThread = CreateThread(0, 0, fat_thread_entry, pThread, 0, 0);
+
+    return (pThread->hThread != 0) ? 0 : -1;
+#else
+    return (0 == pthread_create(&pThread->thread, 0, fat_thread_entry, pThread)) ? 0 : -1;
+#endif
+}
+
+int fat_thread_join(fat_thread* pThread)
+{
+#ifdef _WIN32
+    WaitForSingleObject(pThread->hThread, INFINITE);
+    CloseHandle(pThread->hThread);
+#else
+    pthread_join(pThread->thread, 0);
+#endif
+
+    return pThread->nResult;
+}
+
+void fat_mutex_init(fat_mutex* pMutex)
+{
+#ifdef _WIN32
+    InitializeCriticalSection(&pMutex->section);
+#else
+    pthread_mutex_init(&pMutex->mutex, 0);
+#endif
+}
+
+void fat_mutex_lock(fat_mutex* pMutex)
+{
+#ifdef _WIN32
+    EnterCriticalSection(&pMutex->section);
+#else
+    pthread_mutex_lock(&pMutex->mutex);
+#endif
+}
+
+void fat_mutex_unlock(fat_mutex* pMutex)
+{
+#ifdef _WIN32
+    LeaveCriticalSection(&pMutex->section);
+#else
+    pthread_mutex_unlock(&pMutex->mutex);
+#endif
+}
+
+void fat_mutex_destroy(fat_mutex* pMutex)
+{
+#ifdef _WIN32
+    DeleteCriticalSection(&pMutex->section);
+#else
+    pthread_mutex_destroy(&pMutex->mutex);
+#endif
+}
+
+uint32_t fat_cpu_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO systemInfo;
+
+    GetSystemInfo(&systemInfo);
+
+    return (systemInfo.dwNumberOfProcessors > 0) ? systemInfo.dwNumberOfProcessors : 1;
+#else
+    long lCount = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return (lCount > 0) ? (uint32_t)lCount : 1;
+#endif
+}
+
+double fat_clock_seconds(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER llCounter;
+    LARGE_INTEGER llFrequency;
+
+    QueryPerformanceCounter(&llCounter);
+    QueryPerformanceFrequency(&llFrequency);
+
+    return (double)llCounter.QuadPart / (double)llFrequency.QuadPart;
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+#endif
+}
+
+int fat_file_open_read(const char* szPath)
+{
+#ifdef _WIN32
+    return _open(szPath, _O_RDONLY | _O_BINARY);
+#else
+    return open(szPath, O_RDONLY);
+#endif
+}
+
+int fat_file_create(const char* szPath)
+{
+#ifdef _WIN32
+    return _open(szPath, _O_RDWR | _O_BINARY | _O_CREAT | _O_TRUNC, _S_IREAD | _S_IWRITE);
+#else
+    return open(szPath, O_RDWR | O_CREAT | O_TRUNC, 0644);
+#endif
+}
+
+int fat_file_create_new(const char* szPath)
+{
+#ifdef _WIN32
+    return _open(szPath, _O_RDWR | _O_BINARY | _O_CREAT | _O_EXCL, _S_IREAD | _S_IWRITE);
+#else
+    return open(szPath, O_RDWR | O_CREAT | O_EXCL, 0644);
+#endif
+}
+
+int fat_file_open_write(const char* szPath)
+{
+#ifdef _WIN32
+    return _open(szPath, _O_RDWR | _O_BINARY);
+#else
+    return open(szPath, O_RDWR);
+#endif
+}
+
+int fat_file_sync(int nFile)
+{
+#ifdef _WIN32
+    return _commit(nFile);
+#else
+    return fsync(nFile);
+#endif
+}
+
+int fat_file_close(int nFile)
+{
+#ifdef _WIN32
+    return _close(nFile);
+#else
+    return close(nFile);
+#endif
+}
+
+int fat_file_binary_mode(int nFile)
+{
+#ifdef _WIN32
+    return (-1 == _setmode(nFile, _O_BINARY)) ? -1 : 0;
+#else
+    return (nFile < 0) ? -1 : 0;
+#endif
+}
+
+__int64 fat_file_size(int nFile)
+{
+#ifdef _WIN32
+    struct _stati64 fileStatus;
+
+    return (0 == _fstati64(nFile, &fileStatus)) ? fileStatus.st_size : -1;
+#else
+    struct stat fileStatus;
+
+    return (0 == fstat(nFile, &fileStatus)) ? (__int64)fileStatus.st_size : -1;
+#endif
+}
+
+int fat_file_is_same(
+    int         nFile,
+    const char* szPath)
+{
+#ifdef _WIN32
+    BY_HANDLE_FILE_INFORMATION fileInfo;
+    BY_HANDLE_FILE_INFORMATION pathInfo;
+    HANDLE hPath = INVALID_HANDLE_VALUE;
+    int    nSame = 0;
+
+    hPath = CreateFileA(szPath, 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+
+    if (hPath == INVALID_HANDLE_VALUE)
+        return 0;
+
+    if (GetFileInformationByHandle((HANDLE)_get_osfhandle(nFile), &fileInfo) &&
+        GetFileInformationByHandle(hPath, &pathInfo))
+    {
+        nSame = (fileInfo.dwVolumeSerialNumber == pathInfo.dwVolumeSerialNumber) &&
+                (fileInfo.nFileIndexHigh == pathInfo.nFileIndexHigh) &&
+                (fileInfo.nFileIndexLow == pathInfo.nFileIndexLow);
+    }
+
+    CloseHandle(hPath);
+
+    return nSame;
+#else
+    struct stat fileStatus;
+    struct stat pathStatus;
+
+    if ((0 != fstat(nFile, &fileStatus)) || (0 != stat(szPath, &pathStatus)))
+        return 0;
+
+    return (fileStatus.st_dev == pathStatus.st_dev) && (fileStatus.st_ino == pathStatus.st_ino);
+#endif
+}
+
+__int64 fat_file_seek_data(
+    int      nFile,
+    __int64  llOffset,
+    __int64* pllHole)
+{
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    off_t   llPosition = lseek(nFile, 0, SEEK_CUR);
+    __int64 llData = (__int64)lseek(nFile, (off_t)llOffset, SEEK_DATA);
+
+    if (llData < 0)
+    {
+        llData = (errno == ENXIO) ? -2 : -1;
+    }
+    else
+    {
+        *pllHole = (__int64)lseek(nFile, (off_t)llData, SEEK_HOLE);
+        if (*pllHole < 0)
+            llData = -1;
+    }
+
+    lseek(nFile, llPosition, SEEK_SET);
+
+    return llData;
+#else
+    return -1;
+#endif
+}
+
+__int64 fat_file_pread(
+    int     nFile,
+    void*   pBuffer,
+    size_t  ulLength,
+    __int64 llOffset)
+{
+#ifdef _WIN32
+    OVERLAPPED overlapped;
+    DWORD      dwBytesRead = 0;
+
+    memset(&overlapped, 0x00, sizeof(overlapped));
+    overlapped.Offset = (DWORD)(llOffset & 0xFFFFFFFF);
+    overlapped.OffsetHigh = (DWORD)(llOffset >> 32);
+
+    if (!ReadFile((HANDLE)_get_osfhandle(nFile), pBuffer, (DWORD)ulLength, &dwBytesRead, &overlapped))
+        return (GetLastError() == ERROR_HANDLE_EOF) ? 0 : -1;
+
+    return dwBytesRead;
+#else
+    size_t  ulDone = 0;
+    ssize_t lResult = 0;
+
+    while (ulDone < ulLength)
+    {
+        lResult = pread(nFile, (char*)pBuffer + ulDone, ulLength - ulDone, (off_t)(llOffset + ulDone));
+
+        if ((lResult < 0) && (errno == EINTR))
+            continue;
+
+        if (lResult < 0)
+            return -1;
+
+        if (lResult == 0)
+            break;
+
+        ulDone += (size_t)lResult;
+    }
+
+    return (__int64)ulDone;
+#endif
+}
+
+__int64 fat_file_pwrite(
+    int         nFile,
+    const void* pBuffer,
+    size_t      ulLength,
+    __int64     llOffset)
+{
+#ifdef _WIN32
+    OVERLAPPED overlapped;
+    DWORD      dwBytesWritten = 0;
+
+    memset(&overlapped, 0x00, sizeof(overlapped));
+    overlapped.Offset = (DWORD)(llOffset & 0xFFFFFFFF);
+    overlapped.OffsetHigh = (DWORD)(llOffset >> 32);
+
+    if (!WriteFile((HANDLE)_get_osfhandle(nFile), pBuffer, (DWORD)ulLength, &dwBytesWritten, &overlapped))
+        return -1;
+
+    return dwBytesWritten;
+#else
+    size_t  ulDone = 0;
+    ssize_t lResult = 0;
+
+    while (ulDone < ulLength)
+    {
+        lResult = pwrite(nFile, (const char*)pBuffer + ulDone, ulLength - ulDone, (off_t)(llOffset + ulDone));
+
+        if ((lResult < 0) && (errno == EINTR))
+            continue;
+
+        if (lResult <= 0)
+            return -1;
+
+        ulDone += (size_t)lResult;
+    }
+
+    return (__int64)ulDone;
+#endif
+}
+
+__int64 fat_file_copy_range(
+    int     nFileIn,
+    __int64 llOffsetIn,
+    int     nFileOut,
+    __int64 llOffsetOut,
+    __int64 llLength)
+{
+    __int64 llCopied = 0;
+    __int64 llResult = 0;
+    size_t  ulChunk = 0;
+    void*   pBuffer = 0;
+
+#ifdef __linux__
+    loff_t  llKernelIn = 0;
+    loff_t  llKernelOut = 0;
+    off_t   lSendOffset = 0;
+
+#ifdef SYS_copy_file_range
+    /* In-kernel copy; may share extents on reflink capable file systems. */
+    while (llCopied < llLength)
+    {
+        llKernelIn = (loff_t)(llOffsetIn + llCopied);
+        llKernelOut = (loff_t)(llOffsetOut + llCopied);
+
+        llResult = syscall(SYS_copy_file_range, nFileIn, &llKernelIn, nFileOut, &llKernelOut,
+            (size_t)(llLength - llCopied), 0);
+
+        if ((llResult < 0) && (errno == EINTR))
+            continue;
+
+        if (llResult <= 0)
+            break;
+
+        llCopied += llResult;
+    }
+
+    if (llCopied == llLength)
+        return llCopied;
+#endif
+
+    /* sendfile() writes at the output descriptor's position. */
+    if (lseek(nFileOut, (off_t)(llOffsetOut + llCopied), SEEK_SET) >= 0)
+    {
+        while (llCopied < llLength)
+        {
+            lSendOffset = (off_t)(llOffsetIn + llCopied);
+            llResult = sendfile(nFileOut, nFileIn, &lSendOffset, (size_t)(llLength - llCopied));
+
+            if ((llResult < 0) && (errno == EINTR))
+                continue;
+
+            if (llResult <= 0)
+                break;
+
+            llCopied += llResult;
+        }
+    }
+
+    if (llCopied == llLength)
+        return llCopied;
+#endif
+
+    /* Portable bounce-buffer fallback. */
+    pBuffer = malloc(FAT_COPY_BUFFER_SIZE);
+    if (pBuffer == 0)
+        return -1;
+
+    while (llCopied < llLength)
+    {
+        ulChunk = ((llLength - llCopied) > FAT_COPY_BUFFER_SIZE) ?
+            FAT_COPY_BUFFER_SIZE : (size_t)(llLength - llCopied);
+
+        llResult = fat_file_pread(nFileIn, pBuffer, ulChunk, llOffsetIn + llCopied);
+        if (llResult <= 0)
+            break;
+
+        if (llResult != fat_file_pwrite(nFileOut, pBuffer, (size_t)llResult, llOffsetOut + llCopied))
+        {
+            llCopied = -1;
+            break;
+        }
+
+        llCopied += llResult;
+    }
+
+    free (pBuffer);
+
+    return llCopied;
+}
+
+void fat_file_readahead(
+    int     nFile,
+    __int64 llOffset,
+    __int64 llLength)
+{
+#if defined(POSIX_FADV_WILLNEED)
+    posix_fadvise(nFile, (off_t)llOffset, (off_t)llLength, POSIX_FADV_WILLNEED);
+#endif
+}
+
+void fat_file_drop_cache(
+    int     nFile,
+    __int64 llOffset,
+    __int64 llLength)
+{
+#if defined(POSIX_FADV_DONTNEED)
+    posix_fadvise(nFile, (off_t)llOffset, (off_t)llLength, POSIX_FADV_DONTNEED);
+#endif
+}
+
+int fat_file_set_sparse(int nFile)
+{
+#ifdef _WIN32
+    DWORD ulReturned = 0;
+
+    return DeviceIoControl((HANDLE)_get_osfhandle(nFile), FSCTL_SET_SPARSE, 0, 0, 0, 0, &ulReturned, 0) ? 0 : -1;
+#else
+    (void)nFile;
+    return 0;
+#endif
+}
+
+int fat_file_truncate(
+    int     nFile,
+    __int64 llSize)
+{
+#ifdef _WIN32
+    return _chsize_s(nFile, llSize);
+#else
+    return ftruncate(nFile, (off_t)llSize);
+#endif
+}
+
+int fat_file_set_times(
+    const char* szPath,
+    time_t      tAccess,
+    time_t      tModify)
+{
+#ifdef _WIN32
+    struct _utimbuf times;
+
+    times.actime = tAccess;
+    times.modtime = tModify;
+
+    return _utime(szPath, &times);
+#else
+    struct utimbuf times;
+
+    times.actime = tAccess;
+    times.modtime = tModify;
+
+    return utime(szPath, &times);
+#endif
+}
+
+int fat_file_rename(
+    const char* szFrom,
+    const char* szTo)
+{
+#ifdef _WIN32
+    return MoveFileExA(szFrom, szTo, MOVEFILE_REPLACE_EXISTING) ? 0 : -1;
+#else
+    return rename(szFrom, szTo);
+#endif
+}
+
+int fat_make_directory(const char* szPath)
+{
+    int nStatus;
+
+#ifdef _WIN32
+    nStatus = _mkdir(szPath);
+#else
+    nStatus = mkdir(szPath, 0755);
+#endif
+
+    return ((nStatus == 0) || (errno == EEXIST)) ? 0 : -1;
+}
+
+int fat_make_parent_directories(const char* szPath)
+{
+    char   szPrefix[FAT_PATH_LENGTH];
+    size_t ulLength = strlen(szPath);
+    size_t ulIndex = 0;
+
+    if (ulLength >= sizeof(szPrefix))
+        return -1;
+
+    memcpy(szPrefix, szPath, ulLength + 1);
+
+    for (ulIndex = 1; ulIndex < ulLength; ++ulIndex)
+    {
+        if (szPrefix[ulIndex] != '/')
+            continue;
+
+        szPrefix[ulIndex] = 0;
+
+        if (0 != fat_make_directory(szPrefix))
+            return -1;
+
+        szPrefix[ulIndex] = '/';
+    }
+
+    return 0;
+}
+
+void* fat_scratch_map(
+    const char* szDirectory,
+    uint64_t    ullBytes)
+{
+    char   szPath[FAT_PATH_LENGTH];
+    void*  pMapping = 0;
+#ifdef _WIN32
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    HANDLE hSection = 0;
+
+    if (0 == GetTempFileNameA(szDirectory, "fw", 0, szPath))
+        return 0;
+
+    /* Deleted with its last handle; the view below keeps it alive. */
+    hFile = CreateFileA(
+        szPath,
+        GENERIC_READ | GENERIC_WRITE,
+        0,
+        0,
+        CREATE_ALWAYS,
+        FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+        0);
+
+    if (hFile == INVALID_HANDLE_VALUE)
+        return 0;
+
+    hSection = CreateFileMappingA(hFile, 0, PAGE_READWRITE, (DWORD)(ullBytes >> 32), (DWORD)ullBytes, 0);
+    if (hSection != 0)
+    {
+        pMapping = MapViewOfFile(hSection, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T)ullBytes);
+        CloseHandle(hSection);
+    }
+
+    CloseHandle(hFile);
+
+    return pMapping;
+#else
+    int    nFile = -1;
+
+    if (sizeof(szPath) <= (size_t)_snprintf(szPath, sizeof(szPath), "%s/fatwalker.XXXXXX", szDirectory))
+        return 0;
+
+    nFile = mkstemp(szPath);
+    if (nFile < 0)
+        return 0;
+
+    /* Unlinked up front; the mapping keeps the blocks until it goes. */
+    unlink(szPath);
+
+    if (0 == ftruncate(nFile, (off_t)ullBytes))
+    {
+        pMapping = mmap(0, (size_t)ullBytes, PROT_READ | PROT_WRITE, MAP_SHARED, nFile, 0);
+        if (pMapping == MAP_FAILED)
+            pMapping = 0;
+    }
+
+    close(nFile);
+
+    return pMapping;
+#endif
+}
+
+void fat_scratch_unmap(
+    void*       pMapping,
+    uint64_t    ullBytes)
+{
+#ifdef _WIN32
+    UnmapViewOfFile(pMapping);
+#else
+    munmap(pMapping, (size_t)ullBytes);
+#endif
+}
+
+void* fat_large_alloc(
+    uint64_t    ullBytes,
+    uint32_t    ulMode,
+    uint64_t*   pullMapped)
+{
+    uint64_t ullHuge = FAT_HUGE_PAGE_SIZE;
+    uint64_t ullRounded = 0;
+    void*    pMapping = 0;
+#ifdef _WIN32
+    SIZE_T   ulLargePage = 0;
+
+    /* Large pages need SeLockMemoryPrivilege; Windows has nothing transparent. */
+    if (ulMode == FAT_HUGE_PAGES_EXPLICIT)
+    {
+        ulLargePage = GetLargePageMinimum();
+        if (ulLargePage != 0)
+        {
+            ullHuge = ulLargePage;
+            ullRounded = (ullBytes + ullHuge - 1) & ~(ullHuge - 1);
+            pMapping = VirtualAlloc(0, (SIZE_T)ullRounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+        }
+    }
+
+    if (pMapping == 0)
+    {
+        ullRounded = ullBytes;
+        pMapping = VirtualAlloc(0, (SIZE_T)ullRounded, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    }
+#else
+    uint8_t* pBase = 0;
+    uint64_t ullLead = 0;
+
+    ullRounded = (ullBytes + ullHuge - 1) & ~(ullHuge - 1);
+
+#ifdef MAP_HUGETLB
+    if (ulMode == FAT_HUGE_PAGES_EXPLICIT)
+    {
+        pMapping = mmap(0, (size_t)ullRounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (pMapping == MAP_FAILED)
+            pMapping = 0;
+    }
+#endif
+
+    if ((pMapping == 0) && (ulMode != FAT_HUGE_PAGES_OFF))
+    {
+        /* Over-map by one huge page and trim both ends to 2 MB alignment. */
+        pBase = mmap(0, (size_t)(ullRounded + ullHuge), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (pBase != MAP_FAILED)
+        {
+            ullLead = (ullHuge - ((uint64_t)(size_t)pBase & (ullHuge - 1))) & (ullHuge - 1);
+
+            if (ullLead != 0)
+                munmap(pBase, (size_t)ullLead);
+
+            munmap(pBase + ullLead + ullRounded, (size_t)(ullHuge - ullLead));
+
+            pMapping = pBase + ullLead;
+#ifdef MADV_HUGEPAGE
+            madvise(pMapping, (size_t)ullRounded, MADV_HUGEPAGE);
+#endif
+        }
+    }
+
+    if (pMapping == 0)
+    {
+        ullRounded = ullBytes;
+        pMapping = mmap(0, (size_t)ullRounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (pMapping == MAP_FAILED)
+            pMapping = 0;
+    }
+#endif
+
+    *pullMapped = ullRounded;
+
+    return pMapping;
+}
+
+void fat_large_free(
+    void*       pMapping,
+    uint64_t    ullMapped)
+{
+#ifdef _WIN32
+    VirtualFree(pMapping, 0, MEM_RELEASE);
+#else
+    munmap(pMapping, (size_t)ullMapped);
+#endif
+}
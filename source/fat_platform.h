@@ -0,0 +1,191 @@
+#ifndef __FAT_PLATFORM_H_HEADER__
+#define __FAT_PLATFORM_H_HEADER__
+
+#include <time.h>
+
+#include "stdint.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <xmmintrin.h>
+#else
+#include <pthread.h>
+#endif
+
+/* MSVC spellings used throughout the sources. */
+#ifndef _MSC_VER
+#define __int64   long long
+#define _fseeki64 fseeko
+#define _ftelli64 ftello
+#define _snprintf snprintf
+#define _strtoui64 strtoull
+#define _fdopen   fdopen
+#endif
+
+/* pulls the cache line holding p in ahead of a dependent load. */
+#if defined(_MSC_VER)
+#define FAT_CACHE_PREFETCH(p) _mm_prefetch((const char*)(p), _MM_HINT_T0)
+#elif defined(__GNUC__)
+#define FAT_CACHE_PREFETCH(p) __builtin_prefetch((p), 0, 3)
+#else
+#define FAT_CACHE_PREFETCH(p) ((void)(p))
+#endif
+
+typedef int (*fat_thread_proc)(void* pContext);
+
+typedef struct FAT_THREAD {
+#ifdef _WIN32
+    HANDLE          hThread;
+#else
+    pthread_t       thread;
+#endif
+    fat_thread_proc pfnProc;
+    void*           pContext;
+    int             nResult;
+} fat_thread;
+
+typedef struct FAT_MUTEX {
+#ifdef _WIN32
+    CRITICAL_SECTION section;
+#else
+    pthread_mutex_t  mutex;
+#endif
+} fat_mutex;
+
+/* pThread must stay valid until fat_thread_join() returns. */
+int fat_thread_start(
+    fat_thread*     pThread,
+    fat_thread_proc pfnProc,
+    void*           pContext);
+
+/* returns the value returned by the thread procedure. */
+int fat_thread_join(
+    fat_thread*     pThread);
+
+void fat_mutex_init(fat_mutex* pMutex);
+void fat_mutex_lock(fat_mutex* pMutex);
+void fat_mutex_unlock(fat_mutex* pMutex);
+void fat_mutex_destroy(fat_mutex* pMutex);
+
+uint32_t fat_cpu_count(void);
+
+/* monotonic seconds from an arbitrary start; only differences mean anything. */
+double fat_clock_seconds(void);
+
+/* Unbuffered descriptor I/O.  All offsets are absolute and the input
+   descriptor's file position is never used, so image descriptors can be
+   shared between threads. */
+int fat_file_open_read(const char* szPath);
+int fat_file_create(const char* szPath);
+/* like fat_file_create(), but fails with errno EEXIST if szPath exists. */
+int fat_file_create_new(const char* szPath);
+int fat_file_open_write(const char* szPath);
+int fat_file_sync(int nFile);
+int fat_file_close(int nFile);
+
+/* stops a text-mode descriptor (stdin on Windows) from translating line ends. */
+int fat_file_binary_mode(int nFile);
+
+/* returns -1 on error. */
+__int64 fat_file_size(int nFile);
+
+/* returns 1 if szPath names the file open as nFile, through any link. */
+int fat_file_is_same(
+    int         nFile,
+    const char* szPath);
+
+/* returns the start of the first data extent at or after llOffset and its
+   end in *pllHole, -2 if only holes follow, -1 where the file system
+   cannot report holes.  the file position is moved and put back, so this
+   must not race with stdio on the same descriptor. */
+__int64 fat_file_seek_data(
+    int      nFile,
+    __int64  llOffset,
+    __int64* pllHole);
+
+__int64 fat_file_pread(
+    int     nFile,
+    void*   pBuffer,
+    size_t  ulLength,
+    __int64 llOffset);
+
+__int64 fat_file_pwrite(
+    int         nFile,
+    const void* pBuffer,
+    size_t      ulLength,
+    __int64     llOffset);
+
+/* Copies file to file without passing through user space where the kernel
+   allows it (copy_file_range, then sendfile), else through a bounce buffer.
+   returns the number of bytes copied, -1 on error. */
+__int64 fat_file_copy_range(
+    int     nFileIn,
+    __int64 llOffsetIn,
+    int     nFileOut,
+    __int64 llOffsetOut,
+    __int64 llLength);
+
+/* hints that [llOffset, llOffset + llLength) will be read soon; no-op where unsupported. */
+void fat_file_readahead(
+    int     nFile,
+    __int64 llOffset,
+    __int64 llLength);
+
+/* hints that [llOffset, llOffset + llLength) will not be read again; no-op where unsupported. */
+void fat_file_drop_cache(
+    int     nFile,
+    __int64 llOffset,
+    __int64 llLength);
+
+/* lets ranges never written take no space; files are sparse by default on POSIX. */
+int fat_file_set_sparse(int nFile);
+
+int fat_file_truncate(
+    int     nFile,
+    __int64 llSize);
+
+int fat_file_set_times(
+    const char* szPath,
+    time_t      tAccess,
+    time_t      tModify);
+
+/* replaces szTo if it exists, atomically where the file system allows it. */
+int fat_file_rename(
+    const char* szFrom,
+    const char* szTo);
+
+/* succeeds if the directory already exists. */
+int fat_make_directory(const char* szPath);
+
+/* creates every missing directory leading up to the last '/' of szPath. */
+int fat_make_parent_directories(const char* szPath);
+
+/* maps ullBytes of zeroed memory backed by a scratch file in szDirectory,
+   so the kernel can page it out to that file instead of running out of
+   memory.  the file is gone once unmapped.  returns 0 on error. */
+void* fat_scratch_map(
+    const char* szDirectory,
+    uint64_t    ullBytes);
+
+void fat_scratch_unmap(
+    void*       pMapping,
+    uint64_t    ullBytes);
+
+/* fat_large_alloc() modes. */
+#define FAT_HUGE_PAGES_OFF         (0)
+#define FAT_HUGE_PAGES_TRANSPARENT (1) /* 2 MB aligned and advised; the kernel backs it as it can. */
+#define FAT_HUGE_PAGES_EXPLICIT    (2) /* reserved huge pages, else as transparent. */
+
+/* maps ullBytes of zeroed anonymous memory, on huge pages as ulMode asks,
+   so walks over it miss the TLB less.  *pullMapped gets the size to pass
+   to fat_large_free().  returns 0 on error. */
+void* fat_large_alloc(
+    uint64_t    ullBytes,
+    uint32_t    ulMode,
+    uint64_t*   pullMapped);
+
+void fat_large_free(
+    void*       pMapping,
+    uint64_t    ullMapped);
+
+#endif /* __FAT_PLATFORM_H_HEADER__ */
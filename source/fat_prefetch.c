@@ -0,0 +1,108 @@
+#include <stdio.h>
+#include <string.h>
+#include <memory.h>
+
+#include "stdint.h"
+#include "fat_process.h"
+#include "fat_platform.h"
+#include "fat_prefetch.h"
+
+void fat_prefetch_init(
+    fat_prefetch* pPrefetch,
+    int           nImageFile,
+    uint32_t      ulDepth,
+    int           nDropBehind,
+    uint32_t      ulRootDirOffset,
+    uint32_t      ulClusterSize)
+{
+    memset(pPrefetch, 0x00, sizeof(fat_prefetch));
+
+    pPrefetch->nImageFile = nImageFile;
+    pPrefetch->ulDepth = (ulDepth > FAT_PREFETCH_MAX_DEPTH) ? FAT_PREFETCH_MAX_DEPTH : ulDepth;
+    pPrefetch->nDropBehind = nDropBehind;
+    pPrefetch->ulRootDirOffset = ulRootDirOffset;
+    pPrefetch->ulClusterSize = ulClusterSize;
+}
+
+/* hints extents until ulDepth are outstanding or the chain ends. */
+static void fat_prefetch_fill(
+    fat_prefetch* pPrefetch)
+{
+    uint32_t ulStart = 0;
+    uint32_t ulClusters = 0;
+    uint32_t ulMaxClusters = FAT_PREFETCH_MAX_EXTENT / pPrefetch->ulClusterSize;
+    __int64  llLength = 0;
+
+    if (ulMaxClusters == 0)
+        ulMaxClusters = 1;
+
+    while ((pPrefetch->ulAhead < pPrefetch->ulDepth) &&
+           (pPrefetch->pNext != 0) &&
+           (pPrefetch->llRemaining > 0))
+    {
+        ulStart = pPrefetch->pNext->cluster;
+        ulClusters = 1;
+
+        while ((ulClusters < ulMaxClusters) &&
+               (pPrefetch->pNext->next != 0) &&
+               (pPrefetch->pNext->next->cluster == pPrefetch->pNext->cluster + 1) &&
+               ((__int64)ulClusters * pPrefetch->ulClusterSize < pPrefetch->llRemaining))
+        {
+            pPrefetch->pNext = pPrefetch->pNext->next;
+            ++ulClusters;
+        }
+
+        llLength = (__int64)ulClusters * pPrefetch->ulClusterSize;
+        if (llLength > pPrefetch->llRemaining)
+            llLength = pPrefetch->llRemaining;
+
+        fat_file_readahead(
+            pPrefetch->nImageFile,
+            (__int64)pPrefetch->ulRootDirOffset + (__int64)(ulStart - 2) * pPrefetch->ulClusterSize,
+            llLength);
+
+        pPrefetch->pNext = pPrefetch->pNext->next;
+        pPrefetch->llRemaining -= llLength;
+        pPrefetch->llHinted += llLength;
+
+        pPrefetch->aExtentEnd[(pPrefetch->ulFirst + pPrefetch->ulAhead) % FAT_PREFETCH_MAX_DEPTH] = pPrefetch->llHinted;
+        ++pPrefetch->ulAhead;
+    }
+}
+
+void fat_prefetch_start(
+    fat_prefetch* pPrefetch,
+    fat_node*     pHead,
+    __int64       llSize)
+{
+    pPrefetch->pNext = pHead;
+    pPrefetch->llRemaining = llSize;
+    pPrefetch->llHinted = 0;
+    pPrefetch->ulFirst = 0;
+    pPrefetch->ulAhead = 0;
+
+    if (pPrefetch->ulDepth != 0)
+        fat_prefetch_fill(pPrefetch);
+}
+
+void fat_prefetch_consumed(
+    fat_prefetch* pPrefetch,
+    __int64       llFileEnd,
+    __int64       llImageOffset,
+    __int64       llLength)
+{
+    if (pPrefetch->ulDepth == 0)
+        return;
+
+    if (pPrefetch->nDropBehind != 0)
+        fat_file_drop_cache(pPrefetch->nImageFile, llImageOffset, llLength);
+
+    /* Retire the extents the reader has moved past, then top up. */
+    while ((pPrefetch->ulAhead > 0) && (pPrefetch->aExtentEnd[pPrefetch->ulFirst] <= llFileEnd))
+    {
+        pPrefetch->ulFirst = (pPrefetch->ulFirst + 1) % FAT_PREFETCH_MAX_DEPTH;
+        --pPrefetch->ulAhead;
+    }
+
+    fat_prefetch_fill(pPrefetch);
+}
@@ -0,0 +1,57 @@
+#ifndef __FAT_PREFETCH_H_HEADER__
+#define __FAT_PREFETCH_H_HEADER__
+
+#include "stdint.h"
+#include "fat_process.h"
+#include "fat_platform.h"
+
+#define FAT_PREFETCH_DEFAULT_DEPTH (8)          /* extents hinted ahead. */
+#define FAT_PREFETCH_MAX_DEPTH     (64)
+#define FAT_PREFETCH_MAX_EXTENT    (4 << 20)    /* largest single hint. */
+
+/**
+ * Chain-aware readahead for one reader.
+ *
+ * Keeps the next ulDepth extents of the chain being read hinted to the
+ * kernel (WILLNEED) and, with nDropBehind, releases what the reader has
+ * finished with (DONTNEED), so long scans neither stall on cold reads nor
+ * push the rest of the host's page cache out.
+ */
+typedef struct FAT_PREFETCH {
+    int       nImageFile;
+    uint32_t  ulDepth;          /* 0 disables all hints. */
+    int       nDropBehind;
+    uint32_t  ulRootDirOffset;
+    uint32_t  ulClusterSize;
+
+    fat_node* pNext;            /* first cluster not hinted yet. */
+    __int64   llRemaining;      /* entry bytes not hinted yet. */
+    __int64   llHinted;         /* file offset hinted up to. */
+    __int64   aExtentEnd[FAT_PREFETCH_MAX_DEPTH];   /* ring of hinted extent ends (file offsets). */
+    uint32_t  ulFirst;
+    uint32_t  ulAhead;
+} fat_prefetch;
+
+void fat_prefetch_init(
+    fat_prefetch* pPrefetch,
+    int           nImageFile,
+    uint32_t      ulDepth,
+    int           nDropBehind,
+    uint32_t      ulRootDirOffset,
+    uint32_t      ulClusterSize);
+
+/* starts prefetching a chain read from its beginning. */
+void fat_prefetch_start(
+    fat_prefetch* pPrefetch,
+    fat_node*     pHead,
+    __int64       llSize);
+
+/* the reader is done with file bytes up to llFileEnd, read from
+   [llImageOffset, llImageOffset + llLength) of the image. */
+void fat_prefetch_consumed(
+    fat_prefetch* pPrefetch,
+    __int64       llFileEnd,
+    __int64       llImageOffset,
+    __int64       llLength);
+
+#endif /* __FAT_PREFETCH_H_HEADER__ */
@@ -5,18 +5,56 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <memory.h>
+#include <ctype.h>
 
 #include "stdint.h"
 #include "fat_process.h"
 #include "mbr_defs.h"
 #include "fat_defs.h"
 #include "doubly_linked_list.h"
+#include "fat_index.h"
+#include "fat_platform.h"
+#include "fat_extract.h"
+#include "fat_hexdump.h"
+#include "fat_writeback.h"
+#include "fat_dirscan.h"
+#include "fat_hash.h"
+#include "fat_lazy.h"
+#include "fat_sched.h"
+#include "fat_holes.h"
+#include "fat_spill.h"
+#include "fat_timeline.h"
+#include "fat_carve.h"
+#include "fat_owner.h"
+#include "fat_diff.h"
+#include "fat_estimate.h"
+#include "fat_stream.h"
+#include "fat_defrag.h"
+#include "fat_query.h"
+#include "fat_rescue.h"
+#include "fat_clone.h"
+#include "fat_walk.h"
+#include "fat_profile.h"
 
 #define SECTOR_SIZE (512)
 #define SECTOR_SIZE_SHIFT (9)
 #define SECTOR_TO_BYTE_OFFSET(x) (x << SECTOR_SIZE_SHIFT)
+#define BACKUP_BOOT_SECTOR (6)  /* where FAT32 formatters put the boot sector copy. */
 
-int process_image_file(char* szFilename, int nPatchFat)
+static int report_fat_index_match(
+    fat_chain*  pFatChainNode,
+    const char* szPath,
+    void*       pContext)
+{
+    (void)pContext;
+
+    fprintf(stdout, "%s\n", (szPath != 0) ? szPath : "?");
+    report_fat_chain(pFatChainNode);
+
+    return 0;
+}
+
+int process_image_file(char* szFilename, fat_options* pOptions)
 {
     FILE*               pFile = 0;
     int                 nStatus;
@@ -30,8 +68,80 @@ int process_image_file(char* szFilename, int nPatchFat)
     fat_node *          pFatList = 0;
     fat_chain *         pFatChainList = 0;
     uint32_t            ulFatChainCount = 0;
+    fat_index           fatIndex;
+    char                szDumpFilename[9];
+    char                szDumpExtension[4];
+    uint32_t            ulIndex = 0;
+    uint32_t            ulCount = 0;
+    uint32_t            ulDirFlags = 0;
+    fat_dirty_map       dirtyMap;
+    fat_hole_map        holeMap;
+    fat_carve_set       carveSet;
+    fat_owner_map       ownerMap;
+    fat_defrag_plan     defragPlan;
+    fat_profile         profile;
+    fat_query           query;
+    char*               szJournal = 0;
+    char                szDefaultJournal[4096];
     int                 nReturnValue = 0;
 
+    memset(&fatIndex, 0x00, sizeof(fatIndex));
+    memset(&dirtyMap, 0x00, sizeof(dirtyMap));
+    memset(&holeMap, 0x00, sizeof(holeMap));
+    memset(&ownerMap, 0x00, sizeof(ownerMap));
+    memset(&defragPlan, 0x00, sizeof(defragPlan));
+
+    // Read the image from stdin in one forward pass.
+    if (0 == strcmp(szFilename, "-"))
+    {
+        fat_spill_configure(pOptions->ullMaxMemory, pOptions->szSpillDir, pOptions->ulHugePages);
+        nReturnValue = stream_image(pOptions->szTee, pOptions);
+        goto exit;
+    }
+
+    // Restore the sectors saved by an earlier --patch write-back.
+    if (pOptions->szRollback != 0)
+    {
+        nReturnValue = fat_writeback_rollback(szFilename, pOptions->szRollback);
+        goto exit;
+    }
+
+    // Resolve a single path without loading the FATs or walking the tree.
+    if ((pOptions->nLazy != 0) && (pOptions->szFind != 0))
+    {
+        nReturnValue = lazy_report_path(szFilename, pOptions->szFind);
+        goto exit;
+    }
+
+    // Sample the FAT instead of loading it.
+    if (pOptions->nEstimate != 0)
+    {
+        nReturnValue = estimate_image(szFilename, pOptions->ulEstimateSamples);
+        goto exit;
+    }
+
+    // Compare against a second image of the same volume.
+    if (pOptions->szDiff != 0)
+    {
+        fat_spill_configure(pOptions->ullMaxMemory, pOptions->szSpillDir, pOptions->ulHugePages);
+        nReturnValue = diff_images(szFilename, pOptions->szDiff);
+        goto exit;
+    }
+
+    // Keep the volume-sized arrays within --max-memory, spilling the rest.
+    fat_spill_configure(pOptions->ullMaxMemory, pOptions->szSpillDir, pOptions->ulHugePages);
+
+    // Read around bad sectors, resuming from the map of an earlier run.
+    if (0 != fat_rescue_configure(pOptions->szRescueMap, szFilename))
+    {
+        fprintf(stderr, "cannot use rescue map: '%s'.\n", pOptions->szRescueMap);
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    // Count cycles, misses and faults per phase (if requested).
+    fat_profile_configure(pOptions->nProfile);
+
     // Open the file.
     pFile = fopen(szFilename, "rb");
 
@@ -42,6 +152,7 @@ int process_image_file(char* szFilename, int nPatchFat)
         goto exit;
     }
 
+    fat_profile_begin(&profile, "read FATs");
     nReturnValue = read_fs_config_data(
         pFile,
         &pFAT1_Buffer,
@@ -50,75 +161,480 @@ int process_image_file(char* szFilename, int nPatchFat)
         &lClusterCount,
         &lFileAllocationTableSize,
         &lRootDirectoryEntryOffset);
+    fat_profile_end(&profile);
+
+    if (nReturnValue != 0)
+        goto exit;
+
+    // Copy only the allocated clusters, before anything is patched.
+    if (pOptions->szClone != 0)
+    {
+        nReturnValue = fat_hole_map_load(&holeMap, fileno(pFile));
 
+        if (nReturnValue == 0)
+        {
+            nReturnValue = clone_image(
+                fileno(pFile),
+                pOptions->szClone,
+                pFAT1_Buffer,
+                lFileAllocationTableSize,
+                lRootDirectoryEntryOffset,
+                lClusterSize,
+                &holeMap);
+        }
+
+        goto exit;
+    }
 
     // Attempt to correct inconsistencies in the FAT tables (if requested).
-    if (nPatchFat != 0)
+    if (pOptions->nPatch != 0)
     {
+        nReturnValue = fat_dirty_map_init(
+            &dirtyMap,
+            lFileAllocationTableSize,
+            SECTOR_SIZE);
+
+        if (nReturnValue != 0)
+            goto exit;
+
+        fat_profile_begin(&profile, "patch FATs");
         nReturnValue = patch_file_allocation_tables(
             pFAT1_Buffer,
             pFAT2_Buffer,
             lFileAllocationTableSize,
-            lClusterCount);
+            lClusterCount,
+            &dirtyMap);
+        fat_profile_end(&profile);
+
+        // Write the repaired sectors back, journaling the originals first.
+        if (nReturnValue == 1)
+        {
+            if (pOptions->szJournal != 0)
+            {
+                szJournal = pOptions->szJournal;
+            }
+            else
+            {
+                szJournal = szDefaultJournal;
+                _snprintf(szDefaultJournal, sizeof(szDefaultJournal) - 1, "%s.undo", szFilename);
+                szDefaultJournal[sizeof(szDefaultJournal) - 1] = 0;
+            }
+
+            nReturnValue = fat_writeback_commit(
+                "FAT repair",
+                szFilename,
+                szJournal,
+                &dirtyMap,
+                pFAT1_Buffer,
+                pFAT2_Buffer,
+                (__int64)lRootDirectoryEntryOffset - 2 * (__int64)lFileAllocationTableSize,
+                (__int64)lRootDirectoryEntryOffset - (__int64)lFileAllocationTableSize);
+
+            if (nReturnValue != 0)
+                goto exit;
+        }
+    }
+
+    // FAT2 only serves the patch above (and a defrag write); release it before the node list grows.
+    if ((0 != pFAT2_Buffer) && (pOptions->nDefragApply == 0))
+    {
+        fat_spill_free (pFAT2_Buffer);
+        pFAT2_Buffer = 0;
     }
 
     // Consolidate FAT tables & directories.
+    fat_profile_begin(&profile, "FAT entries");
     ulFatChainCount = process_fat_entries(
         &pFatList,
         pFAT1_Buffer,
         lFileAllocationTableSize);
+    fat_profile_end(&profile);
 
     // Process fat list to fat chain list.
+    fat_profile_begin(&profile, "FAT chains");
     nReturnValue = process_fat_chains(
         &pFatChainList,
         ulFatChainCount,
         pFatList,
         lFileAllocationTableSize);
+    fat_profile_end(&profile);
 
-    // Process directories.
-    nReturnValue = process_dir_entries(
-        pFile,
-        pFatList,
-        pFAT1_Buffer,
-        pFatChainList,
-        ulFatChainCount,
-        lClusterSize,
-        lClusterCount,
-        FAT_ROOT_DIR,
-        lRootDirectoryEntryOffset);
+    // Map every cluster back to its chain while the chains are fresh.
+    if ((nReturnValue == 0) && ((pOptions->szOwner != 0) || (pOptions->szOwnerBatch != 0)))
+    {
+        nReturnValue = fat_owner_map_build(
+            &ownerMap,
+            pFatChainList,
+            ulFatChainCount,
+            lFileAllocationTableSize,
+            pOptions->ullMaxMemory);
+
+        if (nReturnValue != 0)
+            goto exit;
+    }
+
+    if (0 != fat_spill_mapped())
+    {
+        fprintf(stderr, "spilled %llu KB of FAT structures to scratch files.\n",
+            (unsigned long long)(fat_spill_mapped() >> 10));
+    }
+
+    // Carve file signatures out of the free clusters; no tree walk needed.
+    if (pOptions->nCarve != 0)
+    {
+        if (pOptions->szCarveSignatures != 0)
+            nReturnValue = fat_carve_load_set(&carveSet, pOptions->szCarveSignatures);
+        else
+            fat_carve_default_set(&carveSet);
+
+        if (nReturnValue == 0)
+            nReturnValue = fat_hole_map_load(&holeMap, fileno(pFile));
+
+        if (nReturnValue == 0)
+        {
+            nReturnValue = carve_free_clusters(
+                fileno(pFile),
+                pFatList,
+                lFileAllocationTableSize,
+                lRootDirectoryEntryOffset,
+                lClusterSize,
+                &holeMap,
+                &carveSet);
+        }
+
+        goto exit;
+    }
+
+    ulDirFlags =
+        (((pOptions->szFind == 0) && (pOptions->szExtractDir == 0) &&
+          (pOptions->szDump == 0) && (pOptions->nTimeline == 0) &&
+          (pOptions->szOwner == 0) && (pOptions->szOwnerBatch == 0) &&
+          (pOptions->nDefrag == 0) && (pOptions->ulTop == 0) && (pOptions->ullMinSize == 0) &&
+          (pOptions->ullMaxSize == 0) && (pOptions->ulMinFragments == 0)) ? FAT_DIR_REPORT_ENTRIES : 0) |
+        ((pOptions->nStopAtDirEnd != 0) ? FAT_DIR_STOP_AT_END : 0);
+
+    // Process directories, in tree order or in offset order.
+    fat_profile_begin(&profile, "directories");
+
+    if (pOptions->nElevator != 0)
+    {
+        nReturnValue = process_dir_entries_elevator(
+            pFile,
+            pFatList,
+            pFatChainList,
+            ulFatChainCount,
+            lFileAllocationTableSize,
+            lClusterSize,
+            lRootDirectoryEntryOffset,
+            ulDirFlags,
+            pOptions->ulReadahead);
+    }
+    else
+    {
+        nReturnValue = process_dir_entries(
+            pFile,
+            pFatList,
+            pFAT1_Buffer,
+            pFatChainList,
+            ulFatChainCount,
+            lClusterSize,
+            lClusterCount,
+            FAT_ROOT_DIR,
+            lRootDirectoryEntryOffset,
+            ulDirFlags);
+    }
+
+    fat_profile_end(&profile);
+
+    // Hex dump a single file.
+    if (pOptions->szDump != 0)
+    {
+        memset(szDumpFilename, 0x00, sizeof(szDumpFilename));
+        memset(szDumpExtension, 0x00, sizeof(szDumpExtension));
+
+        for (ulIndex = 0; (pOptions->szDump[ulIndex] != 0) && (pOptions->szDump[ulIndex] != '.'); ++ulIndex)
+            if (ulIndex < 8)
+                szDumpFilename[ulIndex] = (char)toupper((unsigned char)pOptions->szDump[ulIndex]);
+
+        if (pOptions->szDump[ulIndex] == '.')
+            for (ulCount = 0, ++ulIndex; (pOptions->szDump[ulIndex] != 0) && (ulCount < 3); ++ulIndex, ++ulCount)
+                szDumpExtension[ulCount] = (char)toupper((unsigned char)pOptions->szDump[ulIndex]);
+
+        nReturnValue = extract_contents(
+            pFile,
+            szDumpFilename,
+            szDumpExtension,
+            0,
+            pFatChainList,
+            ulFatChainCount,
+            lRootDirectoryEntryOffset,
+            lClusterSize,
+            pOptions->ulDumpLayout);
+
+        if (nReturnValue != 0)
+            fprintf(stderr, "no entry named '%s'.\n", pOptions->szDump);
+
+        goto exit;
+    }
+
+    // Map the holes of a sparse image once; content passes skip them.
+    if ((pOptions->szHashManifest != 0) || (pOptions->szExtractDir != 0))
+    {
+        nReturnValue = fat_hole_map_load(&holeMap, fileno(pFile));
+
+        if (nReturnValue != 0)
+            goto exit;
+    }
+
+    // Hash file contents into a manifest, in the same pass as the report.
+    if (pOptions->szHashManifest != 0)
+    {
+        nReturnValue = fat_index_build(
+            &fatIndex,
+            pFatChainList,
+            ulFatChainCount);
+
+        if (nReturnValue == 0)
+        {
+            fat_profile_begin(&profile, "hash");
+            nReturnValue = hash_matching_contents(
+                fileno(pFile),
+                &fatIndex,
+                pOptions->szFind,
+                pOptions->szHashManifest,
+                (pOptions->ulHashAlgorithms != 0) ? pOptions->ulHashAlgorithms : FAT_HASH_SHA256,
+                lRootDirectoryEntryOffset,
+                lClusterSize,
+                pOptions->ulThreads,
+                pOptions->ulReadahead,
+                &holeMap);
+            fat_profile_end(&profile);
+        }
+
+        if (nReturnValue != 0)
+            goto exit;
+    }
+
+    // Extract everything, or the chains matching --find, to a directory.
+    if (pOptions->szExtractDir != 0)
+    {
+        if (fatIndex.pChainList == 0)
+        {
+            nReturnValue = fat_index_build(
+                &fatIndex,
+                pFatChainList,
+                ulFatChainCount);
+        }
+
+        if (nReturnValue == 0)
+        {
+            fat_profile_begin(&profile, "extract");
+            nReturnValue = extract_matching_contents(
+                fileno(pFile),
+                &fatIndex,
+                pOptions->szFind,
+                pOptions->szExtractDir,
+                lRootDirectoryEntryOffset,
+                lClusterSize,
+                pOptions->ulThreads,
+                pOptions->ulReadahead,
+                &holeMap);
+            fat_profile_end(&profile);
+        }
+
+        goto exit;
+    }
+
+    // Report the timestamps of everything, or of --find matches, in time order.
+    if (pOptions->nTimeline != 0)
+    {
+        if (fatIndex.pChainList == 0)
+        {
+            nReturnValue = fat_index_build(
+                &fatIndex,
+                pFatChainList,
+                ulFatChainCount);
+        }
+
+        if (nReturnValue == 0)
+        {
+            nReturnValue = report_timeline(
+                &fatIndex,
+                pOptions->szFind,
+                pOptions->ulTimeKinds,
+                pOptions->szSince,
+                pOptions->szUntil,
+                pOptions->ulThreads);
+        }
+
+        goto exit;
+    }
+
+    // Plan, and optionally carry out, moves that make fragmented files contiguous.
+    if (pOptions->nDefrag != 0)
+    {
+        if (fatIndex.pChainList == 0)
+        {
+            nReturnValue = fat_index_build(
+                &fatIndex,
+                pFatChainList,
+                ulFatChainCount);
+        }
+
+        if (nReturnValue == 0)
+        {
+            nReturnValue = fat_defrag_plan_build(
+                &defragPlan,
+                pFatList,
+                pFatChainList,
+                ulFatChainCount,
+                lFileAllocationTableSize,
+                lClusterCount,
+                lClusterSize,
+                pOptions->ulDefragLimit);
+        }
+
+        if (nReturnValue == 0)
+            report_defrag_plan(&defragPlan, &fatIndex);
+
+        if ((nReturnValue == 0) && (pOptions->nDefragApply != 0))
+        {
+            if (pOptions->szJournal != 0)
+            {
+                szJournal = pOptions->szJournal;
+            }
+            else
+            {
+                szJournal = szDefaultJournal;
+                _snprintf(szDefaultJournal, sizeof(szDefaultJournal) - 1, "%s.undo", szFilename);
+                szDefaultJournal[sizeof(szDefaultJournal) - 1] = 0;
+            }
+
+            nReturnValue = fat_defrag_apply(
+                &defragPlan,
+                szFilename,
+                szJournal,
+                pFAT1_Buffer,
+                pFAT2_Buffer,
+                lFileAllocationTableSize,
+                lRootDirectoryEntryOffset);
+        }
+
+        goto exit;
+    }
+
+    // Resolve image offsets or sectors to the files owning them.
+    if ((pOptions->szOwner != 0) || (pOptions->szOwnerBatch != 0))
+    {
+        if (fatIndex.pChainList == 0)
+        {
+            nReturnValue = fat_index_build(
+                &fatIndex,
+                pFatChainList,
+                ulFatChainCount);
+        }
+
+        if (nReturnValue == 0)
+        {
+            nReturnValue = report_owners(
+                &ownerMap,
+                &fatIndex,
+                lRootDirectoryEntryOffset,
+                lClusterSize,
+                pOptions->szOwner,
+                pOptions->szOwnerBatch);
+        }
+
+        goto exit;
+    }
+
+    // Report only the chains matching the requested name, path or glob.
+    if (pOptions->szFind != 0)
+    {
+        if (fatIndex.pChainList == 0)
+        {
+            nReturnValue = fat_index_build(
+                &fatIndex,
+                pFatChainList,
+                ulFatChainCount);
+        }
+
+        if ((nReturnValue == 0) &&
+            (0 == fat_index_glob(&fatIndex, pOptions->szFind, report_fat_index_match, 0)))
+        {
+            fprintf(stderr, "no entries match '%s'.\n", pOptions->szFind);
+            nReturnValue = -1;
+        }
+
+        goto exit;
+    }
+
+    // Report only the largest, most fragmented or newest chains, or those in range.
+    if ((pOptions->ulTop != 0) || (pOptions->ullMinSize != 0) ||
+        (pOptions->ullMaxSize != 0) || (pOptions->ulMinFragments != 0))
+    {
+        memset(&query, 0x00, sizeof(query));
+        query.ulTop = pOptions->ulTop;
+        query.ulRankBy = pOptions->ulRankBy;
+        query.ullMinSize = pOptions->ullMinSize;
+        query.ullMaxSize = pOptions->ullMaxSize;
+        query.ulMinFragments = pOptions->ulMinFragments;
+
+        nReturnValue = report_fat_query(
+            pFatChainList,
+            ulFatChainCount,
+            lFileAllocationTableSize,
+            &query);
+
+        goto exit;
+    }
 
     // Report Results.
+    fat_profile_begin(&profile, "report");
     nReturnValue = report_fat_dir_entries(
         pFatChainList,
         ulFatChainCount);
+    fflush(stdout);
+    fat_profile_end(&profile);
 
 
 exit:
+    if (0 != fat_rescue_finish())
+        nReturnValue = -1;
+
+    fat_profile_finish();
+
+    fat_index_free(&fatIndex);
+    fat_dirty_map_free(&dirtyMap);
+    fat_hole_map_free(&holeMap);
+    fat_owner_map_free(&ownerMap);
+    fat_defrag_plan_free(&defragPlan);
+
     // Free the pFAT1_Buffer buffer.
     if (0 != pFAT1_Buffer)
     {
-        free (pFAT1_Buffer);
+        fat_spill_free (pFAT1_Buffer);
         pFAT1_Buffer = 0;
     }
 
     // Free the pFAT2_Buffer buffer.
     if (0 != pFAT2_Buffer)
     {
-        free (pFAT2_Buffer);
+        fat_spill_free (pFAT2_Buffer);
         pFAT2_Buffer = 0;
     }
 
     // Free the pFatList buffer.
     if (0 != pFatList)
     {
-        free (pFatList);
+        fat_spill_free (pFatList);
         pFatList = 0;
     }
 
     // Free the pFatChainList buffer.
     if (0 != pFatChainList)
     {
-        free (pFatChainList);
+        fat_spill_free (pFatChainList);
         pFatChainList = 0;
     }
 
@@ -137,6 +653,28 @@ exit:
     return nReturnValue;
 }
 
+/* reads one boot region sector; with a rescue map, a sector recorded bad
+   counts as a failed read instead of coming back as zeros. */
+static int read_config_sector(
+    FILE*    pFile,
+    void*    pBuffer,
+    size_t   ulLength,
+    int32_t  lOffset)
+{
+    if (0 != fat_rescue_enabled())
+    {
+        if ((__int64)ulLength != fat_rescue_read(fileno(pFile), pBuffer, ulLength, lOffset))
+            return -1;
+
+        return (0 != fat_rescue_is_bad(lOffset, ulLength)) ? -1 : 0;
+    }
+
+    if (0 != fseek(pFile, lOffset, SEEK_SET))
+        return -1;
+
+    return (ulLength != fread(pBuffer, 1, ulLength, pFile)) ? -1 : 0;
+}
+
 int read_fs_config_data(
     FILE*               pFile,
     uint32_t**          ppFAT1_Buffer,
@@ -159,6 +697,7 @@ int read_fs_config_data(
     int32_t             lFileAllocationTable1Offset = 0;
     int32_t             lFileAllocationTable2Offset = 0;
     int32_t             lRootDirectoryEntryOffset = 0;
+    uint32_t            ulLostSectors = 0;
 
     MASTER_BOOT_RECORD* pMBR_Buffer = 0;
     FAT32_BOOT_SECTOR*  pFAT_BootSectorBuffer = 0;
@@ -186,67 +725,46 @@ int read_fs_config_data(
     llFileSize = _ftelli64(pFile);
 
     // Read the Master Boot Record.
-    nStatus = fseek (pFile, 0, SEEK_SET);
-    if (0 != nStatus)
-    {
-        fprintf(stderr, "fseek() failed to seek to requested position.\n");
-        nReturnValue = -1;
-        goto exit;
-    }
-
-    ulBytesToRead = sizeof(MASTER_BOOT_RECORD);
-    ulBytesRead = fread(pMBR_Buffer,1,ulBytesToRead,pFile);
-    if(ulBytesToRead != ulBytesRead)
+    if (0 != read_config_sector(pFile, pMBR_Buffer, sizeof(MASTER_BOOT_RECORD), 0))
     {
         fprintf(stderr, "fread() failed to read the request amount.\n");
         nReturnValue = -1;
         goto exit;
     }
 
-    // Seek to the FAT Boot Sector.
+    // Read the FAT Boot Sector.
     lPartition1Offset =
         SECTOR_TO_BYTE_OFFSET(pMBR_Buffer->partEntry1.startSectorOffset);
 
-    nStatus = fseek (pFile, lPartition1Offset, SEEK_SET);
-    if (0 != nStatus)
+    nStatus = read_config_sector(pFile, pFAT_BootSectorBuffer, sizeof(FAT32_BOOT_SECTOR), lPartition1Offset);
+
+    /* On failing media, an unreadable or wiped boot sector falls back to its
+       copy; its own backupBootSector field is lost with it. */
+    if ((0 != fat_rescue_enabled()) &&
+        ((nStatus != 0) ||
+         (pFAT_BootSectorBuffer->bootSignature[0] != 0x55) ||
+         (pFAT_BootSectorBuffer->bootSignature[1] != 0xAA)))
     {
-        fprintf(stderr, "fseek() failed to seek to requested position.\n");
-        nReturnValue = -1;
-        goto exit;
-    }
+        fprintf(stderr, "rescue: boot sector unreadable, using the copy in sector %u.\n", BACKUP_BOOT_SECTOR);
 
-    // Read the FAT Boot Sector.
-    ulBytesToRead = sizeof(FAT32_BOOT_SECTOR);
-    ulBytesRead = fread(pFAT_BootSectorBuffer,1,ulBytesToRead,pFile);
+        nStatus = read_config_sector(pFile, pFAT_BootSectorBuffer, sizeof(FAT32_BOOT_SECTOR),
+            lPartition1Offset + SECTOR_TO_BYTE_OFFSET(BACKUP_BOOT_SECTOR));
+    }
 
-    if(ulBytesToRead != ulBytesRead)
+    if (0 != nStatus)
     {
         fprintf(stderr, "fread() failed to read the request amount.\n");
         nReturnValue = -1;
         goto exit;
     }
 
-    // Seek to the File System Info Sector.
+    // Read the File System Info Sector; its free cluster hints are not needed.
     lFileSystemInfoOffset = (lPartition1Offset +
         SECTOR_TO_BYTE_OFFSET(pFAT_BootSectorBuffer->fsInformationSector));
 
-    nStatus = fseek (pFile, lFileSystemInfoOffset, SEEK_SET);
-    if (0 != nStatus)
-    {
-        fprintf(stderr, "fseek() failed to seek to requested position.\n");
-        nReturnValue = -1;
-        goto exit;
-    }
-
-    // Read the File System Info Sector.
-    ulBytesToRead = sizeof(FS_INFO_SECTOR);
-    ulBytesRead = fread(pFS_InfoSectorBuffer,1,ulBytesToRead,pFile);
-
-    if(ulBytesToRead != ulBytesRead)
+    if (0 != read_config_sector(pFile, pFS_InfoSectorBuffer, sizeof(FS_INFO_SECTOR), lFileSystemInfoOffset))
     {
-        fprintf(stderr, "fread() failed to read the request amount.\n");
-        nReturnValue = -1;
-        goto exit;
+        memset(pFS_InfoSectorBuffer, 0x00, sizeof(FS_INFO_SECTOR));
     }
 
     // Calculate Cluster Size.
@@ -257,8 +775,8 @@ int read_fs_config_data(
     lFileAllocationTableSize =
         SECTOR_TO_BYTE_OFFSET(pFAT_BootSectorBuffer->sectorsPerFat32);
 
-    pFAT1_Buffer = malloc(lFileAllocationTableSize);
-    pFAT2_Buffer = malloc(lFileAllocationTableSize);
+    pFAT1_Buffer = fat_spill_alloc(lFileAllocationTableSize);
+    pFAT2_Buffer = fat_spill_alloc(lFileAllocationTableSize);
 
     if ( (0 == pFAT1_Buffer) || (0 == pFAT2_Buffer) )
     {
@@ -267,54 +785,72 @@ int read_fs_config_data(
         goto exit;
     }
 
-    // Seek to the File Allocation Table 1.
+    // Locate the File Allocation Tables and the Root Dir.
     lFileAllocationTable1Offset = lPartition1Offset +
         SECTOR_TO_BYTE_OFFSET(pFAT_BootSectorBuffer->sectorsBeforeFat);
 
-    nStatus = fseek (pFile, lFileAllocationTable1Offset, SEEK_SET);
-    if (0 != nStatus)
-    {
-        fprintf(stderr, "fseek() failed to seek to requested position.\n");
-        nReturnValue = -1;
-        goto exit;
-    }
-
-    // Read the File Allocation Table 1.
-    ulBytesToRead = lFileAllocationTableSize;
-    ulBytesRead = fread(pFAT1_Buffer,1,ulBytesToRead,pFile);
-
-    if(ulBytesToRead != ulBytesRead)
-    {
-        fprintf(stderr, "fread() failed to read the request amount.\n");
-        nReturnValue = -1;
-        goto exit;
-    }
-
-    // Seek to the File Allocation Table 2.
     lFileAllocationTable2Offset =lFileAllocationTable1Offset +
         lFileAllocationTableSize;
 
-    // Calculate Root Dir offset.
     lRootDirectoryEntryOffset = lFileAllocationTable2Offset +
         lFileAllocationTableSize;
 
-    nStatus = fseek (pFile, lFileAllocationTable2Offset, SEEK_SET);
-    if (0 != nStatus)
+    if (0 != fat_rescue_enabled())
     {
-        fprintf(stderr, "fseek() failed to seek to requested position.\n");
-        nReturnValue = -1;
-        goto exit;
+        // Read both tables around bad sectors, then patch each from the other.
+        fat_rescue_read(fileno(pFile), pFAT1_Buffer, lFileAllocationTableSize, lFileAllocationTable1Offset);
+        fat_rescue_read(fileno(pFile), pFAT2_Buffer, lFileAllocationTableSize, lFileAllocationTable2Offset);
+
+        ulLostSectors = fat_rescue_merge_fats(
+            (uint8_t*)pFAT1_Buffer,
+            (uint8_t*)pFAT2_Buffer,
+            lFileAllocationTable1Offset,
+            lFileAllocationTable2Offset,
+            lFileAllocationTableSize);
+
+        if (0 != ulLostSectors)
+            fprintf(stderr, "rescue: %u FAT sectors are unreadable in both copies; their clusters read as free.\n",
+                ulLostSectors);
     }
+    else
+    {
+        // Read the File Allocation Table 1.
+        nStatus = fseek (pFile, lFileAllocationTable1Offset, SEEK_SET);
+        if (0 != nStatus)
+        {
+            fprintf(stderr, "fseek() failed to seek to requested position.\n");
+            nReturnValue = -1;
+            goto exit;
+        }
 
-    // Read the File Allocation Table 2.
-    ulBytesToRead = lFileAllocationTableSize;
-    ulBytesRead = fread(pFAT2_Buffer,1,ulBytesToRead,pFile);
+        ulBytesToRead = lFileAllocationTableSize;
+        ulBytesRead = fread(pFAT1_Buffer,1,ulBytesToRead,pFile);
 
-    if(ulBytesToRead != ulBytesRead)
-    {
-        fprintf(stderr, "fread() failed to read the request amount.\n");
-        nReturnValue = -1;
-        goto exit;
+        if(ulBytesToRead != ulBytesRead)
+        {
+            fprintf(stderr, "fread() failed to read the request amount.\n");
+            nReturnValue = -1;
+            goto exit;
+        }
+
+        // Read the File Allocation Table 2.
+        nStatus = fseek (pFile, lFileAllocationTable2Offset, SEEK_SET);
+        if (0 != nStatus)
+        {
+            fprintf(stderr, "fseek() failed to seek to requested position.\n");
+            nReturnValue = -1;
+            goto exit;
+        }
+
+        ulBytesToRead = lFileAllocationTableSize;
+        ulBytesRead = fread(pFAT2_Buffer,1,ulBytesToRead,pFile);
+
+        if(ulBytesToRead != ulBytesRead)
+        {
+            fprintf(stderr, "fread() failed to read the request amount.\n");
+            nReturnValue = -1;
+            goto exit;
+        }
     }
 
     // Calculate number of clusters.
@@ -360,7 +896,8 @@ int patch_file_allocation_tables(
     uint32_t* pFat1Buffer,
     uint32_t* pFat2Buffer,
     uint32_t ulFatSize,
-    uint32_t ulClusterCount)
+    uint32_t ulClusterCount,
+    fat_dirty_map* pDirtyMap)
 {
     int      nFAT_Modified = 0;
     int      nFATs_ValueMatch = 0;
@@ -417,6 +954,7 @@ int patch_file_allocation_tables(
                     pFat2Buffer[ulIndex]);
 
                 pFat2Buffer[ulIndex] = pFat1Buffer[ulIndex];
+                fat_dirty_map_mark(pDirtyMap, 2, ulIndex);
                 nFAT_Modified = 1;
             }
 
@@ -429,6 +967,7 @@ int patch_file_allocation_tables(
                     pFat2Buffer[ulIndex]);
 
                 pFat1Buffer[ulIndex] = pFat2Buffer[ulIndex];
+                fat_dirty_map_mark(pDirtyMap, 1, ulIndex);
                 nFAT_Modified = 1;
             }
 
@@ -441,6 +980,7 @@ int patch_file_allocation_tables(
                     pFat2Buffer[ulIndex]);
 
                 pFat2Buffer[ulIndex] = pFat1Buffer[ulIndex];
+                fat_dirty_map_mark(pDirtyMap, 2, ulIndex);
                 nFAT_Modified = 1;
             }
         }
@@ -454,6 +994,7 @@ int patch_file_allocation_tables(
                 pFat2Buffer[ulIndex]);
 
             pFat1Buffer[ulIndex] = pFat2Buffer[ulIndex];
+            fat_dirty_map_mark(pDirtyMap, 1, ulIndex);
             nFAT_Modified = 1;
         }
 
@@ -466,6 +1007,7 @@ int patch_file_allocation_tables(
                 pFat2Buffer[ulIndex]);
 
             pFat2Buffer[ulIndex] = pFat1Buffer[ulIndex];
+            fat_dirty_map_mark(pDirtyMap, 2, ulIndex);
             nFAT_Modified = 1;
         }
     }
@@ -487,7 +1029,7 @@ uint32_t process_fat_entries(
     fat_node * pFatList;
 
     /* Allocate Fat Node List. */
-    pFatList = malloc(ulFatEntries * sizeof(fat_node));
+    pFatList = fat_spill_alloc(ulFatEntries * sizeof(fat_node));
     *ppFatList = pFatList;
 
     memset(pFatList, 0x00, ulFatEntries * sizeof(fat_node));
@@ -502,31 +1044,45 @@ uint32_t process_fat_entries(
         pFatList[ulClusterCurr].cluster = ulClusterCurr;
         pFatList[ulClusterCurr].value   = ulClusterNext;
 
-        /* Unallocated Cluster. */
-        if (pFatList[ulClusterCurr].value == 0)
+        switch (fat_entry_kind(ulClusterNext, ulFatEntries))
         {
-            /* Do nothing. */
-        }
+            /* Allocated Cluster - Chain. */
+            case FAT_ENTRY_NEXT:
+                pFatList[ulClusterCurr].next = &pFatList[ulClusterNext];
+                pFatList[ulClusterNext].prev = &pFatList[ulClusterCurr];
+                break;
 
-        /* Allocated Cluster - Chain. */
-        else if (pFatList[ulClusterCurr].value < ulFatEntries)
-        {
-            pFatList[ulClusterCurr].next = &pFatList[ulClusterNext];
-            pFatList[ulClusterNext].prev = &pFatList[ulClusterCurr];
-        }
+            /* Allocated Cluster - End of Chain. */
+            case FAT_ENTRY_END:
+                /* Complete chain found. */
+                ++ulClusterChainCount;
+                break;
 
-        /* Allocated Cluster - End of Chain. */
-        else if((pFatList[ulClusterCurr].value == FAT_EOC) ||
-                (pFatList[ulClusterCurr].value == FAT_EOF))
-        {
-            /* Complete chain found. */
-            ++ulClusterChainCount;
+            /* Unallocated Cluster, or a reserved value. */
+            default:
+                break;
         }
     }
 
     return ulClusterChainCount;
 }
 
+int fat_entry_kind(
+    uint32_t ulValue,
+    uint32_t ulFatEntries)
+{
+    if (ulValue == 0)
+        return FAT_ENTRY_FREE;
+
+    if (ulValue < ulFatEntries)
+        return FAT_ENTRY_NEXT;
+
+    if ((ulValue == FAT_EOC) || (ulValue == FAT_EOF))
+        return FAT_ENTRY_END;
+
+    return FAT_ENTRY_OTHER;
+}
+
 int process_fat_chains(
     fat_chain ** ppChainList,
     uint32_t     ulChainCount,
@@ -538,10 +1094,8 @@ int process_fat_chains(
     uint32_t ulFatEntryIndex = 0;
     uint32_t ulFatEntryCount = (ulFatSize >> 2);
     fat_chain * pChainList = 0;
-    fat_chain * pChainNode = 0;
-    fat_node * pFatNode = 0;
 
-    *ppChainList = pChainList = malloc(ulChainCount * sizeof(fat_chain));
+    *ppChainList = pChainList = fat_spill_alloc(ulChainCount * sizeof(fat_chain));
     memset(pChainList, 0x00, ulChainCount * sizeof(fat_chain));
 
     for (ulFatEntryIndex = 0; ulFatEntryIndex < ulFatEntryCount; ulFatEntryIndex++)
@@ -549,37 +1103,59 @@ int process_fat_chains(
         if ((pFatList[ulFatEntryIndex].value == FAT_EOC) ||
             (pFatList[ulFatEntryIndex].value == FAT_EOF))
         {
-            pFatNode = &pFatList[ulFatEntryIndex];
-            pChainNode = &pChainList[ulFatChainIndex];
-
             /* set chain tail */
-            pChainNode->tail = pFatNode;
-
-            /* find chain head */
-            while (pFatNode->prev != 0)
-                pFatNode = pFatNode->prev;
-
-            /* set chain head */
-            pChainNode->head = pFatNode;
+            pChainList[ulFatChainIndex].tail = &pFatList[ulFatEntryIndex];
 
             /* increment chain index */
             ++ulFatChainIndex;
         }
     }
 
+    /* find chain heads, walking many chains back at once */
+    fat_walk_find_heads(pChainList, ulFatChainIndex);
+
     return nReturnValue;
 }
 
-int process_dir_entries(
-    FILE*       pFile,
-    fat_node *  pFatList,
-    uint32_t *  pFatBuffer,
-    fat_chain * pFatChainList,
-    uint32_t    ulFatChainCount,
-    uint32_t    ulClusterSize,
-    uint32_t    ulClusterCount,
-    uint32_t    ulDirClusterIndex,
-    uint32_t    ulRootDirOffset)
+/* copies the first directory entry found for a chain into the chain. */
+static void populate_fat_chain(
+    fat_chain*       pChainNode,
+    FAT32_DIR_ENTRY* pDirEntry,
+    fat_chain*       pDirChainNode,
+    __int64          llEntryOffset)
+{
+    if ((pChainNode == 0) || (pChainNode->populated != 0))
+        return;
+
+    memcpy(pChainNode->filename, pDirEntry->dosFilename, sizeof(pChainNode->filename));
+    memcpy(pChainNode->extension, pDirEntry->dosExtension, sizeof(pChainNode->extension));
+
+    pChainNode->attributes = pDirEntry->fileAttributes;
+    pChainNode->filesize = pDirEntry->fileSizeBytes;
+    pChainNode->timestamp.time_ms = pDirEntry->creationTimeMs;
+    pChainNode->timestamp.time.value = pDirEntry->creationTimeHMS;
+    pChainNode->timestamp.date.value = pDirEntry->creationDate;
+    pChainNode->modifytime = pDirEntry->modificationTime;
+    pChainNode->modifydate = pDirEntry->modificationDate;
+    pChainNode->accessdate = pDirEntry->accessDate;
+    pChainNode->entryoffset = (uint64_t)llEntryOffset;
+    pChainNode->parent = (pDirChainNode != pChainNode) ? pDirChainNode : 0;
+
+    pChainNode->populated = 1;
+}
+
+static int process_dir_tree(
+    FILE*                  pFile,
+    fat_node *             pFatList,
+    uint32_t *             pFatBuffer,
+    fat_chain *            pFatChainList,
+    const fat_chain_start* pStarts,
+    uint32_t               ulFatChainCount,
+    uint32_t               ulClusterSize,
+    uint32_t               ulClusterCount,
+    uint32_t               ulDirClusterIndex,
+    uint32_t               ulRootDirOffset,
+    uint32_t               ulDirFlags)
 {
     int nReturnValue = 0;
     int nStatus = 0;
@@ -593,15 +1169,19 @@ int process_dir_entries(
     uint32_t         ulEntryClusterIndex = 0;
     __int64          llDirOffset;
     uint32_t         ulDirsPerCluster;
+    uint32_t         ulEntriesInUse = 0;
+    uint8_t*         pEntryClasses = 0;
     fat_node*        pFatNode = 0;
     fat_chain*       pChainNode = 0;
+    fat_chain*       pDirChainNode = 0;
 
     // Calculate the number of directory entries per cluster.
     ulDirsPerCluster = (ulClusterSize / sizeof(FAT32_DIR_ENTRY));
 
     // Allocate buffer for directory.
     pDirectoryBuffer = malloc(ulClusterSize);
-    if (pDirectoryBuffer == 0)
+    pEntryClasses = malloc(ulDirsPerCluster + 1);
+    if ((pDirectoryBuffer == 0) || (pEntryClasses == 0))
     {
         fprintf(stderr, "allocations failed.\n");
         nReturnValue = -1;
@@ -615,6 +1195,13 @@ int process_dir_entries(
         goto exit;
     }
 
+    /* Chain of this directory, recorded as the parent of its entries. */
+    pDirChainNode = find_fat_chain(
+        pFatChainList,
+        pStarts,
+        ulFatChainCount,
+        ulDirClusterIndex);
+
     /* Determine number of clusters in dir. */
     pFatNode = &pFatList[ulDirClusterIndex];
     ulBlockCount = 1;
@@ -638,9 +1225,12 @@ int process_dir_entries(
             goto exit;
         }
 
-        // Read the Directory Entry.
+        // Read the Directory Entry; unreadable sectors come back as free entries.
         ulBytesToRead = ulClusterSize;
-        ulBytesRead = fread(pDirectoryBuffer,1,ulBytesToRead,pFile);
+        if (0 != fat_rescue_enabled())
+            ulBytesRead = (size_t)fat_rescue_read(fileno(pFile), pDirectoryBuffer, ulBytesToRead, llDirOffset);
+        else
+            ulBytesRead = fread(pDirectoryBuffer,1,ulBytesToRead,pFile);
 
         if (ulBytesToRead != ulBytesRead)
         {
@@ -649,65 +1239,62 @@ int process_dir_entries(
             goto exit;
         }
 
-        // Process the entries in the directory buffer.
-        for (ulIndex = 0; ulIndex < ulDirsPerCluster; ulIndex++)
+        // Classify the whole cluster, then visit the entries in use.
+        ulEntriesInUse = fat_dirscan_classify(
+            pDirectoryBuffer,
+            ulDirsPerCluster,
+            pEntryClasses,
+            (0 != (ulDirFlags & FAT_DIR_STOP_AT_END)) ? 1 : 0);
+
+        /* Per FAT32 spec:  "0x00 => Entry is available and no subsequent entry is in use. */
+        if (0 == (ulDirFlags & FAT_DIR_STOP_AT_END))
+            ulEntriesInUse = ulDirsPerCluster;
+
+        for (ulIndex = 0; ulIndex < ulEntriesInUse; ulIndex++)
         {
+            if (pEntryClasses[ulIndex] == FAT_DIRSCAN_FREE)
+                continue;
+
             pDirEntry = &pDirectoryBuffer[ulIndex];
-            ulEntryClusterIndex  = (pDirEntry->clusterAddressHigh << 16);
+            ulEntryClusterIndex  = ((uint32_t)pDirEntry->clusterAddressHigh << 16);
             ulEntryClusterIndex |= (pDirEntry->clusterAddressLow << 0);
 
-            /* Per FAT32 spec:  "0x00 => Entry is available and no subsequenty entry is in use. */
-            if (pDirEntry->dosFilename[0] == 0)
-            {
-#ifdef skip
-                /* set index to count to break out of second level loop. */
-                ulBlockIndex = ulBlockCount;
-                break;
-#endif
-            }
-            else
-            {
+            /* Find the chain associated with the directory entry. */
+            pChainNode = find_fat_chain(
+                pFatChainList,
+                pStarts,
+                ulFatChainCount,
+                ulEntryClusterIndex);
+
+            populate_fat_chain(pChainNode, pDirEntry, pDirChainNode,
+                llDirOffset + (__int64)ulIndex * sizeof(FAT32_DIR_ENTRY));
 
-               /* Find the chain associated with the directory entry. */
-               pChainNode = find_fat_chain(
-                   pFatChainList,
-                   ulFatChainCount,
-                   ulEntryClusterIndex);
-
-               /* Populate the chain fields. */
-               if ((pChainNode != 0) && (pChainNode->populated == 0))
-               {
-                   memcpy(pChainNode->filename, pDirEntry->dosFilename, sizeof(pChainNode->filename));
-                   memcpy(pChainNode->extension, pDirEntry->dosExtension, sizeof(pChainNode->extension));
-
-                   pChainNode->attributes = pDirEntry->fileAttributes;
-                   pChainNode->filesize = pDirEntry->fileSizeBytes;
-                   pChainNode->timestamp.time_ms = pDirEntry->creationTimeMs;
-                   pChainNode->timestamp.time.value = pDirEntry->creationTimeHMS;
-                   pChainNode->timestamp.date.value = pDirEntry->creationDate;
-
-                   pChainNode->populated = 1;
-               }
-
-               process_dir_entry(pChainNode, pDirEntry);
-
-               /* if entry is subdirectory (exlude dot entry), recursively process. */
-               if ((0 != (pDirEntry->fileAttributes & FILE_ATTRIB_DIR)) &&
-                   (pDirEntry->dosFilename[0] != FILE_DOT_ENTRY))
-               {
-                   process_dir_entries(
-                       pFile,
-                       pFatList,
-                       pFatBuffer,
-                       pFatChainList,
-                       ulFatChainCount,
-                       ulClusterSize,
-                       ulClusterCount,
-                       ulEntryClusterIndex,
-                       ulRootDirOffset);
-               }
+            if (0 != (ulDirFlags & FAT_DIR_REPORT_ENTRIES))
+                process_dir_entry(pChainNode, pDirEntry);
+
+            /* if entry is subdirectory (exlude dot entry), recursively process. */
+            if ((pEntryClasses[ulIndex] == FAT_DIRSCAN_DIRECTORY) ||
+                ((pEntryClasses[ulIndex] == FAT_DIRSCAN_DELETED) &&
+                 (0 != (pDirEntry->fileAttributes & FILE_ATTRIB_DIR))))
+            {
+                process_dir_tree(
+                    pFile,
+                    pFatList,
+                    pFatBuffer,
+                    pFatChainList,
+                    pStarts,
+                    ulFatChainCount,
+                    ulClusterSize,
+                    ulClusterCount,
+                    ulEntryClusterIndex,
+                    ulRootDirOffset,
+                    ulDirFlags);
             }
         }
+
+        /* End of directory reached; later clusters hold no entries in use. */
+        if (ulEntriesInUse < ulDirsPerCluster)
+            break;
     }
 
 exit:
@@ -718,6 +1305,284 @@ exit:
         pDirectoryBuffer = 0;
     }
 
+    // Free the pEntryClasses buffer.
+    if (0 != pEntryClasses)
+    {
+        free (pEntryClasses);
+        pEntryClasses = 0;
+    }
+
+    return nReturnValue;
+}
+
+int process_dir_entries(
+    FILE*       pFile,
+    fat_node *  pFatList,
+    uint32_t *  pFatBuffer,
+    fat_chain * pFatChainList,
+    uint32_t    ulFatChainCount,
+    uint32_t    ulClusterSize,
+    uint32_t    ulClusterCount,
+    uint32_t    ulDirClusterIndex,
+    uint32_t    ulRootDirOffset,
+    uint32_t    ulDirFlags)
+{
+    int              nReturnValue = 0;
+    fat_chain_start* pStarts = 0;
+
+    /* Every entry looks up its chain by start cluster; sort the starts once. */
+    pStarts = sort_fat_chain_starts(pFatChainList, ulFatChainCount);
+    if (pStarts == 0)
+        return -1;
+
+    nReturnValue = process_dir_tree(
+        pFile,
+        pFatList,
+        pFatBuffer,
+        pFatChainList,
+        pStarts,
+        ulFatChainCount,
+        ulClusterSize,
+        ulClusterCount,
+        ulDirClusterIndex,
+        ulRootDirOffset,
+        ulDirFlags);
+
+    free (pStarts);
+
+    return nReturnValue;
+}
+
+/* queues ulCluster of directory ulDirCluster, unless seen before. */
+static int queue_dir_cluster(
+    fat_dir_walk* pWalk,
+    uint32_t      ulDirCluster,
+    uint32_t      ulCluster)
+{
+    if ((ulCluster < 2) || (ulCluster >= pWalk->ulFatEntries))
+        return 1;
+
+    if (0 != (pWalk->pQueued[ulCluster >> 3] & (1 << (ulCluster & 7))))
+        return 1;
+
+    pWalk->pQueued[ulCluster >> 3] |= (uint8_t)(1 << (ulCluster & 7));
+
+    return fat_sched_add(
+        &pWalk->sched,
+        (__int64)pWalk->ulRootDirOffset + (__int64)(ulCluster - 2) * pWalk->ulClusterSize,
+        pWalk->ulClusterSize,
+        ((uint64_t)ulDirCluster << 32) | ulCluster);
+}
+
+int fat_dir_walk_queue(
+    fat_dir_walk* pWalk,
+    uint32_t      ulDirCluster)
+{
+    fat_node* pFatNode = 0;
+    int       nStatus = 0;
+
+    if ((ulDirCluster < 2) || (ulDirCluster >= pWalk->ulFatEntries))
+        return 0;
+
+    for (pFatNode = &pWalk->pFatList[ulDirCluster]; pFatNode != 0; pFatNode = pFatNode->next)
+    {
+        nStatus = queue_dir_cluster(pWalk, ulDirCluster, pFatNode->cluster);
+
+        /* Already queued (shared or cyclic chain) or failed. */
+        if (nStatus != 0)
+            return (nStatus < 0) ? -1 : 0;
+
+        if (0 != (pWalk->ulDirFlags & FAT_DIR_STOP_AT_END))
+            break;
+    }
+
+    return 0;
+}
+
+int fat_dir_walk_cluster(
+    void*          pContext,
+    uint64_t       ullTag,
+    const uint8_t* pData,
+    uint32_t       ulLength)
+{
+    fat_dir_walk*    pWalk = (fat_dir_walk*)pContext;
+    FAT32_DIR_ENTRY* pDirEntry = 0;
+    fat_chain*       pChainNode = 0;
+    fat_chain*       pDirChainNode = 0;
+    fat_node*        pFatNode = 0;
+    uint32_t         ulDirCluster = (uint32_t)(ullTag >> 32);
+    uint32_t         ulCluster = (uint32_t)(ullTag & 0xFFFFFFFF);
+    uint32_t         ulDirsPerCluster = ulLength / sizeof(FAT32_DIR_ENTRY);
+    uint32_t         ulEntriesInUse = 0;
+    uint32_t         ulEntryClusterIndex = 0;
+    uint32_t         ulIndex = 0;
+
+    ulEntriesInUse = fat_dirscan_classify(
+        (const FAT32_DIR_ENTRY*)pData,
+        ulDirsPerCluster,
+        pWalk->pEntryClasses,
+        (0 != (pWalk->ulDirFlags & FAT_DIR_STOP_AT_END)) ? 1 : 0);
+
+    if (0 == (pWalk->ulDirFlags & FAT_DIR_STOP_AT_END))
+        ulEntriesInUse = ulDirsPerCluster;
+
+    pDirChainNode = find_fat_chain(
+        pWalk->pFatChainList,
+        pWalk->pStarts,
+        pWalk->ulFatChainCount,
+        ulDirCluster);
+
+    for (ulIndex = 0; ulIndex < ulEntriesInUse; ulIndex++)
+    {
+        if (pWalk->pEntryClasses[ulIndex] == FAT_DIRSCAN_FREE)
+            continue;
+
+        pDirEntry = (FAT32_DIR_ENTRY*)pData + ulIndex;
+        ulEntryClusterIndex  = ((uint32_t)pDirEntry->clusterAddressHigh << 16);
+        ulEntryClusterIndex |= (pDirEntry->clusterAddressLow << 0);
+
+        pChainNode = find_fat_chain(
+            pWalk->pFatChainList,
+            pWalk->pStarts,
+            pWalk->ulFatChainCount,
+            ulEntryClusterIndex);
+
+        populate_fat_chain(pChainNode, pDirEntry, pDirChainNode,
+            (__int64)pWalk->ulRootDirOffset + (__int64)(ulCluster - 2) * pWalk->ulClusterSize +
+            (__int64)ulIndex * sizeof(FAT32_DIR_ENTRY));
+
+        if (0 != (pWalk->ulDirFlags & FAT_DIR_REPORT_ENTRIES))
+            process_dir_entry(pChainNode, pDirEntry);
+
+        /* Subdirectories join the next sweep instead of recursing. */
+        if ((pWalk->pEntryClasses[ulIndex] == FAT_DIRSCAN_DIRECTORY) ||
+            ((pWalk->pEntryClasses[ulIndex] == FAT_DIRSCAN_DELETED) &&
+             (0 != (pDirEntry->fileAttributes & FILE_ATTRIB_DIR))))
+        {
+            if (0 != fat_dir_walk_queue(pWalk, ulEntryClusterIndex))
+                return -1;
+        }
+    }
+
+    /* Stopping at the end: the next cluster is only needed if this one was full. */
+    if ((0 != (pWalk->ulDirFlags & FAT_DIR_STOP_AT_END)) && (ulEntriesInUse == ulDirsPerCluster))
+    {
+        pFatNode = pWalk->pFatList[ulCluster].next;
+
+        if ((pFatNode != 0) && (0 > queue_dir_cluster(pWalk, ulDirCluster, pFatNode->cluster)))
+            return -1;
+    }
+
+    return 0;
+}
+
+int fat_dir_walk_init(
+    fat_dir_walk* pWalk,
+    int           nImageFile,
+    fat_node *    pFatList,
+    fat_chain *   pFatChainList,
+    uint32_t      ulFatChainCount,
+    uint32_t      ulFatSize,
+    uint32_t      ulClusterSize,
+    uint32_t      ulRootDirOffset,
+    uint32_t      ulDirFlags)
+{
+    memset(pWalk, 0x00, sizeof(fat_dir_walk));
+
+    pWalk->pFatList = pFatList;
+    pWalk->pFatChainList = pFatChainList;
+    pWalk->ulFatChainCount = ulFatChainCount;
+    pWalk->ulFatEntries = ulFatSize >> 2;
+    pWalk->ulClusterSize = ulClusterSize;
+    pWalk->ulRootDirOffset = ulRootDirOffset;
+    pWalk->ulDirFlags = ulDirFlags;
+
+    pWalk->pEntryClasses = malloc(ulClusterSize / sizeof(FAT32_DIR_ENTRY) + 1);
+    pWalk->pQueued = calloc((pWalk->ulFatEntries >> 3) + 1, 1);
+    pWalk->pStarts = sort_fat_chain_starts(pFatChainList, ulFatChainCount);
+    if ((pWalk->pEntryClasses == 0) || (pWalk->pQueued == 0) || (pWalk->pStarts == 0) ||
+        (0 != fat_sched_init(&pWalk->sched, nImageFile)))
+    {
+        fprintf(stderr, "allocations failed.\n");
+        fat_dir_walk_free(pWalk);
+        return -1;
+    }
+
+    return 0;
+}
+
+void fat_dir_walk_free(
+    fat_dir_walk* pWalk)
+{
+    fat_sched_free(&pWalk->sched);
+
+    // Free the pWalk->pEntryClasses buffer.
+    if (0 != pWalk->pEntryClasses)
+    {
+        free (pWalk->pEntryClasses);
+        pWalk->pEntryClasses = 0;
+    }
+
+    // Free the pWalk->pQueued buffer.
+    if (0 != pWalk->pQueued)
+    {
+        free (pWalk->pQueued);
+        pWalk->pQueued = 0;
+    }
+
+    // Free the pWalk->pStarts buffer.
+    if (0 != pWalk->pStarts)
+    {
+        free (pWalk->pStarts);
+        pWalk->pStarts = 0;
+    }
+}
+
+int process_dir_entries_elevator(
+    FILE*       pFile,
+    fat_node *  pFatList,
+    fat_chain * pFatChainList,
+    uint32_t    ulFatChainCount,
+    uint32_t    ulFatSize,
+    uint32_t    ulClusterSize,
+    uint32_t    ulRootDirOffset,
+    uint32_t    ulDirFlags,
+    uint32_t    ulReadahead)
+{
+    int          nReturnValue = 0;
+    fat_dir_walk walk;
+
+    nReturnValue = fat_dir_walk_init(
+        &walk,
+        fileno(pFile),
+        pFatList,
+        pFatChainList,
+        ulFatChainCount,
+        ulFatSize,
+        ulClusterSize,
+        ulRootDirOffset,
+        ulDirFlags);
+
+    if (nReturnValue != 0)
+        return nReturnValue;
+
+    walk.sched.ulReadahead = ulReadahead;
+
+    nReturnValue = fat_dir_walk_queue(&walk, FAT_ROOT_DIR);
+
+    if (nReturnValue == 0)
+        nReturnValue = fat_sched_run(&walk.sched, fat_dir_walk_cluster, &walk);
+
+    if (nReturnValue == 0)
+    {
+        fprintf(stderr, "elevator: %u directory clusters in %u reads over %u passes.\n",
+            walk.sched.ulRequests,
+            walk.sched.ulReads,
+            walk.sched.ulPasses);
+    }
+
+    fat_dir_walk_free(&walk);
+
     return nReturnValue;
 }
 
@@ -730,6 +1595,14 @@ int report_fat_dir_entries(
 
     for (ulFatChainIndex = 0; ulFatChainIndex < ulFatChainCount; ++ulFatChainIndex)
     {
+        /* Fetch the next lanes' worth of chains together, not one miss at a time. */
+        if (0 == (ulFatChainIndex % FAT_WALK_LANES))
+        {
+            fat_walk_warm(
+                &pFatChainList[ulFatChainIndex],
+                (ulFatChainCount - ulFatChainIndex < FAT_WALK_LANES) ? (ulFatChainCount - ulFatChainIndex) : FAT_WALK_LANES);
+        }
+
         report_fat_chain(&pFatChainList[ulFatChainIndex]);
     }
 
@@ -830,26 +1703,70 @@ int process_dir_entry(
     return nReturnValue;
 }
 
-fat_chain* find_fat_chain(
+static int compare_fat_chain_starts(
+    const void* pLeft,
+    const void* pRight)
+{
+    const fat_chain_start* pLeftStart = (const fat_chain_start*)pLeft;
+    const fat_chain_start* pRightStart = (const fat_chain_start*)pRight;
+
+    /* Chains sharing a start keep FAT order, so the first one still wins. */
+    if (pLeftStart->ulStart != pRightStart->ulStart)
+        return (pLeftStart->ulStart < pRightStart->ulStart) ? -1 : 1;
+
+    return (pLeftStart->ulChain < pRightStart->ulChain) ? -1 : ((pLeftStart->ulChain > pRightStart->ulChain) ? 1 : 0);
+}
+
+fat_chain_start* sort_fat_chain_starts(
     fat_chain* pFatChainList,
-    uint32_t   ulFatChainLength,
-    uint32_t   ulClusterStart)
+    uint32_t   ulFatChainCount)
 {
-    fat_chain* pSearchChain = 0;
-    fat_chain* pResultChain = 0;
-    uint32_t ulFatChainIndex = 0;
+    fat_chain_start* pStarts = 0;
+    uint32_t         ulFatChainIndex = 0;
 
-    for (ulFatChainIndex = 0; ulFatChainIndex < ulFatChainLength; ++ulFatChainIndex)
+    pStarts = malloc(((size_t)ulFatChainCount + 1) * sizeof(fat_chain_start));
+    if (pStarts == 0)
     {
-        pSearchChain = &pFatChainList[ulFatChainIndex];
-        if (pSearchChain->head->cluster == ulClusterStart)
-        {
-            pResultChain = pSearchChain;
-            break;
-        }
+        fprintf(stderr, "allocations failed.\n");
+        return 0;
     }
 
-    return pResultChain;
+    for (ulFatChainIndex = 0; ulFatChainIndex < ulFatChainCount; ++ulFatChainIndex)
+    {
+        pStarts[ulFatChainIndex].ulStart = pFatChainList[ulFatChainIndex].start;
+        pStarts[ulFatChainIndex].ulChain = ulFatChainIndex;
+    }
+
+    qsort(pStarts, ulFatChainCount, sizeof(fat_chain_start), compare_fat_chain_starts);
+
+    return pStarts;
+}
+
+fat_chain* find_fat_chain(
+    fat_chain*             pFatChainList,
+    const fat_chain_start* pStarts,
+    uint32_t               ulFatChainLength,
+    uint32_t               ulClusterStart)
+{
+    uint32_t ulLow = 0;
+    uint32_t ulHigh = ulFatChainLength;
+    uint32_t ulMid = 0;
+
+    /* first start >= ulClusterStart. */
+    while (ulLow < ulHigh)
+    {
+        ulMid = ulLow + ((ulHigh - ulLow) >> 1);
+
+        if (pStarts[ulMid].ulStart < ulClusterStart)
+            ulLow = ulMid + 1;
+        else
+            ulHigh = ulMid;
+    }
+
+    if ((ulLow == ulFatChainLength) || (pStarts[ulLow].ulStart != ulClusterStart))
+        return 0;
+
+    return &pFatChainList[pStarts[ulLow].ulChain];
 }
 
 fat_chain* find_fat_chain_by_name(
@@ -883,10 +1800,11 @@ fat_chain* find_fat_chain_by_name(
         szNodeFilename = (char*)pFatChainList[ulFatChainIndex].filename;
         szNodeExtension = (char*)pFatChainList[ulFatChainIndex].extension;
 
-        if ((0 == memcmp(szNodeExtension, szNodeExtension, sizeof(szNodeExtension))) &&
+        if ((0 == memcmp(szNodeExtension, szSearchExtension, sizeof(szSearchExtension))) &&
             (0 == memcmp(szNodeFilename, szSearchFilename, sizeof(szSearchFilename))))
         {
             pResultChain = &pFatChainList[ulFatChainIndex];
+            break;
         }
     }
 
@@ -897,11 +1815,12 @@ void dump_buffer(
     uint32_t* pBuffer,
     uint32_t  ulBufferLength)
 {
-    uint32_t ulBufferIndex = 0;
+    fat_hexdump dump;
 
-    for (ulBufferIndex = 0; ulBufferIndex < ulBufferLength / sizeof(uint32_t); ulBufferIndex++)
+    if (0 == fat_hexdump_open(&dump, stdout, FAT_HEXDUMP_WORDS, 0))
     {
-        fprintf(stdout, "%8.8X ", pBuffer[ulBufferIndex]);
+        fat_hexdump_write(&dump, pBuffer, ulBufferLength & ~(sizeof(uint32_t) - 1));
+        fat_hexdump_close(&dump);
     }
 }
 
@@ -913,9 +1832,11 @@ int extract_contents(
     fat_chain* pFatChainList,
     uint32_t   ulFatChainCount,
     uint32_t   ulRootDirOffset,
-    uint32_t   ulClusterSize)
+    uint32_t   ulClusterSize,
+    uint32_t   ulDumpLayout)
 {
     int nReturnValue = 0;
+    fat_hexdump dump;
     fat_chain* pChainNode = 0;
     fat_node* pFatNode = 0;
     __int64 llFileOffset = 0;
@@ -934,6 +1855,10 @@ int extract_contents(
     {
         nReturnValue = -1;
     }
+    else if (0 != fat_hexdump_open(&dump, stdout, ulDumpLayout, 0))
+    {
+        nReturnValue = -1;
+    }
     else
     {
         pFileBuffer = malloc(ulClusterSize);
@@ -954,15 +1879,22 @@ int extract_contents(
 
             llFileOffset = ulRootDirOffset + (pFatNode->cluster - 2) * ulClusterSize;
 
+            /* The next node arrives while this cluster is read. */
+            FAT_CACHE_PREFETCH(pFatNode->next);
+
             _fseeki64(pFile, llFileOffset, SEEK_SET);
             ulBytesRead = fread(pFileBuffer, 1, ulBytesToRead, pFile);
             ulBytesRemaining -= ulBytesRead;
 
-            dump_buffer(pFileBuffer, ulBytesToRead);
+            fat_hexdump_write(&dump, pFileBuffer, ulBytesRead);
 
             pFatNode = pFatNode->next;
         }
-        fprintf(stdout, "\n");
+
+        fat_hexdump_close(&dump);
+
+        if (ulDumpLayout == FAT_HEXDUMP_WORDS)
+            fprintf(stdout, "\n");
 
         free (pFileBuffer);
     }
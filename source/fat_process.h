@@ -3,14 +3,27 @@
 
 #include "stdint.h"
 #include "fat_defs.h"
+#include "fat_writeback.h"
+#include "fat_sched.h"
 
 #define FAT_EOC         (0x0FFFFFF8)
 #define FAT_EOF         (0x0FFFFFFF)
+#define FAT_BAD         (0x0FFFFFF7)
 #define FAT_ROOT_DIR    (2)
 #define FILE_ATTRIB_DIR (0x10)
 #define FILE_DOT_ENTRY  (0x2E)
 #define FILE_DEL_ENTRY  (0xE5)
 
+/* fat_entry_kind() values. */
+#define FAT_ENTRY_FREE  (0) /* unallocated cluster. */
+#define FAT_ENTRY_NEXT  (1) /* allocated, links to another cluster. */
+#define FAT_ENTRY_END   (2) /* allocated, last cluster of a chain. */
+#define FAT_ENTRY_OTHER (3) /* bad or reserved value. */
+
+/* process_dir_entries() flags. */
+#define FAT_DIR_REPORT_ENTRIES (0x01) /* print every entry as it is walked. */
+#define FAT_DIR_STOP_AT_END    (0x02) /* stop at the 0x00 end-of-directory entry. */
+
 typedef struct FAT_NODE {
     struct FAT_NODE * next;
     struct FAT_NODE * prev;
@@ -21,6 +34,7 @@ typedef struct FAT_NODE {
 typedef struct FAT_CHAIN {
     struct FAT_NODE * head;
     struct FAT_NODE * tail;
+    uint32_t          start;    /* head->cluster, so lookups stay in the chain array. */
     unsigned char filename[8];
     unsigned char extension[3];
     uint32_t      filesize;
@@ -49,17 +63,91 @@ typedef struct FAT_CHAIN {
         } date;
     } timestamp;
 
+    /* last write and last access stamps, as stored in the entry. */
+    uint16_t modifytime;
+    uint16_t modifydate;
+    uint16_t accessdate;
+
+    /* image offset of the directory entry copied in. */
+    uint64_t entryoffset;
+
     uint8_t populated;
+
+    /* chain of the directory holding this entry (0 for the root). */
+    struct FAT_CHAIN * parent;
 } fat_chain;
 
+typedef struct FAT_OPTIONS {
+    int      nPatch;
+    char*    szFind;
+    char*    szExtractDir;
+    uint32_t ulThreads;
+    char*    szDump;
+    uint32_t ulDumpLayout;
+    char*    szJournal;
+    char*    szRollback;
+    int      nStopAtDirEnd;
+    char*    szHashManifest;
+    uint32_t ulHashAlgorithms;
+    int      nLazy;
+    int      nElevator;
+    uint32_t ulReadahead;
+    uint64_t ullMaxMemory;
+    char*    szSpillDir;
+    int      nTimeline;
+    char*    szSince;
+    char*    szUntil;
+    uint32_t ulTimeKinds;
+    int      nCarve;
+    char*    szCarveSignatures;
+    char*    szOwner;
+    char*    szOwnerBatch;
+    char*    szDiff;
+    int      nDefrag;
+    uint32_t ulDefragLimit;
+    int      nDefragApply;
+    uint32_t ulTop;
+    uint32_t ulRankBy;
+    uint64_t ullMinSize;
+    uint64_t ullMaxSize;
+    uint32_t ulMinFragments;
+    int      nEstimate;
+    uint32_t ulEstimateSamples;
+    char*    szTee;
+    char*    szRescueMap;
+    char*    szClone;
+    uint32_t ulHugePages;
+    int      nProfile;
+} fat_options;
+
+/* a chain's start cluster and index, for lookups by start. */
+typedef struct FAT_CHAIN_START {
+    uint32_t ulStart;
+    uint32_t ulChain;
+} fat_chain_start;
+
+/* returns ulFatChainCount entries sorted by start cluster, to be freed by
+   the caller, or 0 if the allocation failed. */
+fat_chain_start* sort_fat_chain_starts(
+    fat_chain* pFatChainList,
+    uint32_t   ulFatChainCount);
+
+/* binary searches pStarts for the first chain starting at ulClusterStart. */
 fat_chain* find_fat_chain(
+    fat_chain*             pFatChainList,
+    const fat_chain_start* pStarts,
+    uint32_t               ulFatChainLength,
+    uint32_t               ulClusterStart);
+
+fat_chain* find_fat_chain_by_name(
+    char*      szFilename,
+    char*      szExtension,
     fat_chain* pFatChainList,
-    uint32_t   ulFatChainLength,
-    uint32_t   ulClusterStart);
+    uint32_t   ulFatChainCount);
 
 int process_image_file(
-    char* szFilename,
-    int   nPatch);
+    char*        szFilename,
+    fat_options* pOptions);
 
 int read_fs_config_data(
     FILE*               pFile,
@@ -70,11 +158,18 @@ int read_fs_config_data(
     int32_t*            pFileAllocationTableSize,
     int32_t*            pRootDirectoryEntryOffset);
 
+/* marks every repaired entry in pDirtyMap (may be 0). */
 int patch_file_allocation_tables(
     uint32_t* pFat1Buffer,
     uint32_t* pFat2Buffer,
     uint32_t ulFatSize,
-    uint32_t ulClusterCount);
+    uint32_t ulClusterCount,
+    fat_dirty_map* pDirtyMap);
+
+/* how process_fat_entries() reads one FAT1 value; one of FAT_ENTRY_*. */
+int fat_entry_kind(
+    uint32_t ulValue,
+    uint32_t ulFatEntries);
 
 /* returns number of fat chains found. */
 uint32_t process_fat_entries(
@@ -97,7 +192,71 @@ int process_dir_entries(
     uint32_t    ulClusterSize,
     uint32_t    ulClusterCount,
     uint32_t    ulClusterIndex,
-    uint32_t    ulRootDirOffset);
+    uint32_t    ulRootDirOffset,
+    uint32_t    ulDirFlags);
+
+/**
+ * Directory walk driven one cluster at a time.
+ *
+ * fat_dir_walk_queue() marks the clusters of a directory and adds them to
+ * sched; whoever owns sched delivers each one to fat_dir_walk_cluster(),
+ * which populates the chains of its entries and queues any subdirectory.
+ * The elevator walk lets fat_sched_run() deliver them; a stream delivers
+ * them as they arrive.  Every cluster is queued at most once.
+ */
+typedef struct FAT_DIR_WALK {
+    fat_sched        sched;
+    fat_node *       pFatList;
+    fat_chain *      pFatChainList;
+    uint32_t         ulFatChainCount;
+    uint32_t         ulFatEntries;
+    uint32_t         ulClusterSize;
+    uint32_t         ulRootDirOffset;
+    uint32_t         ulDirFlags;
+    uint8_t *        pEntryClasses;
+    uint8_t *        pQueued;     /* one bit per cluster already queued. */
+    fat_chain_start* pStarts;     /* chains sorted by start cluster. */
+} fat_dir_walk;
+
+int fat_dir_walk_init(
+    fat_dir_walk* pWalk,
+    int           nImageFile,
+    fat_node *    pFatList,
+    fat_chain *   pFatChainList,
+    uint32_t      ulFatChainCount,
+    uint32_t      ulFatSize,
+    uint32_t      ulClusterSize,
+    uint32_t      ulRootDirOffset,
+    uint32_t      ulDirFlags);
+
+void fat_dir_walk_free(
+    fat_dir_walk* pWalk);
+
+/* queues a directory: all of its clusters, or only the first when stopping at the end. */
+int fat_dir_walk_queue(
+    fat_dir_walk* pWalk,
+    uint32_t      ulDirCluster);
+
+/* a fat_sched_complete; ullTag is (directory cluster << 32) | cluster. */
+int fat_dir_walk_cluster(
+    void*          pContext,
+    uint64_t       ullTag,
+    const uint8_t* pData,
+    uint32_t       ulLength);
+
+/* walks the whole tree from the root, reading directory clusters in
+   elevator order instead of tree order; the next ulReadahead queued
+   clusters are hinted to the kernel ahead of each read. */
+int process_dir_entries_elevator(
+    FILE*       pFile,
+    fat_node *  pFatList,
+    fat_chain * pFatChainList,
+    uint32_t    ulFatChainCount,
+    uint32_t    ulFatSize,
+    uint32_t    ulClusterSize,
+    uint32_t    ulRootDirOffset,
+    uint32_t    ulDirFlags,
+    uint32_t    ulReadahead);
 
 int process_dir_entry(
     fat_chain * pFatChain,
@@ -125,6 +284,7 @@ int extract_contents(
     fat_chain* pFatChainList,
     uint32_t   ulFatChainCount,
     uint32_t   ulRootDirOffset,
-    uint32_t   ulClusterSize);
+    uint32_t   ulClusterSize,
+    uint32_t   ulDumpLayout);
 
 #endif /* __FAT_PROCESS_H_HEADER__ */
@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <linux/perf_event.h>
+#define FAT_PROFILE_PERF
+#elif !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+#include "stdint.h"
+#include "fat_platform.h"
+#include "fat_profile.h"
+
+#define PROFILE_CYCLES        (0)
+#define PROFILE_INSTRUCTIONS  (1)
+#define PROFILE_LLC_MISSES    (2)
+#define PROFILE_BRANCH_MISSES (3)
+#define PROFILE_PAGE_FAULTS   (4)
+
+#define PROFILE_COLUMN_LENGTH (32)
+
+static int g_nEnabled = 0;
+static int g_anCounters[FAT_PROFILE_COUNTERS] = { -1, -1, -1, -1, -1 };
+
+#ifdef FAT_PROFILE_PERF
+static int profile_open(
+    uint32_t ulType,
+    uint64_t ullConfig)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0x00, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = ulType;
+    attr.config = ullConfig;
+    attr.inherit = 1;           /* hash and extract workers count too. */
+    attr.exclude_kernel = 1;    /* all perf_event_paranoid 2 allows. */
+    attr.exclude_hv = 1;
+
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+/* reads every open counter; pAvailable marks those that could be read. */
+static void profile_read(
+    uint64_t* pValues,
+    int*      pAvailable)
+{
+    int nIndex = 0;
+
+    memset(pValues, 0x00, FAT_PROFILE_COUNTERS * sizeof(uint64_t));
+    memset(pAvailable, 0x00, FAT_PROFILE_COUNTERS * sizeof(int));
+
+#ifdef FAT_PROFILE_PERF
+    for (nIndex = 0; nIndex < FAT_PROFILE_COUNTERS; ++nIndex)
+    {
+        if ((g_anCounters[nIndex] >= 0) &&
+            (sizeof(uint64_t) == read(g_anCounters[nIndex], &pValues[nIndex], sizeof(uint64_t))))
+        {
+            pAvailable[nIndex] = 1;
+        }
+    }
+#else
+    (void)nIndex;
+#endif
+}
+
+/* minor plus major faults of this process so far; 0 where unknown. */
+static uint64_t profile_rusage_faults(void)
+{
+#ifndef _WIN32
+    struct rusage usage;
+
+    if (0 == getrusage(RUSAGE_SELF, &usage))
+        return (uint64_t)usage.ru_minflt + (uint64_t)usage.ru_majflt;
+#endif
+
+    return 0;
+}
+
+/* "-" for a figure that could not be measured. */
+static const char* profile_column(
+    char*       szColumn,
+    int         nAvailable,
+    const char* szFormat,
+    double      dValue)
+{
+    if (nAvailable == 0)
+        return "-";
+
+    _snprintf(szColumn, PROFILE_COLUMN_LENGTH - 1, szFormat, dValue);
+    szColumn[PROFILE_COLUMN_LENGTH - 1] = 0;
+
+    return szColumn;
+}
+
+void fat_profile_configure(
+    int          nEnabled)
+{
+    int nIndex = 0;
+    int nOpened = 0;
+    int nError = 0;
+
+    g_nEnabled = nEnabled;
+
+    if (g_nEnabled == 0)
+        return;
+
+#ifdef FAT_PROFILE_PERF
+    g_anCounters[PROFILE_CYCLES] = profile_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+    g_anCounters[PROFILE_INSTRUCTIONS] = profile_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    g_anCounters[PROFILE_LLC_MISSES] = profile_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    g_anCounters[PROFILE_BRANCH_MISSES] = profile_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+    nError = errno;
+    g_anCounters[PROFILE_PAGE_FAULTS] = profile_open(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+#endif
+
+    for (nIndex = 0; nIndex <= PROFILE_BRANCH_MISSES; ++nIndex)
+        if (g_anCounters[nIndex] >= 0)
+            ++nOpened;
+
+    if (nOpened == 0)
+    {
+#ifdef FAT_PROFILE_PERF
+        fprintf(stderr, "profile: hardware counters unavailable (%s); timing and page faults only.\n", strerror(nError));
+#else
+        fprintf(stderr, "profile: hardware counters unavailable on this system; timing and page faults only.\n");
+#endif
+    }
+
+    fprintf(stderr, "profile: %-14s %9s %14s %14s %6s %10s %9s %10s\n",
+        "phase", "seconds", "cycles", "instructions", "IPC", "LLC/kinst", "br/kinst", "faults");
+}
+
+void fat_profile_begin(
+    fat_profile* pProfile,
+    const char*  szPhase)
+{
+    if (g_nEnabled == 0)
+        return;
+
+    pProfile->szPhase = szPhase;
+    pProfile->ullFaults = profile_rusage_faults();
+    profile_read(pProfile->aullStart, pProfile->anStarted);
+
+    pProfile->dStart = fat_clock_seconds();
+}
+
+void fat_profile_end(
+    fat_profile* pProfile)
+{
+    double   dSeconds = 0;
+    uint64_t aullValues[FAT_PROFILE_COUNTERS];
+    int      anAvailable[FAT_PROFILE_COUNTERS];
+    char     aszColumns[6][PROFILE_COLUMN_LENGTH];
+    int      nIndex = 0;
+
+    if (g_nEnabled == 0)
+        return;
+
+    dSeconds = fat_clock_seconds() - pProfile->dStart;
+
+    profile_read(aullValues, anAvailable);
+
+    for (nIndex = 0; nIndex < FAT_PROFILE_COUNTERS; ++nIndex)
+    {
+        anAvailable[nIndex] = anAvailable[nIndex] && pProfile->anStarted[nIndex] &&
+                              (aullValues[nIndex] >= pProfile->aullStart[nIndex]);
+        aullValues[nIndex] = anAvailable[nIndex] ? (aullValues[nIndex] - pProfile->aullStart[nIndex]) : 0;
+    }
+
+    if ((anAvailable[PROFILE_PAGE_FAULTS] == 0) && (pProfile->ullFaults != 0))
+    {
+        aullValues[PROFILE_PAGE_FAULTS] = profile_rusage_faults() - pProfile->ullFaults;
+        anAvailable[PROFILE_PAGE_FAULTS] = 1;
+    }
+
+    fprintf(stderr, "profile: %-14s %9.3f %14s %14s %6s %10s %9s %10s\n",
+        pProfile->szPhase,
+        dSeconds,
+        profile_column(aszColumns[0], anAvailable[PROFILE_CYCLES], "%.0f",
+            (double)aullValues[PROFILE_CYCLES]),
+        profile_column(aszColumns[1], anAvailable[PROFILE_INSTRUCTIONS], "%.0f",
+            (double)aullValues[PROFILE_INSTRUCTIONS]),
+        profile_column(aszColumns[2],
+            anAvailable[PROFILE_CYCLES] && anAvailable[PROFILE_INSTRUCTIONS] && (aullValues[PROFILE_CYCLES] != 0),
+            "%.2f",
+            (double)aullValues[PROFILE_INSTRUCTIONS] / (double)(aullValues[PROFILE_CYCLES] ? aullValues[PROFILE_CYCLES] : 1)),
+        profile_column(aszColumns[3],
+            anAvailable[PROFILE_LLC_MISSES] && anAvailable[PROFILE_INSTRUCTIONS] && (aullValues[PROFILE_INSTRUCTIONS] != 0),
+            "%.2f",
+            1000.0 * (double)aullValues[PROFILE_LLC_MISSES] / (double)(aullValues[PROFILE_INSTRUCTIONS] ? aullValues[PROFILE_INSTRUCTIONS] : 1)),
+        profile_column(aszColumns[4],
+            anAvailable[PROFILE_BRANCH_MISSES] && anAvailable[PROFILE_INSTRUCTIONS] && (aullValues[PROFILE_INSTRUCTIONS] != 0),
+            "%.2f",
+            1000.0 * (double)aullValues[PROFILE_BRANCH_MISSES] / (double)(aullValues[PROFILE_INSTRUCTIONS] ? aullValues[PROFILE_INSTRUCTIONS] : 1)),
+        profile_column(aszColumns[5], anAvailable[PROFILE_PAGE_FAULTS], "%.0f",
+            (double)aullValues[PROFILE_PAGE_FAULTS]));
+}
+
+void fat_profile_finish(void)
+{
+    int nIndex = 0;
+
+    for (nIndex = 0; nIndex < FAT_PROFILE_COUNTERS; ++nIndex)
+    {
+#ifdef FAT_PROFILE_PERF
+        if (g_anCounters[nIndex] >= 0)
+            close(g_anCounters[nIndex]);
+#endif
+        g_anCounters[nIndex] = -1;
+    }
+
+    g_nEnabled = 0;
+}
@@ -0,0 +1,43 @@
+#ifndef __FAT_PROFILE_H_HEADER__
+#define __FAT_PROFILE_H_HEADER__
+
+#include "stdint.h"
+
+#define FAT_PROFILE_COUNTERS (5)    /* cycles, instructions, LLC misses, branch misses, page faults. */
+
+typedef struct FAT_PROFILE {
+    const char* szPhase;
+    double      dStart;
+    uint64_t    ullFaults;          /* getrusage() faults at the start, for a missing fault counter. */
+    uint64_t    aullStart[FAT_PROFILE_COUNTERS];    /* counter values at the start. */
+    int         anStarted[FAT_PROFILE_COUNTERS];    /* which of them could be read. */
+} fat_profile;
+
+/**
+ * Per-phase hardware counters for --profile.
+ *
+ * Once enabled, each fat_profile_begin() / fat_profile_end() pair prints
+ * one line to stderr: wall time, cycles, instructions, IPC, last-level
+ * cache and branch misses per thousand instructions, and page faults.
+ * Counters come from perf_event_open on Linux, user space only and
+ * inherited by threads.  The counters run from fat_profile_configure()
+ * on and each phase reports the difference between its end and start
+ * readings, since a reset does not clear what exited threads handed back.
+ * Any counter that cannot be opened (no PMU in a VM, perf_event_paranoid,
+ * other systems) shows as "-"; page faults then fall back to getrusage().
+ * A no-op unless enabled.
+ */
+void fat_profile_configure(
+    int          nEnabled);
+
+void fat_profile_begin(
+    fat_profile* pProfile,
+    const char*  szPhase);
+
+void fat_profile_end(
+    fat_profile* pProfile);
+
+/* closes the counters. */
+void fat_profile_finish(void);
+
+#endif /* __FAT_PROFILE_H_HEADER__ */
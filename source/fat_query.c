@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <ctype.h>
+
+#include "stdint.h"
+#include "fat_process.h"
+#include "fat_index.h"
+#include "fat_platform.h"
+#include "fat_query.h"
+
+#define QUERY_PATH_LENGTH (FAT_INDEX_MAX_DEPTH * FAT_INDEX_NAME_LENGTH + 1)
+
+typedef struct QUERY_HEAP_ENTRY {
+    uint64_t  ullKey;
+    uint32_t  ulChain;
+} query_heap_entry;
+
+/* ranks below:  a smaller key, or the same key later in the chain list. */
+static int query_ranks_below(
+    const query_heap_entry* pLeft,
+    const query_heap_entry* pRight)
+{
+    if (pLeft->ullKey != pRight->ullKey)
+        return (pLeft->ullKey < pRight->ullKey);
+
+    return (pLeft->ulChain > pRight->ulChain);
+}
+
+static int compare_query_entries(
+    const void* pLeft,
+    const void* pRight)
+{
+    if (query_ranks_below((const query_heap_entry*)pRight, (const query_heap_entry*)pLeft))
+        return -1;
+
+    if (query_ranks_below((const query_heap_entry*)pLeft, (const query_heap_entry*)pRight))
+        return 1;
+
+    return 0;
+}
+
+/* restores the min-heap below ulIndex. */
+static void query_sift_down(
+    query_heap_entry* pHeap,
+    uint32_t          ulCount,
+    uint32_t          ulIndex)
+{
+    query_heap_entry entry = pHeap[ulIndex];
+    uint32_t         ulChild = 0;
+
+    while ((ulChild = 2 * ulIndex + 1) < ulCount)
+    {
+        if ((ulChild + 1 < ulCount) && query_ranks_below(&pHeap[ulChild + 1], &pHeap[ulChild]))
+            ++ulChild;
+
+        if (!query_ranks_below(&pHeap[ulChild], &entry))
+            break;
+
+        pHeap[ulIndex] = pHeap[ulChild];
+        ulIndex = ulChild;
+    }
+
+    pHeap[ulIndex] = entry;
+}
+
+static void query_sift_up(
+    query_heap_entry* pHeap,
+    uint32_t          ulIndex)
+{
+    query_heap_entry entry = pHeap[ulIndex];
+
+    while ((ulIndex > 0) && query_ranks_below(&entry, &pHeap[(ulIndex - 1) >> 1]))
+    {
+        pHeap[ulIndex] = pHeap[(ulIndex - 1) >> 1];
+        ulIndex = (ulIndex - 1) >> 1;
+    }
+
+    pHeap[ulIndex] = entry;
+}
+
+/* runs of the chain, bounded against FAT loops. */
+static uint32_t query_fragments(
+    const fat_chain* pChain,
+    uint32_t         ulLimit)
+{
+    const fat_node* pFatNode = pChain->head;
+    uint32_t        ulSteps = 0;
+    uint32_t        ulFragments = 0;
+    uint32_t        ulPrevious = 0;
+
+    for (ulSteps = 0; (pFatNode != 0) && (ulSteps < ulLimit); ++ulSteps)
+    {
+        if ((ulSteps == 0) || (pFatNode->cluster != ulPrevious + 1))
+            ++ulFragments;
+
+        ulPrevious = pFatNode->cluster;
+
+        if (pFatNode == pChain->tail)
+            break;
+
+        pFatNode = pFatNode->next;
+    }
+
+    return ulFragments;
+}
+
+/* "/DIR/.../NAME.EXT" from the parent links, without building an index. */
+static const char* query_chain_path(
+    const fat_chain* pChain,
+    char*            szPath)
+{
+    const fat_chain* apComponents[FAT_INDEX_MAX_DEPTH];
+    char             szName[FAT_INDEX_NAME_LENGTH];
+    uint32_t         ulDepth = 0;
+    size_t           ulLength = 0;
+
+    for (ulDepth = 0; (pChain != 0) && (pChain->populated != 0); ++ulDepth)
+    {
+        if (ulDepth == FAT_INDEX_MAX_DEPTH)
+            return "?";
+
+        apComponents[ulDepth] = pChain;
+        pChain = pChain->parent;
+    }
+
+    if (ulDepth == 0)
+        return "?";
+
+    while (ulDepth-- > 0)
+    {
+        fat_index_format_name(apComponents[ulDepth]->filename, apComponents[ulDepth]->extension, szName);
+
+        szPath[ulLength++] = '/';
+        memcpy(&szPath[ulLength], szName, strlen(szName));
+        ulLength += strlen(szName);
+    }
+
+    szPath[ulLength] = 0;
+
+    return szPath;
+}
+
+int fat_query_rank(
+    const char* szName)
+{
+    if (0 == strcmp(szName, "size"))
+        return FAT_QUERY_BY_SIZE;
+
+    if (0 == strcmp(szName, "fragments"))
+        return FAT_QUERY_BY_FRAGMENTS;
+
+    if (0 == strcmp(szName, "modified"))
+        return FAT_QUERY_BY_MODIFIED;
+
+    return -1;
+}
+
+int fat_query_parse_size(
+    const char* szSize,
+    uint64_t*   pullSize)
+{
+    char* szEnd = 0;
+
+    *pullSize = _strtoui64(szSize, &szEnd, 10);
+
+    if (szEnd == szSize)
+        return -1;
+
+    switch (toupper((unsigned char)*szEnd))
+    {
+        case 'K': *pullSize <<= 10; ++szEnd; break;
+        case 'M': *pullSize <<= 20; ++szEnd; break;
+        case 'G': *pullSize <<= 30; ++szEnd; break;
+        default:  break;
+    }
+
+    return (*szEnd == 0) ? 0 : -1;
+}
+
+int report_fat_query(
+    fat_chain*       pFatChainList,
+    uint32_t         ulFatChainCount,
+    uint32_t         ulFatSize,
+    const fat_query* pQuery)
+{
+    query_heap_entry* pHeap = 0;
+    query_heap_entry  entry;
+    fat_chain*        pChain = 0;
+    char*             szPath = 0;
+    uint32_t          ulRankBy = (pQuery->ulRankBy != 0) ? pQuery->ulRankBy : FAT_QUERY_BY_SIZE;
+    uint32_t          ulHeapCount = 0;
+    uint32_t          ulIndex = 0;
+    uint32_t          ulFragments = 0;
+    uint32_t          ulMatches = 0;
+    int               nReturnValue = 0;
+
+    szPath = malloc(QUERY_PATH_LENGTH);
+    if ((szPath == 0) ||
+        ((pQuery->ulTop != 0) && (0 == (pHeap = malloc(pQuery->ulTop * sizeof(query_heap_entry))))))
+    {
+        fprintf(stderr, "allocations failed.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    for (ulIndex = 0; ulIndex < ulFatChainCount; ++ulIndex)
+    {
+        pChain = &pFatChainList[ulIndex];
+
+        /* Cheapest predicates first. */
+        if ((pChain->filesize < pQuery->ullMinSize) ||
+            ((pQuery->ullMaxSize != 0) && (pChain->filesize > pQuery->ullMaxSize)))
+            continue;
+
+        ulFragments = 0;
+
+        if ((pQuery->ulMinFragments != 0) || (ulRankBy == FAT_QUERY_BY_FRAGMENTS))
+        {
+            ulFragments = query_fragments(pChain, ulFatSize >> 2);
+
+            if (ulFragments < pQuery->ulMinFragments)
+                continue;
+        }
+
+        ++ulMatches;
+
+        if (pQuery->ulTop == 0)
+        {
+            fprintf(stdout, "%s\n", query_chain_path(pChain, szPath));
+            report_fat_chain(pChain);
+            continue;
+        }
+
+        entry.ulChain = ulIndex;
+
+        if (ulRankBy == FAT_QUERY_BY_FRAGMENTS)
+            entry.ullKey = ulFragments;
+        else if (ulRankBy == FAT_QUERY_BY_MODIFIED)
+            entry.ullKey = ((uint64_t)pChain->modifydate << 16) | pChain->modifytime;
+        else
+            entry.ullKey = pChain->filesize;
+
+        /* Keep the ulTop best seen so far; the weakest sits at the root. */
+        if (ulHeapCount < pQuery->ulTop)
+        {
+            pHeap[ulHeapCount] = entry;
+            query_sift_up(pHeap, ulHeapCount++);
+        }
+        else if (query_ranks_below(&pHeap[0], &entry))
+        {
+            pHeap[0] = entry;
+            query_sift_down(pHeap, ulHeapCount, 0);
+        }
+    }
+
+    if (pQuery->ulTop != 0)
+    {
+        qsort(pHeap, ulHeapCount, sizeof(query_heap_entry), compare_query_entries);
+
+        for (ulIndex = 0; ulIndex < ulHeapCount; ++ulIndex)
+        {
+            pChain = &pFatChainList[pHeap[ulIndex].ulChain];
+
+            fprintf(stdout, "%s\n", query_chain_path(pChain, szPath));
+            report_fat_chain(pChain);
+        }
+    }
+
+    fprintf(stderr, "%u of %u chains match.\n", ulMatches, ulFatChainCount);
+
+exit:
+    // Free the pHeap buffer.
+    if (0 != pHeap)
+    {
+        free (pHeap);
+        pHeap = 0;
+    }
+
+    // Free the szPath buffer.
+    if (0 != szPath)
+    {
+        free (szPath);
+        szPath = 0;
+    }
+
+    return nReturnValue;
+}
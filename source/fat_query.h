@@ -0,0 +1,44 @@
+#ifndef __FAT_QUERY_H_HEADER__
+#define __FAT_QUERY_H_HEADER__
+
+#include "stdint.h"
+#include "fat_process.h"
+
+/* report_fat_query() ranking keys, largest first. */
+#define FAT_QUERY_BY_SIZE      (1)
+#define FAT_QUERY_BY_FRAGMENTS (2)
+#define FAT_QUERY_BY_MODIFIED  (3)  /* newest first. */
+
+/**
+ * Filter and ranking applied while the chains are walked.
+ *
+ * Predicates run cheapest first, so a chain rejected on size is never
+ * walked to count its fragments.  With ulTop the survivors go through a
+ * bounded min-heap and memory and output stay at ulTop entries; without
+ * it they are printed as they are found.
+ */
+typedef struct FAT_QUERY {
+    uint32_t  ulTop;            /* 0 for every match, in chain order. */
+    uint32_t  ulRankBy;         /* FAT_QUERY_BY_; FAT_QUERY_BY_SIZE if 0. */
+    uint64_t  ullMinSize;
+    uint64_t  ullMaxSize;       /* 0 for no limit. */
+    uint32_t  ulMinFragments;
+} fat_query;
+
+/* "size", "fragments" or "modified"; -1 if unknown. */
+int fat_query_rank(
+    const char* szName);
+
+/* bytes, with an optional K, M or G suffix.  returns 0 on success. */
+int fat_query_parse_size(
+    const char* szSize,
+    uint64_t*   pullSize);
+
+/* prints the path and entry of every chain matching pQuery. */
+int report_fat_query(
+    fat_chain*       pFatChainList,
+    uint32_t         ulFatChainCount,
+    uint32_t         ulFatSize,
+    const fat_query* pQuery);
+
+#endif /* __FAT_QUERY_H_HEADER__ */
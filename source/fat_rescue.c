@@ -0,0 +1,610 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <time.h>
+
+#include "stdint.h"
+#include "fat_platform.h"
+#include "fat_rescue.h"
+
+#define RESCUE_PATH_LENGTH (4096)
+#define RESCUE_LINE_LENGTH (4096)
+#define RESCUE_COPY_SIZE   (1 << 16)
+
+/* one run of the map; anything not covered has not been tried ('?'). */
+typedef struct RESCUE_RANGE {
+    __int64 llStart;
+    __int64 llEnd;
+    char    cStatus;    /* '+' read; '-', '*' or '/' bad. */
+} rescue_range;
+
+static int           g_nEnabled = 0;
+static char          g_szMapFile[RESCUE_PATH_LENGTH];
+static __int64       g_llImageSize = 0;
+static __int64       g_llPosition = 0;      /* end of the last read; ddrescue's current_pos. */
+static rescue_range* g_pRanges = 0;         /* sorted, disjoint; guarded by g_mutex. */
+static uint32_t      g_ulRangeCount = 0;
+static uint32_t      g_ulRangeCapacity = 0;
+static char**        g_pszDone = 0;         /* sorted, read-only once loaded. */
+static uint32_t      g_ulDoneCount = 0;
+static FILE*         g_pDoneLog = 0;
+static time_t        g_tSaved = 0;
+static uint32_t      g_ulNewBad = 0;        /* sectors that failed this run. */
+static uint32_t      g_ulSkippedBad = 0;    /* known bad sectors not tried again. */
+static uint32_t      g_ulFatRepaired = 0;
+static fat_mutex     g_mutex;
+
+static int compare_done_items(
+    const void* pLeft,
+    const void* pRight)
+{
+    return strcmp(*(char* const*)pLeft, *(char* const*)pRight);
+}
+
+/* first range ending after llOffset. */
+static uint32_t rescue_find(
+    __int64 llOffset)
+{
+    uint32_t ulLow = 0;
+    uint32_t ulHigh = g_ulRangeCount;
+    uint32_t ulMiddle = 0;
+
+    while (ulLow < ulHigh)
+    {
+        ulMiddle = ulLow + ((ulHigh - ulLow) >> 1);
+
+        if (g_pRanges[ulMiddle].llEnd <= llOffset)
+            ulLow = ulMiddle + 1;
+        else
+            ulHigh = ulMiddle;
+    }
+
+    return ulLow;
+}
+
+static int rescue_range_is_bad(
+    __int64 llStart,
+    __int64 llEnd)
+{
+    uint32_t ulIndex = 0;
+
+    for (ulIndex = rescue_find(llStart); (ulIndex < g_ulRangeCount) && (g_pRanges[ulIndex].llStart < llEnd); ++ulIndex)
+        if (g_pRanges[ulIndex].cStatus != '+')
+            return 1;
+
+    return 0;
+}
+
+/* records [llStart, llEnd) as cStatus, splitting and merging neighbours. */
+static int rescue_mark(
+    __int64 llStart,
+    __int64 llEnd,
+    char    cStatus)
+{
+    rescue_range* pGrown = 0;
+    rescue_range  left;
+    rescue_range  right;
+    uint32_t      ulFirst = 0;
+    uint32_t      ulLast = 0;
+    uint32_t      ulNeeded = 0;
+    int           nLeft = 0;
+    int           nRight = 0;
+
+    if (llStart >= llEnd)
+        return 0;
+
+    /* Ranges [ulFirst, ulLast) overlap or touch the new one. */
+    ulFirst = rescue_find(llStart - 1);
+    for (ulLast = ulFirst; (ulLast < g_ulRangeCount) && (g_pRanges[ulLast].llStart <= llEnd); ++ulLast)
+        ;
+
+    // Keep what sticks out with another status, absorb it otherwise.
+    if ((ulFirst < ulLast) && (g_pRanges[ulFirst].llStart < llStart))
+    {
+        left = g_pRanges[ulFirst];
+        left.llEnd = llStart;
+
+        if (left.cStatus == cStatus)
+            llStart = left.llStart;
+        else
+            nLeft = 1;
+    }
+
+    if ((ulFirst < ulLast) && (g_pRanges[ulLast - 1].llEnd > llEnd))
+    {
+        right = g_pRanges[ulLast - 1];
+        right.llStart = (right.llStart > llEnd) ? right.llStart : llEnd;
+
+        if (right.cStatus == cStatus)
+            llEnd = right.llEnd;
+        else
+            nRight = 1;
+    }
+
+    ulNeeded = g_ulRangeCount - (ulLast - ulFirst) + 1 + nLeft + nRight;
+
+    if (ulNeeded > g_ulRangeCapacity)
+    {
+        pGrown = realloc(g_pRanges, (ulNeeded + 256) * sizeof(rescue_range));
+        if (pGrown == 0)
+        {
+            fprintf(stderr, "allocations failed.\n");
+            return -1;
+        }
+
+        g_pRanges = pGrown;
+        g_ulRangeCapacity = ulNeeded + 256;
+    }
+
+    memmove(&g_pRanges[ulFirst + 1 + nLeft + nRight],
+            &g_pRanges[ulLast],
+            (g_ulRangeCount - ulLast) * sizeof(rescue_range));
+
+    if (nLeft != 0)
+        g_pRanges[ulFirst++] = left;
+
+    g_pRanges[ulFirst].llStart = llStart;
+    g_pRanges[ulFirst].llEnd = llEnd;
+    g_pRanges[ulFirst].cStatus = cStatus;
+
+    if (nRight != 0)
+        g_pRanges[ulFirst + 1] = right;
+
+    g_ulRangeCount = ulNeeded;
+
+    return 0;
+}
+
+/* writes the map beside itself and renames it over the old one. */
+static int rescue_save(
+    char cCurrentStatus)
+{
+    FILE*    pMap = 0;
+    char     szTemporary[RESCUE_PATH_LENGTH + 8];
+    __int64  llPosition = 0;
+    uint32_t ulIndex = 0;
+
+    _snprintf(szTemporary, sizeof(szTemporary) - 1, "%s.tmp", g_szMapFile);
+    szTemporary[sizeof(szTemporary) - 1] = 0;
+
+    pMap = fopen(szTemporary, "w");
+    if (pMap == 0)
+    {
+        fprintf(stderr, "fopen() failed on file: '%s'.\n", szTemporary);
+        return -1;
+    }
+
+    fprintf(pMap, "# Mapfile. Created by FatWalker\n");
+    fprintf(pMap, "# current_pos  current_status  current_pass\n");
+    fprintf(pMap, "0x%08llX     %c               1\n", (unsigned long long)g_llPosition, cCurrentStatus);
+    fprintf(pMap, "#      pos        size  status\n");
+
+    for (ulIndex = 0; ulIndex < g_ulRangeCount; ++ulIndex)
+    {
+        if (g_pRanges[ulIndex].llStart > llPosition)
+            fprintf(pMap, "0x%08llX  0x%08llX  ?\n",
+                (unsigned long long)llPosition,
+                (unsigned long long)(g_pRanges[ulIndex].llStart - llPosition));
+
+        fprintf(pMap, "0x%08llX  0x%08llX  %c\n",
+            (unsigned long long)g_pRanges[ulIndex].llStart,
+            (unsigned long long)(g_pRanges[ulIndex].llEnd - g_pRanges[ulIndex].llStart),
+            g_pRanges[ulIndex].cStatus);
+
+        llPosition = g_pRanges[ulIndex].llEnd;
+    }
+
+    if (g_llImageSize > llPosition)
+        fprintf(pMap, "0x%08llX  0x%08llX  ?\n",
+            (unsigned long long)llPosition,
+            (unsigned long long)(g_llImageSize - llPosition));
+
+    if ((0 != fclose(pMap)) || (0 != fat_file_rename(szTemporary, g_szMapFile)))
+    {
+        fprintf(stderr, "write failed on file: '%s'.\n", g_szMapFile);
+        return -1;
+    }
+
+    g_tSaved = time(0);
+
+    return 0;
+}
+
+/* saves the map when the last checkpoint is old enough; g_mutex held. */
+static void rescue_checkpoint(void)
+{
+    if (time(0) - g_tSaved >= FAT_RESCUE_CHECKPOINT_SECONDS)
+        rescue_save('?');
+}
+
+/* an existing map, ours or ddrescue's; '?' areas are left to be tried. */
+static int rescue_load_map(void)
+{
+    FILE*    pMap = 0;
+    char     szLine[RESCUE_LINE_LENGTH];
+    char*    szField = 0;
+    __int64  llStart = 0;
+    __int64  llSize = 0;
+    int      nStatusLine = 1;
+    int      nReturnValue = 0;
+
+    pMap = fopen(g_szMapFile, "r");
+    if (pMap == 0)
+        return 0;
+
+    while ((nReturnValue == 0) && (0 != fgets(szLine, sizeof(szLine), pMap)))
+    {
+        szField = szLine;
+        while ((*szField == ' ') || (*szField == '\t'))
+            ++szField;
+
+        if ((*szField == '#') || (*szField == '\n') || (*szField == '\r') || (*szField == 0))
+            continue;
+
+        llStart = (__int64)_strtoui64(szField, &szField, 0);
+
+        /* The first line is the saved position, not a range. */
+        if (nStatusLine != 0)
+        {
+            g_llPosition = llStart;
+            nStatusLine = 0;
+            continue;
+        }
+
+        llSize = (__int64)_strtoui64(szField, &szField, 0);
+
+        while ((*szField == ' ') || (*szField == '\t'))
+            ++szField;
+
+        if ((*szField == '+') || (*szField == '-') || (*szField == '*') || (*szField == '/'))
+            nReturnValue = rescue_mark(llStart, llStart + llSize, *szField);
+    }
+
+    fclose(pMap);
+
+    return nReturnValue;
+}
+
+/* the items completed by earlier runs. */
+static int rescue_load_done(
+    const char* szDoneFile)
+{
+    FILE*    pDone = 0;
+    char     szLine[RESCUE_LINE_LENGTH];
+    char**   pGrown = 0;
+    uint32_t ulCapacity = 0;
+    size_t   ulLength = 0;
+
+    pDone = fopen(szDoneFile, "r");
+    if (pDone == 0)
+        return 0;
+
+    while (0 != fgets(szLine, sizeof(szLine), pDone))
+    {
+        ulLength = strlen(szLine);
+        while ((ulLength > 0) && ((szLine[ulLength - 1] == '\n') || (szLine[ulLength - 1] == '\r')))
+            szLine[--ulLength] = 0;
+
+        if (ulLength == 0)
+            continue;
+
+        if (g_ulDoneCount == ulCapacity)
+        {
+            ulCapacity = (ulCapacity == 0) ? 256 : (ulCapacity << 1);
+            pGrown = realloc(g_pszDone, ulCapacity * sizeof(char*));
+
+            if (pGrown == 0)
+            {
+                fprintf(stderr, "allocations failed.\n");
+                fclose(pDone);
+                return -1;
+            }
+
+            g_pszDone = pGrown;
+        }
+
+        g_pszDone[g_ulDoneCount] = malloc(ulLength + 1);
+        if (g_pszDone[g_ulDoneCount] == 0)
+        {
+            fprintf(stderr, "allocations failed.\n");
+            fclose(pDone);
+            return -1;
+        }
+
+        memcpy(g_pszDone[g_ulDoneCount++], szLine, ulLength + 1);
+    }
+
+    fclose(pDone);
+
+    qsort(g_pszDone, g_ulDoneCount, sizeof(char*), compare_done_items);
+
+    return 0;
+}
+
+int fat_rescue_configure(
+    const char* szMapFile,
+    const char* szImageFilename)
+{
+    char szDoneFile[RESCUE_PATH_LENGTH + 8];
+    int  nImageFile = -1;
+
+    if ((szMapFile == 0) || (strlen(szMapFile) >= sizeof(g_szMapFile)))
+        return (szMapFile == 0) ? 0 : -1;
+
+    fat_mutex_init(&g_mutex);
+    strcpy(g_szMapFile, szMapFile);
+
+    nImageFile = fat_file_open_read(szImageFilename);
+    if (nImageFile >= 0)
+    {
+        g_llImageSize = fat_file_size(nImageFile);
+        fat_file_close(nImageFile);
+    }
+
+    _snprintf(szDoneFile, sizeof(szDoneFile) - 1, "%s.done", szMapFile);
+    szDoneFile[sizeof(szDoneFile) - 1] = 0;
+
+    if ((0 != rescue_load_map()) || (0 != rescue_load_done(szDoneFile)))
+        return -1;
+
+    g_pDoneLog = fopen(szDoneFile, "a");
+    if (g_pDoneLog == 0)
+    {
+        fprintf(stderr, "fopen() failed on file: '%s'.\n", szDoneFile);
+        return -1;
+    }
+
+    if ((g_ulRangeCount != 0) || (g_ulDoneCount != 0))
+        fprintf(stderr, "rescue: resuming from '%s' (%u ranges, %u items done).\n",
+            szMapFile, g_ulRangeCount, g_ulDoneCount);
+
+    g_tSaved = time(0);
+    g_nEnabled = 1;
+
+    return 0;
+}
+
+int fat_rescue_enabled(void)
+{
+    return g_nEnabled;
+}
+
+__int64 fat_rescue_read(
+    int     nFile,
+    void*   pBuffer,
+    size_t  ulLength,
+    __int64 llOffset)
+{
+    size_t ulDone = 0;
+    size_t ulChunk = 0;
+    int    nBad = 0;
+
+    if (g_nEnabled == 0)
+        return fat_file_pread(nFile, pBuffer, ulLength, llOffset);
+
+    fat_mutex_lock(&g_mutex);
+    nBad = rescue_range_is_bad(llOffset, llOffset + (__int64)ulLength);
+    fat_mutex_unlock(&g_mutex);
+
+    if ((nBad == 0) && ((__int64)ulLength == fat_file_pread(nFile, pBuffer, ulLength, llOffset)))
+    {
+        fat_mutex_lock(&g_mutex);
+        rescue_mark(llOffset, llOffset + (__int64)ulLength, '+');
+        g_llPosition = llOffset + (__int64)ulLength;
+        rescue_checkpoint();
+        fat_mutex_unlock(&g_mutex);
+
+        return (__int64)ulLength;
+    }
+
+    // Retry a sector at a time; what still fails reads as zeros.
+    for (ulDone = 0; ulDone < ulLength; ulDone += ulChunk)
+    {
+        ulChunk = FAT_RESCUE_SECTOR_SIZE - (size_t)((llOffset + (__int64)ulDone) % FAT_RESCUE_SECTOR_SIZE);
+        if (ulChunk > ulLength - ulDone)
+            ulChunk = ulLength - ulDone;
+
+        fat_mutex_lock(&g_mutex);
+        nBad = rescue_range_is_bad(llOffset + (__int64)ulDone, llOffset + (__int64)(ulDone + ulChunk));
+        if (nBad != 0)
+            ++g_ulSkippedBad;
+        fat_mutex_unlock(&g_mutex);
+
+        if ((nBad == 0) &&
+            ((__int64)ulChunk == fat_file_pread(nFile, (uint8_t*)pBuffer + ulDone, ulChunk, llOffset + (__int64)ulDone)))
+        {
+            fat_mutex_lock(&g_mutex);
+            rescue_mark(llOffset + (__int64)ulDone, llOffset + (__int64)(ulDone + ulChunk), '+');
+            fat_mutex_unlock(&g_mutex);
+            continue;
+        }
+
+        memset((uint8_t*)pBuffer + ulDone, 0x00, ulChunk);
+
+        if (nBad == 0)
+        {
+            fat_mutex_lock(&g_mutex);
+            rescue_mark(llOffset + (__int64)ulDone, llOffset + (__int64)(ulDone + ulChunk), '-');
+            ++g_ulNewBad;
+            fat_mutex_unlock(&g_mutex);
+        }
+    }
+
+    fat_mutex_lock(&g_mutex);
+    g_llPosition = llOffset + (__int64)ulLength;
+    rescue_checkpoint();
+    fat_mutex_unlock(&g_mutex);
+
+    return (__int64)ulLength;
+}
+
+__int64 fat_rescue_copy_range(
+    int     nFileIn,
+    __int64 llOffsetIn,
+    int     nFileOut,
+    __int64 llOffsetOut,
+    __int64 llLength)
+{
+    uint8_t* pBuffer = 0;
+    __int64  llDone = 0;
+    size_t   ulChunk = 0;
+    int      nBad = 0;
+
+    if (g_nEnabled == 0)
+        return fat_file_copy_range(nFileIn, llOffsetIn, nFileOut, llOffsetOut, llLength);
+
+    fat_mutex_lock(&g_mutex);
+    nBad = rescue_range_is_bad(llOffsetIn, llOffsetIn + llLength);
+    fat_mutex_unlock(&g_mutex);
+
+    if ((nBad == 0) && (llLength == fat_file_copy_range(nFileIn, llOffsetIn, nFileOut, llOffsetOut, llLength)))
+    {
+        fat_mutex_lock(&g_mutex);
+        rescue_mark(llOffsetIn, llOffsetIn + llLength, '+');
+        g_llPosition = llOffsetIn + llLength;
+        rescue_checkpoint();
+        fat_mutex_unlock(&g_mutex);
+
+        return llLength;
+    }
+
+    // Bounce through fat_rescue_read() so that bad sectors become zeros.
+    pBuffer = malloc(RESCUE_COPY_SIZE);
+    if (pBuffer == 0)
+    {
+        fprintf(stderr, "allocations failed.\n");
+        return -1;
+    }
+
+    for (llDone = 0; llDone < llLength; llDone += ulChunk)
+    {
+        ulChunk = RESCUE_COPY_SIZE;
+        if ((__int64)ulChunk > llLength - llDone)
+            ulChunk = (size_t)(llLength - llDone);
+
+        if (((__int64)ulChunk != fat_rescue_read(nFileIn, pBuffer, ulChunk, llOffsetIn + llDone)) ||
+            ((__int64)ulChunk != fat_file_pwrite(nFileOut, pBuffer, ulChunk, llOffsetOut + llDone)))
+            break;
+    }
+
+    free (pBuffer);
+
+    return llDone;
+}
+
+int fat_rescue_is_bad(
+    __int64 llOffset,
+    __int64 llLength)
+{
+    int nBad = 0;
+
+    if (g_nEnabled == 0)
+        return 0;
+
+    fat_mutex_lock(&g_mutex);
+    nBad = rescue_range_is_bad(llOffset, llOffset + llLength);
+    fat_mutex_unlock(&g_mutex);
+
+    return nBad;
+}
+
+uint32_t fat_rescue_merge_fats(
+    uint8_t* pFat1,
+    uint8_t* pFat2,
+    __int64  llFat1Offset,
+    __int64  llFat2Offset,
+    uint32_t ulFatSize)
+{
+    uint32_t ulSector = 0;
+    uint32_t ulLost = 0;
+    int      nBad1 = 0;
+    int      nBad2 = 0;
+
+    for (ulSector = 0; ulSector < ulFatSize; ulSector += FAT_RESCUE_SECTOR_SIZE)
+    {
+        nBad1 = fat_rescue_is_bad(llFat1Offset + ulSector, FAT_RESCUE_SECTOR_SIZE);
+        nBad2 = fat_rescue_is_bad(llFat2Offset + ulSector, FAT_RESCUE_SECTOR_SIZE);
+
+        if ((nBad1 != 0) && (nBad2 != 0))
+            ++ulLost;
+        else if (nBad1 != 0)
+            memcpy(&pFat1[ulSector], &pFat2[ulSector], FAT_RESCUE_SECTOR_SIZE);
+        else if (nBad2 != 0)
+            memcpy(&pFat2[ulSector], &pFat1[ulSector], FAT_RESCUE_SECTOR_SIZE);
+
+        if ((nBad1 != 0) != (nBad2 != 0))
+            ++g_ulFatRepaired;
+    }
+
+    return ulLost;
+}
+
+int fat_rescue_is_done(
+    const char* szItem)
+{
+    if ((g_nEnabled == 0) || (g_ulDoneCount == 0))
+        return 0;
+
+    return (0 != bsearch(&szItem, g_pszDone, g_ulDoneCount, sizeof(char*), compare_done_items));
+}
+
+void fat_rescue_mark_done(
+    const char* szItem)
+{
+    if (g_nEnabled == 0)
+        return;
+
+    fat_mutex_lock(&g_mutex);
+    fprintf(g_pDoneLog, "%s\n", szItem);
+    fflush(g_pDoneLog);
+    fat_mutex_unlock(&g_mutex);
+}
+
+int fat_rescue_finish(void)
+{
+    uint32_t ulIndex = 0;
+    int      nReturnValue = 0;
+
+    if (g_nEnabled == 0)
+        return 0;
+
+    nReturnValue = rescue_save('+');
+
+    fprintf(stderr, "rescue: %u bad sectors found, %u known bad sectors skipped, %u FAT sectors taken from the other copy; map in '%s'.\n",
+        g_ulNewBad,
+        g_ulSkippedBad,
+        g_ulFatRepaired,
+        g_szMapFile);
+
+    if (0 != g_pDoneLog)
+    {
+        fclose(g_pDoneLog);
+        g_pDoneLog = 0;
+    }
+
+    // Free the g_pszDone list.
+    if (0 != g_pszDone)
+    {
+        for (ulIndex = 0; ulIndex < g_ulDoneCount; ++ulIndex)
+            free (g_pszDone[ulIndex]);
+
+        free (g_pszDone);
+        g_pszDone = 0;
+    }
+
+    // Free the g_pRanges buffer.
+    if (0 != g_pRanges)
+    {
+        free (g_pRanges);
+        g_pRanges = 0;
+    }
+
+    g_ulDoneCount = 0;
+    g_ulRangeCount = 0;
+    g_ulRangeCapacity = 0;
+    g_nEnabled = 0;
+    fat_mutex_destroy(&g_mutex);
+
+    return nReturnValue;
+}
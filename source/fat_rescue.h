@@ -0,0 +1,71 @@
+#ifndef __FAT_RESCUE_H_HEADER__
+#define __FAT_RESCUE_H_HEADER__
+
+#include "stdint.h"
+#include "fat_platform.h"
+
+#define FAT_RESCUE_SECTOR_SIZE        (512)
+#define FAT_RESCUE_CHECKPOINT_SECONDS (30)
+
+/**
+ * Reading from failing media.
+ *
+ * Once fat_rescue_configure() has named a map file, fat_rescue_read() and
+ * fat_rescue_copy_range() stop failing on unreadable sectors: a failed
+ * read is retried a sector at a time, sectors that still fail come back
+ * as zeros and are recorded bad, and sectors recorded bad are never tried
+ * again.  The map is written in ddrescue's mapfile format ('+' read,
+ * '-' bad, '?' not tried) every FAT_RESCUE_CHECKPOINT_SECONDS and on
+ * fat_rescue_finish(); an existing map, ours or ddrescue's, is loaded
+ * first so a rerun resumes without touching known bad areas.
+ *
+ * Completed extracts are appended to "<map>.done" as they finish and are
+ * skipped by a rerun.  Without a map every call passes straight through
+ * to the plain fat_file_* call.  All calls may be made from any thread.
+ */
+int fat_rescue_configure(
+    const char* szMapFile,
+    const char* szImageFilename);
+
+int fat_rescue_enabled(void);
+
+/* fat_file_pread() that zero-fills unreadable sectors; returns ulLength, or -1. */
+__int64 fat_rescue_read(
+    int     nFile,
+    void*   pBuffer,
+    size_t  ulLength,
+    __int64 llOffset);
+
+/* fat_file_copy_range() that zero-fills unreadable sectors. */
+__int64 fat_rescue_copy_range(
+    int     nFileIn,
+    __int64 llOffsetIn,
+    int     nFileOut,
+    __int64 llOffsetOut,
+    __int64 llLength);
+
+/* non-zero if any sector of [llOffset, llOffset + llLength) is recorded bad. */
+int fat_rescue_is_bad(
+    __int64 llOffset,
+    __int64 llLength);
+
+/* fills the sectors of one FAT copy that are recorded bad from the other;
+   returns the number of sectors bad in both. */
+uint32_t fat_rescue_merge_fats(
+    uint8_t* pFat1,
+    uint8_t* pFat2,
+    __int64  llFat1Offset,
+    __int64  llFat2Offset,
+    uint32_t ulFatSize);
+
+/* non-zero if szItem was completed by an earlier run. */
+int fat_rescue_is_done(
+    const char* szItem);
+
+void fat_rescue_mark_done(
+    const char* szItem);
+
+/* writes the map and prints what was found; no-op without a map. */
+int fat_rescue_finish(void);
+
+#endif /* __FAT_RESCUE_H_HEADER__ */
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#include "stdint.h"
+#include "fat_platform.h"
+#include "fat_rescue.h"
+#include "fat_sched.h"
+
+static int fat_sched_compare(const void* pLeft, const void* pRight)
+{
+    const fat_sched_request* pA = (const fat_sched_request*)pLeft;
+    const fat_sched_request* pB = (const fat_sched_request*)pRight;
+
+    if (pA->llOffset != pB->llOffset)
+        return (pA->llOffset < pB->llOffset) ? -1 : 1;
+
+    /* Keep equal offsets in arrival order. */
+    return (pA->ullTag < pB->ullTag) ? -1 : ((pA->ullTag > pB->ullTag) ? 1 : 0);
+}
+
+int fat_sched_init(
+    fat_sched* pSched,
+    int        nImageFile)
+{
+    memset(pSched, 0x00, sizeof(fat_sched));
+
+    pSched->nImageFile = nImageFile;
+    pSched->pBuffer = malloc(FAT_SCHED_MAX_MERGE);
+
+    if (pSched->pBuffer == 0)
+    {
+        fprintf(stderr, "allocations failed.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+void fat_sched_free(
+    fat_sched* pSched)
+{
+    // Free the pSched->pQueue buffer.
+    if (0 != pSched->pQueue)
+    {
+        free (pSched->pQueue);
+        pSched->pQueue = 0;
+    }
+
+    // Free the pSched->pPass buffer.
+    if (0 != pSched->pPass)
+    {
+        free (pSched->pPass);
+        pSched->pPass = 0;
+    }
+
+    // Free the pSched->pBuffer buffer.
+    if (0 != pSched->pBuffer)
+    {
+        free (pSched->pBuffer);
+        pSched->pBuffer = 0;
+    }
+}
+
+int fat_sched_add(
+    fat_sched* pSched,
+    __int64    llOffset,
+    uint32_t   ulLength,
+    uint64_t   ullTag)
+{
+    fat_sched_request* pGrown = 0;
+
+    if (ulLength > FAT_SCHED_MAX_MERGE)
+        return -1;
+
+    if (pSched->ulQueued == pSched->ulCapacity)
+    {
+        pSched->ulCapacity = (pSched->ulCapacity == 0) ? 256 : (pSched->ulCapacity << 1);
+        pGrown = realloc(pSched->pQueue, pSched->ulCapacity * sizeof(fat_sched_request));
+
+        if (pGrown == 0)
+        {
+            fprintf(stderr, "allocations failed.\n");
+            return -1;
+        }
+
+        pSched->pQueue = pGrown;
+    }
+
+    pSched->pQueue[pSched->ulQueued].llOffset = llOffset;
+    pSched->pQueue[pSched->ulQueued].ulLength = ulLength;
+    pSched->pQueue[pSched->ulQueued].ullTag = ullTag;
+    ++pSched->ulQueued;
+
+    return 0;
+}
+
+/* serves pPass[ulFirst, ulLast) in order, merging adjacent requests. */
+static int fat_sched_sweep(
+    fat_sched*         pSched,
+    uint32_t           ulFirst,
+    uint32_t           ulLast,
+    fat_sched_complete pfnComplete,
+    void*              pContext)
+{
+    fat_sched_request* pPass = pSched->pPass;
+    uint32_t           ulStart = ulFirst;
+    uint32_t           ulEnd = 0;
+    uint32_t           ulIndex = 0;
+    uint32_t           ulHinted = ulFirst;
+    __int64            llRunStart = 0;
+    __int64            llRunEnd = 0;
+
+    while (ulStart < ulLast)
+    {
+        llRunStart = pPass[ulStart].llOffset;
+        llRunEnd = llRunStart + pPass[ulStart].ulLength;
+
+        /* Extend the run over requests that touch or overlap it. */
+        for (ulEnd = ulStart + 1; ulEnd < ulLast; ++ulEnd)
+        {
+            if (pPass[ulEnd].llOffset > llRunEnd)
+                break;
+
+            if (pPass[ulEnd].llOffset + pPass[ulEnd].ulLength > llRunStart + FAT_SCHED_MAX_MERGE)
+                break;
+
+            if (pPass[ulEnd].llOffset + pPass[ulEnd].ulLength > llRunEnd)
+                llRunEnd = pPass[ulEnd].llOffset + pPass[ulEnd].ulLength;
+        }
+
+        /* Keep the requests after this run in flight. */
+        if (ulHinted < ulEnd)
+            ulHinted = ulEnd;
+
+        while ((ulHinted < ulLast) && (ulHinted < ulEnd + pSched->ulReadahead))
+        {
+            fat_file_readahead(pSched->nImageFile, pPass[ulHinted].llOffset, pPass[ulHinted].ulLength);
+            ++ulHinted;
+        }
+
+        if ((llRunEnd - llRunStart) != fat_rescue_read(
+                pSched->nImageFile,
+                pSched->pBuffer,
+                (size_t)(llRunEnd - llRunStart),
+                llRunStart))
+        {
+            fprintf(stderr, "read failed at offset: %lld.\n", llRunStart);
+            return -1;
+        }
+
+        ++pSched->ulReads;
+        pSched->llHead = llRunEnd;
+
+        for (ulIndex = ulStart; ulIndex < ulEnd; ++ulIndex)
+        {
+            if (0 != pfnComplete(
+                    pContext,
+                    pPass[ulIndex].ullTag,
+                    pSched->pBuffer + (pPass[ulIndex].llOffset - llRunStart),
+                    pPass[ulIndex].ulLength))
+                return -1;
+        }
+
+        ulStart = ulEnd;
+    }
+
+    return 0;
+}
+
+int fat_sched_run(
+    fat_sched*         pSched,
+    fat_sched_complete pfnComplete,
+    void*              pContext)
+{
+    fat_sched_request* pSwap = 0;
+    uint32_t           ulSwap = 0;
+    uint32_t           ulCount = 0;
+    uint32_t           ulFirst = 0;
+
+    while (pSched->ulQueued > 0)
+    {
+        /* The queued requests become this pass; new ones queue for the next. */
+        pSwap = pSched->pPass;
+        pSched->pPass = pSched->pQueue;
+        pSched->pQueue = pSwap;
+
+        ulSwap = pSched->ulPassCapacity;
+        pSched->ulPassCapacity = pSched->ulCapacity;
+        pSched->ulCapacity = ulSwap;
+
+        ulCount = pSched->ulQueued;
+        pSched->ulQueued = 0;
+
+        qsort(pSched->pPass, ulCount, sizeof(fat_sched_request), fat_sched_compare);
+
+        /* C-LOOK: sweep up from the head, then wrap to the lowest offset. */
+        for (ulFirst = 0; (ulFirst < ulCount) && (pSched->pPass[ulFirst].llOffset < pSched->llHead); ++ulFirst)
+            ;
+
+        if ((0 != fat_sched_sweep(pSched, ulFirst, ulCount, pfnComplete, pContext)) ||
+            (0 != fat_sched_sweep(pSched, 0, ulFirst, pfnComplete, pContext)))
+            return -1;
+
+        ++pSched->ulPasses;
+        pSched->ulRequests += ulCount;
+    }
+
+    return 0;
+}
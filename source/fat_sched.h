@@ -0,0 +1,69 @@
+#ifndef __FAT_SCHED_H_HEADER__
+#define __FAT_SCHED_H_HEADER__
+
+#include "stdint.h"
+#include "fat_platform.h"
+
+#define FAT_SCHED_MAX_MERGE (1 << 20)   /* largest merged read. */
+
+typedef struct FAT_SCHED_REQUEST {
+    __int64   llOffset;
+    uint32_t  ulLength;
+    uint64_t  ullTag;
+} fat_sched_request;
+
+/* called once per request with its data; return non-zero to stop the run. */
+typedef int (*fat_sched_complete)(
+    void*          pContext,
+    uint64_t       ullTag,
+    const uint8_t* pData,
+    uint32_t       ulLength);
+
+/**
+ * Elevator (C-LOOK) read scheduler.
+ *
+ * Requests are queued with fat_sched_add().  fat_sched_run() serves them
+ * in passes: each pass sorts what is queued by image offset and sweeps
+ * upward from the current head position, wrapping once, with adjacent
+ * requests merged into a single read of up to FAT_SCHED_MAX_MERGE bytes.
+ * Requests added from a completion callback join the next pass.  The
+ * next ulReadahead requests of a sweep are hinted to the kernel before
+ * each read so that they are in flight while the current one completes.
+ */
+typedef struct FAT_SCHED {
+    int                nImageFile;
+    fat_sched_request* pQueue;      /* next pass. */
+    uint32_t           ulQueued;
+    uint32_t           ulCapacity;
+    fat_sched_request* pPass;       /* pass being served. */
+    uint32_t           ulPassCapacity;
+    uint8_t*           pBuffer;
+    __int64            llHead;      /* end of the last read. */
+    uint32_t           ulReadahead; /* requests hinted past each read; 0 for none. */
+
+    uint32_t           ulPasses;
+    uint32_t           ulRequests;
+    uint32_t           ulReads;
+} fat_sched;
+
+int fat_sched_init(
+    fat_sched* pSched,
+    int        nImageFile);
+
+void fat_sched_free(
+    fat_sched* pSched);
+
+/* ulLength must not exceed FAT_SCHED_MAX_MERGE. */
+int fat_sched_add(
+    fat_sched* pSched,
+    __int64    llOffset,
+    uint32_t   ulLength,
+    uint64_t   ullTag);
+
+/* serves passes until nothing is queued. */
+int fat_sched_run(
+    fat_sched*         pSched,
+    fat_sched_complete pfnComplete,
+    void*              pContext);
+
+#endif /* __FAT_SCHED_H_HEADER__ */
@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#include "stdint.h"
+#include "fat_platform.h"
+#include "fat_spill.h"
+
+#define FAT_SPILL_HEAP    (0)
+#define FAT_SPILL_SCRATCH (1)
+#define FAT_SPILL_LARGE   (2)     /* anonymous mapping, on huge pages where possible. */
+
+#define FAT_SPILL_LARGE_BLOCK ((uint64_t)2 << 20)   /* smallest block worth a huge page. */
+
+/* Precedes every block; sized to keep the block 64-byte aligned. */
+typedef struct FAT_SPILL_HEADER {
+    uint64_t  ullBytes;     /* block plus header. */
+    uint64_t  ullMapped;    /* size of a FAT_SPILL_LARGE mapping. */
+    uint32_t  ulKind;
+    uint32_t  aulPad[11];
+} fat_spill_header;
+
+static uint64_t    g_ullBudget = 0;
+static const char* g_szDirectory = 0;
+static uint32_t    g_ulHugePages = FAT_HUGE_PAGES_TRANSPARENT;
+static uint64_t    g_ullHeap = 0;       /* guarded by g_mutex. */
+static uint64_t    g_ullMapped = 0;     /* guarded by g_mutex. */
+static fat_mutex   g_mutex;
+static int         g_nConfigured = 0;
+
+void fat_spill_configure(
+    uint64_t    ullBudget,
+    const char* szDirectory,
+    uint32_t    ulHugePages)
+{
+    if (g_nConfigured == 0)
+    {
+        fat_mutex_init(&g_mutex);
+        g_nConfigured = 1;
+    }
+
+    g_ullBudget = ullBudget;
+    g_szDirectory = szDirectory;
+    g_ulHugePages = ulHugePages;
+}
+
+void* fat_spill_alloc(
+    size_t      ulBytes)
+{
+    fat_spill_header* pHeader = 0;
+    uint64_t          ullBytes = (uint64_t)ulBytes + sizeof(fat_spill_header);
+    uint64_t          ullMapped = 0;
+    uint32_t          ulKind = FAT_SPILL_HEAP;
+    int               nSpill = 0;
+
+    if ((g_nConfigured != 0) && (g_ullBudget != 0))
+    {
+        fat_mutex_lock(&g_mutex);
+        nSpill = (g_ullHeap + ullBytes > g_ullBudget);
+        fat_mutex_unlock(&g_mutex);
+    }
+
+    if (nSpill != 0)
+    {
+        pHeader = fat_scratch_map((g_szDirectory != 0) ? g_szDirectory : ".", ullBytes);
+
+        /* Over budget is still better than failing outright. */
+        if (pHeader == 0)
+        {
+            fprintf(stderr, "spill to '%s' failed; using the heap.\n", (g_szDirectory != 0) ? g_szDirectory : ".");
+            nSpill = 0;
+        }
+        else
+        {
+            ulKind = FAT_SPILL_SCRATCH;
+        }
+    }
+
+    /* Chain walks hop around these at random; huge pages spare the TLB. */
+    if ((nSpill == 0) && (ullBytes >= FAT_SPILL_LARGE_BLOCK) && (g_ulHugePages != FAT_HUGE_PAGES_OFF))
+    {
+        pHeader = fat_large_alloc(ullBytes, g_ulHugePages, &ullMapped);
+        if (pHeader != 0)
+            ulKind = FAT_SPILL_LARGE;
+    }
+
+    if (pHeader == 0)
+    {
+        pHeader = calloc(1, (size_t)ullBytes);
+        if (pHeader == 0)
+            return 0;
+    }
+
+    pHeader->ullBytes = ullBytes;
+    pHeader->ullMapped = ullMapped;
+    pHeader->ulKind = ulKind;
+
+    /* Concurrent callers may overshoot the budget by one block each. */
+    if (g_nConfigured != 0)
+    {
+        fat_mutex_lock(&g_mutex);
+        if (nSpill != 0)
+            g_ullMapped += ullBytes;
+        else
+            g_ullHeap += ullBytes;
+        fat_mutex_unlock(&g_mutex);
+    }
+
+    return pHeader + 1;
+}
+
+void fat_spill_free(
+    void*       pBlock)
+{
+    fat_spill_header* pHeader = 0;
+
+    if (pBlock == 0)
+        return;
+
+    pHeader = (fat_spill_header*)pBlock - 1;
+
+    if (g_nConfigured != 0)
+    {
+        fat_mutex_lock(&g_mutex);
+        if (pHeader->ulKind == FAT_SPILL_SCRATCH)
+            g_ullMapped -= pHeader->ullBytes;
+        else
+            g_ullHeap -= pHeader->ullBytes;
+        fat_mutex_unlock(&g_mutex);
+    }
+
+    if (pHeader->ulKind == FAT_SPILL_SCRATCH)
+        fat_scratch_unmap(pHeader, pHeader->ullBytes);
+    else if (pHeader->ulKind == FAT_SPILL_LARGE)
+        fat_large_free(pHeader, pHeader->ullMapped);
+    else
+        free (pHeader);
+}
+
+int fat_spill_huge_pages(
+    const char* szMode)
+{
+    if (0 == strcmp(szMode, "off"))
+        return FAT_HUGE_PAGES_OFF;
+
+    if (0 == strcmp(szMode, "transparent"))
+        return FAT_HUGE_PAGES_TRANSPARENT;
+
+    if (0 == strcmp(szMode, "explicit"))
+        return FAT_HUGE_PAGES_EXPLICIT;
+
+    return -1;
+}
+
+uint64_t fat_spill_mapped(void)
+{
+    uint64_t ullMapped = 0;
+
+    if (g_nConfigured != 0)
+    {
+        fat_mutex_lock(&g_mutex);
+        ullMapped = g_ullMapped;
+        fat_mutex_unlock(&g_mutex);
+    }
+
+    return ullMapped;
+}
@@ -0,0 +1,38 @@
+#ifndef __FAT_SPILL_H_HEADER__
+#define __FAT_SPILL_H_HEADER__
+
+#include "stdint.h"
+#include "fat_platform.h"
+
+/**
+ * Budgeted allocator for the volume-sized arrays (both FATs, the FAT node
+ * list and the chain list).
+ *
+ * Blocks come from the heap while the heap total stays within the budget
+ * set by fat_spill_configure(); past it they are backed by scratch files
+ * in the spill directory, so a volume larger than RAM pages to disk
+ * instead of failing.  With no budget every block stays in memory.
+ * In-memory blocks of 2 MB and up are mapped on huge pages as
+ * ulHugePages (a FAT_HUGE_PAGES_* mode) asks; transparent until
+ * configured.  The allocator may be used from any thread.
+ */
+void fat_spill_configure(
+    uint64_t    ullBudget,
+    const char* szDirectory,
+    uint32_t    ulHugePages);
+
+/* returns zeroed memory, or 0 on error. */
+void* fat_spill_alloc(
+    size_t      ulBytes);
+
+void fat_spill_free(
+    void*       pBlock);
+
+/* parses "off", "transparent" or "explicit"; returns -1 if unknown. */
+int fat_spill_huge_pages(
+    const char* szMode);
+
+/* bytes currently spilled to scratch files. */
+uint64_t fat_spill_mapped(void);
+
+#endif /* __FAT_SPILL_H_HEADER__ */
@@ -0,0 +1,718 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#include "stdint.h"
+#include "mbr_defs.h"
+#include "fat_defs.h"
+#include "fat_process.h"
+#include "fat_platform.h"
+#include "fat_dirscan.h"
+#include "fat_spill.h"
+#include "fat_owner.h"
+#include "fat_sched.h"
+#include "fat_stream.h"
+
+#define STREAM_SECTOR_SHIFT (9)
+#define STREAM_SKIP_SIZE    (1 << 16)
+
+/* what the head of a chain said about the whole chain. */
+#define STREAM_UNKNOWN      (0)
+#define STREAM_DIRECTORY    (1)
+#define STREAM_FILE         (2)
+
+typedef struct FAT_STREAM {
+    FILE*              pInput;
+    FILE*              pTee;
+    __int64            llPosition;      /* bytes consumed so far. */
+
+    fat_dir_walk       walk;
+    uint32_t           ulClusterSize;
+    uint32_t           ulRootDirOffset;
+
+    fat_sched_request* pAhead;          /* min-heap by offset of clusters still to come. */
+    uint32_t           ulAheadCount;
+    uint32_t           ulAheadCapacity;
+
+    fat_sched_request* pMissed;         /* asked for after they went by unheld. */
+    uint32_t           ulMissedCount;
+    uint32_t           ulMissedCapacity;
+
+    uint32_t*          pHeldClusters;   /* ascending, in arrival order. */
+    uint8_t*           pHeldData;
+    uint32_t           ulHeldCount;
+    uint32_t           ulHeldCapacity;
+
+    uint32_t           ulWalked;
+    uint32_t           ulHeldUsed;
+    uint32_t           ulRecovered;
+} fat_stream;
+
+/* reads up to ulLength bytes, copying them to the tee file; returns the count read. */
+static size_t stream_read(
+    fat_stream* pStream,
+    void*       pBuffer,
+    size_t      ulLength)
+{
+    size_t ulBytesRead = 0;
+    size_t ulChunk = 0;
+
+    while (ulBytesRead < ulLength)
+    {
+        ulChunk = fread((uint8_t*)pBuffer + ulBytesRead, 1, ulLength - ulBytesRead, pStream->pInput);
+        if (ulChunk == 0)
+            break;
+
+        ulBytesRead += ulChunk;
+    }
+
+    if ((pStream->pTee != 0) && (ulBytesRead != fwrite(pBuffer, 1, ulBytesRead, pStream->pTee)))
+    {
+        fprintf(stderr, "fwrite() failed on the tee file.\n");
+        fclose(pStream->pTee);
+        pStream->pTee = 0;
+    }
+
+    pStream->llPosition += ulBytesRead;
+
+    return ulBytesRead;
+}
+
+/* reads and drops everything up to llOffset. */
+static int stream_skip_to(
+    fat_stream* pStream,
+    __int64     llOffset,
+    uint8_t*    pScratch)
+{
+    size_t ulLength = 0;
+
+    while (pStream->llPosition < llOffset)
+    {
+        ulLength = STREAM_SKIP_SIZE;
+        if ((__int64)ulLength > llOffset - pStream->llPosition)
+            ulLength = (size_t)(llOffset - pStream->llPosition);
+
+        if (ulLength != stream_read(pStream, pScratch, ulLength))
+        {
+            fprintf(stderr, "stream ended at byte %lld, before byte %lld.\n",
+                (long long)pStream->llPosition,
+                (long long)llOffset);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int stream_push_ahead(
+    fat_stream*              pStream,
+    const fat_sched_request* pRequest)
+{
+    fat_sched_request* pGrown = 0;
+    fat_sched_request  request = *pRequest;
+    uint32_t           ulIndex = pStream->ulAheadCount;
+
+    if (pStream->ulAheadCount == pStream->ulAheadCapacity)
+    {
+        pStream->ulAheadCapacity = (pStream->ulAheadCapacity == 0) ? 256 : (pStream->ulAheadCapacity << 1);
+        pGrown = realloc(pStream->pAhead, pStream->ulAheadCapacity * sizeof(fat_sched_request));
+
+        if (pGrown == 0)
+        {
+            fprintf(stderr, "allocations failed.\n");
+            return -1;
+        }
+
+        pStream->pAhead = pGrown;
+    }
+
+    while ((ulIndex > 0) && (pStream->pAhead[(ulIndex - 1) >> 1].llOffset > request.llOffset))
+    {
+        pStream->pAhead[ulIndex] = pStream->pAhead[(ulIndex - 1) >> 1];
+        ulIndex = (ulIndex - 1) >> 1;
+    }
+
+    pStream->pAhead[ulIndex] = request;
+    ++pStream->ulAheadCount;
+
+    return 0;
+}
+
+static fat_sched_request stream_pop_ahead(
+    fat_stream* pStream)
+{
+    fat_sched_request top = pStream->pAhead[0];
+    fat_sched_request last = pStream->pAhead[--pStream->ulAheadCount];
+    uint32_t          ulIndex = 0;
+    uint32_t          ulChild = 0;
+
+    while ((ulChild = 2 * ulIndex + 1) < pStream->ulAheadCount)
+    {
+        if ((ulChild + 1 < pStream->ulAheadCount) &&
+            (pStream->pAhead[ulChild + 1].llOffset < pStream->pAhead[ulChild].llOffset))
+            ++ulChild;
+
+        if (pStream->pAhead[ulChild].llOffset >= last.llOffset)
+            break;
+
+        pStream->pAhead[ulIndex] = pStream->pAhead[ulChild];
+        ulIndex = ulChild;
+    }
+
+    if (pStream->ulAheadCount != 0)
+        pStream->pAhead[ulIndex] = last;
+
+    return top;
+}
+
+static int stream_add_missed(
+    fat_stream*              pStream,
+    const fat_sched_request* pRequest)
+{
+    fat_sched_request* pGrown = 0;
+
+    if (pStream->ulMissedCount == pStream->ulMissedCapacity)
+    {
+        pStream->ulMissedCapacity = (pStream->ulMissedCapacity == 0) ? 64 : (pStream->ulMissedCapacity << 1);
+        pGrown = realloc(pStream->pMissed, pStream->ulMissedCapacity * sizeof(fat_sched_request));
+
+        if (pGrown == 0)
+        {
+            fprintf(stderr, "allocations failed.\n");
+            return -1;
+        }
+
+        pStream->pMissed = pGrown;
+    }
+
+    pStream->pMissed[pStream->ulMissedCount++] = *pRequest;
+
+    return 0;
+}
+
+static int stream_hold(
+    fat_stream*    pStream,
+    uint32_t       ulCluster,
+    const uint8_t* pData)
+{
+    uint32_t* pGrownClusters = 0;
+    uint8_t*  pGrownData = 0;
+    uint32_t  ulCapacity = 0;
+
+    if (pStream->ulHeldCount == pStream->ulHeldCapacity)
+    {
+        ulCapacity = (pStream->ulHeldCapacity == 0) ? 64 : (pStream->ulHeldCapacity << 1);
+
+        pGrownClusters = realloc(pStream->pHeldClusters, ulCapacity * sizeof(uint32_t));
+        if (pGrownClusters != 0)
+            pStream->pHeldClusters = pGrownClusters;
+
+        pGrownData = realloc(pStream->pHeldData, (size_t)ulCapacity * pStream->ulClusterSize);
+        if (pGrownData != 0)
+            pStream->pHeldData = pGrownData;
+
+        if ((pGrownClusters == 0) || (pGrownData == 0))
+        {
+            fprintf(stderr, "allocations failed.\n");
+            return -1;
+        }
+
+        pStream->ulHeldCapacity = ulCapacity;
+    }
+
+    pStream->pHeldClusters[pStream->ulHeldCount] = ulCluster;
+    memcpy(&pStream->pHeldData[(size_t)pStream->ulHeldCount * pStream->ulClusterSize], pData, pStream->ulClusterSize);
+    ++pStream->ulHeldCount;
+
+    return 0;
+}
+
+/* the held copy of ulCluster, or 0. */
+static const uint8_t* stream_find_held(
+    const fat_stream* pStream,
+    uint32_t          ulCluster)
+{
+    uint32_t ulLow = 0;
+    uint32_t ulHigh = pStream->ulHeldCount;
+    uint32_t ulMiddle = 0;
+
+    while (ulLow < ulHigh)
+    {
+        ulMiddle = ulLow + ((ulHigh - ulLow) >> 1);
+
+        if (pStream->pHeldClusters[ulMiddle] < ulCluster)
+            ulLow = ulMiddle + 1;
+        else
+            ulHigh = ulMiddle;
+    }
+
+    if ((ulLow < pStream->ulHeldCount) && (pStream->pHeldClusters[ulLow] == ulCluster))
+        return &pStream->pHeldData[(size_t)ulLow * pStream->ulClusterSize];
+
+    return 0;
+}
+
+/**
+ * serves what the walk queued since the last call: the cluster at llCurrent
+ * from pCurrent, earlier ones from the held copies, later ones once they
+ * arrive.  Walking a cluster can queue more, so this runs until the queue
+ * stays empty.
+ */
+static int stream_drain(
+    fat_stream*    pStream,
+    __int64        llCurrent,
+    const uint8_t* pCurrent)
+{
+    fat_sched_request request;
+    const uint8_t*    pData = 0;
+    int               nStatus = 0;
+
+    while (pStream->walk.sched.ulQueued != 0)
+    {
+        request = pStream->walk.sched.pQueue[--pStream->walk.sched.ulQueued];
+
+        if (request.llOffset > llCurrent)
+        {
+            nStatus = stream_push_ahead(pStream, &request);
+        }
+        else if ((request.llOffset == llCurrent) && (pCurrent != 0))
+        {
+            nStatus = fat_dir_walk_cluster(&pStream->walk, request.ullTag, pCurrent, request.ulLength);
+            ++pStream->ulWalked;
+        }
+        else if (0 != (pData = stream_find_held(pStream, (uint32_t)(request.ullTag & 0xFFFFFFFF))))
+        {
+            nStatus = fat_dir_walk_cluster(&pStream->walk, request.ullTag, pData, request.ulLength);
+            ++pStream->ulWalked;
+            ++pStream->ulHeldUsed;
+        }
+        else
+        {
+            nStatus = stream_add_missed(pStream, &request);
+        }
+
+        if (nStatus != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+/* a cluster of a chain whose head is still ahead; held if it reads as directory entries. */
+static int stream_parses_as_directory(
+    const FAT32_DIR_ENTRY* pEntries,
+    uint32_t               ulEntryCount,
+    uint8_t*               pClasses)
+{
+    uint32_t ulEntriesInUse = fat_dirscan_classify(pEntries, ulEntryCount, pClasses, 1);
+    uint32_t ulIndex = 0;
+    uint32_t ulByte = 0;
+
+    if (ulEntriesInUse == 0)
+        return 0;
+
+    for (ulIndex = 0; ulIndex < ulEntriesInUse; ++ulIndex)
+    {
+        if (pClasses[ulIndex] == FAT_DIRSCAN_LFN)
+            continue;
+
+        if (0 != (pEntries[ulIndex].fileAttributes & 0xC0))
+            return 0;
+
+        for (ulByte = 1; ulByte < sizeof(pEntries[ulIndex].dosFilename); ++ulByte)
+            if (pEntries[ulIndex].dosFilename[ulByte] < 0x20)
+                return 0;
+    }
+
+    return 1;
+}
+
+static void stream_free(
+    fat_stream* pStream)
+{
+    fat_dir_walk_free(&pStream->walk);
+
+    // Free the pStream->pAhead buffer.
+    if (0 != pStream->pAhead)
+    {
+        free (pStream->pAhead);
+        pStream->pAhead = 0;
+    }
+
+    // Free the pStream->pMissed buffer.
+    if (0 != pStream->pMissed)
+    {
+        free (pStream->pMissed);
+        pStream->pMissed = 0;
+    }
+
+    // Free the pStream->pHeldClusters buffer.
+    if (0 != pStream->pHeldClusters)
+    {
+        free (pStream->pHeldClusters);
+        pStream->pHeldClusters = 0;
+    }
+
+    // Free the pStream->pHeldData buffer.
+    if (0 != pStream->pHeldData)
+    {
+        free (pStream->pHeldData);
+        pStream->pHeldData = 0;
+    }
+}
+
+int stream_image(
+    const char*  szTeeFilename,
+    fat_options* pOptions)
+{
+    fat_stream         stream;
+    fat_sched_request  request;
+    MASTER_BOOT_RECORD mbr;
+    FAT32_BOOT_SECTOR  bootSector;
+    fat_owner_map      ownerMap;
+    uint32_t*          pFAT1_Buffer = 0;
+    fat_node*          pFatList = 0;
+    fat_chain*         pFatChainList = 0;
+    uint8_t*           pVerdicts = 0;
+    uint8_t*           pCluster = 0;
+    uint8_t*           pClasses = 0;
+    uint32_t           ulFatChainCount = 0;
+    uint32_t           ulFatSize = 0;
+    uint32_t           ulDirsPerCluster = 0;
+    uint32_t           ulCluster = 0;
+    uint32_t           ulChain = 0;
+    uint32_t           ulPosition = 0;
+    uint32_t           ulDirFlags = 0;
+    uint32_t           ulIndex = 0;
+    __int64            llPartitionOffset = 0;
+    __int64            llFat1Offset = 0;
+    __int64            llOffset = 0;
+    int                nTeeFile = -1;
+    int                nWalked = 0;
+    int                nReturnValue = 0;
+
+    memset(&stream, 0x00, sizeof(stream));
+    memset(&ownerMap, 0x00, sizeof(ownerMap));
+
+    if ((pOptions->nPatch != 0) || (pOptions->szFind != 0) || (pOptions->szExtractDir != 0) ||
+        (pOptions->szDump != 0) || (pOptions->szHashManifest != 0) || (pOptions->nCarve != 0) ||
+        (pOptions->szOwner != 0) || (pOptions->szOwnerBatch != 0) || (pOptions->nDefrag != 0) ||
+        (pOptions->nTimeline != 0) || (pOptions->ulTop != 0) || (pOptions->ullMinSize != 0) ||
+        (pOptions->ullMaxSize != 0) || (pOptions->ulMinFragments != 0))
+    {
+        fprintf(stderr, "an image read from stdin only gets the report; --tee it to a file for the rest.\n");
+        return -1;
+    }
+
+    stream.pInput = stdin;
+    fat_file_binary_mode(fileno(stdin));
+
+    if (szTeeFilename != 0)
+    {
+        stream.pTee = fopen(szTeeFilename, "wb");
+        if (stream.pTee == 0)
+        {
+            fprintf(stderr, "fopen() failed on file: '%s'.\n", szTeeFilename);
+            return -1;
+        }
+    }
+
+    pCluster = malloc(STREAM_SKIP_SIZE);
+    if (pCluster == 0)
+    {
+        fprintf(stderr, "allocations failed.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    // Read the Master Boot Record and the FAT Boot Sector.
+    if (sizeof(mbr) != stream_read(&stream, &mbr, sizeof(mbr)))
+    {
+        fprintf(stderr, "stream ended in the master boot record.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    llPartitionOffset = (__int64)mbr.partEntry1.startSectorOffset << STREAM_SECTOR_SHIFT;
+
+    /* Without a partition table the first sector was the boot sector; the
+       stream cannot go back for it, so reuse the copy already read. */
+    if (llPartitionOffset < (__int64)sizeof(mbr))
+    {
+        llPartitionOffset = 0;
+        memcpy(&bootSector, &mbr, sizeof(bootSector));
+    }
+    else if ((0 != stream_skip_to(&stream, llPartitionOffset, pCluster)) ||
+             (sizeof(bootSector) != stream_read(&stream, &bootSector, sizeof(bootSector))))
+    {
+        fprintf(stderr, "stream ended in the boot sector.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    stream.ulClusterSize = bootSector.bytesPerSector * bootSector.sectorsPerCluster;
+    ulFatSize = bootSector.sectorsPerFat32 << STREAM_SECTOR_SHIFT;
+    llFat1Offset = llPartitionOffset + ((__int64)bootSector.sectorsBeforeFat << STREAM_SECTOR_SHIFT);
+    stream.ulRootDirOffset = (uint32_t)(llFat1Offset + 2 * (__int64)ulFatSize);
+
+    if ((stream.ulClusterSize == 0) || (stream.ulClusterSize > STREAM_SKIP_SIZE) || ((ulFatSize >> 2) <= 2))
+    {
+        fprintf(stderr, "invalid boot sector.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    // FAT1 is kept; FAT2 only passes through to the tee file.
+    pFAT1_Buffer = fat_spill_alloc(ulFatSize);
+    if (pFAT1_Buffer == 0)
+    {
+        fprintf(stderr, "allocations failed.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    if ((0 != stream_skip_to(&stream, llFat1Offset, pCluster)) ||
+        (ulFatSize != stream_read(&stream, pFAT1_Buffer, ulFatSize)) ||
+        (0 != stream_skip_to(&stream, stream.ulRootDirOffset, pCluster)))
+    {
+        fprintf(stderr, "stream ended in the file allocation tables.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    ulFatChainCount = process_fat_entries(&pFatList, pFAT1_Buffer, ulFatSize);
+
+    nReturnValue = process_fat_chains(&pFatChainList, ulFatChainCount, pFatList, ulFatSize);
+    if (nReturnValue != 0)
+        goto exit;
+
+    // Cluster to chain and position, for telling heads from the rest.
+    nReturnValue = fat_owner_map_build(&ownerMap, pFatChainList, ulFatChainCount, ulFatSize, pOptions->ullMaxMemory);
+    if (nReturnValue != 0)
+        goto exit;
+
+    ulDirsPerCluster = stream.ulClusterSize / sizeof(FAT32_DIR_ENTRY);
+    ulDirFlags = FAT_DIR_REPORT_ENTRIES | ((pOptions->nStopAtDirEnd != 0) ? FAT_DIR_STOP_AT_END : 0);
+
+    pVerdicts = calloc(ulFatChainCount + 1, 1);
+    pClasses = malloc(ulDirsPerCluster + 1);
+    if ((pVerdicts == 0) || (pClasses == 0))
+    {
+        fprintf(stderr, "allocations failed.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    nReturnValue = fat_dir_walk_init(
+        &stream.walk,
+        -1,
+        pFatList,
+        pFatChainList,
+        ulFatChainCount,
+        ulFatSize,
+        stream.ulClusterSize,
+        stream.ulRootDirOffset,
+        ulDirFlags);
+
+    if (nReturnValue != 0)
+        goto exit;
+
+    nReturnValue = fat_dir_walk_queue(&stream.walk, FAT_ROOT_DIR);
+
+    if (nReturnValue == 0)
+        nReturnValue = stream_drain(&stream, stream.llPosition - 1, 0);
+
+    // One cluster at a time to the end of the stream.
+    for (ulCluster = FAT_ROOT_DIR; nReturnValue == 0; ++ulCluster)
+    {
+        llOffset = stream.llPosition;
+
+        if (stream.ulClusterSize != stream_read(&stream, pCluster, stream.ulClusterSize))
+            break;
+
+        /* Nothing pending and nothing missed: the walk is complete and the rest only passes through. */
+        if ((stream.ulAheadCount == 0) && (stream.ulMissedCount == 0))
+            continue;
+
+        nWalked = 0;
+
+        while ((nReturnValue == 0) && (stream.ulAheadCount != 0) && (stream.pAhead[0].llOffset <= llOffset))
+        {
+            request = stream_pop_ahead(&stream);
+
+            if (request.llOffset < llOffset)
+            {
+                nReturnValue = stream_add_missed(&stream, &request);
+                continue;
+            }
+
+            nReturnValue = fat_dir_walk_cluster(&stream.walk, request.ullTag, pCluster, request.ulLength);
+            ++stream.ulWalked;
+            nWalked = 1;
+
+            if (nReturnValue == 0)
+                nReturnValue = stream_drain(&stream, llOffset, pCluster);
+        }
+
+        if ((nReturnValue != 0) || (nWalked != 0))
+            continue;
+
+        // Predict whether the walk can still ask for this cluster.
+        if (ulCluster >= ownerMap.ulClusterCount)
+            continue;
+
+        ulChain = fat_owner_lookup(&ownerMap, ulCluster, &ulPosition);
+
+        if (ulChain == FAT_OWNER_NONE)
+        {
+            /* A free cluster opening a directory: deleted subdirectories are walked too. */
+            if (0 != fat_dirscan_opens_directory((FAT32_DIR_ENTRY*)pCluster, ulDirsPerCluster))
+                nReturnValue = stream_hold(&stream, ulCluster, pCluster);
+
+            continue;
+        }
+
+        if (ulPosition == 0)
+            pVerdicts[ulChain] = (0 != fat_dirscan_opens_directory((FAT32_DIR_ENTRY*)pCluster, ulDirsPerCluster)) ?
+                STREAM_DIRECTORY : STREAM_FILE;
+
+        if ((pVerdicts[ulChain] == STREAM_DIRECTORY) ||
+            ((pVerdicts[ulChain] == STREAM_UNKNOWN) &&
+             (0 != stream_parses_as_directory((FAT32_DIR_ENTRY*)pCluster, ulDirsPerCluster, pClasses))))
+        {
+            nReturnValue = stream_hold(&stream, ulCluster, pCluster);
+        }
+    }
+
+    if (nReturnValue != 0)
+        goto exit;
+
+    // Anything still ahead lies past the end of the stream.
+    while (stream.ulAheadCount != 0)
+    {
+        request = stream_pop_ahead(&stream);
+
+        nReturnValue = stream_add_missed(&stream, &request);
+        if (nReturnValue != 0)
+            goto exit;
+    }
+
+    // Read back what went by unheld from the tee file; that can queue more.
+    if ((stream.pTee != 0) && (stream.ulMissedCount != 0))
+    {
+        fflush(stream.pTee);
+
+        nTeeFile = fat_file_open_read(szTeeFilename);
+        if (nTeeFile < 0)
+        {
+            fprintf(stderr, "open failed on file: '%s'.\n", szTeeFilename);
+            nReturnValue = -1;
+            goto exit;
+        }
+
+        for (ulIndex = 0; ulIndex < stream.ulMissedCount; )
+        {
+            request = stream.pMissed[ulIndex];
+
+            if ((__int64)request.ulLength != fat_file_pread(nTeeFile, pCluster, request.ulLength, request.llOffset))
+            {
+                ++ulIndex;
+                continue;
+            }
+
+            stream.pMissed[ulIndex] = stream.pMissed[--stream.ulMissedCount];
+
+            nReturnValue = fat_dir_walk_cluster(&stream.walk, request.ullTag, pCluster, request.ulLength);
+            ++stream.ulWalked;
+            ++stream.ulRecovered;
+
+            if (nReturnValue == 0)
+                nReturnValue = stream_drain(&stream, stream.llPosition, 0);
+
+            if (nReturnValue != 0)
+                goto exit;
+        }
+    }
+
+    fprintf(stderr, "stream: %llu KB read, %u directory clusters walked, %u held (%u used), %u read back from the tee file.\n",
+        (unsigned long long)(stream.llPosition >> 10),
+        stream.ulWalked,
+        stream.ulHeldCount,
+        stream.ulHeldUsed,
+        stream.ulRecovered);
+
+    if (stream.ulMissedCount != 0)
+    {
+        fprintf(stderr, "%u directory clusters went by before their directory was found, or lie past the end%s.\n",
+            stream.ulMissedCount,
+            (stream.pTee == 0) ? "; --tee the stream to recover the former" : "");
+    }
+
+    // Report Results.
+    nReturnValue = report_fat_dir_entries(
+        pFatChainList,
+        ulFatChainCount);
+
+exit:
+    stream_free(&stream);
+    fat_owner_map_free(&ownerMap);
+
+    if (nTeeFile >= 0)
+        fat_file_close(nTeeFile);
+
+    if (stream.pTee != 0)
+    {
+        if (0 != fclose(stream.pTee))
+        {
+            fprintf(stderr, "fclose() failed on file: '%s'.\n", szTeeFilename);
+            nReturnValue = -1;
+        }
+
+        stream.pTee = 0;
+    }
+
+    // Free the pFAT1_Buffer buffer.
+    if (0 != pFAT1_Buffer)
+    {
+        fat_spill_free (pFAT1_Buffer);
+        pFAT1_Buffer = 0;
+    }
+
+    // Free the pFatList buffer.
+    if (0 != pFatList)
+    {
+        fat_spill_free (pFatList);
+        pFatList = 0;
+    }
+
+    // Free the pFatChainList buffer.
+    if (0 != pFatChainList)
+    {
+        fat_spill_free (pFatChainList);
+        pFatChainList = 0;
+    }
+
+    // Free the pVerdicts buffer.
+    if (0 != pVerdicts)
+    {
+        free (pVerdicts);
+        pVerdicts = 0;
+    }
+
+    // Free the pCluster buffer.
+    if (0 != pCluster)
+    {
+        free (pCluster);
+        pCluster = 0;
+    }
+
+    // Free the pClasses buffer.
+    if (0 != pClasses)
+    {
+        free (pClasses);
+        pClasses = 0;
+    }
+
+    return nReturnValue;
+}
@@ -0,0 +1,25 @@
+#ifndef __FAT_STREAM_H_HEADER__
+#define __FAT_STREAM_H_HEADER__
+
+#include "stdint.h"
+#include "fat_process.h"
+
+/**
+ * Single forward pass over an image read from stdin.
+ *
+ * The boot sector and FAT1 arrive ahead of the data region, so the chains
+ * are built before the first data cluster is read.  From there every
+ * cluster is either a directory cluster the walk has already asked for,
+ * which is walked on arrival, or one that may be asked for later: the
+ * head of a chain (or a free cluster) opening with "." and "..", the rest
+ * of such a chain, or a cluster of a chain whose head is still ahead that
+ * parses as directory entries.  Only those are held in memory; everything
+ * else is dropped once read.  A directory cluster that went by without
+ * being held is read back from the tee file when there is one.  The
+ * report is printed once the stream ends.
+ */
+int stream_image(
+    const char*  szTeeFilename,
+    fat_options* pOptions);
+
+#endif /* __FAT_STREAM_H_HEADER__ */
@@ -0,0 +1,542 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#include "stdint.h"
+#include "fat_process.h"
+#include "fat_index.h"
+#include "fat_platform.h"
+#include "fat_timeline.h"
+
+#define TIMELINE_MAX_THREADS   (64)
+#define TIMELINE_MIN_PER_SLICE (16384)  /* smaller inputs sort on one thread. */
+#define TIMELINE_RADIX         (256)
+
+/* One LSD radix pass, split into contiguous slices, one per thread. */
+typedef struct FAT_RADIX_JOB {
+    fat_timeline_event* pSource;
+    fat_timeline_event* pTarget;
+    uint32_t            ulCount;
+    uint32_t            ulSlices;
+    uint32_t            ulShift;
+    uint32_t*           pCounts;    /* ulSlices * TIMELINE_RADIX; counts, then offsets. */
+} fat_radix_job;
+
+typedef struct FAT_RADIX_SLICE {
+    fat_radix_job*      pJob;
+    uint32_t            ulSlice;
+} fat_radix_slice;
+
+static uint64_t fat_time_pack(
+    uint32_t ulYear,
+    uint32_t ulMonth,
+    uint32_t ulDay,
+    uint32_t ulHour,
+    uint32_t ulMinute,
+    uint32_t ulSecond,
+    uint32_t ulHundredths)
+{
+    return ((uint64_t)ulYear << 48) |
+           ((uint64_t)ulMonth << 40) |
+           ((uint64_t)ulDay << 32) |
+           ((uint64_t)ulHour << 24) |
+           ((uint64_t)ulMinute << 16) |
+           ((uint64_t)ulSecond << 8) |
+           ((uint64_t)ulHundredths);
+}
+
+uint64_t fat_time_key(
+    uint16_t    usDate,
+    uint16_t    usTime,
+    uint8_t     ucTenMs)
+{
+    if (usDate == 0)
+        return 0;
+
+    /* Date: 7-bit year since 1980, 4-bit month, 5-bit day.
+       Time: 5-bit hour, 6-bit minute, 5-bit two-second count. */
+    return fat_time_pack(
+        ((usDate >> 9) & 0x7F) + 1980,
+        (usDate >> 5) & 0x0F,
+        usDate & 0x1F,
+        (usTime >> 11) & 0x1F,
+        (usTime >> 5) & 0x3F,
+        ((usTime & 0x1F) << 1) + (ucTenMs / 100),
+        ucTenMs % 100);
+}
+
+int fat_time_parse(
+    const char* szTime,
+    int         nEndOfRange,
+    uint64_t*   pullKey)
+{
+    unsigned int ulYear = 0;
+    unsigned int ulMonth = 0;
+    unsigned int ulDay = 0;
+    unsigned int ulHour = 0;
+    unsigned int ulMinute = 0;
+    unsigned int ulSecond = 0;
+    unsigned int ulHundredths = 0;
+    int          nUsed = 0;
+    int          nFields = 0;
+
+    if (3 != sscanf(szTime, "%4u-%2u-%2u%n", &ulYear, &ulMonth, &ulDay, &nUsed))
+        return -1;
+
+    szTime += nUsed;
+    nFields = 3;
+
+    if (((*szTime == ' ') || (*szTime == 'T')) &&
+        (2 == sscanf(szTime + 1, "%2u:%2u%n", &ulHour, &ulMinute, &nUsed)))
+    {
+        szTime += nUsed + 1;
+        nFields = 5;
+
+        if ((*szTime == ':') && (1 == sscanf(szTime + 1, "%2u%n", &ulSecond, &nUsed)))
+        {
+            szTime += nUsed + 1;
+            nFields = 6;
+        }
+    }
+
+    if ((*szTime != 0) ||
+        (ulMonth < 1) || (ulMonth > 12) || (ulDay < 1) || (ulDay > 31) ||
+        (ulHour > 23) || (ulMinute > 59) || (ulSecond > 59))
+        return -1;
+
+    /* The end of a range runs to the last hundredth of what was given. */
+    if (nEndOfRange != 0)
+    {
+        if (nFields < 5)
+        {
+            ulHour = 23;
+            ulMinute = 59;
+        }
+
+        if (nFields < 6)
+            ulSecond = 59;
+
+        ulHundredths = 99;
+    }
+
+    *pullKey = fat_time_pack(ulYear, ulMonth, ulDay, ulHour, ulMinute, ulSecond, ulHundredths);
+
+    return 0;
+}
+
+int fat_time_kinds(
+    const char* szNames)
+{
+    int         nKinds = 0;
+    const char* pStart = szNames;
+    size_t      ulLength = 0;
+
+    while (*pStart != 0)
+    {
+        ulLength = strcspn(pStart, ",");
+
+        if (((ulLength == 7) && (0 == strncmp(pStart, "created", 7))) ||
+            ((ulLength == 1) && (*pStart == 'c')))
+            nKinds |= FAT_TIME_CREATED;
+        else if (((ulLength == 8) && (0 == strncmp(pStart, "modified", 8))) ||
+                 ((ulLength == 1) && (*pStart == 'm')))
+            nKinds |= FAT_TIME_MODIFIED;
+        else if (((ulLength == 8) && (0 == strncmp(pStart, "accessed", 8))) ||
+                 ((ulLength == 1) && (*pStart == 'a')))
+            nKinds |= FAT_TIME_ACCESSED;
+        else
+            return -1;
+
+        pStart += ulLength;
+        if (*pStart == ',')
+            ++pStart;
+    }
+
+    return (nKinds != 0) ? nKinds : -1;
+}
+
+static int timeline_add_event(
+    fat_timeline* pTimeline,
+    fat_chain*    pChain,
+    const char*   szPath,
+    uint32_t      ulKind,
+    uint64_t      ullKey)
+{
+    fat_timeline_event* pEvents = 0;
+
+    /* Unset stamps have no place on a timeline. */
+    if (ullKey == 0)
+        return 0;
+
+    if (pTimeline->ulCount == pTimeline->ulCapacity)
+    {
+        pTimeline->ulCapacity = (pTimeline->ulCapacity == 0) ? 1024 : (pTimeline->ulCapacity << 1);
+        pEvents = realloc(pTimeline->pEvents, pTimeline->ulCapacity * sizeof(fat_timeline_event));
+
+        if (pEvents == 0)
+        {
+            fprintf(stderr, "allocations failed.\n");
+            return 1;
+        }
+
+        pTimeline->pEvents = pEvents;
+    }
+
+    pTimeline->pEvents[pTimeline->ulCount].ullKey = ullKey;
+    pTimeline->pEvents[pTimeline->ulCount].pChain = pChain;
+    pTimeline->pEvents[pTimeline->ulCount].szPath = szPath;
+    pTimeline->pEvents[pTimeline->ulCount].ulKind = ulKind;
+    ++pTimeline->ulCount;
+
+    return 0;
+}
+
+static int timeline_collect_chain(
+    fat_chain*  pChain,
+    const char* szPath,
+    void*       pContext)
+{
+    fat_timeline* pTimeline = (fat_timeline*)pContext;
+    int           nStatus = 0;
+
+    if (szPath == 0)
+        return 0;
+
+    if (0 != (pTimeline->ulKinds & FAT_TIME_CREATED))
+        nStatus |= timeline_add_event(pTimeline, pChain, szPath, FAT_TIME_CREATED,
+            fat_time_key(pChain->timestamp.date.value, pChain->timestamp.time.value, pChain->timestamp.time_ms));
+
+    if (0 != (pTimeline->ulKinds & FAT_TIME_MODIFIED))
+        nStatus |= timeline_add_event(pTimeline, pChain, szPath, FAT_TIME_MODIFIED,
+            fat_time_key(pChain->modifydate, pChain->modifytime, 0));
+
+    if (0 != (pTimeline->ulKinds & FAT_TIME_ACCESSED))
+        nStatus |= timeline_add_event(pTimeline, pChain, szPath, FAT_TIME_ACCESSED,
+            fat_time_key(pChain->accessdate, 0, 0));
+
+    return nStatus;
+}
+
+static void radix_slice_bounds(
+    fat_radix_job* pJob,
+    uint32_t       ulSlice,
+    uint32_t*      pulFirst,
+    uint32_t*      pulLast)
+{
+    *pulFirst = (uint32_t)(((uint64_t)pJob->ulCount * ulSlice) / pJob->ulSlices);
+    *pulLast = (uint32_t)(((uint64_t)pJob->ulCount * (ulSlice + 1)) / pJob->ulSlices);
+}
+
+static int radix_count_slice(void* pContext)
+{
+    fat_radix_slice* pSlice = (fat_radix_slice*)pContext;
+    fat_radix_job*   pJob = pSlice->pJob;
+    uint32_t*        pCounts = &pJob->pCounts[pSlice->ulSlice * TIMELINE_RADIX];
+    uint32_t         ulFirst = 0;
+    uint32_t         ulLast = 0;
+    uint32_t         ulIndex = 0;
+
+    radix_slice_bounds(pJob, pSlice->ulSlice, &ulFirst, &ulLast);
+
+    memset(pCounts, 0x00, TIMELINE_RADIX * sizeof(uint32_t));
+
+    for (ulIndex = ulFirst; ulIndex < ulLast; ++ulIndex)
+        ++pCounts[(pJob->pSource[ulIndex].ullKey >> pJob->ulShift) & 0xFF];
+
+    return 0;
+}
+
+static int radix_scatter_slice(void* pContext)
+{
+    fat_radix_slice* pSlice = (fat_radix_slice*)pContext;
+    fat_radix_job*   pJob = pSlice->pJob;
+    uint32_t*        pOffsets = &pJob->pCounts[pSlice->ulSlice * TIMELINE_RADIX];
+    uint32_t         ulFirst = 0;
+    uint32_t         ulLast = 0;
+    uint32_t         ulIndex = 0;
+
+    radix_slice_bounds(pJob, pSlice->ulSlice, &ulFirst, &ulLast);
+
+    for (ulIndex = ulFirst; ulIndex < ulLast; ++ulIndex)
+        pJob->pTarget[pOffsets[(pJob->pSource[ulIndex].ullKey >> pJob->ulShift) & 0xFF]++] = pJob->pSource[ulIndex];
+
+    return 0;
+}
+
+/* runs pfnProc once per slice, on slice 0 inline and the rest on threads. */
+static void radix_run_slices(
+    fat_radix_slice* pSlices,
+    uint32_t         ulSlices,
+    fat_thread_proc  pfnProc)
+{
+    fat_thread aThreads[TIMELINE_MAX_THREADS];
+    int        anStarted[TIMELINE_MAX_THREADS];
+    uint32_t   ulSlice = 0;
+
+    for (ulSlice = 1; ulSlice < ulSlices; ++ulSlice)
+    {
+        anStarted[ulSlice] = (0 == fat_thread_start(&aThreads[ulSlice], pfnProc, &pSlices[ulSlice]));
+
+        if (anStarted[ulSlice] == 0)
+            pfnProc(&pSlices[ulSlice]);
+    }
+
+    pfnProc(&pSlices[0]);
+
+    for (ulSlice = 1; ulSlice < ulSlices; ++ulSlice)
+        if (anStarted[ulSlice] != 0)
+            fat_thread_join(&aThreads[ulSlice]);
+}
+
+/**
+ * Stable LSD radix sort on the 64-bit keys, one byte per pass.
+ *
+ * Each pass counts digits per slice in parallel, turns the counts into
+ * per-slice output offsets (digit-major, slice-minor, which keeps equal
+ * digits in input order), then scatters every slice in parallel.  Bytes
+ * that are the same in every key are skipped.
+ */
+static int timeline_radix_sort(
+    fat_timeline* pTimeline,
+    uint32_t      ulThreadCount)
+{
+    int                 nReturnValue = 0;
+    fat_timeline_event* pScratch = 0;
+    fat_timeline_event* pSwap = 0;
+    uint32_t*           pCounts = 0;
+    fat_radix_job       job;
+    fat_radix_slice     aSlices[TIMELINE_MAX_THREADS];
+    uint64_t            ullAnd = ~(uint64_t)0;
+    uint64_t            ullOr = 0;
+    uint32_t            ulIndex = 0;
+    uint32_t            ulSlice = 0;
+    uint32_t            ulDigit = 0;
+    uint32_t            ulOffset = 0;
+    uint32_t            ulCount = 0;
+
+    if (pTimeline->ulCount < 2)
+        return 0;
+
+    if (ulThreadCount == 0)
+        ulThreadCount = fat_cpu_count();
+
+    if (ulThreadCount > TIMELINE_MAX_THREADS)
+        ulThreadCount = TIMELINE_MAX_THREADS;
+
+    if (ulThreadCount > pTimeline->ulCount / TIMELINE_MIN_PER_SLICE)
+        ulThreadCount = pTimeline->ulCount / TIMELINE_MIN_PER_SLICE;
+
+    if (ulThreadCount == 0)
+        ulThreadCount = 1;
+
+    pScratch = malloc(pTimeline->ulCount * sizeof(fat_timeline_event));
+    pCounts = malloc(ulThreadCount * TIMELINE_RADIX * sizeof(uint32_t));
+
+    if ((pScratch == 0) || (pCounts == 0))
+    {
+        fprintf(stderr, "allocations failed.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    for (ulIndex = 0; ulIndex < pTimeline->ulCount; ++ulIndex)
+    {
+        ullAnd &= pTimeline->pEvents[ulIndex].ullKey;
+        ullOr |= pTimeline->pEvents[ulIndex].ullKey;
+    }
+
+    memset(&job, 0x00, sizeof(job));
+    job.pSource = pTimeline->pEvents;
+    job.pTarget = pScratch;
+    job.ulCount = pTimeline->ulCount;
+    job.ulSlices = ulThreadCount;
+    job.pCounts = pCounts;
+
+    for (ulSlice = 0; ulSlice < ulThreadCount; ++ulSlice)
+    {
+        aSlices[ulSlice].pJob = &job;
+        aSlices[ulSlice].ulSlice = ulSlice;
+    }
+
+    for (job.ulShift = 0; job.ulShift < 64; job.ulShift += 8)
+    {
+        if (0 == (((ullAnd ^ ullOr) >> job.ulShift) & 0xFF))
+            continue;
+
+        radix_run_slices(aSlices, ulThreadCount, radix_count_slice);
+
+        /* Counts become the first output slot of each (digit, slice). */
+        for (ulOffset = 0, ulDigit = 0; ulDigit < TIMELINE_RADIX; ++ulDigit)
+        {
+            for (ulSlice = 0; ulSlice < ulThreadCount; ++ulSlice)
+            {
+                ulCount = pCounts[ulSlice * TIMELINE_RADIX + ulDigit];
+                pCounts[ulSlice * TIMELINE_RADIX + ulDigit] = ulOffset;
+                ulOffset += ulCount;
+            }
+        }
+
+        radix_run_slices(aSlices, ulThreadCount, radix_scatter_slice);
+
+        pSwap = job.pSource;
+        job.pSource = job.pTarget;
+        job.pTarget = pSwap;
+    }
+
+    /* An odd number of passes leaves the result in the scratch array. */
+    if (job.pSource != pTimeline->pEvents)
+    {
+        pScratch = pTimeline->pEvents;
+        pTimeline->pEvents = job.pSource;
+        pTimeline->ulCapacity = pTimeline->ulCount;
+    }
+
+exit:
+    // Free the pScratch buffer.
+    if (0 != pScratch)
+    {
+        free (pScratch);
+        pScratch = 0;
+    }
+
+    // Free the pCounts buffer.
+    if (0 != pCounts)
+    {
+        free (pCounts);
+        pCounts = 0;
+    }
+
+    return nReturnValue;
+}
+
+int fat_timeline_build(
+    fat_timeline* pTimeline,
+    fat_index*    pIndex,
+    const char*   szPattern,
+    uint32_t      ulKinds,
+    uint32_t      ulThreadCount)
+{
+    memset(pTimeline, 0x00, sizeof(fat_timeline));
+
+    pTimeline->ulKinds = (ulKinds != 0) ? ulKinds : FAT_TIME_ALL;
+
+    fat_index_glob(
+        pIndex,
+        (szPattern != 0) ? szPattern : "/**",
+        timeline_collect_chain,
+        pTimeline);
+
+    return timeline_radix_sort(pTimeline, ulThreadCount);
+}
+
+void fat_timeline_free(
+    fat_timeline* pTimeline)
+{
+    // Free the pTimeline->pEvents buffer.
+    if (0 != pTimeline->pEvents)
+    {
+        free (pTimeline->pEvents);
+        pTimeline->pEvents = 0;
+    }
+
+    pTimeline->ulCount = 0;
+    pTimeline->ulCapacity = 0;
+}
+
+/* index of the first event whose key is not below ullKey. */
+static uint32_t timeline_lower_bound(
+    const fat_timeline* pTimeline,
+    uint64_t            ullKey)
+{
+    uint32_t ulLow = 0;
+    uint32_t ulHigh = pTimeline->ulCount;
+    uint32_t ulMiddle = 0;
+
+    while (ulLow < ulHigh)
+    {
+        ulMiddle = ulLow + ((ulHigh - ulLow) >> 1);
+
+        if (pTimeline->pEvents[ulMiddle].ullKey < ullKey)
+            ulLow = ulMiddle + 1;
+        else
+            ulHigh = ulMiddle;
+    }
+
+    return ulLow;
+}
+
+uint32_t fat_timeline_range(
+    const fat_timeline* pTimeline,
+    uint64_t            ullFrom,
+    uint64_t            ullTo,
+    uint32_t*           pulFirst)
+{
+    uint32_t ulEnd = 0;
+
+    *pulFirst = timeline_lower_bound(pTimeline, ullFrom);
+
+    if (ullTo == ~(uint64_t)0)
+        ulEnd = pTimeline->ulCount;
+    else
+        ulEnd = timeline_lower_bound(pTimeline, ullTo + 1);
+
+    return (ulEnd > *pulFirst) ? (ulEnd - *pulFirst) : 0;
+}
+
+int report_timeline(
+    fat_index*  pIndex,
+    const char* szPattern,
+    uint32_t    ulKinds,
+    const char* szSince,
+    const char* szUntil,
+    uint32_t    ulThreadCount)
+{
+    int                 nReturnValue = 0;
+    fat_timeline        timeline;
+    fat_timeline_event* pEvent = 0;
+    uint64_t            ullFrom = 0;
+    uint64_t            ullTo = ~(uint64_t)0;
+    uint32_t            ulFirst = 0;
+    uint32_t            ulCount = 0;
+    uint32_t            ulIndex = 0;
+
+    memset(&timeline, 0x00, sizeof(timeline));
+
+    if (((szSince != 0) && (0 != fat_time_parse(szSince, 0, &ullFrom))) ||
+        ((szUntil != 0) && (0 != fat_time_parse(szUntil, 1, &ullTo))))
+    {
+        fprintf(stderr, "times must look like 'YYYY-MM-DD[ HH:MM[:SS]]'.\n");
+        return -1;
+    }
+
+    nReturnValue = fat_timeline_build(&timeline, pIndex, szPattern, ulKinds, ulThreadCount);
+    if (nReturnValue != 0)
+        goto exit;
+
+    ulCount = fat_timeline_range(&timeline, ullFrom, ullTo, &ulFirst);
+
+    for (ulIndex = ulFirst; ulIndex < ulFirst + ulCount; ++ulIndex)
+    {
+        pEvent = &timeline.pEvents[ulIndex];
+
+        fprintf(stdout, "%04u-%02u-%02u %02u:%02u:%02u.%02u %c %10uB %s\n",
+            (unsigned int)((pEvent->ullKey >> 48) & 0xFFFF),
+            (unsigned int)((pEvent->ullKey >> 40) & 0xFF),
+            (unsigned int)((pEvent->ullKey >> 32) & 0xFF),
+            (unsigned int)((pEvent->ullKey >> 24) & 0xFF),
+            (unsigned int)((pEvent->ullKey >> 16) & 0xFF),
+            (unsigned int)((pEvent->ullKey >> 8) & 0xFF),
+            (unsigned int)(pEvent->ullKey & 0xFF),
+            (pEvent->ulKind == FAT_TIME_CREATED) ? 'c' : ((pEvent->ulKind == FAT_TIME_MODIFIED) ? 'm' : 'a'),
+            pEvent->pChain->filesize,
+            pEvent->szPath);
+    }
+
+    fprintf(stderr, "timeline: %u of %u events in range.\n", ulCount, timeline.ulCount);
+
+exit:
+    fat_timeline_free(&timeline);
+
+    return nReturnValue;
+}
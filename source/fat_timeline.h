@@ -0,0 +1,85 @@
+#ifndef __FAT_TIMELINE_H_HEADER__
+#define __FAT_TIMELINE_H_HEADER__
+
+#include "stdint.h"
+#include "fat_process.h"
+#include "fat_index.h"
+
+#define FAT_TIME_CREATED  (0x01)
+#define FAT_TIME_MODIFIED (0x02)
+#define FAT_TIME_ACCESSED (0x04)
+#define FAT_TIME_ALL      (FAT_TIME_CREATED | FAT_TIME_MODIFIED | FAT_TIME_ACCESSED)
+
+/**
+ * One timestamp of one entry.
+ *
+ * Keys pack the decoded fields from most to least significant, one per
+ * byte except the 16-bit year:  year, month, day, hour, minute, second,
+ * hundredths.  Comparing keys as integers therefore orders events in
+ * time, and a key can be built from a typed date for range queries.
+ */
+typedef struct FAT_TIMELINE_EVENT {
+    uint64_t    ullKey;
+    fat_chain*  pChain;
+    const char* szPath;
+    uint32_t    ulKind;         /* one FAT_TIME_ bit. */
+} fat_timeline_event;
+
+/* events sorted by key; equal keys keep path order. */
+typedef struct FAT_TIMELINE {
+    fat_timeline_event* pEvents;
+    uint32_t            ulCount;
+    uint32_t            ulCapacity;
+    uint32_t            ulKinds;
+} fat_timeline;
+
+/* key of a FAT date/time pair plus 10 ms units (0 when only a date is
+   stored); 0 for an unset date. */
+uint64_t fat_time_key(
+    uint16_t    usDate,
+    uint16_t    usTime,
+    uint8_t     ucTenMs);
+
+/* parses "YYYY-MM-DD[ HH:MM[:SS]]" ('T' may separate the time).  fields
+   left out are taken as their lowest value, or their highest with
+   nEndOfRange, so a bare date covers the whole day.  returns 0 on success. */
+int fat_time_parse(
+    const char* szTime,
+    int         nEndOfRange,
+    uint64_t*   pullKey);
+
+/* parses "created,modified,accessed" (or any of c, m, a); returns the
+   FAT_TIME_ bits, or -1 on an unknown name. */
+int fat_time_kinds(
+    const char* szNames);
+
+/* collects the selected timestamps of every chain matching szPattern
+   (0 for all) and sorts them with ulThreadCount threads (0 for one per CPU). */
+int fat_timeline_build(
+    fat_timeline* pTimeline,
+    fat_index*    pIndex,
+    const char*   szPattern,
+    uint32_t      ulKinds,
+    uint32_t      ulThreadCount);
+
+void fat_timeline_free(
+    fat_timeline* pTimeline);
+
+/* binary searches the events with ullFrom <= key <= ullTo.  returns how
+   many there are, with the first in *pulFirst. */
+uint32_t fat_timeline_range(
+    const fat_timeline* pTimeline,
+    uint64_t            ullFrom,
+    uint64_t            ullTo,
+    uint32_t*           pulFirst);
+
+/* prints the events between szSince and szUntil (0 for open ends). */
+int report_timeline(
+    fat_index*  pIndex,
+    const char* szPattern,
+    uint32_t    ulKinds,
+    const char* szSince,
+    const char* szUntil,
+    uint32_t    ulThreadCount);
+
+#endif /* __FAT_TIMELINE_H_HEADER__ */
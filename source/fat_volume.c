@@ -0,0 +1,413 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <memory.h>
+
+#include "stdint.h"
+#include "fat_process.h"
+#include "fat_index.h"
+#include "fat_platform.h"
+#include "fat_holes.h"
+#include "fat_spill.h"
+#include "fat_owner.h"
+#include "fat_volume.h"
+
+#define VOLUME_PATH_LENGTH (4096)
+
+struct FAT_VOLUME {
+    int         nImageFile;     /* shared by all readers; only positioned reads. */
+    uint32_t    ulClusterSize;
+    uint32_t    ulClusterCount;
+    uint32_t    ulFatSize;
+    uint32_t    ulRootDirOffset;
+
+    fat_node *  pFatList;
+    fat_chain * pFatChainList;
+    uint32_t    ulFatChainCount;
+
+    fat_index   index;
+    fat_owner_map ownerMap;     /* chain per cluster, built with the index. */
+    int         nIndexed;
+    uint64_t    ullPathBytes;   /* size of the index path pool. */
+
+    fat_hole_map holeMap;       /* data extents of a sparse image. */
+};
+
+int fat_volume_open(
+    const char*  szImageFilename,
+    fat_volume** ppVolume)
+{
+    int         nReturnValue = 0;
+    FILE*       pFile = 0;
+    fat_volume* pVolume = 0;
+    uint32_t*   pFAT1_Buffer = 0;
+    uint32_t*   pFAT2_Buffer = 0;
+    int32_t     lClusterSize = 0;
+    int32_t     lClusterCount = 0;
+    int32_t     lFileAllocationTableSize = 0;
+    int32_t     lRootDirectoryEntryOffset = 0;
+
+    *ppVolume = 0;
+
+    pVolume = calloc(1, sizeof(fat_volume));
+    if (pVolume == 0)
+    {
+        fprintf(stderr, "allocations failed.\n");
+        return -1;
+    }
+
+    pVolume->nImageFile = -1;
+
+    pFile = fopen(szImageFilename, "rb");
+    if (0 == pFile)
+    {
+        fprintf(stderr, "fopen() failed on file: '%s.\n", szImageFilename);
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    nReturnValue = read_fs_config_data(
+        pFile,
+        &pFAT1_Buffer,
+        &pFAT2_Buffer,
+        &lClusterSize,
+        &lClusterCount,
+        &lFileAllocationTableSize,
+        &lRootDirectoryEntryOffset);
+
+    if (nReturnValue != 0)
+        goto exit;
+
+    pVolume->ulClusterSize = lClusterSize;
+    pVolume->ulClusterCount = lClusterCount;
+    pVolume->ulFatSize = lFileAllocationTableSize;
+    pVolume->ulRootDirOffset = lRootDirectoryEntryOffset;
+
+    pVolume->ulFatChainCount = process_fat_entries(
+        &pVolume->pFatList,
+        pFAT1_Buffer,
+        lFileAllocationTableSize);
+
+    nReturnValue = process_fat_chains(
+        &pVolume->pFatChainList,
+        pVolume->ulFatChainCount,
+        pVolume->pFatList,
+        lFileAllocationTableSize);
+
+    if ((nReturnValue != 0) || (pVolume->pFatList == 0) || (pVolume->pFatChainList == 0))
+    {
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    // Populate the chains from the directory tree, silently.
+    nReturnValue = process_dir_entries(
+        pFile,
+        pVolume->pFatList,
+        pFAT1_Buffer,
+        pVolume->pFatChainList,
+        pVolume->ulFatChainCount,
+        lClusterSize,
+        lClusterCount,
+        FAT_ROOT_DIR,
+        lRootDirectoryEntryOffset,
+        0);
+
+    if (nReturnValue != 0)
+        goto exit;
+
+    // Reads after open go through a descriptor shared by every thread.
+    pVolume->nImageFile = fat_file_open_read(szImageFilename);
+    if (pVolume->nImageFile < 0)
+    {
+        fprintf(stderr, "open failed on file: '%s'.\n", szImageFilename);
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    // Holes are queried before the descriptor is shared.
+    nReturnValue = fat_hole_map_load(&pVolume->holeMap, pVolume->nImageFile);
+    if (nReturnValue != 0)
+        goto exit;
+
+    *ppVolume = pVolume;
+
+exit:
+    // Free the pFAT1_Buffer buffer.
+    if (0 != pFAT1_Buffer)
+    {
+        fat_spill_free (pFAT1_Buffer);
+        pFAT1_Buffer = 0;
+    }
+
+    // Free the pFAT2_Buffer buffer.
+    if (0 != pFAT2_Buffer)
+    {
+        fat_spill_free (pFAT2_Buffer);
+        pFAT2_Buffer = 0;
+    }
+
+    // Close the file.
+    if (pFile != 0)
+        fclose(pFile);
+
+    if (nReturnValue != 0)
+        fat_volume_close(pVolume);
+
+    return nReturnValue;
+}
+
+int fat_volume_build_index(
+    fat_volume*  pVolume)
+{
+    uint32_t   ulChainIndex = 0;
+
+    if (pVolume->nIndexed != 0)
+        return 0;
+
+    if (0 != fat_index_build(&pVolume->index, pVolume->pFatChainList, pVolume->ulFatChainCount))
+        return -1;
+
+    if (0 != fat_owner_map_build(&pVolume->ownerMap, pVolume->pFatChainList, pVolume->ulFatChainCount, pVolume->ulFatSize, 0))
+    {
+        fat_index_free(&pVolume->index);
+        return -1;
+    }
+
+    for (ulChainIndex = 0; ulChainIndex < pVolume->ulFatChainCount; ++ulChainIndex)
+        if (pVolume->index.pPathOffsets[ulChainIndex] != FAT_INDEX_NONE)
+            pVolume->ullPathBytes += strlen(pVolume->index.pPathPool + pVolume->index.pPathOffsets[ulChainIndex]) + 1;
+
+    pVolume->nIndexed = 1;
+
+    return 0;
+}
+
+void fat_volume_close(
+    fat_volume*  pVolume)
+{
+    if (pVolume == 0)
+        return;
+
+    fat_index_free(&pVolume->index);
+    fat_hole_map_free(&pVolume->holeMap);
+
+    fat_owner_map_free(&pVolume->ownerMap);
+    pVolume->nIndexed = 0;
+
+    // Free the pVolume->pFatList buffer.
+    if (0 != pVolume->pFatList)
+    {
+        fat_spill_free (pVolume->pFatList);
+        pVolume->pFatList = 0;
+    }
+
+    // Free the pVolume->pFatChainList buffer.
+    if (0 != pVolume->pFatChainList)
+    {
+        fat_spill_free (pVolume->pFatChainList);
+        pVolume->pFatChainList = 0;
+    }
+
+    if (pVolume->nImageFile >= 0)
+        fat_file_close(pVolume->nImageFile);
+
+    free (pVolume);
+}
+
+uint32_t fat_volume_cluster_size(
+    const fat_volume* pVolume)
+{
+    return pVolume->ulClusterSize;
+}
+
+uint32_t fat_volume_chain_count(
+    const fat_volume* pVolume)
+{
+    return pVolume->ulFatChainCount;
+}
+
+uint32_t fat_volume_data_offset(
+    const fat_volume* pVolume)
+{
+    return pVolume->ulRootDirOffset;
+}
+
+const fat_index* fat_volume_index(
+    const fat_volume* pVolume)
+{
+    return (pVolume->nIndexed != 0) ? &pVolume->index : 0;
+}
+
+const fat_hole_map* fat_volume_hole_map(
+    const fat_volume* pVolume)
+{
+    return &pVolume->holeMap;
+}
+
+uint64_t fat_volume_memory_usage(
+    const fat_volume* pVolume)
+{
+    uint64_t ullFatEntries = pVolume->ulFatSize >> 2;
+    uint64_t ullChains = pVolume->ulFatChainCount;
+    uint64_t ullBytes = sizeof(fat_volume);
+
+    ullBytes += ullFatEntries * sizeof(fat_node);
+    ullBytes += ullChains * sizeof(fat_chain);
+    ullBytes += pVolume->holeMap.ulCapacity * sizeof(fat_data_extent);
+
+    if (pVolume->nIndexed != 0)
+    {
+        ullBytes += fat_owner_map_bytes(&pVolume->ownerMap);
+        ullBytes += (pVolume->index.ulBucketMask + 1) * 2 * sizeof(uint32_t);
+        ullBytes += (ullChains + 1) * (4 * sizeof(uint32_t) + FAT_INDEX_NAME_LENGTH);
+        ullBytes += pVolume->ullPathBytes;
+    }
+
+    return ullBytes;
+}
+
+const fat_chain* fat_volume_chain_by_cluster(
+    const fat_volume* pVolume,
+    uint32_t          ulCluster)
+{
+    uint32_t ulChainIndex = FAT_OWNER_NONE;
+
+    if (pVolume->nIndexed != 0)
+        ulChainIndex = fat_owner_lookup(&pVolume->ownerMap, ulCluster, 0);
+
+    if (ulChainIndex == FAT_OWNER_NONE)
+        return 0;
+
+    return &pVolume->pFatChainList[ulChainIndex];
+}
+
+const fat_chain* fat_volume_chain_by_path(
+    const fat_volume* pVolume,
+    const char*       szPath)
+{
+    if (pVolume->nIndexed == 0)
+        return 0;
+
+    return fat_index_find_path(&pVolume->index, szPath);
+}
+
+uint32_t fat_volume_chains_by_name(
+    const fat_volume* pVolume,
+    const char*       szName,
+    fat_index_visit   pfnVisit,
+    void*             pContext)
+{
+    if (pVolume->nIndexed == 0)
+        return 0;
+
+    return fat_index_find_name(&pVolume->index, szName, pfnVisit, pContext);
+}
+
+const char* fat_volume_chain_path(
+    const fat_volume* pVolume,
+    const fat_chain*  pChain)
+{
+    if (pVolume->nIndexed == 0)
+        return 0;
+
+    return fat_index_path(&pVolume->index, pChain);
+}
+
+uint32_t fat_volume_list_directory(
+    const fat_volume* pVolume,
+    const char*       szPath,
+    fat_index_visit   pfnVisit,
+    void*             pContext)
+{
+    char   szPattern[VOLUME_PATH_LENGTH];
+    size_t ulLength = strlen(szPath);
+
+    if (pVolume->nIndexed == 0)
+        return 0;
+
+    while ((ulLength > 0) && (szPath[ulLength - 1] == '/'))
+        --ulLength;
+
+    if (ulLength + 3 > sizeof(szPattern))
+        return 0;
+
+    /* 8.3 names cannot hold glob characters, so the path is taken literally. */
+    memcpy(szPattern, szPath, ulLength);
+    memcpy(szPattern + ulLength, "/*", 3);
+
+    return fat_index_glob(&pVolume->index, szPattern, pfnVisit, pContext);
+}
+
+__int64 fat_volume_read(
+    const fat_volume* pVolume,
+    const fat_chain*  pChain,
+    __int64           llOffset,
+    void*             pBuffer,
+    size_t            ulLength)
+{
+    fat_node* pFatNode = pChain->head;
+    __int64   llCluster = 0;
+    __int64   llDone = 0;
+    __int64   llRun = 0;
+    __int64   llResult = 0;
+    __int64   llImageOffset = 0;
+    uint32_t  ulSkip = 0;
+    uint32_t  ulRunClusters = 0;
+
+    if ((llOffset < 0) || (llOffset >= pChain->filesize))
+        return 0;
+
+    if ((__int64)ulLength > pChain->filesize - llOffset)
+        ulLength = (size_t)(pChain->filesize - llOffset);
+
+    /* Skip the clusters before llOffset. */
+    for (llCluster = llOffset / pVolume->ulClusterSize; (pFatNode != 0) && (llCluster > 0); --llCluster)
+        pFatNode = pFatNode->next;
+
+    ulSkip = (uint32_t)(llOffset % pVolume->ulClusterSize);
+
+    /* Read contiguous cluster runs with one call each. */
+    while ((pFatNode != 0) && (llDone < (__int64)ulLength))
+    {
+        ulRunClusters = 1;
+
+        while ((pFatNode->next != 0) &&
+               (pFatNode->next->cluster == pFatNode->cluster + 1) &&
+               ((__int64)ulRunClusters * pVolume->ulClusterSize - ulSkip < (__int64)ulLength - llDone))
+        {
+            pFatNode = pFatNode->next;
+            ++ulRunClusters;
+        }
+
+        llRun = (__int64)ulRunClusters * pVolume->ulClusterSize - ulSkip;
+        if (llRun > (__int64)ulLength - llDone)
+            llRun = (__int64)ulLength - llDone;
+
+        llImageOffset = (__int64)pVolume->ulRootDirOffset +
+            (__int64)(pFatNode->cluster - ulRunClusters + 1 - 2) * pVolume->ulClusterSize + ulSkip;
+
+        /* Holes of a sparse image read as zeros. */
+        if (0 != fat_hole_map_is_hole(&pVolume->holeMap, llImageOffset, llRun))
+        {
+            memset((char*)pBuffer + llDone, 0x00, (size_t)llRun);
+        }
+        else
+        {
+            llResult = fat_file_pread(
+                pVolume->nImageFile,
+                (char*)pBuffer + llDone,
+                (size_t)llRun,
+                llImageOffset);
+
+            if (llResult != llRun)
+                return -1;
+        }
+
+        llDone += llRun;
+        ulSkip = 0;
+        pFatNode = pFatNode->next;
+    }
+
+    return llDone;
+}
@@ -0,0 +1,92 @@
+#ifndef __FAT_VOLUME_H_HEADER__
+#define __FAT_VOLUME_H_HEADER__
+
+#include "stdint.h"
+#include "fat_process.h"
+#include "fat_index.h"
+#include "fat_platform.h"
+#include "fat_holes.h"
+
+/**
+ * Opaque handle to an opened image.
+ *
+ * fat_volume_open() loads the FATs, the chains and the directory tree;
+ * fat_volume_build_index() adds the name/path index and the cluster owner
+ * map.  After that the handle is never written again, so any number of
+ * threads may query and read through one handle without locking.  Only
+ * fat_volume_close() must not race with other calls.
+ */
+typedef struct FAT_VOLUME fat_volume;
+
+int fat_volume_open(
+    const char*  szImageFilename,
+    fat_volume** ppVolume);
+
+/* must complete before the handle is shared between threads. */
+int fat_volume_build_index(
+    fat_volume*  pVolume);
+
+void fat_volume_close(
+    fat_volume*  pVolume);
+
+uint32_t fat_volume_cluster_size(
+    const fat_volume* pVolume);
+
+uint32_t fat_volume_chain_count(
+    const fat_volume* pVolume);
+
+/* image offset of cluster 2. */
+uint32_t fat_volume_data_offset(
+    const fat_volume* pVolume);
+
+/* data/hole layout of the image, for whole-volume scans. */
+const fat_hole_map* fat_volume_hole_map(
+    const fat_volume* pVolume);
+
+/* name/path index; 0 until fat_volume_build_index() has run. */
+const fat_index* fat_volume_index(
+    const fat_volume* pVolume);
+
+/* approximate heap bytes held by the handle. */
+uint64_t fat_volume_memory_usage(
+    const fat_volume* pVolume);
+
+/* chain that owns ulCluster (any cluster of the chain), 0 if free. */
+const fat_chain* fat_volume_chain_by_cluster(
+    const fat_volume* pVolume,
+    uint32_t          ulCluster);
+
+const fat_chain* fat_volume_chain_by_path(
+    const fat_volume* pVolume,
+    const char*       szPath);
+
+/* returns the number of chains visited. */
+uint32_t fat_volume_chains_by_name(
+    const fat_volume* pVolume,
+    const char*       szName,
+    fat_index_visit   pfnVisit,
+    void*             pContext);
+
+/* "/DIR/.../NAME.EXT", or 0 if the chain has no directory entry. */
+const char* fat_volume_chain_path(
+    const fat_volume* pVolume,
+    const fat_chain*  pChain);
+
+/* visits the entries directly below szPath ("/" for the root).
+   returns the number of entries visited. */
+uint32_t fat_volume_list_directory(
+    const fat_volume* pVolume,
+    const char*       szPath,
+    fat_index_visit   pfnVisit,
+    void*             pContext);
+
+/* reads up to ulLength bytes of the file at llOffset, bounded by the entry
+   size.  returns the number of bytes read, -1 on error. */
+__int64 fat_volume_read(
+    const fat_volume* pVolume,
+    const fat_chain*  pChain,
+    __int64           llOffset,
+    void*             pBuffer,
+    size_t            ulLength);
+
+#endif /* __FAT_VOLUME_H_HEADER__ */
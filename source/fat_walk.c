@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "stdint.h"
+#include "fat_process.h"
+#include "fat_platform.h"
+#include "fat_walk.h"
+
+typedef struct FAT_WALK_LANE {
+    fat_chain* pChain;
+    fat_node*  pNode;
+    uint32_t   ulHops;
+} fat_walk_lane;
+
+void fat_walk_find_heads(
+    fat_chain* pChains,
+    uint32_t   ulCount)
+{
+    fat_walk_lane aLanes[FAT_WALK_LANES];
+    fat_node*     pPrev = 0;
+    uint32_t      ulActive = 0;
+    uint32_t      ulNext = 0;
+    uint32_t      ulLane = 0;
+
+    for (;;)
+    {
+        /* Keep every lane busy while chains remain. */
+        while ((ulActive < FAT_WALK_LANES) && (ulNext < ulCount))
+        {
+            aLanes[ulActive].pChain = &pChains[ulNext];
+            aLanes[ulActive].pNode = pChains[ulNext].tail;
+            FAT_CACHE_PREFETCH(aLanes[ulActive].pNode);
+
+            ++ulActive;
+            ++ulNext;
+        }
+
+        if (ulActive == 0)
+            break;
+
+        /* One hop back on each lane; a finished lane takes the last one's place. */
+        for (ulLane = 0; ulLane < ulActive; )
+        {
+            pPrev = aLanes[ulLane].pNode->prev;
+
+            if (pPrev != 0)
+            {
+                FAT_CACHE_PREFETCH(pPrev);
+                aLanes[ulLane].pNode = pPrev;
+                ++ulLane;
+            }
+            else
+            {
+                aLanes[ulLane].pChain->head = aLanes[ulLane].pNode;
+                aLanes[ulLane].pChain->start = aLanes[ulLane].pNode->cluster;
+                aLanes[ulLane] = aLanes[--ulActive];
+            }
+        }
+    }
+}
+
+void fat_walk_warm(
+    const fat_chain* pChains,
+    uint32_t         ulCount)
+{
+    fat_walk_lane aLanes[FAT_WALK_LANES];
+    fat_node*     pNext = 0;
+    uint32_t      ulActive = 0;
+    uint32_t      ulNext = 0;
+    uint32_t      ulLane = 0;
+
+    for (;;)
+    {
+        while ((ulActive < FAT_WALK_LANES) && (ulNext < ulCount))
+        {
+            if (pChains[ulNext].head != 0)
+            {
+                aLanes[ulActive].pNode = pChains[ulNext].head;
+                aLanes[ulActive].ulHops = 0;
+                FAT_CACHE_PREFETCH(aLanes[ulActive].pNode);
+                ++ulActive;
+            }
+
+            ++ulNext;
+        }
+
+        if (ulActive == 0)
+            break;
+
+        for (ulLane = 0; ulLane < ulActive; )
+        {
+            pNext = aLanes[ulLane].pNode->next;
+
+            if ((pNext != 0) && (++aLanes[ulLane].ulHops < FAT_WALK_WARM_HOPS))
+            {
+                FAT_CACHE_PREFETCH(pNext);
+                aLanes[ulLane].pNode = pNext;
+                ++ulLane;
+            }
+            else
+            {
+                aLanes[ulLane] = aLanes[--ulActive];
+            }
+        }
+    }
+}
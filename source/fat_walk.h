@@ -0,0 +1,31 @@
+#ifndef __FAT_WALK_H_HEADER__
+#define __FAT_WALK_H_HEADER__
+
+#include "stdint.h"
+#include "fat_process.h"
+
+#define FAT_WALK_LANES     (16)     /* chains walked at once. */
+#define FAT_WALK_WARM_HOPS (4096)   /* nodes per chain pulled in by fat_walk_warm(). */
+
+/**
+ * Chain walks over the FAT node list, FAT_WALK_LANES chains at a time.
+ *
+ * On a fragmented volume every hop of a chain is a cache miss that cannot
+ * start until the last one ends.  These walks take one hop on each of
+ * several chains in turn and prefetch the node each lane needs next, so
+ * the misses of different chains overlap instead of queueing.  Chain
+ * order is kept.
+ */
+
+/* sets head and start of each chain from its tail. */
+void fat_walk_find_heads(
+    fat_chain* pChains,
+    uint32_t   ulCount);
+
+/* pulls the first FAT_WALK_WARM_HOPS nodes of each chain into the cache
+   ahead of a serial walk over them. */
+void fat_walk_warm(
+    const fat_chain* pChains,
+    uint32_t         ulCount);
+
+#endif /* __FAT_WALK_H_HEADER__ */
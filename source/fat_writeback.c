@@ -0,0 +1,587 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <memory.h>
+#include <errno.h>
+
+#include "stdint.h"
+#include "fat_platform.h"
+#include "fat_writeback.h"
+
+#define FNV1A_OFFSET (0x811C9DC5)
+#define FNV1A_PRIME  (0x01000193)
+
+#define WRITEBACK_PATH_LENGTH (4096)
+#define WRITEBACK_RETIRED     ".rolled-back"
+
+typedef struct FAT_WRITEBACK_RUN {
+    __int64  llOffset;
+    uint32_t ulLength;
+    uint8_t* pData;     /* patched sectors in memory. */
+} fat_writeback_run;
+
+static uint32_t writeback_checksum(
+    const uint8_t* pData,
+    uint32_t       ulLength)
+{
+    uint32_t ulHash = FNV1A_OFFSET;
+
+    while (ulLength-- > 0)
+    {
+        ulHash ^= *pData++;
+        ulHash *= FNV1A_PRIME;
+    }
+
+    return ulHash;
+}
+
+static int writeback_compare_runs(
+    const void* pLeft,
+    const void* pRight)
+{
+    __int64 llLeft = ((const fat_writeback_run*)pLeft)->llOffset;
+    __int64 llRight = ((const fat_writeback_run*)pRight)->llOffset;
+
+    return (llLeft < llRight) ? -1 : ((llLeft > llRight) ? 1 : 0);
+}
+
+/* appends the runs of consecutive dirty sectors of one FAT copy. */
+static uint32_t writeback_collect_runs(
+    fat_dirty_map*     pDirtyMap,
+    uint8_t*           pDirty,
+    uint8_t*           pFatBuffer,
+    __int64            llFatOffset,
+    fat_writeback_run* pRuns,
+    uint32_t           ulRunCount)
+{
+    uint32_t ulSector = 0;
+    uint32_t ulStart = 0;
+
+    while (ulSector < pDirtyMap->ulSectorCount)
+    {
+        /* Skip clean bytes of the bitmap eight sectors at a time. */
+        if (((ulSector & 7) == 0) && (pDirty[ulSector >> 3] == 0))
+        {
+            ulSector += 8;
+            continue;
+        }
+
+        if (0 == (pDirty[ulSector >> 3] & (1 << (ulSector & 7))))
+        {
+            ++ulSector;
+            continue;
+        }
+
+        ulStart = ulSector;
+
+        while ((ulSector < pDirtyMap->ulSectorCount) &&
+               (0 != (pDirty[ulSector >> 3] & (1 << (ulSector & 7)))))
+        {
+            ++ulSector;
+        }
+
+        pRuns[ulRunCount].llOffset = llFatOffset + (__int64)ulStart * pDirtyMap->ulSectorSize;
+        pRuns[ulRunCount].ulLength = (ulSector - ulStart) * pDirtyMap->ulSectorSize;
+        pRuns[ulRunCount].pData = pFatBuffer + (size_t)ulStart * pDirtyMap->ulSectorSize;
+        ++ulRunCount;
+    }
+
+    return ulRunCount;
+}
+
+int fat_dirty_map_init(
+    fat_dirty_map* pDirtyMap,
+    uint32_t       ulFatSize,
+    uint32_t       ulSectorSize)
+{
+    uint32_t ulBitmapSize = 0;
+
+    memset(pDirtyMap, 0x00, sizeof(fat_dirty_map));
+
+    pDirtyMap->ulSectorSize = ulSectorSize;
+    pDirtyMap->ulSectorCount = (ulFatSize + ulSectorSize - 1) / ulSectorSize;
+
+    ulBitmapSize = (pDirtyMap->ulSectorCount + 7) >> 3;
+    pDirtyMap->pFat1Dirty = calloc(ulBitmapSize + 1, 1);
+    pDirtyMap->pFat2Dirty = calloc(ulBitmapSize + 1, 1);
+
+    if ((0 == pDirtyMap->pFat1Dirty) || (0 == pDirtyMap->pFat2Dirty))
+    {
+        fprintf(stderr, "allocations failed.\n");
+        fat_dirty_map_free(pDirtyMap);
+        return -1;
+    }
+
+    return 0;
+}
+
+void fat_dirty_map_free(fat_dirty_map* pDirtyMap)
+{
+    free (pDirtyMap->pFat1Dirty);
+    free (pDirtyMap->pFat2Dirty);
+    free (pDirtyMap->pExtraOffsets);
+    free (pDirtyMap->pExtraData);
+
+    memset(pDirtyMap, 0x00, sizeof(fat_dirty_map));
+}
+
+void fat_dirty_map_mark(
+    fat_dirty_map* pDirtyMap,
+    int            nFat,
+    uint32_t       ulEntry)
+{
+    uint32_t ulSector = 0;
+    uint8_t* pDirty = 0;
+
+    /* Patching without write-back passes no map. */
+    if (pDirtyMap == 0)
+        return;
+
+    ulSector = (uint32_t)(((uint64_t)ulEntry * sizeof(uint32_t)) / pDirtyMap->ulSectorSize);
+    pDirty = (nFat == 1) ? pDirtyMap->pFat1Dirty : pDirtyMap->pFat2Dirty;
+
+    if ((pDirty != 0) && (ulSector < pDirtyMap->ulSectorCount))
+        pDirty[ulSector >> 3] |= (uint8_t)(1 << (ulSector & 7));
+}
+
+uint32_t fat_dirty_map_count(fat_dirty_map* pDirtyMap)
+{
+    uint32_t ulSector = 0;
+    uint32_t ulCount = 0;
+
+    for (ulSector = 0; ulSector < pDirtyMap->ulSectorCount; ++ulSector)
+    {
+        if (0 != (pDirtyMap->pFat1Dirty[ulSector >> 3] & (1 << (ulSector & 7))))
+            ++ulCount;
+
+        if (0 != (pDirtyMap->pFat2Dirty[ulSector >> 3] & (1 << (ulSector & 7))))
+            ++ulCount;
+    }
+
+    return ulCount + pDirtyMap->ulExtraCount;
+}
+
+uint8_t* fat_dirty_map_sector(
+    fat_dirty_map* pDirtyMap,
+    int            nImageFile,
+    __int64        llOffset)
+{
+    __int64* pGrownOffsets = 0;
+    uint8_t* pGrownData = 0;
+    uint8_t* pSector = 0;
+    uint32_t ulExtra = 0;
+
+    /* Few files move per plan; a linear search is enough. */
+    for (ulExtra = 0; ulExtra < pDirtyMap->ulExtraCount; ++ulExtra)
+        if (pDirtyMap->pExtraOffsets[ulExtra] == llOffset)
+            return pDirtyMap->pExtraData + (size_t)ulExtra * pDirtyMap->ulSectorSize;
+
+    if (pDirtyMap->ulExtraCount == pDirtyMap->ulExtraCapacity)
+    {
+        pDirtyMap->ulExtraCapacity = (pDirtyMap->ulExtraCapacity == 0) ? 16 : (pDirtyMap->ulExtraCapacity << 1);
+
+        pGrownOffsets = realloc(pDirtyMap->pExtraOffsets, pDirtyMap->ulExtraCapacity * sizeof(__int64));
+        if (pGrownOffsets != 0)
+            pDirtyMap->pExtraOffsets = pGrownOffsets;
+
+        pGrownData = realloc(pDirtyMap->pExtraData, (size_t)pDirtyMap->ulExtraCapacity * pDirtyMap->ulSectorSize);
+        if (pGrownData != 0)
+            pDirtyMap->pExtraData = pGrownData;
+
+        if ((pGrownOffsets == 0) || (pGrownData == 0))
+        {
+            fprintf(stderr, "allocations failed.\n");
+            pDirtyMap->ulExtraCapacity = pDirtyMap->ulExtraCount;
+            return 0;
+        }
+    }
+
+    pSector = pDirtyMap->pExtraData + (size_t)pDirtyMap->ulExtraCount * pDirtyMap->ulSectorSize;
+
+    if (pDirtyMap->ulSectorSize != fat_file_pread(nImageFile, pSector, pDirtyMap->ulSectorSize, llOffset))
+    {
+        fprintf(stderr, "read failed at image offset %lld.\n", llOffset);
+        return 0;
+    }
+
+    pDirtyMap->pExtraOffsets[pDirtyMap->ulExtraCount++] = llOffset;
+
+    return pSector;
+}
+
+int fat_writeback_commit(
+    const char*    szLabel,
+    const char*    szImageFilename,
+    const char*    szJournal,
+    fat_dirty_map* pDirtyMap,
+    uint32_t*      pFat1Buffer,
+    uint32_t*      pFat2Buffer,
+    __int64        llFat1Offset,
+    __int64        llFat2Offset)
+{
+    int                nReturnValue = 0;
+    int                nImageFile = -1;
+    int                nJournalFile = -1;
+    FILE*              pJournal = 0;
+    fat_writeback_run* pRuns = 0;
+    uint32_t           ulRunCount = 0;
+    uint32_t           ulRun = 0;
+    uint32_t           ulMaxLength = 0;
+    __int64            llBytes = 0;
+    uint8_t*           pOriginal = 0;
+    FAT_UNDO_HEADER    header;
+    FAT_UNDO_RECORD    record;
+
+    /* At most one run per two sectors of each copy, plus the others. */
+    pRuns = malloc((pDirtyMap->ulSectorCount + pDirtyMap->ulExtraCount + 2) * sizeof(fat_writeback_run));
+    if (pRuns == 0)
+    {
+        fprintf(stderr, "allocations failed.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    /* FAT1 precedes FAT2 on disk, so the runs come out in ascending order. */
+    ulRunCount = writeback_collect_runs(pDirtyMap, pDirtyMap->pFat1Dirty,
+        (uint8_t*)pFat1Buffer, llFat1Offset, pRuns, 0);
+    ulRunCount = writeback_collect_runs(pDirtyMap, pDirtyMap->pFat2Dirty,
+        (uint8_t*)pFat2Buffer, llFat2Offset, pRuns, ulRunCount);
+
+    for (ulRun = 0; ulRun < pDirtyMap->ulExtraCount; ++ulRun)
+    {
+        pRuns[ulRunCount + ulRun].llOffset = pDirtyMap->pExtraOffsets[ulRun];
+        pRuns[ulRunCount + ulRun].ulLength = pDirtyMap->ulSectorSize;
+        pRuns[ulRunCount + ulRun].pData = pDirtyMap->pExtraData + (size_t)ulRun * pDirtyMap->ulSectorSize;
+    }
+
+    qsort(pRuns + ulRunCount, pDirtyMap->ulExtraCount, sizeof(fat_writeback_run), writeback_compare_runs);
+    ulRunCount += pDirtyMap->ulExtraCount;
+
+    if (ulRunCount == 0)
+        goto exit;
+
+    for (ulRun = 0; ulRun < ulRunCount; ++ulRun)
+    {
+        if (pRuns[ulRun].ulLength > ulMaxLength)
+            ulMaxLength = pRuns[ulRun].ulLength;
+    }
+
+    pOriginal = malloc(ulMaxLength);
+    if (pOriginal == 0)
+    {
+        fprintf(stderr, "allocations failed.\n");
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    /* Never overwrite a journal; it may be the only way back.  Creating it
+       exclusively leaves no gap for another run to slip one in. */
+    nJournalFile = fat_file_create_new(szJournal);
+    if ((nJournalFile < 0) && (errno == EEXIST))
+    {
+        fprintf(stderr, "undo journal '%s' already exists, not writing.\n", szJournal);
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    if (nJournalFile >= 0)
+    {
+        pJournal = _fdopen(nJournalFile, "wb");
+
+        if (pJournal == 0)
+            fat_file_close(nJournalFile);
+    }
+
+    nImageFile = fat_file_open_write(szImageFilename);
+
+    if ((nImageFile < 0) || (pJournal == 0))
+    {
+        fprintf(stderr, "open failed on image '%s' or journal '%s'.\n", szImageFilename, szJournal);
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    // Record the original sectors.
+    memset(&header, 0x00, sizeof(header));
+    memcpy(header.magic, FAT_UNDO_MAGIC, FAT_UNDO_MAGIC_SIZE);
+    header.recordCount = ulRunCount;
+    header.sectorSize = pDirtyMap->ulSectorSize;
+    header.imageSize = (uint64_t)fat_file_size(nImageFile);
+
+    if (1 != fwrite(&header, sizeof(header), 1, pJournal))
+    {
+        fprintf(stderr, "fwrite() failed on journal '%s'.\n", szJournal);
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    for (ulRun = 0; ulRun < ulRunCount; ++ulRun)
+    {
+        if (pRuns[ulRun].ulLength != fat_file_pread(nImageFile, pOriginal,
+                pRuns[ulRun].ulLength, pRuns[ulRun].llOffset))
+        {
+            fprintf(stderr, "read failed on image '%s'.\n", szImageFilename);
+            nReturnValue = -1;
+            goto exit;
+        }
+
+        record.offset = (uint64_t)pRuns[ulRun].llOffset;
+        record.length = pRuns[ulRun].ulLength;
+        record.checksum = writeback_checksum(pOriginal, pRuns[ulRun].ulLength);
+
+        if ((1 != fwrite(&record, sizeof(record), 1, pJournal)) ||
+            (1 != fwrite(pOriginal, pRuns[ulRun].ulLength, 1, pJournal)))
+        {
+            fprintf(stderr, "fwrite() failed on journal '%s'.\n", szJournal);
+            nReturnValue = -1;
+            goto exit;
+        }
+    }
+
+    // The journal must be durable before the image is touched.
+    if ((0 != fflush(pJournal)) || (0 != fat_file_sync(fileno(pJournal))))
+    {
+        fprintf(stderr, "sync failed on journal '%s'.\n", szJournal);
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    // Write the patched sectors.
+    for (ulRun = 0; ulRun < ulRunCount; ++ulRun)
+    {
+        if (pRuns[ulRun].ulLength != fat_file_pwrite(nImageFile, pRuns[ulRun].pData,
+                pRuns[ulRun].ulLength, pRuns[ulRun].llOffset))
+        {
+            fprintf(stderr, "write failed on image '%s'; roll back with --rollback %s.\n",
+                szImageFilename, szJournal);
+            nReturnValue = -1;
+            goto exit;
+        }
+
+        llBytes += pRuns[ulRun].ulLength;
+    }
+
+    if (0 != fat_file_sync(nImageFile))
+    {
+        fprintf(stderr, "sync failed on image '%s'.\n", szImageFilename);
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    fprintf(stdout, "%s written: %u sectors in %u runs (%lld bytes), undo journal '%s'.\n",
+        szLabel,
+        fat_dirty_map_count(pDirtyMap),
+        ulRunCount,
+        llBytes,
+        szJournal);
+
+exit:
+    // Close the journal.
+    if (0 != pJournal)
+    {
+        fclose(pJournal);
+        pJournal = 0;
+    }
+
+    // Close the image.
+    if (nImageFile >= 0)
+    {
+        fat_file_close(nImageFile);
+        nImageFile = -1;
+    }
+
+    // Free the pOriginal buffer.
+    if (0 != pOriginal)
+    {
+        free (pOriginal);
+        pOriginal = 0;
+    }
+
+    // Free the pRuns buffer.
+    if (0 != pRuns)
+    {
+        free (pRuns);
+        pRuns = 0;
+    }
+
+    return nReturnValue;
+}
+
+int fat_writeback_rollback(
+    const char*    szImageFilename,
+    const char*    szJournal)
+{
+    int              nReturnValue = 0;
+    int              nImageFile = -1;
+    int              nRetiredFile = -1;
+    __int64          llImageSize = 0;
+    FILE*            pJournal = 0;
+    uint8_t*         pData = 0;
+    uint8_t*         pGrown = 0;
+    size_t           ulDataSize = 0;
+    size_t           ulDataUsed = 0;
+    uint32_t         ulRecord = 0;
+    FAT_UNDO_RECORD* pRecord = 0;
+    FAT_UNDO_HEADER  header;
+    char             szRetired[WRITEBACK_PATH_LENGTH];
+
+    pJournal = fopen(szJournal, "rb");
+    if (pJournal == 0)
+    {
+        fprintf(stderr, "fopen() failed on journal: '%s'.\n", szJournal);
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    if ((1 != fread(&header, sizeof(header), 1, pJournal)) ||
+        (0 != memcmp(header.magic, FAT_UNDO_MAGIC, FAT_UNDO_MAGIC_SIZE)))
+    {
+        fprintf(stderr, "'%s' is not an undo journal.\n", szJournal);
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    /* Read and verify every record before writing any of them. */
+    for (ulRecord = 0; ulRecord < header.recordCount; ++ulRecord)
+    {
+        if (ulDataUsed + sizeof(FAT_UNDO_RECORD) > ulDataSize)
+        {
+            ulDataSize = (ulDataSize + sizeof(FAT_UNDO_RECORD)) << 1;
+            pGrown = realloc(pData, ulDataSize);
+
+            if (pGrown == 0)
+                free (pData);
+
+            pData = pGrown;
+        }
+
+        if ((pData == 0) || (1 != fread(pData + ulDataUsed, sizeof(FAT_UNDO_RECORD), 1, pJournal)))
+        {
+            fprintf(stderr, "journal '%s' is truncated.\n", szJournal);
+            nReturnValue = -1;
+            goto exit;
+        }
+
+        pRecord = (FAT_UNDO_RECORD*)(pData + ulDataUsed);
+        ulDataUsed += sizeof(FAT_UNDO_RECORD);
+
+        if (ulDataUsed + pRecord->length > ulDataSize)
+        {
+            ulDataSize = (ulDataUsed + pRecord->length) << 1;
+            pGrown = realloc(pData, ulDataSize);
+
+            if (pGrown == 0)
+            {
+                fprintf(stderr, "allocations failed.\n");
+                nReturnValue = -1;
+                goto exit;
+            }
+
+            pData = pGrown;
+            pRecord = (FAT_UNDO_RECORD*)(pData + ulDataUsed - sizeof(FAT_UNDO_RECORD));
+        }
+
+        if ((pData == 0) || (1 != fread(pData + ulDataUsed, pRecord->length, 1, pJournal)) ||
+            (pRecord->checksum != writeback_checksum(pData + ulDataUsed, pRecord->length)))
+        {
+            fprintf(stderr, "journal '%s' record %u is damaged.\n", szJournal, ulRecord);
+            nReturnValue = -1;
+            goto exit;
+        }
+
+        ulDataUsed += pRecord->length;
+    }
+
+    /* Refuse up front rather than restore and then fail to retire. */
+    _snprintf(szRetired, sizeof(szRetired) - 1, "%s" WRITEBACK_RETIRED, szJournal);
+    szRetired[sizeof(szRetired) - 1] = 0;
+
+    nRetiredFile = fat_file_open_read(szRetired);
+    if (nRetiredFile >= 0)
+    {
+        fat_file_close(nRetiredFile);
+        fprintf(stderr, "'%s' already exists; move it away before rolling back '%s' again.\n", szRetired, szJournal);
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    nImageFile = fat_file_open_write(szImageFilename);
+    if (nImageFile < 0)
+    {
+        fprintf(stderr, "open failed on image '%s'.\n", szImageFilename);
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    /* A journal only fits the image it was written against. */
+    llImageSize = fat_file_size(nImageFile);
+    if ((llImageSize < 0) || ((uint64_t)llImageSize != header.imageSize))
+    {
+        fprintf(stderr, "journal '%s' was written for a %llu byte image; '%s' is %lld bytes.\n",
+            szJournal, (unsigned long long)header.imageSize, szImageFilename, llImageSize);
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    ulDataUsed = 0;
+
+    for (ulRecord = 0; ulRecord < header.recordCount; ++ulRecord)
+    {
+        pRecord = (FAT_UNDO_RECORD*)(pData + ulDataUsed);
+        ulDataUsed += sizeof(FAT_UNDO_RECORD);
+
+        if (pRecord->length != fat_file_pwrite(nImageFile, pData + ulDataUsed,
+                pRecord->length, (__int64)pRecord->offset))
+        {
+            fprintf(stderr, "write failed on image '%s'.\n", szImageFilename);
+            nReturnValue = -1;
+            goto exit;
+        }
+
+        ulDataUsed += pRecord->length;
+    }
+
+    if (0 != fat_file_sync(nImageFile))
+    {
+        fprintf(stderr, "sync failed on image '%s'.\n", szImageFilename);
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    /* Retire the journal, so that the next --patch can write its own. */
+    fclose(pJournal);
+    pJournal = 0;
+
+    if (0 != fat_file_rename(szJournal, szRetired))
+    {
+        fprintf(stderr, "restored, but rename failed on journal '%s'; remove it before the next --patch.\n", szJournal);
+        nReturnValue = -1;
+        goto exit;
+    }
+
+    fprintf(stdout, "restored %u runs from undo journal '%s' (now '%s').\n", header.recordCount, szJournal, szRetired);
+
+exit:
+    // Close the journal.
+    if (0 != pJournal)
+    {
+        fclose(pJournal);
+        pJournal = 0;
+    }
+
+    // Close the image.
+    if (nImageFile >= 0)
+    {
+        fat_file_close(nImageFile);
+        nImageFile = -1;
+    }
+
+    // Free the pData buffer.
+    if (0 != pData)
+    {
+        free (pData);
+        pData = 0;
+    }
+
+    return nReturnValue;
+}
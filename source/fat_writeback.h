@@ -0,0 +1,104 @@
+#ifndef __FAT_WRITEBACK_H_HEADER__
+#define __FAT_WRITEBACK_H_HEADER__
+
+#include "stdint.h"
+#include "fat_platform.h"
+
+#define FAT_UNDO_MAGIC      "FWUNDO01"
+#define FAT_UNDO_MAGIC_SIZE (8)
+
+/* Pack all structures together as tightly as possible. */
+#pragma pack(1)
+
+/**
+ * Undo journal header, followed by ulRecordCount records.
+ */
+typedef struct fatUndoHeader
+{
+   char       magic[8];            /* [00-07] FAT_UNDO_MAGIC. */
+   uint32_t   recordCount;         /* [08-11] Number of records that follow. */
+   uint32_t   sectorSize;          /* [12-15] Sector size the records are multiples of. */
+   uint64_t   imageSize;           /* [16-23] Size of the image when the journal was written. */
+} FAT_UNDO_HEADER;
+
+/**
+ * Undo journal record, followed by length bytes of original image data.
+ */
+typedef struct fatUndoRecord
+{
+   uint64_t   offset;              /* [00-07] Absolute image offset of the run. */
+   uint32_t   length;              /* [08-11] Length of the run in bytes. */
+   uint32_t   checksum;            /* [12-15] FNV-1a of the original data. */
+} FAT_UNDO_RECORD;
+
+/* Stop packing structures. */
+#pragma pack()
+
+/**
+ * Dirty sector bitmaps for the two in-memory FAT copies, plus any other
+ * sectors (directory entries) written and journaled with them.
+ */
+typedef struct FAT_DIRTY_MAP {
+    uint32_t  ulSectorSize;
+    uint32_t  ulSectorCount;    /* sectors per FAT. */
+    uint8_t * pFat1Dirty;       /* one bit per FAT1 sector. */
+    uint8_t * pFat2Dirty;       /* one bit per FAT2 sector. */
+
+    __int64 * pExtraOffsets;    /* image offsets of the other sectors. */
+    uint8_t * pExtraData;       /* ulSectorSize bytes each. */
+    uint32_t  ulExtraCount;
+    uint32_t  ulExtraCapacity;
+} fat_dirty_map;
+
+int fat_dirty_map_init(
+    fat_dirty_map* pDirtyMap,
+    uint32_t       ulFatSize,
+    uint32_t       ulSectorSize);
+
+void fat_dirty_map_free(
+    fat_dirty_map* pDirtyMap);
+
+/* marks the sector holding FAT entry ulEntry (nFat: 1 or 2). */
+void fat_dirty_map_mark(
+    fat_dirty_map* pDirtyMap,
+    int            nFat,
+    uint32_t       ulEntry);
+
+uint32_t fat_dirty_map_count(
+    fat_dirty_map* pDirtyMap);
+
+/* in-memory copy of the sector at llOffset (sector aligned) outside the
+   FATs, read from nImageFile the first time it is asked for; changes to
+   it are written by fat_writeback_commit().  returns 0 on failure. */
+uint8_t* fat_dirty_map_sector(
+    fat_dirty_map* pDirtyMap,
+    int            nImageFile,
+    __int64        llOffset);
+
+/**
+ * Writes the dirty FAT sectors back to the image.
+ *
+ * The original contents of every dirty run are first saved to szJournal
+ * and synced; the runs are then written in ascending offset order, adjacent
+ * dirty sectors coalesced into one write, and the image is synced.  Other
+ * sectors follow the FATs, one write each.  szLabel names the change in
+ * the summary line ("FAT repair", "defrag").
+ */
+int fat_writeback_commit(
+    const char*    szLabel,
+    const char*    szImageFilename,
+    const char*    szJournal,
+    fat_dirty_map* pDirtyMap,
+    uint32_t*      pFat1Buffer,
+    uint32_t*      pFat2Buffer,
+    __int64        llFat1Offset,
+    __int64        llFat2Offset);
+
+/* restores the original sectors recorded in szJournal, then renames it
+   to "<szJournal>.rolled-back".  writes nothing if the image size differs
+   from the one in the journal or that name is already taken. */
+int fat_writeback_rollback(
+    const char*    szImageFilename,
+    const char*    szJournal);
+
+#endif /* __FAT_WRITEBACK_H_HEADER__ */
@@ -7,44 +7,271 @@
 #include <memory.h>
 
 #include "fat_process.h"
+#include "fat_hexdump.h"
+#include "fat_hash.h"
+#include "fat_prefetch.h"
+#include "fat_timeline.h"
+#include "fat_query.h"
+#include "fat_daemon.h"
+#include "fat_spill.h"
 
 int main(int argc, char *argv[])
 {
-    char* szFilename = 0;
-    int   nPatchFat = 0;
-    int   nReturnValue = 0;
+    char*       szFilename = 0;
+    fat_options options;
+    int         nArgIndex = 0;
+    int         nLayout = 0;
+    int         nAlgorithms = 0;
+    int         nTimeKinds = 0;
+    int         nRankBy = 0;
+    int         nHugePages = 0;
+    uint64_t    ullCacheBytes = (uint64_t)1024 << 20;
+    int         nReturnValue = 0;
 
-    if (argc == 2)
+    memset(&options, 0x00, sizeof(options));
+    options.ulReadahead = FAT_PREFETCH_DEFAULT_DEPTH;
+    options.ulHugePages = FAT_HUGE_PAGES_TRANSPARENT;
+
+    if (argc < 2)
     {
-        szFilename = argv[1];
-        nPatchFat = 0;
+        nReturnValue = -1;
+        goto usage;
     }
-    else if (argc == 3)
+
+    // Serve queries from a local socket instead of processing one image.
+    if ((0 == strcmp(argv[1], "--serve")) && (argc >= 3))
     {
-        szFilename = argv[1];
-        nPatchFat = 0;
+        for (nArgIndex = 3; nArgIndex < argc; ++nArgIndex)
+        {
+            if ((0 == strcmp(argv[nArgIndex], "--cache-mb")) && (nArgIndex + 1 < argc))
+            {
+                ullCacheBytes = (uint64_t)strtoul(argv[++nArgIndex], 0, 10) << 20;
+            }
+            else if ((0 == strcmp(argv[nArgIndex], "--threads")) && (nArgIndex + 1 < argc))
+            {
+                options.ulThreads = (uint32_t)strtoul(argv[++nArgIndex], 0, 10);
+            }
+            else
+            {
+                nReturnValue = -1;
+                goto usage;
+            }
+        }
 
-        if (0 != strcmp(argv[2], "--patch"))
+        nReturnValue = daemon_serve(argv[2], ullCacheBytes, options.ulThreads);
+        goto exit;
+    }
+
+    szFilename = argv[1];
+
+    for (nArgIndex = 2; nArgIndex < argc; ++nArgIndex)
+    {
+        if (0 == strcmp(argv[nArgIndex], "--patch"))
         {
-            nReturnValue = -1;
-            goto usage;
+            options.nPatch = 1;
+        }
+        else if (0 == strcmp(argv[nArgIndex], "--lazy"))
+        {
+            options.nLazy = 1;
+        }
+        else if (0 == strcmp(argv[nArgIndex], "--elevator"))
+        {
+            options.nElevator = 1;
+        }
+        else if (0 == strcmp(argv[nArgIndex], "--carve"))
+        {
+            options.nCarve = 1;
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--carve-signatures")) && (nArgIndex + 1 < argc))
+        {
+            options.nCarve = 1;
+            options.szCarveSignatures = argv[++nArgIndex];
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--defrag")) && (nArgIndex + 1 < argc))
+        {
+            options.nDefrag = 1;
+            options.ulDefragLimit = (0 == strcmp(argv[++nArgIndex], "all")) ? 0 : (uint32_t)strtoul(argv[nArgIndex], 0, 10);
+        }
+        else if (0 == strcmp(argv[nArgIndex], "--defrag-apply"))
+        {
+            options.nDefragApply = 1;
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--top")) && (nArgIndex + 1 < argc))
+        {
+            options.ulTop = (uint32_t)strtoul(argv[++nArgIndex], 0, 10);
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--by")) && (nArgIndex + 1 < argc) &&
+                 (0 < (nRankBy = fat_query_rank(argv[nArgIndex + 1]))))
+        {
+            options.ulRankBy = (uint32_t)nRankBy;
+            ++nArgIndex;
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--min-size")) && (nArgIndex + 1 < argc) &&
+                 (0 == fat_query_parse_size(argv[nArgIndex + 1], &options.ullMinSize)))
+        {
+            ++nArgIndex;
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--max-size")) && (nArgIndex + 1 < argc) &&
+                 (0 == fat_query_parse_size(argv[nArgIndex + 1], &options.ullMaxSize)))
+        {
+            ++nArgIndex;
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--min-fragments")) && (nArgIndex + 1 < argc))
+        {
+            options.ulMinFragments = (uint32_t)strtoul(argv[++nArgIndex], 0, 10);
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--tee")) && (nArgIndex + 1 < argc))
+        {
+            options.szTee = argv[++nArgIndex];
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--rescue-map")) && (nArgIndex + 1 < argc))
+        {
+            options.szRescueMap = argv[++nArgIndex];
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--clone")) && (nArgIndex + 1 < argc))
+        {
+            options.szClone = argv[++nArgIndex];
+        }
+        else if (0 == strcmp(argv[nArgIndex], "--profile"))
+        {
+            options.nProfile = 1;
+        }
+        else if (0 == strcmp(argv[nArgIndex], "--estimate"))
+        {
+            options.nEstimate = 1;
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--samples")) && (nArgIndex + 1 < argc))
+        {
+            options.ulEstimateSamples = (uint32_t)strtoul(argv[++nArgIndex], 0, 10);
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--diff")) && (nArgIndex + 1 < argc))
+        {
+            options.szDiff = argv[++nArgIndex];
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--owner")) && (nArgIndex + 1 < argc))
+        {
+            options.szOwner = argv[++nArgIndex];
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--owner-batch")) && (nArgIndex + 1 < argc))
+        {
+            options.szOwnerBatch = argv[++nArgIndex];
+        }
+        else if (0 == strcmp(argv[nArgIndex], "--timeline"))
+        {
+            options.nTimeline = 1;
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--since")) && (nArgIndex + 1 < argc))
+        {
+            options.szSince = argv[++nArgIndex];
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--until")) && (nArgIndex + 1 < argc))
+        {
+            options.szUntil = argv[++nArgIndex];
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--time-kinds")) && (nArgIndex + 1 < argc) &&
+                 (0 < (nTimeKinds = fat_time_kinds(argv[nArgIndex + 1]))))
+        {
+            options.ulTimeKinds = (uint32_t)nTimeKinds;
+            ++nArgIndex;
+        }
+        else if (0 == strcmp(argv[nArgIndex], "--stop-at-dir-end"))
+        {
+            options.nStopAtDirEnd = 1;
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--find")) && (nArgIndex + 1 < argc))
+        {
+            options.szFind = argv[++nArgIndex];
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--extract")) && (nArgIndex + 1 < argc))
+        {
+            options.szExtractDir = argv[++nArgIndex];
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--threads")) && (nArgIndex + 1 < argc))
+        {
+            options.ulThreads = (uint32_t)strtoul(argv[++nArgIndex], 0, 10);
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--readahead")) && (nArgIndex + 1 < argc))
+        {
+            options.ulReadahead = (uint32_t)strtoul(argv[++nArgIndex], 0, 10);
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--max-memory")) && (nArgIndex + 1 < argc))
+        {
+            options.ullMaxMemory = (uint64_t)strtoul(argv[++nArgIndex], 0, 10) << 20;
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--spill-dir")) && (nArgIndex + 1 < argc))
+        {
+            options.szSpillDir = argv[++nArgIndex];
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--huge-pages")) && (nArgIndex + 1 < argc) &&
+                 (0 <= (nHugePages = fat_spill_huge_pages(argv[nArgIndex + 1]))))
+        {
+            options.ulHugePages = (uint32_t)nHugePages;
+            ++nArgIndex;
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--journal")) && (nArgIndex + 1 < argc))
+        {
+            options.szJournal = argv[++nArgIndex];
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--rollback")) && (nArgIndex + 1 < argc))
+        {
+            options.szRollback = argv[++nArgIndex];
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--hash")) && (nArgIndex + 1 < argc))
+        {
+            options.szHashManifest = argv[++nArgIndex];
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--hash-algo")) && (nArgIndex + 1 < argc) &&
+                 (0 < (nAlgorithms = fat_hash_algorithms(argv[nArgIndex + 1]))))
+        {
+            options.ulHashAlgorithms = (uint32_t)nAlgorithms;
+            ++nArgIndex;
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--dump")) && (nArgIndex + 1 < argc))
+        {
+            options.szDump = argv[++nArgIndex];
+        }
+        else if ((0 == strcmp(argv[nArgIndex], "--layout")) && (nArgIndex + 1 < argc) &&
+                 (0 <= (nLayout = fat_hexdump_layout(argv[nArgIndex + 1]))))
+        {
+            options.ulDumpLayout = (uint32_t)nLayout;
+            ++nArgIndex;
         }
         else
         {
-            nPatchFat = 1;
+            nReturnValue = -1;
+            goto usage;
         }
     }
-    else
+
+    /* Both would journal to the same <image>.undo; the second would find the first's. */
+    if ((options.nPatch != 0) && (options.nDefragApply != 0))
     {
+        fprintf(stderr, "--patch and --defrag-apply each write an undo journal; run them one at a time.\n");
         nReturnValue = -1;
-        goto usage;
+        goto exit;
     }
 
-    nReturnValue = process_image_file(szFilename, nPatchFat);
+    nReturnValue = process_image_file(szFilename, &options);
     goto exit;
 
 usage:
-    fprintf(stderr, "Usage: %s [input file] [--patch]\n", argv[0]);
+    fprintf(stderr, "Usage: %s [input file, or - for stdin [--tee stream copy]] [--patch [--journal undo file]]\n"
+                    "       [--rollback undo file] [--rescue-map ddrescue map file]\n"
+                    "       [--elevator] [--stop-at-dir-end] [--find name|/path|glob] [--lazy --find /path]\n"
+                    "       [--extract output dir] [--threads count] [--readahead extents]\n"
+                    "       [--max-memory MB [--spill-dir scratch dir]] [--huge-pages off|transparent|explicit]\n"
+                    "       [--profile]\n"
+                    "       [--hash manifest file] [--hash-algo sha256,xxh64]\n"
+                    "       [--carve [--carve-signatures signature file]]\n"
+                    "       [--owner offset,...] [--owner-batch offset file]\n"
+                    "       [--top count [--by size|fragments|modified]]\n"
+                    "       [--min-size bytes[K|M|G]] [--max-size bytes[K|M|G]] [--min-fragments count]\n"
+                    "       [--estimate [--samples FAT pages]]\n"
+                    "       [--diff newer image file] [--clone sparse output image]\n"
+                    "       [--defrag count|all [--defrag-apply [--journal undo file]]]\n"
+                    "       [--timeline [--since time] [--until time] [--time-kinds created,modified,accessed]]\n"
+                    "       [--dump NAME.EXT] [--layout words|classic|plain]\n"
+                    "       %s --serve [socket path] [--cache-mb size] [--threads count]\n", argv[0], argv[0]);
 
 exit:
 #ifdef _DEBUG
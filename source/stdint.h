@@ -10,5 +10,7 @@ typedef unsigned int            uint32_t;
 #ifdef _MSC_VER
 typedef signed __int64          int64_t;
 typedef unsigned __int64        uint64_t;
+#else
+#include <stdint.h>
 #endif
 #endif